@@ -0,0 +1,129 @@
+/*
+ * Arena.hpp
+ *
+ * A monotonic (bump) allocator for short-lived bulk data, such as a
+ * loader's temporaries. Allocating is a pointer bump inside the current
+ * chunk; when that runs out another chunk is taken, each twice the size
+ * of the last up to 64 MB, and always big enough for the request.
+ * Nothing is freed on its own. reset() makes all of it free again but
+ * keeps the chunks, so a batch of loads reuses the same, already faulted
+ * in pages; release() gives them back.
+ *
+ * Not thread safe: one arena per thread.
+ */
+
+#ifndef ARENA_HPP_
+#define ARENA_HPP_
+
+#include <stddef.h>
+#include <algorithm>
+#include <vector>
+
+namespace mem {
+
+class Arena
+{
+public:
+    explicit Arena(size_t chunkSize = 1 << 20);
+    ~Arena();
+
+    // Uninitialized; align must be a power of two
+    void *  allocate(size_t bytes, size_t align = 16);
+
+    template <typename T>
+    T *     allocate(size_t count) { return (T *)allocate(count * sizeof(T), alignof(T) < 16 ? 16 : alignof(T)); }
+
+    // Everything allocated so far becomes invalid
+    void    reset();
+    void    release();
+
+    size_t  used() const { return _used; }             // bytes handed out since the last reset
+    size_t  reserved() const { return _reserved; }     // bytes held in chunks
+    unsigned int chunks() const { return _chunks.size(); }
+
+protected:
+    Arena(const Arena &);
+    Arena & operator=(const Arena &);
+
+    struct Chunk
+    {
+        char *  data;
+        size_t  size;
+    };
+
+    std::vector<Chunk> _chunks;
+    unsigned int _current;      // chunk being allocated from
+    size_t  _offset;            // into it
+    size_t  _chunkSize;
+    size_t  _used, _reserved;
+};
+
+// For standard containers. Deallocation does nothing; growing a vector
+// in an arena leaves its old storage behind until the next reset.
+template <typename T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+
+    ArenaAllocator(Arena & arena):arena(&arena){}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> & other):arena(other.arena){}
+
+    T *     allocate(size_t count) { return arena->allocate<T>(count); }
+    void    deallocate(T *, size_t) {}
+
+    template <typename U>
+    bool    operator==(const ArenaAllocator<U> & other) const { return arena == other.arena; }
+    template <typename U>
+    bool    operator!=(const ArenaAllocator<U> & other) const { return arena != other.arena; }
+
+    Arena * arena;
+};
+
+// Appends without ever moving what's there: elements live in fixed size
+// blocks from the arena, found by shift and mask
+template <typename T, unsigned int SHIFT = 14>
+class ArenaArray
+{
+public:
+    explicit ArenaArray(Arena & arena):_arena(arena), _size(0){}
+
+    void
+    push_back(const T & value)
+    {
+        if (_size == (size_t)_blocks.size() << SHIFT)
+            _blocks.push_back(_arena.allocate<T>((size_t)1 << SHIFT));
+        _blocks[_size >> SHIFT][_size & MASK] = value;
+        _size++;
+    }
+
+    T &         operator[](size_t i) { return _blocks[i >> SHIFT][i & MASK]; }
+    const T &   operator[](size_t i) const { return _blocks[i >> SHIFT][i & MASK]; }
+    size_t      size() const { return _size; }
+    bool        empty() const { return !_size; }
+
+    // Onto the end of a vector, reserving exactly once
+    template <typename Vector>
+    void
+    appendTo(Vector & out) const
+    {
+        out.reserve(out.size() + _size);
+        for (size_t done = 0, b = 0; done < _size; b++) {
+            size_t n = std::min(_size - done, (size_t)1 << SHIFT);
+            out.insert(out.end(), _blocks[b], _blocks[b] + n);
+            done += n;
+        }
+    }
+
+protected:
+    static const size_t MASK = ((size_t)1 << SHIFT) - 1;
+
+    Arena &     _arena;
+    std::vector<T *> _blocks;
+    size_t      _size;
+};
+
+}
+
+#endif /* ARENA_HPP_ */
@@ -0,0 +1,172 @@
+/*
+ * Atlas.hpp
+ *
+ * Packs many small RGBA images into a few pages (which can go in a
+ * TextureArrays array, a page per layer). Placement is MaxRects with the
+ * best short side fit rule. Every image gets a cell of padding texels
+ * around it on each side, and the cell's position and size are rounded
+ * up to a multiple of alignment. The whole cell is filled by repeating
+ * the image's edge texels. With alignment 2^L, a mip level up to L never
+ * averages texels from two images, and padding keeps bilinear filtering
+ * inside the cell.
+ *
+ * Each image gets a Region: its page, its texels there, and the uv
+ * rectangle that replaces the unit square. remapMesh() rewrites a
+ * mesh's uvs through them.
+ *
+ * With thousands of images the work is split over a job system's
+ * threads. The sorted images are dealt round robin onto as many pages
+ * as they should need, each page is packed on its own, and whatever
+ * didn't fit goes through one more serial pass. The result is the same
+ * with or without a job system, and for any thread count.
+ *
+ * write() saves an atlas as a file that AtlasFile maps read-only and
+ * uses in place. The layout is a header, the regions in image order,
+ * the names, a name-sorted index for find(), and the pages, each 4 KB
+ * aligned so they can go straight to glTexSubImage. Native byte order.
+ */
+
+#ifndef ATLAS_HPP_
+#define ATLAS_HPP_
+
+#include <GL/glew.h>
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "Jobs.hpp"
+#include "TriMesh.hpp"
+
+using std::string;
+using std::vector;
+
+namespace atlas {
+
+// width * height RGBA texels, bottom row first, kept alive by the
+// caller until build() returns
+struct Image
+{
+    string          name;
+    GLsizei         width, height;
+    const GLubyte * pixels;
+};
+
+struct Options
+{
+    Options():pageWidth(2048), pageHeight(2048), padding(2), alignment(4), jobs(NULL){}
+
+    GLsizei         pageWidth, pageHeight;
+    GLsizei         padding;        // texels of repeated edge on every side
+    GLsizei         alignment;      // a power of two
+    jobs::JobSystem * jobs;         // NULL = all on the calling thread
+};
+
+struct Region
+{
+    unsigned int    page;
+    unsigned int    x, y;           // the image's first texel, padding excluded
+    unsigned int    width, height;
+    float           u0, v0, u1, v1;
+};
+
+// A rectangle packer for one page
+class MaxRects
+{
+public:
+    struct Rect
+    {
+        int x, y, width, height;
+    };
+
+    MaxRects(int width, int height);
+
+    // False if it doesn't fit anywhere
+    bool    insert(int width, int height, Rect * placed);
+
+    // Fraction of the page in use
+    float   getOccupancy() const;
+
+protected:
+    void    place(const Rect & used);
+
+    int             width, height;
+    long            usedArea;
+    vector<Rect>    free;       // maximal free rectangles, may overlap
+};
+
+class Atlas
+{
+public:
+    Atlas();
+
+    // False, with the atlas left empty, if any image's cell is bigger
+    // than a page
+    bool    build(const vector<Image> & images, const Options & options = Options());
+
+    // Saves everything; see the top of the file
+    bool    write(const string & fileName) const;
+
+    unsigned int    getPageCount() const { return pages.size(); }
+    GLsizei         getPageWidth() const { return pageWidth; }
+    GLsizei         getPageHeight() const { return pageHeight; }
+    const GLubyte * getPage(unsigned int page) const { return &pages[page][0]; }
+
+    // In the order the images were given
+    unsigned int    getRegionCount() const { return regions.size(); }
+    const Region &  getRegion(unsigned int image) const { return regions[image]; }
+    const string &  getName(unsigned int image) const { return names[image]; }
+
+    // The image called name, -1 if none
+    int     find(const string & name) const;
+
+    // Fraction of all pages covered by images, padding excluded
+    float   getOccupancy() const;
+
+protected:
+    GLsizei                 pageWidth, pageHeight;
+    vector<vector<GLubyte> > pages;
+    vector<Region>          regions;
+    vector<string>          names;
+    vector<unsigned int>    byName;     // image indices, sorted by name
+};
+
+// A file from Atlas::write(), mapped read-only. Everything returned
+// stays valid until close().
+class AtlasFile
+{
+public:
+    AtlasFile();
+    ~AtlasFile();
+
+    bool    open(const string & fileName);
+    void    close();
+
+    unsigned int    getPageCount() const;
+    GLsizei         getPageWidth() const;
+    GLsizei         getPageHeight() const;
+    const GLubyte * getPage(unsigned int page) const;
+
+    unsigned int    getRegionCount() const;
+    const Region &  getRegion(unsigned int image) const { return _regions[image]; }
+    string          getName(unsigned int image) const;
+
+    int     find(const string & name) const;
+
+protected:
+    AtlasFile(const AtlasFile &);
+    AtlasFile & operator=(const AtlasFile &);
+
+    char *          _data;
+    size_t          _size;
+    const Region *  _regions;
+};
+
+// Points each submesh's uvs at the region for its material (or the
+// whole mesh at materials[0] if it has no submeshes). NULL entries and
+// materials past the end are left alone.
+void remapMesh(mesh::TriMesh & mesh, const vector<const Region *> & materials);
+
+}
+
+#endif /* ATLAS_HPP_ */
@@ -0,0 +1,54 @@
+/*
+ * BatchMath.hpp
+ *
+ * glm::mat4 work over whole arrays at a time: transforming points,
+ * concatenating one matrix with many (proj * view * model for every
+ * object), and normal matrices. Each function has scalar, SSE, AVX and
+ * NEON paths, picked at run time the same way as culling's, except that
+ * only these have NEON, so BEST here is batch::getBestIsa(); SCALAR is
+ * what the others are checked against.
+ *
+ * The point and matrix products do glm's operations in glm's order, so
+ * on x86 every path gives exactly the bits glm's operator* would.
+ */
+
+#ifndef BATCHMATH_HPP_
+#define BATCHMATH_HPP_
+
+#include "glm/glm.hpp"
+#include "Culling.hpp"
+
+using glm::mat3;
+using glm::mat4;
+using glm::vec3;
+using glm::vec4;
+
+namespace batch {
+
+// cull::getBestIsa(), or NEON where the compiler targets it
+cull::Isa getBestIsa();
+
+// out[i] = m * vec4(in[i], 1)
+void transformPoints(const mat4 & m, const vec3 * in, vec4 * out, unsigned int count,
+                     cull::Isa isa = cull::BEST);
+
+// The same without w, for affine m. out may be in.
+void transformPoints(const mat4 & m, const vec3 * in, vec3 * out, unsigned int count,
+                     cull::Isa isa = cull::BEST);
+
+// out[i] = a * b[i]. out may be b.
+void concatenate(const mat4 & a, const mat4 * b, mat4 * out, unsigned int count,
+                 cull::Isa isa = cull::BEST);
+
+// out[i] = a[i] * b[i]. out may be a or b.
+void multiply(const mat4 * a, const mat4 * b, mat4 * out, unsigned int count,
+              cull::Isa isa = cull::BEST);
+
+// out[i] = inverse transpose of mat3(m[i]), what a NormalMatrix uniform
+// wants. Singular matrices give infinities, as glm's inverse does.
+void normalMatrices(const mat4 * m, mat3 * out, unsigned int count,
+                    cull::Isa isa = cull::BEST);
+
+}
+
+#endif /* BATCHMATH_HPP_ */
@@ -0,0 +1,106 @@
+/*
+ * Bvh.hpp
+ *
+ * Bounding volume hierarchy over the triangles of a TriMesh, for ray
+ * casting and mouse picking on the CPU.
+ *
+ * build() splits with a binned SAH and farms large subtrees out to
+ * threads. Nodes are 32 bytes and siblings sit next to each other, so
+ * an interior node only stores where its first child is. intersect()
+ * walks the tree with a short fixed stack, visiting the nearer child
+ * first; the ray/box slab tests use SSE where available.
+ *
+ * refit() recomputes the bounds after the vertices move without
+ * touching the topology, which is much cheaper than a rebuild but
+ * slowly degrades the tree if the mesh deforms a lot.
+ */
+
+#ifndef BVH_HPP_
+#define BVH_HPP_
+
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "TriMesh.hpp"
+
+using std::vector;
+using glm::mat4;
+using glm::vec3;
+
+namespace bvh {
+
+struct Node
+{
+    float           min[3];
+    unsigned int    leftFirst;  // first child, or first triangle if a leaf
+    float           max[3];
+    unsigned int    count;      // triangles in a leaf, 0 if interior
+
+    bool isLeaf() const { return count > 0; }
+};
+
+struct Ray
+{
+    Ray() {}
+    Ray(const vec3 & origin, const vec3 & dir, float tmax = 1e30f):
+        origin(origin), dir(dir), tmax(tmax) {}
+
+    vec3    origin;
+    vec3    dir;
+    float   tmax;
+};
+
+struct Hit
+{
+    Hit():t(1e30f), u(0), v(0), triangle(NO_HIT) {}
+
+    static const unsigned int NO_HIT = ~0u;
+
+    bool valid() const { return triangle != NO_HIT; }
+
+    float           t;          // distance along the ray, in units of dir
+    float           u, v;       // barycentrics of vertices 1 and 2
+    unsigned int    triangle;   // index into the mesh (vertices 3i..3i+2)
+};
+
+class Bvh
+{
+public:
+    Bvh();
+
+    // threads: 0 = one per hardware thread
+    bool build(const mesh::TriMesh & mesh, unsigned int threads = 0);
+
+    // Update the bounds for moved vertices (same triangle count)
+    bool refit(const mesh::TriMesh & mesh);
+
+    // Closest hit closer than ray.tmax
+    bool intersect(const Ray & ray, Hit & hit) const;
+
+    unsigned int getNodeCount() const { return nodeCount; }
+    unsigned int getTriangleCount() const { return indices.size(); }
+    const vector<Node> & getNodes() const { return nodes; }
+
+    // Traversal stack; the builder makes leaves rather than go deeper
+    static const int STACK_SIZE = 64;
+
+protected:
+    class Builder;
+    friend class Builder;
+
+    void setBounds(Node & node, const vec3 & min, const vec3 & max);
+    void intersectLeaf(const Node & node, const Ray & ray, Hit & hit) const;
+
+    vector<Node>            nodes;      // root at 0, 1 unused, then pairs
+    unsigned int            nodeCount;
+    vector<unsigned int>    indices;    // mesh triangle for each leaf slot
+    vector<vec3>            verts;      // triangle corners in leaf order
+};
+
+// Ray through pixel (x, y) of a width x height viewport, with y counting
+// down from the top as mouse coordinates do
+Ray screenRay(int x, int y, int width, int height, const mat4 & view, const mat4 & proj);
+
+}
+
+#endif /* BVH_HPP_ */
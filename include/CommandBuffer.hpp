@@ -0,0 +1,290 @@
+/*
+ * CommandBuffer.hpp
+ *
+ * Deferred GL submission. Game side threads record small POD commands
+ * (bind program, set uniform block, bind texture, bind VAO, draw, bind
+ * framebuffer) into CommandLists, one per recording thread, so
+ * recording takes no locks and touches no GL. A CommandQueue holds two
+ * frames of lists: while one thread, the only one with the GL context,
+ * replays frame N, the others record frame N+1.
+ *
+ * Replaying goes through a CommandBackend, like RenderGraph's
+ * GraphBackend, so recording and ordering can be checked without a
+ * context (see test/cmdbench.cpp).
+ */
+
+#ifndef COMMANDBUFFER_HPP_
+#define COMMANDBUFFER_HPP_
+
+#include <GL/glew.h>
+
+#include <stddef.h>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using std::vector;
+
+namespace render {
+
+enum CommandType
+{
+    CMD_BIND_PROGRAM,
+    CMD_UNIFORM_BLOCK,
+    CMD_BIND_TEXTURE,
+    CMD_BIND_VAO,
+    CMD_DRAW,
+    CMD_BIND_FRAMEBUFFER
+};
+
+// Every command starts with one of these; size covers the whole
+// command, header and any data after it included
+struct CommandHeader
+{
+    unsigned int type;
+    unsigned int size;
+};
+
+struct BindProgram
+{
+    GLuint program;
+};
+
+// size bytes of data follow, copied when recorded, for the uniform
+// block bound at binding
+struct UniformBlock
+{
+    GLuint binding;
+    GLuint size;
+};
+
+struct BindTexture
+{
+    GLuint  unit;
+    GLenum  target;
+    GLuint  texture;
+};
+
+struct BindVao
+{
+    GLuint vao;
+};
+
+// glDrawArrays when indexType is 0, else glDrawElements with offset
+// into the bound index buffer, in bytes
+struct Draw
+{
+    GLenum  mode;
+    GLenum  indexType;
+    GLint   first;
+    GLsizei count;
+    GLsizei instances;
+    GLuint  offset;
+};
+
+// Binds framebuffer, sets the viewport and clears whatever clear says
+struct BindFramebuffer
+{
+    GLuint      framebuffer;
+    GLint       x, y;
+    GLsizei     width, height;
+    GLbitfield  clear;
+    GLfloat     color[4];
+};
+
+/*
+ * Where commands end up. GLCommandBackend below makes the calls; tests
+ * substitute their own.
+ */
+class CommandBackend
+{
+public:
+    virtual ~CommandBackend() {}
+
+    virtual void    beginFrame() {}
+    virtual void    bindProgram(const BindProgram & cmd) = 0;
+    virtual void    uniformBlock(const UniformBlock & cmd, const void * data) = 0;
+    virtual void    bindTexture(const BindTexture & cmd) = 0;
+    virtual void    bindVao(const BindVao & cmd) = 0;
+    virtual void    draw(const Draw & cmd) = 0;
+    virtual void    bindFramebuffer(const BindFramebuffer & cmd) = 0;
+    virtual void    endFrame() {}
+};
+
+/*
+ * Streams uniform blocks into one buffer, orphaned every frame, and
+ * skips binding the program or VAO that is already bound. Create, use
+ * and destroy it on the GL thread.
+ */
+class GLCommandBackend : public CommandBackend
+{
+public:
+    GLCommandBackend();
+    virtual ~GLCommandBackend();
+
+    virtual void    beginFrame();
+    virtual void    bindProgram(const BindProgram & cmd);
+    virtual void    uniformBlock(const UniformBlock & cmd, const void * data);
+    virtual void    bindTexture(const BindTexture & cmd);
+    virtual void    bindVao(const BindVao & cmd);
+    virtual void    draw(const Draw & cmd);
+    virtual void    bindFramebuffer(const BindFramebuffer & cmd);
+
+protected:
+    GLuint      buffer;
+    GLsizeiptr  capacity;
+    GLsizeiptr  offset;         // next free byte this frame
+    GLsizeiptr  needed;         // bytes the last frame wanted
+    GLint       alignment;
+    GLuint      program;
+    GLuint      vao;
+};
+
+/*
+ * Commands one after the other in blocks that are kept between frames,
+ * so once warmed up recording allocates nothing. One thread at a time.
+ */
+class CommandList
+{
+public:
+    // Commands never straddle blocks; bigger ones get a block to themselves
+    static const size_t BLOCK_SIZE = 64 * 1024;
+
+    CommandList();
+    ~CommandList();
+
+    void    bindProgram(GLuint program);
+    void    uniformBlock(GLuint binding, const void * data, GLuint size);
+    void    bindTexture(GLuint unit, GLenum target, GLuint texture);
+    void    bindVao(GLuint vao);
+    void    draw(GLenum mode, GLint first, GLsizei count, GLsizei instances = 1);
+    void    drawElements(GLenum mode, GLsizei count, GLenum type, GLuint offset = 0, GLsizei instances = 1);
+    void    bindFramebuffer(GLuint framebuffer, GLint x, GLint y, GLsizei width, GLsizei height,
+                            GLbitfield clear = 0, const GLfloat * color = NULL);
+
+    // Replays everything, in the order it was recorded
+    void    execute(CommandBackend & backend) const;
+
+    // Forgets the commands, keeping the blocks
+    void    reset();
+
+    unsigned int size() const { return count; }
+    size_t  bytes() const { return used; }
+    size_t  reserved() const;
+
+protected:
+    CommandList(const CommandList &);
+    CommandList & operator=(const CommandList &);
+
+    struct Block
+    {
+        char *  data;
+        size_t  size;
+        size_t  used;
+    };
+
+    // Room for a command of type with payload bytes after the header
+    void *  push(CommandType type, size_t payload);
+
+    vector<Block>   blocks;
+    unsigned int    current;    // block being written
+    unsigned int    count;
+    size_t          used;
+};
+
+/*
+ * A frame's worth of lists, replayed in index order
+ */
+class CommandBuffer
+{
+public:
+    explicit CommandBuffer(unsigned int lists = 1);
+    ~CommandBuffer();
+
+    CommandList &   getList(unsigned int index) { return *lists[index]; }
+    unsigned int    getListCount() const { return lists.size(); }
+
+    // beginFrame(), every list, endFrame()
+    void    execute(CommandBackend & backend) const;
+    void    reset();
+
+    unsigned int size() const;
+
+protected:
+    CommandBuffer(const CommandBuffer &);
+    CommandBuffer & operator=(const CommandBuffer &);
+
+    vector<CommandList *> lists;
+};
+
+struct QueueStats
+{
+    unsigned int    frames;         // executed
+    double          submitWait;     // seconds submit() spent waiting for the GL thread
+    double          executeTime;    // seconds spent replaying
+};
+
+/*
+ * Two CommandBuffers passed between the recording side and the GL
+ * thread. The recording side runs at most one frame ahead: submit()
+ * waits for the frame before the one it hands over.
+ *
+ * Either start() a thread to replay frames, or call executeNext() from
+ * a thread of your own (with GLFW 2 the context can't leave the thread
+ * that opened the window, so that one replays and the game moves).
+ */
+class CommandQueue
+{
+public:
+    typedef std::function<void()> Function;
+
+    explicit CommandQueue(unsigned int lists = 1);
+
+    // Stops the thread, if any, after the frames already submitted
+    ~CommandQueue();
+
+    // Recording side: lists for the frame being recorded, any thread per
+    // list, none once submit() is called
+    CommandList &   getList(unsigned int index) { return recording->getList(index); }
+    unsigned int    getListCount() const { return recording->getListCount(); }
+
+    // Recording side: hands the frame over and returns lists for the
+    // next one
+    void    submit();
+
+    // Recording side: waits for everything submitted to be replayed
+    void    finish();
+
+    // GL side: replays the next frame, waiting for one. False once
+    // stop() was called and everything submitted has run.
+    bool    executeNext(CommandBackend & backend);
+
+    // Replays frames on a new thread until stop(). begin runs on it
+    // first (make the context current there), present after each frame
+    // (swap buffers), end last.
+    void    start(CommandBackend & backend, const Function & begin = Function(),
+                  const Function & present = Function(), const Function & end = Function());
+    void    stop();
+
+    QueueStats getStats();
+
+protected:
+    CommandQueue(const CommandQueue &);
+    CommandQueue & operator=(const CommandQueue &);
+
+    CommandBuffer * buffers[2];
+    CommandBuffer * recording;
+    CommandBuffer * ready;      // submitted, until replayed
+    bool            stopping;
+
+    std::mutex              lock;
+    std::condition_variable changed;
+    std::thread             thread;
+    QueueStats              stats;
+};
+
+}
+
+#endif /* COMMANDBUFFER_HPP_ */
@@ -0,0 +1,155 @@
+/*
+ * Context.hpp
+ *
+ * Window/context abstraction for the demos. GlfwContext opens a normal
+ * window; EglContext creates a surfaceless (or pbuffer) context and
+ * renders into an Fbo instead, so the demos run on machines without a
+ * display or GPU (e.g. Mesa llvmpipe).
+ *
+ * createContext() understands these options and removes them from argv:
+ *
+ *   --headless         use the EGL backend
+ *   --frames N         stop after N frames (default 1 when headless)
+ *   --timestep S       seconds per frame reported by getTime() when
+ *                      running a fixed number of frames (default 1/60)
+ *   --capture PREFIX   write every frame to PREFIX0000.png, ...
+ *   --profile FILE     time every frame, print a breakdown on close and
+ *                      save a Chrome trace to FILE
+ *   --profile-draws    with --profile, time every draw call on the GPU
+ *                      too (two timestamp queries per draw)
+ *   --stats            show each frame's GL call counts in the window
+ *                      title, or print them when headless (needs a
+ *                      GL_STATS build, see Stats.hpp)
+ */
+
+#ifndef CONTEXT_HPP_
+#define CONTEXT_HPP_
+
+#include <GL/glew.h>
+#include <GL/glfw.h>
+
+#include <string>
+
+#include "fbo.hpp"
+
+using std::string;
+
+namespace context {
+
+struct Options
+{
+    Options():headless(false), frames(0), timestep(1.0 / 60.0), profileDraws(false), stats(false){}
+
+    bool    headless;
+    int     frames;
+    double  timestep;
+    string  capture;
+    string  profile;
+    bool    profileDraws;
+    bool    stats;
+};
+
+class Context
+{
+public:
+    Context(const Options & options);
+    virtual ~Context() {}
+
+    virtual bool open(int width, int height, const char * title) = 0;
+    virtual void close() = 0;
+
+    // Captures the frame if requested, then presents it
+    void    swapBuffers();
+
+    // False once the window is closed, ESC is hit or the frames run out
+    bool    isRunning();
+
+    // Wall clock, or frame * timestep when running a fixed frame count
+    double  getTime();
+
+    int     getFrame() { return frame; }
+
+    virtual void getSize(int * width, int * height) = 0;
+    virtual void setSwapInterval(int interval) {}
+
+    // Input. Headless contexts never see any.
+    virtual int  getKey(int key) { return GLFW_RELEASE; }
+    virtual int  getMouseButton(int button) { return GLFW_RELEASE; }
+    virtual void getMousePos(int * x, int * y);
+
+protected:
+    virtual void    present() = 0;
+    virtual bool    isOpen() = 0;
+    virtual double  getWallTime() = 0;
+
+    bool    initGlew();
+    bool    writeFrame();
+
+    // Where --stats output goes; prints it by default
+    virtual void    showStats(const string & line);
+
+    // Backends call these once the context is current / before it goes
+    void    startProfiling();
+    void    stopProfiling();
+
+    Options options;
+    int     frame;
+};
+
+class GlfwContext : public Context
+{
+public:
+    GlfwContext(const Options & options):Context(options){}
+
+    virtual bool open(int width, int height, const char * title);
+    virtual void close();
+
+    virtual void getSize(int * width, int * height);
+    virtual void setSwapInterval(int interval);
+
+    virtual int  getKey(int key);
+    virtual int  getMouseButton(int button);
+    virtual void getMousePos(int * x, int * y);
+
+protected:
+    virtual void    present();
+    virtual bool    isOpen();
+    virtual double  getWallTime();
+    virtual void    showStats(const string & line);
+
+    string  title;
+};
+
+#ifdef HAVE_EGL
+
+class EglContext : public Context
+{
+public:
+    EglContext(const Options & options);
+    virtual ~EglContext();
+
+    virtual bool open(int width, int height, const char * title);
+    virtual void close();
+
+    virtual void getSize(int * width, int * height);
+
+protected:
+    virtual void    present();
+    virtual bool    isOpen() { return display != 0; }
+    virtual double  getWallTime();
+
+    void *  display;    // EGLDisplay
+    void *  surface;    // EGLSurface, unused when surfaceless
+    void *  ctx;        // EGLContext
+    Fbo     target;
+    int     width, height;
+};
+
+#endif
+
+// Picks a backend from the command line and strips the options it used
+Context * createContext(int & argc, char * argv[]);
+
+}
+
+#endif /* CONTEXT_HPP_ */
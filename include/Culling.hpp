@@ -0,0 +1,102 @@
+/*
+ * Culling.hpp
+ *
+ * CPU frustum culling for scenes with many objects. World space bounds
+ * live in a BoundsArray (structure of arrays, one float per object per
+ * component) so the SSE/AVX paths can test 4 or 8 objects against a
+ * plane per instruction. The instruction set is picked at run time;
+ * SCALAR is always available and is what the SIMD paths are checked
+ * against.
+ *
+ * Results go into a byte per object (1 = visible) so that threads can
+ * cull disjoint ranges of the same array without any locking.
+ */
+
+#ifndef CULLING_HPP_
+#define CULLING_HPP_
+
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "Jobs.hpp"
+#include "TriMesh.hpp"
+
+using std::vector;
+using glm::mat4;
+using glm::vec3;
+using glm::vec4;
+
+namespace cull {
+
+enum Isa
+{
+    SCALAR,
+    SSE,        // 4 objects at a time
+    AVX,        // 8 objects at a time
+    NEON,       // ARM, BatchMath only (batch::getBestIsa())
+    BEST        // widest one this CPU supports for the call
+};
+
+// Widest of the paths culling, SoaMesh and the others have: never NEON
+Isa             getBestIsa();
+const char *    getIsaName(Isa isa);
+
+class Frustum
+{
+public:
+    Frustum() {}
+
+    // Planes of proj * view (or proj * view * model for object space)
+    Frustum(const mat4 & viewProj);
+
+    bool testAabb(const vec3 & center, const vec3 & extent) const;
+    bool testSphere(const vec3 & center, float radius) const;
+
+    // left, right, bottom, top, near, far. xyz is the unit normal
+    // pointing inwards, dot(xyz, p) + w is the signed distance.
+    vec4 planes[6];
+};
+
+class BoundsArray
+{
+public:
+    // Transforms the object space box by model and stores the box
+    // around the result. Returns the object's index.
+    unsigned int add(const mesh::Aabb & box, const mat4 & model = mat4(1.0f));
+    unsigned int add(const vec3 & center, const vec3 & extent);
+
+    void set(unsigned int index, const vec3 & center, const vec3 & extent);
+
+    unsigned int size() const { return cx.size(); }
+    void reserve(unsigned int count);
+    void clear();
+
+    // Box centers and half extents, and the radius of the sphere
+    // around each box
+    vector<float> cx, cy, cz;
+    vector<float> ex, ey, ez;
+    vector<float> radius;
+};
+
+// visible[i] = 1 if object i may intersect the frustum, 0 if it
+// certainly doesn't. Returns the number of visible objects.
+unsigned int cullAabbs(const Frustum & frustum, const BoundsArray & bounds,
+                       unsigned char * visible, Isa isa = BEST);
+
+// Same, but against the bounding spheres: cheaper, looser
+unsigned int cullSpheres(const Frustum & frustum, const BoundsArray & bounds,
+                         unsigned char * visible, Isa isa = BEST);
+
+// cullAabbs split across threads (0 = one per hardware thread)
+unsigned int cullAabbsParallel(const Frustum & frustum, const BoundsArray & bounds,
+                               unsigned char * visible, unsigned int threads = 0,
+                               Isa isa = BEST);
+
+// The same on a job system's threads
+unsigned int cullAabbsParallel(const Frustum & frustum, const BoundsArray & bounds,
+                               unsigned char * visible, jobs::JobSystem & jobs,
+                               Isa isa = BEST);
+
+}
+
+#endif /* CULLING_HPP_ */
@@ -0,0 +1,112 @@
+/*
+ * DrawList.hpp
+ *
+ * State-sorted draw submission. Each draw gets a 64 bit sort key, most
+ * significant field first:
+ *
+ *   target   8 bits    render target, as returned by addTarget()
+ *   program 10 bits    GLSLProgram handle
+ *   texture 14 bits    material texture (unit 0)
+ *   vao     14 bits
+ *   depth   18 bits    0 = near, so draws sharing state go front to back
+ *
+ * so sorting by key groups draws by the state that costs most to
+ * change. sort() is an LSD radix sort, split over a job system's
+ * threads for large lists. record() then writes the draws into a
+ * CommandList, binding only what differs from the draw before. Handles
+ * wider than their field only group less well; record() compares the
+ * real values.
+ */
+
+#ifndef DRAWLIST_HPP_
+#define DRAWLIST_HPP_
+
+#include <GL/glew.h>
+
+#include <vector>
+
+#include "CommandBuffer.hpp"
+#include "Jobs.hpp"
+
+using std::vector;
+
+namespace render {
+
+typedef unsigned long long SortKey;
+
+// What a draw needs bound
+struct DrawState
+{
+    unsigned int    target;     // from DrawList::addTarget()
+    GLuint          program;
+    GLuint          texture;    // GL_TEXTURE_2D on unit 0, 0 for none
+    GLuint          vao;
+};
+
+SortKey makeSortKey(const DrawState & state, float depth);
+
+struct DrawListStats
+{
+    unsigned int draws;
+    unsigned int targetBinds;
+    unsigned int programBinds;
+    unsigned int textureBinds;
+    unsigned int vaoBinds;
+
+    unsigned int stateChanges() const { return targetBinds + programBinds + textureBinds + vaoBinds; }
+};
+
+class DrawList
+{
+public:
+    DrawList();
+
+    // A framebuffer, viewport and clear to draw into. Once sorted,
+    // targets are drawn in the order they were added; only the first
+    // bind of each clears.
+    unsigned int addTarget(const BindFramebuffer & target);
+
+    // depth in [0, 1], 0 nearest. uniforms (size bytes, copied) go to
+    // uniformBinding before the draw.
+    void    add(const DrawState & state, const Draw & draw, float depth,
+                const void * uniforms = NULL, GLuint size = 0);
+
+    // Sorts by key, keeping the order draws were added among equal keys;
+    // on jobs' threads if given, else on this one
+    void    sort(jobs::JobSystem * jobs = NULL);
+
+    // Writes the draws, in sorted order if sort() was called since the
+    // last add(), else as added. With elide false every draw rebinds
+    // all its state, the way the demos draw.
+    DrawListStats record(CommandList & list, GLuint uniformBinding = 0, bool elide = true) const;
+
+    // Draws and targets go; the memory stays
+    void    clear();
+
+    unsigned int size() const { return draws.size(); }
+    SortKey getKey(unsigned int index) const { return keys[order[index]]; }
+
+protected:
+    struct Item
+    {
+        DrawState   state;
+        Draw        draw;
+        unsigned int uniforms;      // offset into uniformData
+        GLuint      uniformSize;
+    };
+
+    vector<BindFramebuffer> targets;
+    vector<Item>            draws;
+    vector<SortKey>         keys;
+    vector<unsigned int>    order;      // draws in the order to record them
+    vector<unsigned char>   uniformData;
+    bool                    sorted;
+};
+
+// Stable LSD radix sort of keys, putting the permutation in order.
+// Digits every key shares are skipped.
+void radixSort(const vector<SortKey> & keys, vector<unsigned int> & order, jobs::JobSystem * jobs = NULL);
+
+}
+
+#endif /* DRAWLIST_HPP_ */
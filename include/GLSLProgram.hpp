@@ -21,7 +21,7 @@ using std::string;
 namespace shader {
 
 enum GLSLShaderType {
-	VERTEX, FRAGMENT, GEOMETRY, TESS_CONTROL, TESS_EVALUATION
+	VERTEX, FRAGMENT, GEOMETRY, TESS_CONTROL, TESS_EVALUATION, COMPUTE
 };
 
 class GLSLProgram
@@ -0,0 +1,97 @@
+/*
+ * Hierarchy.hpp
+ *
+ * A transform hierarchy for scenes with many nodes. Each node has a
+ * local translation, rotation (a quaternion) and scale, and update()
+ * turns them into world matrices, parent * translate * rotate * scale.
+ *
+ * Nodes live in flat arrays in breadth-first order: every level of the
+ * tree is one contiguous range, parents come before their children and
+ * siblings sit together. update() walks the levels in order, each one
+ * split across threads, so a node's parent is always done by the time
+ * it's reached and no locking is needed. Only nodes that were changed,
+ * or are under one that was, are recomputed.
+ *
+ * Node ids from add() don't change. Adding nodes reorders the arrays at
+ * the next update(); getSlot() maps an id to its place in them.
+ */
+
+#ifndef HIERARCHY_HPP_
+#define HIERARCHY_HPP_
+
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/quaternion.hpp"
+#include "Jobs.hpp"
+
+using std::vector;
+using glm::mat4;
+using glm::quat;
+using glm::vec3;
+
+namespace scene {
+
+class Hierarchy
+{
+public:
+    static const unsigned int NONE = ~0u;
+
+    Hierarchy();
+
+    // A node under parent (NONE for a root). Returns its id.
+    unsigned int add(unsigned int parent, const vec3 & translation = vec3(0.0f),
+                     const quat & rotation = quat(), const vec3 & scale = vec3(1.0f));
+
+    void setTranslation(unsigned int id, const vec3 & translation);
+    void setRotation(unsigned int id, const quat & rotation);
+    void setScale(unsigned int id, const vec3 & scale);
+
+    const vec3 & getTranslation(unsigned int id) const { return translations[slots[id]]; }
+    const quat & getRotation(unsigned int id) const { return rotations[slots[id]]; }
+    const vec3 & getScale(unsigned int id) const { return scales[slots[id]]; }
+    unsigned int getParent(unsigned int id) const;
+
+    // Brings every world matrix up to date. threads: 0 = one per
+    // hardware thread. Returns the number of nodes recomputed.
+    unsigned int update(unsigned int threads = 0);
+
+    // The same on a job system's threads
+    unsigned int update(jobs::JobSystem & jobs);
+
+    // As of the last update()
+    const mat4 & getWorld(unsigned int id) const { return worlds[slots[id]]; }
+
+    // The world matrices in breadth-first order, and where each id is
+    // in it. Valid until the next add().
+    const vector<mat4> & getWorlds() const { return worlds; }
+    unsigned int getSlot(unsigned int id) const { return slots[id]; }
+
+    unsigned int size() const { return ids.size(); }
+    unsigned int getLevelCount() const { return levels.empty() ? 0 : levels.size() - 1; }
+    void reserve(unsigned int count);
+    void clear();
+
+protected:
+    void flatten();
+    unsigned int updateRange(unsigned int begin, unsigned int end);
+    template <class ParallelFor>
+    unsigned int updateLevels(ParallelFor parallel);
+
+    // By slot
+    vector<unsigned int>    parents;        // slot, NONE for a root
+    vector<vec3>            translations;
+    vector<quat>            rotations;
+    vector<vec3>            scales;
+    vector<mat4>            worlds;
+    vector<unsigned char>   dirty;          // changed since the last update()
+
+    vector<unsigned int>    ids;            // id at each slot
+    vector<unsigned int>    slots;          // slot of each id
+    vector<unsigned int>    levels;         // first slot of each level, then size()
+    bool                    flat;           // arrays are breadth-first
+};
+
+}
+
+#endif /* HIERARCHY_HPP_ */
@@ -0,0 +1,159 @@
+/*
+ * Ibl.hpp
+ *
+ * Image based lighting precomputed from an environment cube map (such
+ * as the one util::image::loadCubemap() makes):
+ *
+ *  - diffuse: irradiance as 9 spherical harmonic coefficients (bands 0
+ *    to 2), already convolved with the cosine lobe after Ramamoorthi and
+ *    Hanrahan, "An Efficient Representation for Irradiance Environment
+ *    Maps" (2001). evaluate(n) is the irradiance E(n); a Lambertian
+ *    surface reflects albedo / pi times that.
+ *
+ *  - specular: a cube map whose level l is the environment convolved
+ *    with GGX at roughness l / (levels - 1), with N = V = R, as in
+ *    Karis, "Real Shading in Unreal Engine 4" (2013). Each texel takes
+ *    importance samples of the lobe, read from the mip of the source
+ *    whose texels are about the size of the sample's share of the lobe
+ *    (filtered importance sampling), so few samples give little noise.
+ *
+ * The CPU path runs anywhere, GL or not: rows of texels are split over
+ * a job system's threads, if given, and the SSE path works on four
+ * texels at a time, agreeing with the scalar one to float rounding.
+ * prefilterOnGpu() does the specular part with shaders/prefilter.comp
+ * instead. The results can be cached in a file keyed by a hash of the
+ * source and the options; shaders/ibl.frag shades with them.
+ */
+
+#ifndef IBL_HPP_
+#define IBL_HPP_
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "Culling.hpp"
+#include "GLSLProgram.hpp"
+#include "Jobs.hpp"
+
+using std::string;
+using std::vector;
+using glm::vec3;
+
+namespace ibl {
+
+/*
+ * Linear RGB floats, faces in loadCubemap()'s order (+x, -x, +y, -y, +z,
+ * -z), each face's rows as GL takes them. Level l is size >> l square.
+ */
+class Cubemap
+{
+public:
+    Cubemap();
+    explicit Cubemap(GLsizei size, unsigned int levels = 1);
+
+    // 8 bit RGB faces back to back, as util::image::loadCubemapPixels()
+    // gives them; srgb decodes them to linear
+    static Cubemap fromPixels(GLsizei size, const GLubyte * rgb, bool srgb = true);
+
+    // Level 0 of a GL cube map, read back. The same decoding as
+    // fromPixels().
+    static Cubemap fromTexture(GLuint texture, bool srgb = true);
+
+    // Every level below 0 box filtered from the one above, down to 1x1
+    void    buildMips();
+
+    GLsizei         getSize(unsigned int level = 0) const { return std::max(size >> level, 1); }
+    unsigned int    getLevels() const { return data.size(); }
+    float *         getTexel(unsigned int level, int face, int x, int y)
+    {
+        return &data[level][(((size_t)face * getSize(level) + y) * getSize(level) + x) * 3];
+    }
+    const float *   getTexel(unsigned int level, int face, int x, int y) const
+    {
+        return &data[level][(((size_t)face * getSize(level) + y) * getSize(level) + x) * 3];
+    }
+    vector<float> & getLevel(unsigned int level) { return data[level]; }
+    const vector<float> & getLevel(unsigned int level) const { return data[level]; }
+
+    // Bilinear within the two levels nearest lod, edges clamped per face
+    vec3    sample(const vec3 & dir, float lod) const;
+
+    // A GL_RGB16F cube map with these levels, filtered trilinearly
+    GLuint  createTexture() const;
+
+protected:
+    GLsizei                 size;
+    vector<vector<float> >  data;
+};
+
+// The direction through the middle of a texel
+vec3 texelDirection(int face, GLsizei size, int x, int y);
+
+struct Sh9
+{
+    vec3 c[9];
+
+    vec3 evaluate(const vec3 & n) const;
+};
+
+struct Options
+{
+    Options():size(128), levels(0), samples(64), jobs(NULL), isa(cull::BEST){}
+
+    GLsizei         size;       // specular level 0, at most the source's
+    unsigned int    levels;     // 0 = down to 8x8
+    unsigned int    samples;    // per texel
+    jobs::JobSystem * jobs;     // NULL = all on the calling thread
+    cull::Isa       isa;
+};
+
+// Seconds spent on each part
+struct Timing
+{
+    double mips, irradiance, specular;
+};
+
+struct Environment
+{
+    Sh9     irradiance;
+    Cubemap specular;
+};
+
+Sh9     computeIrradiance(const Cubemap & source, jobs::JobSystem * jobs = NULL, cull::Isa isa = cull::BEST);
+
+// source needs its mips (buildMips())
+Cubemap prefilterSpecular(const Cubemap & source, const Options & options = Options());
+
+// Both, building source's mips first if it has none
+void    precompute(Cubemap & source, const Options & options, Environment * environment, Timing * timing = NULL);
+
+// Changes with the source's texels and every option the results depend
+// on; jobs and isa don't count
+unsigned long long cacheKey(const Cubemap & source, const Options & options);
+
+bool    writeCache(const string & fileName, const Environment & environment, unsigned long long key);
+
+// False, leaving environment alone, if the file is missing, damaged or
+// for another key
+bool    readCache(const string & fileName, Environment * environment, unsigned long long key);
+
+// The cached results if fileName has them, otherwise precompute() and
+// write them there. Returns whether they came from the cache.
+bool    loadOrPrecompute(const string & fileName, Cubemap & source, const Options & options,
+                         Environment * environment, Timing * timing = NULL);
+
+// The specular cube map made on the GPU from a cube map texture
+// sourceSize square, with program linked from shaders/prefilter.comp.
+// Gives the source mipmaps. Needs compute shaders (GL 4.3); 0 without them.
+GLuint  prefilterOnGpu(GLuint source, GLsizei sourceSize, const Options & options, shader::GLSLProgram & program);
+
+// Sh[9] and SpecularLevels, for shaders/ibl.frag
+void    setUniforms(shader::GLSLProgram & program, const Sh9 & irradiance, unsigned int specularLevels);
+
+}
+
+#endif /* IBL_HPP_ */
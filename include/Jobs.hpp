@@ -0,0 +1,184 @@
+/*
+ * Jobs.hpp
+ *
+ * A work-stealing job system. Each thread, the main one included, has
+ * a Chase-Lev deque: it pushes and pops its own jobs at the bottom,
+ * last in first out, while idle threads steal the oldest ones from the
+ * top. Threads that aren't part of the pool queue into a shared list.
+ *
+ * A Counter tracks a group of jobs. wait() runs other jobs until the
+ * group is done instead of blocking, so waiting inside a job is fine,
+ * and a job can be held back until another group finishes.
+ *
+ * The thread that creates the JobSystem is its main thread, the one
+ * with the GL context. runOnMain() queues work that must stay there
+ * (uploads, anything else touching GL); it runs when the main thread
+ * calls pumpMain() or waits.
+ */
+
+#ifndef JOBS_HPP_
+#define JOBS_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using std::vector;
+
+namespace jobs {
+
+typedef std::function<void()> Function;
+
+struct Job;
+class Deque;
+
+// Jobs that signal a counter add one to it when queued and take it
+// away when they finish
+class Counter
+{
+public:
+    Counter():count(0), busy(0) {}
+
+    // Once true, and no jobs are waiting on it, the counter can go
+    bool done() const
+    {
+        return count.load(std::memory_order_acquire) == 0 && busy.load(std::memory_order_acquire) == 0;
+    }
+
+protected:
+    friend class JobSystem;
+
+    Counter(const Counter &);
+    Counter & operator=(const Counter &);
+
+    std::atomic<int> count;
+    std::atomic<int> busy;      // threads still finishing a job on it
+    std::mutex lock;
+    vector<Job *> waiting;      // run once count is zero
+};
+
+struct Stats
+{
+    unsigned long long executed;        // jobs run, by any thread
+    unsigned long long stolen;          // of those, taken from another thread
+    unsigned long long stealAttempts;   // including ones finding nothing
+    unsigned long long onMain;          // runOnMain() jobs run
+};
+
+class JobSystem
+{
+public:
+    // threads in all, counting the calling one (0 = one per hardware
+    // thread)
+    explicit JobSystem(unsigned int threads = 0);
+
+    // Finishes every queued job first
+    ~JobSystem();
+
+    // Queues fn on this thread. signal, if given, counts it until it
+    // has run; after, if given, keeps it from starting until that
+    // counter is zero.
+    void run(const Function & fn, Counter * signal = NULL, Counter * after = NULL);
+
+    // Queues fn to run on the main thread only
+    void runOnMain(const Function & fn, Counter * signal = NULL);
+
+    // Runs jobs until counter is zero; on the main thread, main thread
+    // jobs too
+    void wait(Counter & counter);
+
+    // Runs the main thread jobs queued so far; call it once a frame,
+    // from the main thread. Returns how many ran.
+    unsigned int pumpMain();
+
+    // fn(begin, end) over [0, count), in pieces of grain (0 = a few
+    // per thread), spread over the pool. Returns when all are done.
+    template <class F>
+    void parallelFor(unsigned int count, unsigned int grain, F fn);
+
+    unsigned int getThreadCount() const { return deques.size(); }
+    bool isMainThread() const;
+
+    Stats getStats() const;
+    void resetStats();
+
+protected:
+    struct ThreadStats
+    {
+        std::atomic<unsigned long long> executed, stolen, stealAttempts;
+        char padding[64 - 3 * sizeof(unsigned long long)];
+    };
+
+    JobSystem(const JobSystem &);
+    JobSystem & operator=(const JobSystem &);
+
+    void submit(Job * job);
+    void execute(Job * job, int self);
+    bool runOne(int self, bool main);
+    bool haveWork() const;
+    void workerLoop(int self);
+    int  currentThread() const;
+
+    vector<Deque *>             deques;         // one per thread, main's first
+    vector<ThreadStats>         stats;
+    vector<std::thread>         workers;
+
+    std::mutex                  sharedLock;     // jobs from outside the pool
+    vector<Job *>               shared;
+    std::atomic<unsigned int>   sharedCount;
+
+    std::mutex                  mainLock;       // runOnMain()
+    std::deque<Job *>           mainJobs;
+    std::atomic<unsigned int>   mainCount;
+    std::atomic<unsigned long long> onMain;
+
+    std::mutex                  sleepLock;
+    std::condition_variable     wake;
+    std::atomic<int>            sleepers;
+    std::atomic<int>            pending;        // queued and not finished
+    std::atomic<bool>           stopping;
+};
+
+
+template <class F>
+void
+JobSystem::parallelFor(unsigned int count, unsigned int grain, F fn)
+{
+    if (grain == 0)
+        grain = count / (getThreadCount() * 4) + 1;
+    if (count <= grain) {
+        fn(0u, count);
+        return;
+    }
+
+    // This thread takes the first piece and then pops the rest from the
+    // far end, while thieves start at the near end
+    Counter counter;
+    for (unsigned int begin = grain; begin < count; begin += grain) {
+        unsigned int end = std::min(begin + grain, count);
+        run([&fn, begin, end]() { fn(begin, end); }, &counter);
+    }
+    fn(0u, grain);
+    wait(counter);
+}
+
+// For code where a job system is optional: jobs->parallelFor(), or the
+// whole range on this thread if jobs is NULL
+template <class F>
+void
+parallelFor(JobSystem * jobs, unsigned int count, unsigned int grain, F fn)
+{
+    if (jobs)
+        jobs->parallelFor(count, grain, fn);
+    else
+        fn(0u, count);
+}
+
+}
+
+#endif /* JOBS_HPP_ */
@@ -1,6 +1,7 @@
 #ifndef LOADER_H
 #define LOADER_H
 
+#include "Arena.hpp"
 #include "TriMesh.hpp"
 #include <string>
 
@@ -8,7 +9,81 @@ using std::string;
 
 namespace mesh {
 
-    TriMesh loadObj(string filename);
+    // With an arena, the loader's temporaries come from it instead of
+    // growing vectors, and the mesh's arrays are allocated once at their
+    // exact size. They are left in the arena; reset it between loads.
+    TriMesh loadObj(string filename, mem::Arena * arena = NULL);
+
+    // What a pass over an .obj finds: enough to allocate for it exactly
+    class ObjInfo
+    {
+    public:
+        ObjInfo():positions(0), uvs(0), normals(0), corners(0), hasUvs(true), hasNormals(true){}
+
+        unsigned int positions, uvs, normals;   // v, vt and vn lines
+        unsigned int corners;                   // three per triangle
+        bool hasUvs, hasNormals;                // on every face
+
+        vector<SubMesh> submeshes;
+        vector<string> materials;
+        vector<string> materialLibraries;
+    };
+
+    // Out-of-core loading, in two passes. scanObj() counts; readObj()
+    // then writes info.corners corners straight into the caller's arrays.
+    // Pass normals or uvs only if info says every face has them, NULL
+    // otherwise; normals aren't generated here. On top of the output,
+    // memory holds the file's own v/vt/vn arrays (which faces index into)
+    // at their exact size, and a fixed window of the file. Both return
+    // false if the file can't be read, and readObj() if it no longer
+    // matches info.
+    bool scanObj(const string & filename, ObjInfo & info);
+    bool readObj(const string & filename, const ObjInfo & info,
+                 vec3 * vertices, vec3 * normals, vec2 * uvs);
+
+    // Converts an .obj to a binary file of its corners the same way,
+    // writing through a memory map so the output needn't fit in memory
+    bool writeObjCache(const string & objFile, const string & cacheFile);
+
+    // A cache file from writeObjCache(), mapped read-only. The arrays
+    // stay valid until close().
+    class ObjCache
+    {
+    public:
+        ObjCache();
+        ~ObjCache();
+
+        bool open(const string & cacheFile);
+        void close();
+
+        unsigned int corners() const { return _corners; }
+        const vec3 * vertices() const { return _vertices; }
+        const vec3 * normals() const { return _normals; }      // NULL if the .obj had none
+        const vec2 * uvs() const { return _uvs; }              // NULL if the .obj had none
+        const Aabb & bounds() const { return _bounds; }
+
+        const vector<SubMesh> & submeshes() const { return _submeshes; }
+        const vector<string> & materials() const { return _materials; }
+        const vector<string> & materialLibraries() const { return _materialLibraries; }
+
+        // A copy in memory, with normals generated if there were none,
+        // the same as loadObj() would give
+        TriMesh toTriMesh() const;
+
+    protected:
+        ObjCache(const ObjCache &);
+        ObjCache & operator=(const ObjCache &);
+
+        char * _data;
+        size_t _size;
+        unsigned int _corners;
+        const vec3 * _vertices, * _normals;
+        const vec2 * _uvs;
+        Aabb _bounds;
+        vector<SubMesh> _submeshes;
+        vector<string> _materials;
+        vector<string> _materialLibraries;
+    };
 
 }
 
@@ -0,0 +1,102 @@
+/*
+ * Lod.hpp
+ *
+ * Levels of detail by quadric error mesh simplification (Garland and
+ * Heckbert), with the attribute terms from Hoppe's "New quadric metric"
+ * so that normals and uvs hold up as well as the shape does.
+ *
+ * Simplification is by half edge collapse: a vertex is folded into one
+ * of its neighbours, so every level reuses the full mesh's vertices and
+ * only the indices change. A LodMesh keeps all its levels back to back
+ * in one index array (one GL index buffer), finest first, each with
+ * the object space error it was built with. Per draw, select() picks
+ * the coarsest level whose error projects to less than a pixel or so.
+ *
+ * Vertices on uv or normal seams (where the mesh is split into open
+ * borders that lie on top of each other) and on non-manifold edges
+ * never move. Other open borders only collapse along themselves.
+ */
+
+#ifndef LOD_HPP_
+#define LOD_HPP_
+
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "Jobs.hpp"
+#include "TriMesh.hpp"
+
+using std::string;
+using std::vector;
+
+namespace lod {
+
+struct Options
+{
+    Options():
+        levels(8),
+        ratio(0.5f),
+        normalWeight(0.01f),
+        uvWeight(1.0f)
+    {}
+
+    unsigned int    levels;         // at most, counting the full mesh
+    float           ratio;          // triangles in a level over the previous
+
+    // Attribute error against geometric error. Positions are measured
+    // relative to the mesh's size, so these do not depend on its scale.
+    // Normals turn a lot more than a small mesh moves, hence the tiny
+    // default; much more and the shape gives way to keep the shading.
+    float           normalWeight;
+    float           uvWeight;
+};
+
+struct Level
+{
+    unsigned int    first;          // into LodMesh::mesh.indices
+    unsigned int    count;          // indices, three per triangle
+    float           error;          // object space
+};
+
+class LodMesh
+{
+public:
+    // Coarsest level whose error is under maxPixels when seen from
+    // distance away. pixelsPerUnit comes from getPixelsPerUnit().
+    unsigned int select(float distance, float pixelsPerUnit, float maxPixels = 1.0f) const;
+
+    // Vertices shared by all levels; indices holds every level
+    mesh::IndexedMesh   mesh;
+    vector<Level>       levels;     // finest first
+};
+
+// Screen pixels covered by one unit at distance 1 through
+// glm::perspective(fovy, ...) on a viewport height pixels high
+float getPixelsPerUnit(float fovy, int height);
+
+// Simplifies m down to targetTriangles (or as close as the seams and
+// borders allow) and returns the new indices into m.vertices. error,
+// if given, gets the object space error.
+vector<unsigned int> simplify(const mesh::IndexedMesh & m, unsigned int targetTriangles,
+                              const Options & options = Options(), float * error = NULL);
+
+// The whole chain in one pass
+LodMesh build(const mesh::TriMesh & m, const Options & options = Options());
+
+// build() over many meshes on threads (0 = one per hardware thread),
+// an equal share of the meshes each
+vector<LodMesh> buildBatch(const vector<const mesh::TriMesh *> & meshes,
+                           const Options & options = Options(), unsigned int threads = 0);
+
+// The same on a job system's threads, a mesh per job, so idle threads
+// steal from the ones with the big meshes
+vector<LodMesh> buildBatch(const vector<const mesh::TriMesh *> & meshes, const Options & options,
+                           jobs::JobSystem & jobs);
+
+// mesh::loadObj() followed by build()
+LodMesh loadObj(const string & filename, const Options & options = Options());
+
+}
+
+#endif /* LOD_HPP_ */
@@ -0,0 +1,102 @@
+/*
+ * Meshlet.hpp
+ *
+ * Splits an indexed mesh into meshlets (clusters of at most 64 vertices
+ * and 124 triangles, what mesh shader hardware likes), so culling can
+ * work on pieces of an object instead of all of it.
+ *
+ * Each meshlet has a bounding sphere for frustum culling and a normal
+ * cone for backface culling: when the camera is on the back side of the
+ * cone, every triangle in the meshlet faces away and the whole meshlet
+ * can go. The builder grows meshlets greedily from a seed triangle,
+ * preferring neighbours that add few vertices and bend the cone little.
+ *
+ * Everything lives in a MeshletArray, one flat array per field like
+ * cull::BoundsArray, so the SSE path can test four meshlets at a time
+ * and the whole thing uploads to shader storage buffers as is
+ * (shaders/meshletcull.comp is the same test as a compute shader).
+ */
+
+#ifndef MESHLET_HPP_
+#define MESHLET_HPP_
+
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "Culling.hpp"
+#include "TriMesh.hpp"
+
+using std::vector;
+using glm::vec3;
+
+namespace meshlet {
+
+struct Options
+{
+    Options():
+        maxVertices(64),
+        maxTriangles(124),
+        coneWeight(2.0f)
+    {}
+
+    unsigned int    maxVertices;    // at most 256, local indices are bytes
+    unsigned int    maxTriangles;
+
+    // How much the builder favours tight normal cones over round,
+    // compact meshlets. 0 ignores the normals.
+    float           coneWeight;
+};
+
+class MeshletArray
+{
+public:
+    unsigned int size() const { return vertexOffset.size(); }
+    void clear();
+
+    // The source mesh's indices again, meshlet after meshlet: meshlet i's
+    // triangles start at index triangleOffset[i] * 3, so a visible
+    // meshlet is one glDrawElements (or one entry of a multi-draw)
+    vector<unsigned int> getIndices() const;
+
+    // Per meshlet: where its vertices and triangles start and how many
+    // there are
+    vector<unsigned int> vertexOffset, vertexCount;
+    vector<unsigned int> triangleOffset, triangleCount;
+
+    // Source mesh vertex for each meshlet vertex
+    vector<unsigned int> vertices;
+
+    // Three bytes per triangle, indexing the meshlet's own vertices
+    vector<unsigned char> triangles;
+
+    // Bounding spheres
+    vector<float> cx, cy, cz, radius;
+
+    // Normal cones: the meshlet faces away from any camera where
+    // dot(center - camera, axis) >= cutoff * |center - camera| + radius.
+    // A cutoff of 1 never culls.
+    vector<float> ax, ay, az, cutoff;
+};
+
+// Splits m's triangles into meshlets; positions and normals (for the
+// bounds) come from m as well
+MeshletArray build(const mesh::IndexedMesh & m, const Options & options = Options());
+
+enum Test
+{
+    FRUSTUM = 1,
+    BACKFACE = 2,
+    ALL = FRUSTUM | BACKFACE
+};
+
+// visible[i] = 1 unless meshlet i is outside the frustum or faces away
+// from camera, both given in the meshlets' object space (build the
+// Frustum from proj * view * model). Returns the number visible. AVX
+// runs the SSE path: a mesh has a few hundred meshlets, not thousands.
+unsigned int cullMeshlets(const cull::Frustum & frustum, const vec3 & camera,
+                          const MeshletArray & meshlets, unsigned char * visible,
+                          int tests = ALL, cull::Isa isa = cull::BEST);
+
+}
+
+#endif /* MESHLET_HPP_ */
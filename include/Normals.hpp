@@ -0,0 +1,65 @@
+/*
+ * Normals.hpp
+ *
+ * Vertex normals and tangent frames for TriMeshes that come without
+ * them. Both work on the mesh's corners (three per triangle), so hard
+ * edges and uv seams just come out as corners with different values.
+ *
+ * computeNormals() gives every corner the weighted average of the face
+ * normals around its position, leaving out faces that meet its own at
+ * more than the crease angle. computeTangents() follows MikkTSpace's
+ * rules, so normal maps baked by the usual tools look right: per-face
+ * tangents are projected into each corner's normal plane, weighted by
+ * the corner's angle, and averaged over corners that share position,
+ * normal and uv and are mirrored the same way. It is not bit-exact with
+ * the reference implementation, which also splits degenerate and
+ * badly distorted groups.
+ *
+ * Both scatter the faces into per-position (or per-group) lists first
+ * and then gather per corner, over ranges of the mesh on threads. Every
+ * corner adds up its faces in the same order however many threads there
+ * are, so the results don't depend on the thread count.
+ */
+
+#ifndef NORMALS_HPP_
+#define NORMALS_HPP_
+
+#include "SoaMesh.hpp"
+#include "TriMesh.hpp"
+
+namespace mesh {
+
+enum NormalWeighting
+{
+    AREA_WEIGHTED,      // big faces count more
+    ANGLE_WEIGHTED      // by the face's angle at the vertex (Thurmer and Wuthrich)
+};
+
+struct NormalOptions
+{
+    NormalOptions():
+        creaseAngle(60.0f),
+        weighting(ANGLE_WEIGHTED),
+        threads(0)
+    {}
+
+    // Degrees. Faces meeting at more than this keep a hard edge; 180
+    // smooths everything.
+    float               creaseAngle;
+    NormalWeighting     weighting;
+    unsigned int        threads;    // 0 = one per hardware thread
+};
+
+// Fills m.normals, replacing whatever was there
+void computeNormals(TriMesh & m, const NormalOptions & options = NormalOptions());
+
+// The same, bit for bit, for the structure of arrays layout
+void computeNormals(SoaMesh & m, const NormalOptions & options = NormalOptions());
+
+// Fills m.tangents from m.normals and m.uvs. Returns false, and leaves
+// the tangents empty, if the mesh doesn't have both.
+bool computeTangents(TriMesh & m, unsigned int threads = 0);
+
+}
+
+#endif /* NORMALS_HPP_ */
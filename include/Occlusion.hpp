@@ -0,0 +1,131 @@
+/*
+ * Occlusion.hpp
+ *
+ * CPU occlusion culling, after masked software occlusion culling. A few
+ * cheap occluder meshes (decimated stand-ins for walls, buildings,
+ * terrain) are rasterized into a small depth buffer, and object boxes
+ * that are entirely behind what was drawn there are rejected before
+ * they cost any vertex work.
+ *
+ * The buffer stores 1/w, so bigger is nearer and it interpolates
+ * linearly in screen space. Occluders still have to sit inside what
+ * they stand for, but the rasterization is conservative both ways: a
+ * pixel on an occluder's outline is only covered if the occluder
+ * covers all of it, and its depth is the farthest 1/w the triangle has
+ * anywhere in it. A pyramid of 2x2 minimums (the farthest occluder
+ * under each texel) then lets a box of any size be tested against at
+ * most four texels.
+ *
+ * start() returns straight away and does the work on worker threads,
+ * so it can overlap the submission of the previous frame; finish()
+ * waits for it. Nothing it is given may change in between.
+ */
+
+#ifndef OCCLUSION_HPP_
+#define OCCLUSION_HPP_
+
+#include <thread>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "Culling.hpp"
+#include "TriMesh.hpp"
+
+using std::vector;
+using glm::mat4;
+using glm::vec3;
+using glm::vec4;
+
+namespace cull {
+
+class OcclusionCuller
+{
+public:
+    // Depth buffer size, and threads (0 = one per hardware thread)
+    OcclusionCuller(int width = 256, int height = 128, unsigned int threads = 0);
+    ~OcclusionCuller();
+
+    // The mesh is referenced, not copied, and has to outlive the culler.
+    // Returns the occluder's index.
+    unsigned int addOccluder(const mesh::TriMesh & mesh, const mat4 & model = mat4(1.0f));
+    void setOccluderModel(unsigned int index, const mat4 & model);
+    void clearOccluders();
+
+    // Rasterizes the occluders seen through viewProj and tests bounds
+    // against them. visible is read and written: objects already at 0
+    // (from cullAabbs, say) are skipped, the others are set to 0 if
+    // they are hidden. bounds and visible must stay put until finish().
+    void start(const mat4 & viewProj, const BoundsArray & bounds, unsigned char * visible);
+
+    // Waits for start(); returns the number of objects still visible
+    unsigned int finish();
+
+    // start() and finish() in one
+    unsigned int cull(const mat4 & viewProj, const BoundsArray & bounds, unsigned char * visible);
+
+    // Against the buffer from the last finish()
+    bool isOccluded(const vec3 & center, const vec3 & extent) const;
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+
+    // Level 0 of the pyramid: 1/w, 0 where nothing was drawn, bottom
+    // row first, getStride() floats per row
+    const float * getDepth() const { return &levels[0].front(); }
+    int getStride() const { return stride; }
+
+    unsigned int getThreadCount() const { return threads; }
+
+    // From the last frame: triangles that reached the buffer, and
+    // seconds spent rasterizing and testing
+    unsigned int getTriangleCount() const { return triangles.size(); }
+    double getRasterTime() const { return rasterTime; }
+    double getTestTime() const { return testTime; }
+
+    // Setup triangle: edges a x + b y + c, positive inside, and 1/w
+    // as a plane over the screen, never below wmin
+    struct Triangle
+    {
+        float   a[3], b[3], c[3];
+        float   wa, wb, wc, wmin;
+        int     minX, minY, maxX, maxY;
+    };
+
+protected:
+    struct Occluder
+    {
+        const mesh::TriMesh *   mesh;
+        mat4                    model;
+        vector<int>             neighbours;     // per edge, see findNeighbours()
+    };
+
+    void run();
+    void setupTriangles();
+    void rasterizeRows(int y0, int y1);
+    void buildPyramid();
+    bool isRectOccluded(float minX, float minY, float maxX, float maxY, float nearest) const;
+    unsigned int testRange(unsigned int begin, unsigned int end);
+
+    int                 width, height, stride;
+    unsigned int        threads;
+
+    vector<Occluder>    occluders;
+    vector<Triangle>    triangles;
+    vector<vec4>        clipped;        // occluder vertices this frame
+    vector<signed char> windings;       // per triangle: 1, -1, or 0 if dropped
+    vector< vector<float> > levels;     // [0] is the full size buffer
+    vector<int>         levelWidths, levelHeights;
+
+    // Set by start() for run()
+    mat4                viewProj;
+    const BoundsArray * bounds;
+    unsigned char *     visible;
+    unsigned int        visibleCount;
+
+    std::thread         worker;
+    double              rasterTime, testTime;
+};
+
+}
+
+#endif /* OCCLUSION_HPP_ */
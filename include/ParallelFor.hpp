@@ -0,0 +1,41 @@
+/*
+ * ParallelFor.hpp
+ *
+ * Splits a loop over [0, count) into one contiguous range per thread
+ * and runs them on short-lived threads, the first on the caller. Fine
+ * for a few calls a frame on big ranges; code that already has a
+ * jobs::JobSystem should use its parallelFor() instead.
+ */
+
+#ifndef PARALLEL_FOR_HPP_
+#define PARALLEL_FOR_HPP_
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace util {
+
+// Runs fn(begin, end) on each range and returns once all are done
+template <class Function>
+void
+parallelFor(unsigned int count, unsigned int threads, Function fn)
+{
+    unsigned int chunk = (count + threads - 1) / std::max(1u, threads);
+    if (threads <= 1 || chunk == 0 || chunk >= count) {
+        fn(0u, count);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    for (unsigned int begin = chunk; begin < count; begin += chunk)
+        workers.push_back(std::thread(fn, begin, std::min(begin + chunk, count)));
+
+    fn(0u, chunk);
+    for (unsigned int i = 0; i < workers.size(); i++)
+        workers[i].join();
+}
+
+}
+
+#endif /* PARALLEL_FOR_HPP_ */
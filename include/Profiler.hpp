@@ -0,0 +1,130 @@
+/*
+ * Profiler.hpp
+ *
+ * Frame timing for the demos. CPU scopes are recorded into a lock-free
+ * ring per thread; GPU scopes are bracketed with GL_TIMESTAMP queries
+ * that are read back a few frames later so the pipeline never stalls.
+ * endFrame() folds both into per-scope statistics (min/avg/p99 of the
+ * per-frame totals) and an event list that can be saved as a Chrome
+ * trace (chrome://tracing, Perfetto).
+ *
+ * Everything is a no-op until setEnabled(true). Scope names must be
+ * string literals (or otherwise outlive the profiler); intern() makes
+ * such a copy of a name built at run time.
+ *
+ * Vao draws open a CPU scope each, but only time on the GPU after
+ * setDrawScopes(true): that is two timestamp queries per draw call, so
+ * GPU timing is otherwise left to passes (Fbo, RenderGraph).
+ */
+
+#ifndef PROFILER_HPP_
+#define PROFILER_HPP_
+
+#include <stdio.h>
+
+#include <string>
+
+namespace profile {
+
+// Frames between issuing GPU queries and reading them back
+const int GPU_LATENCY = 4;
+
+struct Stats
+{
+    double       min, avg, p99;    // seconds
+    unsigned int samples;
+};
+
+void    setEnabled(bool enabled);
+bool    isEnabled();
+
+// GPU timing of each draw call, off by default
+void    setDrawScopes(bool enabled);
+bool    getDrawScopes();
+
+// A copy of name that lives as long as the profiler
+const char * intern(const std::string & name);
+
+// Monotonic clock in seconds
+double  now();
+
+// Frame boundaries. Call from the thread that owns the GL context.
+void    beginFrame();
+void    endFrame();
+
+// CPU scopes. beginCpu/endCpu must nest properly on each thread.
+void    beginCpu(const char * name);
+void    endCpu();
+
+// GPU scopes, context thread only
+void    beginGpu(const char * name);
+void    endGpu();
+
+class CpuScope
+{
+public:
+    CpuScope(const char * name) { beginCpu(name); }
+    ~CpuScope() { endCpu(); }
+};
+
+class GpuScope
+{
+public:
+    GpuScope(const char * name) { beginGpu(name); }
+    ~GpuScope() { endGpu(); }
+};
+
+// Both, the GPU scope inside the CPU one
+class CpuGpuScope
+{
+public:
+    CpuGpuScope(const char * name) { beginCpu(name); beginGpu(name); }
+    ~CpuGpuScope() { endGpu(); endCpu(); }
+};
+
+// A CPU scope, timed on the GPU as well if getDrawScopes()
+class DrawScope
+{
+public:
+    DrawScope(const char * name):gpu(getDrawScopes())
+    {
+        beginCpu(name);
+        if (gpu)
+            beginGpu(name);
+    }
+    ~DrawScope()
+    {
+        if (gpu)
+            endGpu();
+        endCpu();
+    }
+
+private:
+    bool gpu;
+};
+
+// Results. "frame" holds the whole frame on either side.
+bool    getCpuStats(const char * name, Stats & stats);
+bool    getGpuStats(const char * name, Stats & stats);
+
+void    printReport(FILE * out = stdout);
+bool    writeChromeTrace(const char * filename);
+
+// Forget all statistics and trace events
+void    reset();
+
+}
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#define PROFILE_SCOPE(name) \
+    profile::CpuScope PROFILE_CONCAT(_profileCpu, __LINE__)(name)
+
+#define PROFILE_GPU_SCOPE(name) \
+    profile::CpuGpuScope PROFILE_CONCAT(_profileGpu, __LINE__)(name)
+
+#define PROFILE_DRAW_SCOPE(name) \
+    profile::DrawScope PROFILE_CONCAT(_profileDraw, __LINE__)(name)
+
+#endif /* PROFILER_HPP_ */
@@ -0,0 +1,207 @@
+/*
+ * RenderGraph.hpp
+ *
+ * Declarative frame pass scheduler. Passes declare which named render
+ * targets they read and write; compile() culls passes whose results are
+ * never consumed, orders the survivors, works out where memory barriers
+ * and framebuffer invalidations are required, and assigns pooled targets
+ * to transient resources. execute() then replays the schedule, timing
+ * each pass on the CPU and GPU under its name (see Profiler.hpp).
+ *
+ * All GL traffic goes through a GraphBackend so the scheduling can be
+ * validated without a context (see test/rendergraph.cpp).
+ */
+
+#ifndef RENDERGRAPH_HPP_
+#define RENDERGRAPH_HPP_
+
+#include <GL/glew.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "fbo.hpp"
+
+using std::string;
+using std::vector;
+
+namespace render {
+
+// Size and attachment count of a render target, matching Fbo::create()
+struct TargetDesc
+{
+    GLuint width, height;
+    GLuint count;
+
+    bool operator==(const TargetDesc & o) const
+    {
+        return width == o.width && height == o.height && count == o.count;
+    }
+};
+
+// The default framebuffer, or any target the graph does not own
+const int DEFAULT_TARGET = -1;
+
+/*
+ * Everything the graph needs from GL. GLBackend below is the real
+ * implementation; tests substitute a recording mock.
+ */
+class GraphBackend
+{
+public:
+    virtual ~GraphBackend() {}
+
+    virtual int     createTarget(const TargetDesc & desc) = 0;
+    virtual void    bindTarget(int target) = 0;
+    virtual void    invalidateTarget(int target, bool color, bool depth) = 0;
+    virtual void    memoryBarrier(GLbitfield barriers) = 0;
+    virtual GLuint  getTexture(int target, GLuint index) = 0;
+};
+
+/*
+ * Backend that allocates Fbo objects and issues the calls directly.
+ * Invalidation is skipped when ARB_invalidate_subdata is missing.
+ */
+class GLBackend : public GraphBackend
+{
+public:
+    virtual ~GLBackend();
+
+    virtual int     createTarget(const TargetDesc & desc);
+    virtual void    bindTarget(int target);
+    virtual void    invalidateTarget(int target, bool color, bool depth);
+    virtual void    memoryBarrier(GLbitfield barriers);
+    virtual GLuint  getTexture(int target, GLuint index);
+
+private:
+    vector<Fbo*> targets;
+};
+
+// How a pass touches a resource
+enum Access {
+    READ_TEXTURE,   // sampled with texture()
+    READ_IMAGE,     // imageLoad()
+    WRITE_TARGET,   // bound as the pass's framebuffer
+    WRITE_IMAGE     // imageStore(), incoherent until a barrier
+};
+
+class RenderGraph;
+
+// Handed to each pass callback so it can find its physical resources
+class PassContext
+{
+public:
+    GLuint getTexture(const string & resource, GLuint index = 0);
+
+private:
+    friend class RenderGraph;
+    PassContext(RenderGraph & graph):graph(graph){}
+    RenderGraph & graph;
+};
+
+typedef std::function<void (PassContext &)> PassCallback;
+
+// One entry of the compiled schedule
+struct ScheduledPass
+{
+    int         pass;           // index into the declared passes
+    int         target;         // physical target bound for the pass
+    GLbitfield  barriers;       // glMemoryBarrier bits issued before the pass
+    bool        discardColor;   // invalidate colour on bind (fresh contents)
+    bool        discardDepth;   // invalidate depth on bind
+    bool        invalidateDepth;// invalidate depth once the pass is done
+    vector<int> retired;        // targets of transient resources last used
+                                // here, colour invalidated once it's done
+};
+
+class RenderGraph
+{
+public:
+    RenderGraph(GraphBackend & backend);
+
+    // Resource declaration. Transient targets come from the pool;
+    // imported ones (e.g. DEFAULT_TARGET) are used as-is and never
+    // invalidated.
+    void    createTarget(const string & name, GLuint width, GLuint height, GLuint count = 1);
+    void    importTarget(const string & name, int target);
+    void    markOutput(const string & name);
+
+    // Pass declaration. Returns the pass index for read()/write().
+    int     addPass(const string & name, PassCallback callback, bool sideEffect = false);
+    void    read(int pass, const string & resource, Access access = READ_TEXTURE);
+    void    write(int pass, const string & resource, Access access = WRITE_TARGET);
+
+    bool    compile();
+    void    execute();
+
+    // Drops passes and resources but keeps the target pool for reuse
+    void    reset();
+
+    const vector<ScheduledPass> & getSchedule() { return schedule; }
+    const string & getPassName(int pass) { return passes[pass].name; }
+    int     getPoolSize() { return (int)pool.size(); }
+    string  log() { return logString; }
+
+private:
+    friend class PassContext;
+
+    struct Use
+    {
+        int     resource;
+        Access  access;
+    };
+
+    struct Resource
+    {
+        string      name;
+        TargetDesc  desc;
+        bool        imported;
+        bool        output;
+        int         target;     // physical target once compiled
+        int         firstUse;   // schedule step
+        int         lastRead;   // schedule step, -1 if never read
+        int         lastUse;
+    };
+
+    struct Pass
+    {
+        string          name;
+        const char *    scope;      // name, interned for the profiler
+        PassCallback    callback;
+        bool            sideEffect;
+        vector<Use>     uses;
+        vector<int>     producers;  // passes whose results we consume
+        vector<int>     after;      // passes we must follow (any hazard)
+        bool            live;
+    };
+
+    struct PoolEntry
+    {
+        TargetDesc  desc;
+        int         target;
+        bool        busy;
+    };
+
+    int     findResource(const string & name);
+    int     renderTargetOf(const Pass & pass);
+    void    buildDependencies();
+    void    cull();
+    bool    order(vector<int> & sorted);
+    void    computeLifetimes(const vector<int> & sorted);
+    void    allocateTargets(const vector<int> & sorted);
+    void    placeBarriers(const vector<int> & sorted);
+    int     acquire(const TargetDesc & desc);
+
+    GraphBackend &      backend;
+    vector<Resource>    resources;
+    vector<Pass>        passes;
+    vector<PoolEntry>   pool;
+    vector<ScheduledPass> schedule;
+    bool                compiled;
+    string              logString;
+};
+
+}
+
+#endif /* RENDERGRAPH_HPP_ */
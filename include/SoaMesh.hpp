@@ -0,0 +1,83 @@
+/*
+ * SoaMesh.hpp
+ *
+ * A TriMesh's corners as structure of arrays: x[], y[], z[] and so on,
+ * one float per corner each, for CPU passes over every vertex. Every
+ * array starts on a 64 byte boundary and is padded to a multiple of 16
+ * floats with copies of its last element, so the SSE and AVX loops run
+ * whole aligned registers to the end with no remainder, and the padding
+ * never changes a min or max.
+ *
+ * Anything writing the arrays directly should call repad() afterwards.
+ * The methods here keep the padding right themselves.
+ */
+
+#ifndef SOAMESH_HPP_
+#define SOAMESH_HPP_
+
+#include "glm/glm.hpp"
+#include "Culling.hpp"
+#include "TriMesh.hpp"
+
+using glm::mat4;
+
+namespace mesh {
+
+class SoaMesh
+{
+public:
+    static const unsigned int ALIGNMENT = 64;   // bytes
+    static const unsigned int PADDING = 16;     // floats
+
+    SoaMesh();
+    explicit SoaMesh(const TriMesh & m);
+    SoaMesh(const SoaMesh & other);
+    SoaMesh & operator=(const SoaMesh & other);
+    ~SoaMesh();
+
+    // Room for count corners, positions only. Contents are undefined.
+    void resize(unsigned int count);
+
+    // Allocate, or free, the optional arrays
+    void setNormals(bool present);
+    void setUvs(bool present);
+
+    void repad();
+
+    unsigned int size() const { return _count; }
+    unsigned int paddedSize() const { return _padded; }
+    bool hasNormals() const { return nx != NULL; }
+    bool hasUvs() const { return u != NULL; }
+
+    TriMesh toTriMesh() const;
+
+    // Interleaved for a vertex buffer: position, then normal and uv if
+    // there are any, every stride floats (0 = packed)
+    unsigned int interleavedFloats() const { return 3 + (hasNormals() ? 3 : 0) + (hasUvs() ? 2 : 0); }
+    void interleave(float * out, unsigned int stride = 0) const;
+
+    // Same as TriMesh's
+    void computeBounds(cull::Isa isa = cull::BEST);
+    void normalize(float radius = 1.0f, cull::Isa isa = cull::BEST);
+
+    // Positions by m's affine part, normals by the inverse transpose of
+    // its upper 3x3, renormalized (zero ones stay zero)
+    void transform(const mat4 & m, cull::Isa isa = cull::BEST);
+
+    float * x, * y, * z;
+    float * nx, * ny, * nz;     // NULL without normals
+    float * u, * v;             // NULL without uvs
+
+    Aabb bounds;
+
+protected:
+    float * allocate();
+    void release(float * & array);
+    void pad(float * array);
+
+    unsigned int _count, _padded;
+};
+
+}
+
+#endif /* SOAMESH_HPP_ */
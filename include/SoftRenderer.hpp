@@ -0,0 +1,133 @@
+/*
+ * SoftRenderer.hpp
+ *
+ * CPU rasterizer for machines without a GPU and for reference images.
+ * It takes a TriMesh and a Shader (a C++ stand-in for a GLSL program,
+ * see SoftShaders.hpp) and draws into a Framebuffer the way GL would:
+ * clip space in, near plane clipping, [0,1] depth with GL_LESS,
+ * counter-clockwise front faces, rows stored bottom first.
+ *
+ * draw() runs in three steps:
+ *
+ *   1. vertices are shaded in parallel chunks
+ *   2. triangles are clipped, set up and binned into 64x64 tiles,
+ *      keeping submission order within each tile
+ *   3. worker threads take whole tiles and rasterize their bins with
+ *      edge functions, four pixels at a time with SSE. Every 8x8 block
+ *      keeps its farthest depth, so triangles entirely behind a block
+ *      skip it without touching the depth buffer.
+ *
+ * Each pixel is only ever written by one thread, in submission order,
+ * so the output does not depend on the thread count.
+ */
+
+#ifndef SOFT_RENDERER_HPP_
+#define SOFT_RENDERER_HPP_
+
+#include <stdint.h>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "TriMesh.hpp"
+
+using std::vector;
+using glm::vec4;
+
+namespace soft {
+
+// Floats a shader can pass from vertex() to fragment()
+const int MAX_VARYINGS = 16;
+
+const int TILE_SIZE = 64;
+const int BLOCK_SIZE = 8;
+
+class Shader
+{
+public:
+    virtual ~Shader() {}
+
+    virtual int getVaryingCount() const = 0;
+
+    // Returns the clip space position of mesh vertex i (gl_Position)
+    // and writes its outputs to varyings
+    virtual vec4 vertex(const mesh::TriMesh & mesh, unsigned int i, float * varyings) const = 0;
+
+    // Perspective correct interpolated varyings in, RGBA out
+    virtual vec4 fragment(const float * varyings) const = 0;
+};
+
+class Framebuffer
+{
+public:
+    Framebuffer();
+
+    void create(int width, int height);
+    void clear(const vec4 & color = vec4(0.0f), float depth = 1.0f);
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+
+    // RGBA8, bottom row first like glReadPixels
+    const uint8_t * getColor() const { return &color.front(); }
+    const float * getDepth() const { return &depth.front(); }
+    uint32_t getPixel(int x, int y) const;
+
+    // Through DevIL; the format follows the extension
+    bool save(const char * fileName) const;
+
+protected:
+    friend class Renderer;
+
+    void updateBlockDepth(int bx, int by);
+
+    int     width, height;
+    int     blocksX, blocksY;
+
+    vector<uint8_t> color;
+    vector<float>   depth;
+    vector<float>   blockMax;   // farthest depth in each 8x8 block
+};
+
+class Renderer
+{
+public:
+    // threads: 0 = one per hardware thread
+    Renderer(unsigned int threads = 0);
+
+    void draw(Framebuffer & target, const mesh::TriMesh & mesh, const Shader & shader);
+
+    // glEnable/glDisable(GL_CULL_FACE), back faces only. Off by default.
+    void setCullFace(bool enabled) { cullBack = enabled; }
+
+    unsigned int getThreadCount() const { return threads; }
+
+    // Setup triangle, after clipping
+    struct Triangle
+    {
+        float   a[3], b[3], c[3];   // edge i: a x + b y + c, opposite vertex i
+        bool    topLeft[3];
+        float   invArea;
+        float   z[3], invW[3];
+        float   zmin;
+        int     minX, minY, maxX, maxY;
+        float   varyings[3][MAX_VARYINGS];
+    };
+
+protected:
+    void shadeVertices(const mesh::TriMesh & mesh, const Shader & shader);
+    void setupTriangles(int width, int height, int varyingCount);
+    void rasterizeTile(Framebuffer & target, int tile, const Shader & shader);
+
+    unsigned int        threads;
+    bool                cullBack;
+    int                 tilesX, tilesY;
+
+    vector<vec4>        clipPos;
+    vector<float>       vertexVaryings;
+    vector<Triangle>    triangles;
+    vector< vector<unsigned int> > bins;
+};
+
+}
+
+#endif /* SOFT_RENDERER_HPP_ */
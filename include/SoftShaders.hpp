@@ -0,0 +1,76 @@
+/*
+ * SoftShaders.hpp
+ *
+ * C++ versions of the GLSL programs in shaders/, for the SoftRenderer.
+ * They follow the GLSL line by line (quirks included) so CPU and GPU
+ * renders of the same scene can be compared pixel by pixel. The public
+ * members are the uniforms and have the same names.
+ */
+
+#ifndef SOFT_SHADERS_HPP_
+#define SOFT_SHADERS_HPP_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "SoftRenderer.hpp"
+
+using std::string;
+using std::vector;
+using glm::mat3;
+using glm::mat4;
+using glm::vec3;
+using glm::vec4;
+
+namespace soft {
+
+// samplerCube with GL_LINEAR filtering and GL_CLAMP_TO_EDGE
+class Cubemap
+{
+public:
+    // Same files and layout as util::image::loadCubemap
+    bool load(const string & filebase);
+
+    vec4 sample(const vec3 & dir) const;
+
+protected:
+    vec4 texel(int face, int x, int y) const;
+
+    int             size[6][2];
+    vector<uint8_t> faces[6];   // RGB, rows as handed to glTexImage2D
+};
+
+// shaders/basicshade.vert + basicshade.frag
+class BasicShadeShader : public Shader
+{
+public:
+    virtual int getVaryingCount() const { return 3; }
+    virtual vec4 vertex(const mesh::TriMesh & mesh, unsigned int i, float * varyings) const;
+    virtual vec4 fragment(const float * varyings) const;
+
+    mat4    MVP;
+    mat3    NormalMatrix;
+};
+
+// shaders/env.vert + env.frag
+class EnvShader : public Shader
+{
+public:
+    EnvShader():Tex1(NULL) {}
+
+    virtual int getVaryingCount() const { return 9; }
+    virtual vec4 vertex(const mesh::TriMesh & mesh, unsigned int i, float * varyings) const;
+    virtual vec4 fragment(const float * varyings) const;
+
+    mat4            MVP;
+    mat4            ModelMatrix;
+    mat3            NormalMatrix;
+    vec3            WorldCameraPosition;
+    const Cubemap * Tex1;
+};
+
+}
+
+#endif /* SOFT_SHADERS_HPP_ */
@@ -0,0 +1,91 @@
+/*
+ * Stats.hpp
+ *
+ * Per-frame GL call statistics: draws, binds, uniform updates and the
+ * bytes handed to glBufferData/glTexImage2D. The wrappers (Vao, Fbo,
+ * GLSLProgram, CompressedTriMesh, util::image) report through
+ * STATS_COUNT, which only exists when built with GL_STATS
+ * (`scons stats=1`); otherwise it expands to nothing and the counters
+ * below stay at zero.
+ *
+ * Context::swapBuffers() closes each frame. Pass --stats to a demo to
+ * get the totals in the window title (or on stdout when headless).
+ */
+
+#ifndef STATS_HPP_
+#define STATS_HPP_
+
+#include <stdio.h>
+#include <string>
+
+using std::string;
+
+namespace stats {
+
+enum Counter
+{
+    DRAW_CALLS,
+    VERTICES,               // vertices submitted, times instances
+    PROGRAM_BINDS,
+    VERTEX_ARRAY_BINDS,
+    BUFFER_BINDS,
+    FRAMEBUFFER_BINDS,
+    TEXTURE_BINDS,
+    UNIFORM_UPDATES,
+    BUFFER_UPLOADS,
+    BUFFER_BYTES,
+    TEXTURE_UPLOADS,
+    TEXTURE_BYTES,
+    COUNTER_COUNT
+};
+
+struct Frame
+{
+    Frame();
+
+    unsigned long operator[](Counter c) const { return counts[c]; }
+
+    // Every bind, including the resets to 0 the wrappers do
+    unsigned long stateChanges() const;
+
+    unsigned long counts[COUNTER_COUNT];
+};
+
+#ifdef GL_STATS
+const bool ENABLED = true;
+#else
+const bool ENABLED = false;
+#endif
+
+// Counts for the frame in progress. Context thread only.
+extern Frame current;
+
+inline void
+count(Counter counter, unsigned long n = 1)
+{
+    current.counts[counter] += n;
+}
+
+// Folds the current frame into the totals and starts a new one
+void            endFrame();
+
+const Frame &   getLastFrame();
+const Frame &   getTotals();
+unsigned int    getFrameCount();
+void            reset();
+
+const char *    getName(Counter counter);
+
+// "draws 12 (3.4k verts) | state 40 | uniforms 25 | upload 1.2 MB buf, 0 B tex"
+string          format(const Frame & frame);
+void            print(const Frame & frame, FILE * out = stdout);
+
+}
+
+#ifdef GL_STATS
+    #define STATS_COUNT(counter, n) stats::count(stats::counter, (n))
+#else
+    #define STATS_COUNT(counter, n) ((void)0)
+#endif
+
+#endif /* STATS_HPP_ */
@@ -0,0 +1,161 @@
+/*
+ * TextureArrays.hpp
+ *
+ * Materials as layers of GL_TEXTURE_2D_ARRAYs instead of one
+ * GL_TEXTURE_2D each, so changing material stops being a bind. Images
+ * of the same size share an array; each gets a TextureRef (array and
+ * layer) that a draw passes to its shader, packed into one uint.
+ *
+ * With ARB_bindless_texture each array's handle is made resident and
+ * written to a uniform buffer, so a single draw, instanced or not, can
+ * sample any material:
+ *
+ *   #extension GL_ARB_bindless_texture : require
+ *   layout(std140) uniform TextureHandles { uvec4 handles[256]; };
+ *   ...
+ *   sampler2DArray s = sampler2DArray(handles[ref >> 16].xy);
+ *   texture(s, vec3(uv, ref & 0xffff));
+ *
+ * Without it bindArrays() puts the arrays on consecutive texture units
+ * and the shader indexes a sampler2DArray array with the ref's array;
+ * the index must be the same for the whole draw (a uniform), so it
+ * takes a draw per array instead of one in all.
+ *
+ * The layer bookkeeping is LayerAllocator, which touches no GL and is
+ * tested on its own (test/texarraycheck.cpp).
+ */
+
+#ifndef TEXTUREARRAYS_HPP_
+#define TEXTUREARRAYS_HPP_
+
+#include <GL/glew.h>
+
+#include <stddef.h>
+#include <vector>
+
+using std::vector;
+
+namespace render {
+
+struct TextureRef
+{
+    unsigned int array;
+    unsigned int layer;
+
+    // What the shader gets: array in the high 16 bits, layer in the low
+    unsigned int packed() const { return array << 16 | layer; }
+    static TextureRef unpack(unsigned int packed)
+    {
+        TextureRef ref = { packed >> 16, packed & 0xffff };
+        return ref;
+    }
+
+    bool operator==(const TextureRef & o) const { return array == o.array && layer == o.layer; }
+};
+
+/*
+ * Which array and layer each image goes in. An image takes a free
+ * layer in an array of its size, a freed one first, and a new array is
+ * only started once all of those are full.
+ *
+ * Arrays are sized to what is in them: an array's capacity starts at
+ * one layer and doubles, up to layersPerArray, whenever an image needs
+ * a layer past it.
+ */
+class LayerAllocator
+{
+public:
+    explicit LayerAllocator(unsigned int layersPerArray = 64);
+
+    // created is set when the image needs an array that doesn't exist
+    // yet, which has index ref.array
+    TextureRef  allocate(GLsizei width, GLsizei height, bool * created = NULL);
+    void        free(TextureRef ref);
+
+    unsigned int getArrayCount() const { return arrays.size(); }
+    unsigned int getLayersPerArray() const { return layersPerArray; }
+    GLsizei     getWidth(unsigned int array) const { return arrays[array].width; }
+    GLsizei     getHeight(unsigned int array) const { return arrays[array].height; }
+    unsigned int getUsedLayers(unsigned int array) const;
+    unsigned int getCapacity(unsigned int array) const { return arrays[array].capacity; }
+
+    void        clear() { arrays.clear(); }
+
+protected:
+    struct Array
+    {
+        GLsizei width, height;
+        vector<unsigned char> used;     // per layer
+        unsigned int live;
+        unsigned int capacity;          // layers with storage
+    };
+
+    unsigned int    layersPerArray;
+    vector<Array>   arrays;
+};
+
+/*
+ * The arrays themselves: RGBA8, mipmapped, linear filtering and
+ * repeat. Create and use on the GL thread.
+ *
+ * Storage follows the allocator's capacity. Growing an array makes a
+ * bigger one, copies the layers over and deletes the old one, so
+ * getTexture() and the array's bindless handle change; update() writes
+ * the new handle before the next draw.
+ */
+class TextureArrays
+{
+public:
+    // The most arrays the handle buffer holds
+    static const unsigned int MAX_ARRAYS = 256;
+
+    // bindless false keeps to the fallback even where the extension is
+    explicit TextureArrays(unsigned int layersPerArray = 64, bool bindless = true);
+    ~TextureArrays();
+
+    // width * height RGBA pixels, bottom row first
+    TextureRef  add(GLsizei width, GLsizei height, const GLubyte * pixels);
+
+    // An image file, through DevIL, like util::image::loadImage().
+    // False if it can't be read.
+    bool        load(const char * fileName, TextureRef * ref);
+
+    // The layer is free for the next image of its size
+    void        remove(TextureRef ref);
+
+    // Mipmaps for the arrays added to since, and the handles for new
+    // ones. Call before drawing.
+    void        update();
+
+    // Binds the handle buffer to binding (bindless), or each array to
+    // firstUnit + its index, up to maxUnits of them. Returns how many
+    // arrays can be drawn from.
+    unsigned int bindArrays(GLuint binding, GLuint firstUnit = 0, GLuint maxUnits = 16);
+
+    bool        isBindless() const { return bindless; }
+    unsigned int getArrayCount() const { return textures.size(); }
+    GLuint      getTexture(unsigned int array) const { return textures[array]; }
+    GLuint      getHandleBuffer() const { return handleBuffer; }
+    const LayerAllocator & getAllocator() const { return allocator; }
+
+protected:
+    TextureArrays(const TextureArrays &);
+    TextureArrays & operator=(const TextureArrays &);
+
+    GLuint      createArray(GLsizei width, GLsizei height, GLsizei layers);
+    void        grow(unsigned int array);
+
+    LayerAllocator  allocator;
+    bool            bindless;
+    vector<GLuint>  textures;
+    vector<GLsizei> layers;         // per array, in its storage
+    vector<GLuint64> handles;
+    vector<unsigned char> dirty;    // per array, needs mipmaps
+    GLuint          handleBuffer;
+    bool            handlesChanged;
+    bool            warned;         // about arrays past MAX_ARRAYS
+};
+
+}
+
+#endif /* TEXTUREARRAYS_HPP_ */
@@ -1,6 +1,7 @@
 #ifndef TRIMESH_H
 #define TRIMESH_H
 
+#include <string>
 #include <vector>
 
 #include "glm/glm.hpp"
@@ -8,6 +9,7 @@
 #include <GL/glew.h>
 #include "GL/glfw.h"
 
+using std::string;
 using std::vector;
 
 using glm::vec4;
@@ -32,15 +34,89 @@ namespace mesh {
         float u, v;
     };
 
+    // Axis aligned box. Empty until something is added to it.
+    class Aabb
+    {
+    public:
+        Aabb():min(1e30f), max(-1e30f){}
+        Aabb(vec3 const & min, vec3 const & max):min(min), max(max){}
+
+        void add(vec3 const & p) { min = glm::min(min, p); max = glm::max(max, p); }
+        void add(Aabb const & b) { if (!b.empty()) { add(b.min); add(b.max); } }
+        bool empty() const { return min.x > max.x; }
+
+        vec3 center() const { return (min + max) * 0.5f; }
+        vec3 extent() const { return (max - min) * 0.5f; }
+
+        vec3 min, max;
+    };
+
+    // A run of corners (three per triangle) that came from one object
+    // and group of an .obj and share a material
+    class SubMesh
+    {
+    public:
+        SubMesh():material(-1), first(0), count(0){}
+
+        string object;          // from "o"
+        string group;           // from "g", names separated by spaces
+        int material;           // index into TriMesh::materials, -1 if none
+        unsigned int first, count;
+    };
+
     class TriMesh {
     public:
         void normalize(float radius = 1.0f);
+
+        // Rescans the vertices; call after editing them by hand
+        void computeBounds();
+
+        // Moves uvs of corners [first, first + count) from the unit
+        // square onto [min, max], for an image that has been moved into
+        // part of a bigger one (an atlas). Tiling can't survive that:
+        // uvs outside [0, 1] are clamped first. count 0 means to the end.
+        void remapUvs(vec2 const & min, vec2 const & max, unsigned int first = 0, unsigned int count = 0);
+
         vector<vec3> vertices;
         vector<vec3> normals;
         vector<vec2> uvs;
+
+        // Optional, from computeTangents(): xyz points along +u, w is
+        // the sign of the bitangent, cross(normal, xyz) * w
+        vector<vec4> tangents;
+
+        // From loadObj(): the submeshes cover every corner in order. Empty
+        // for meshes made any other way, meaning one range over everything.
+        vector<SubMesh> submeshes;
+        vector<string> materials;           // "usemtl" names
+        vector<string> materialLibraries;   // "mtllib" files, not loaded
+
+        // Object space bounds, kept current by normalize()
+        Aabb bounds;
     private:
     };
 
+    // The same triangles with shared vertices: corners with the same
+    // position, normal and uv become one vertex, and every three
+    // indices make a triangle
+    class IndexedMesh {
+    public:
+        IndexedMesh(){}
+        IndexedMesh(TriMesh const & mesh);
+
+        // Back to one vertex per corner
+        TriMesh expand() const;
+
+        unsigned int triangleCount() const { return indices.size() / 3; }
+
+        vector<vec3> vertices;
+        vector<vec3> normals;
+        vector<vec2> uvs;
+        vector<unsigned int> indices;
+
+        Aabb bounds;
+    };
+
     class CompressedTriMesh {
     public:
         CompressedTriMesh(TriMesh const & mesh, GLint renderType);
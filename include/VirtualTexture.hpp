@@ -0,0 +1,360 @@
+/*
+ * VirtualTexture.hpp
+ *
+ * Images far too big to load whole (32k x 32k terrain, scans) sampled
+ * through a small cache of their tiles. writeTileFile() cuts an image
+ * and its mip levels into square tiles, each with a border of
+ * neighbouring texels so bilinear filtering stays inside it, and
+ * TileFile maps the result read-only.
+ *
+ * Every frame the scene is drawn once more into a small Fbo with
+ * shaders/vtfeedback.frag, which writes the tile (level, x, y) each
+ * pixel would sample. The tiles seen are looked up in a TileCache, an
+ * LRU of the slots in one physical texture; the ones missing are copied
+ * out of the mapping on job threads, coarsest first, and uploaded on
+ * the GL thread a few per frame. The PageTable says, for every tile of
+ * every level, which slot to read instead: the tile itself or its
+ * nearest resident ancestor, so a missing tile shows blurred rather
+ * than not at all. shaders/vt.frag reads it from the indirection
+ * texture, one layer per level, and then samples the physical one.
+ *
+ * The coarsest level is one tile, loaded up front and never evicted.
+ *
+ * TileFile, TileCache, PageTable and Streamer touch no GL and are
+ * tested on their own (test/vtcheck.cpp); VirtualTexture puts them on
+ * textures and does the feedback pass.
+ */
+
+#ifndef VIRTUALTEXTURE_HPP_
+#define VIRTUALTEXTURE_HPP_
+
+#include <GL/glew.h>
+
+#include <stddef.h>
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "GLSLProgram.hpp"
+#include "Jobs.hpp"
+#include "fbo.hpp"
+
+using std::string;
+using std::vector;
+
+namespace vt {
+
+struct TileId
+{
+    unsigned int level;
+    unsigned int x, y;
+
+    // Level in the high 8 bits, then y and x in 12 each
+    unsigned int packed() const { return level << 24 | y << 12 | x; }
+    static TileId unpack(unsigned int packed)
+    {
+        TileId tile = { packed >> 24, packed & 0xfff, (packed >> 12) & 0xfff };
+        return tile;
+    }
+
+    bool operator==(const TileId & o) const { return level == o.level && x == o.x && y == o.y; }
+};
+
+// No tile; an evicted key when nothing was evicted
+const unsigned int NO_TILE = 0xffffffff;
+
+// The tiles of an image: level l is max(1, width >> l) by
+// max(1, height >> l) texels, cut into tileSize squares (the last row
+// and column running over the edge), down to the level that fits in
+// one. A tile is stored paddedSize() texels square.
+struct Layout
+{
+    Layout():width(0), height(0), tileSize(0), border(0), levels(0){}
+    Layout(GLsizei width, GLsizei height, GLsizei tileSize, GLsizei border);
+
+    GLsizei levelWidth(unsigned int level) const { return std::max(width >> level, 1); }
+    GLsizei levelHeight(unsigned int level) const { return std::max(height >> level, 1); }
+    unsigned int tilesX(unsigned int level) const { return (levelWidth(level) + tileSize - 1) / tileSize; }
+    unsigned int tilesY(unsigned int level) const { return (levelHeight(level) + tileSize - 1) / tileSize; }
+    GLsizei paddedSize() const { return tileSize + 2 * border; }
+
+    // The tile one level up covering this one; the coarsest has none
+    TileId parent(const TileId & tile) const;
+
+    GLsizei         width, height;
+    GLsizei         tileSize, border;
+    unsigned int    levels;
+};
+
+// Copies the level 0 texels [x, x + width) x [y, y + height), all inside
+// the image, into out as RGBA rows of width * 4 bytes, bottom row first.
+// Called from several threads at once.
+typedef std::function<void(GLsizei x, GLsizei y, GLsizei width, GLsizei height, GLubyte * out)> Source;
+
+// Tiles an image into fileName, reading it a tile at a time, so it
+// never has to be in memory whole. Each level is box filtered from the
+// one below as it was written, its tiles spread over jobs' threads if
+// given. Tiles go to 4 KB boundaries. False if the file can't be made,
+// or the image needs more than 4096 tiles a side.
+bool writeTileFile(const string & fileName, GLsizei width, GLsizei height, const Source & source,
+                   GLsizei tileSize = 128, GLsizei border = 4, jobs::JobSystem * jobs = NULL);
+
+// A file from writeTileFile(), mapped read-only
+class TileFile
+{
+public:
+    TileFile();
+    ~TileFile();
+
+    bool    open(const string & fileName);
+    void    close();
+
+    const Layout &  getLayout() const { return layout; }
+
+    // paddedSize() squared RGBA texels, straight from the mapping: the
+    // first read of a tile may wait for the disk
+    const GLubyte * getTile(const TileId & tile) const;
+    size_t          getTileBytes() const;
+
+protected:
+    TileFile(const TileFile &);
+    TileFile & operator=(const TileFile &);
+
+    char *          _data;
+    size_t          _size;
+    Layout          layout;
+    const unsigned int * _firstTile;    // per level
+};
+
+/*
+ * Which tile each slot of the physical texture holds, least recently
+ * used first out. A slot used this frame is never given away, so a view
+ * that needs more tiles than there are slots doesn't evict what it is
+ * drawing; pinned slots never are.
+ */
+class TileCache
+{
+public:
+    explicit TileCache(unsigned int slots);
+
+    // The slot holding key, -1 if none
+    int     find(unsigned int key) const;
+
+    // Makes a slot the most recently used, as of frame
+    void    touch(int slot, unsigned int frame);
+
+    // A slot for key, touched: a free one, or the least recently used
+    // one not touched this frame, whose key goes in evicted (NO_TILE if
+    // the slot was free). -1 if every slot was used this frame.
+    int     insert(unsigned int key, unsigned int frame, unsigned int * evicted, bool pinned = false);
+
+    void    remove(unsigned int key);
+
+    // Whether insert() would find a slot this frame
+    bool    hasRoom(unsigned int frame) const { return !free.empty() || (tail >= 0 && slots[tail].frame != frame); }
+
+    unsigned int getSlotCount() const { return slots.size(); }
+    unsigned int getUsedSlots() const { return byKey.size(); }
+    unsigned int getKey(int slot) const { return slots[slot].key; }
+    unsigned int getFrame(int slot) const { return slots[slot].frame; }
+    bool         isPinned(int slot) const { return slots[slot].pinned; }
+
+protected:
+    struct Slot
+    {
+        unsigned int key;
+        unsigned int frame;
+        int prev, next;         // towards the most and least recently used
+        bool pinned;            // and then out of the list
+    };
+
+    void    unlink(int slot);
+    void    pushFront(int slot);
+
+    vector<Slot>    slots;
+    int             head, tail;     // most and least recently used
+    vector<int>     free;
+    std::unordered_map<unsigned int, int> byKey;
+};
+
+/*
+ * For every tile of every level, the slot to sample and the level it
+ * holds: the tile's own, or its nearest resident ancestor's. The
+ * entries changed since clearDirty() are kept as a rectangle per
+ * level, for uploading.
+ */
+class PageTable
+{
+public:
+    struct Mapping
+    {
+        int             slot;       // -1 when nothing above is resident
+        unsigned int    level;
+    };
+
+    explicit PageTable(const Layout & layout);
+
+    void    map(const TileId & tile, int slot);
+    void    unmap(const TileId & tile);
+
+    const Mapping & lookup(const TileId & tile) const
+    {
+        return mappings[tile.level][tile.y * layout.tilesX(tile.level) + tile.x];
+    }
+    bool    isResident(const TileId & tile) const { return lookup(tile).level == tile.level && lookup(tile).slot >= 0; }
+
+    // Entries [x0, x1) x [y0, y1) of level changed; false if none
+    bool    getDirty(unsigned int level, unsigned int * x0, unsigned int * y0, unsigned int * x1, unsigned int * y1) const;
+    void    clearDirty();
+
+    const Layout & getLayout() const { return layout; }
+
+protected:
+    struct Rect
+    {
+        unsigned int x0, y0, x1, y1;
+    };
+
+    void    refresh(const TileId & tile);
+
+    Layout                      layout;
+    vector<vector<int> >        resident;   // slot per tile, -1 if none
+    vector<vector<Mapping> >    mappings;
+    vector<Rect>                dirty;
+};
+
+// Totals since the streamer was made
+struct StreamStats
+{
+    unsigned int requested;     // distinct tiles in the feedback
+    unsigned int resident;      // of those, already in a slot
+    unsigned int loads;         // copies started
+    unsigned int uploads;       // tiles put in slots
+    unsigned int evictions;
+    unsigned int dropped;       // loaded but no slot was free this frame
+};
+
+// A loaded tile for the GL thread to put in its slot
+struct Upload
+{
+    TileId          tile;
+    int             slot;
+    vector<GLubyte> pixels;
+};
+
+/*
+ * The cache, the page table and the loads, without GL. Each frame:
+ * beginFrame(), request() with the feedback, then update() and upload
+ * what it returns.
+ */
+class Streamer
+{
+public:
+    // slots in the physical texture, at least 2. With jobs, tiles are
+    // copied on its threads, at most maxLoads at a time; without (or if
+    // it has no threads but this one), in request().
+    Streamer(const TileFile & file, unsigned int slots, jobs::JobSystem * jobs = NULL, unsigned int maxLoads = 16);
+
+    // Waits for the copies in flight
+    ~Streamer();
+
+    void    beginFrame();
+
+    // Feedback pixels from shaders/vtfeedback.frag, RGBA8. Resident tiles
+    // are kept, missing ones are queued, coarsest and most seen first,
+    // unless every slot is already in use this frame.
+    void    request(const GLubyte * feedback, unsigned int pixels);
+
+    // Up to maxUploads loaded tiles, given their slots in the cache and
+    // page table
+    void    update(unsigned int maxUploads, vector<Upload> & uploads);
+
+    const TileCache &   getCache() const { return cache; }
+    const PageTable &   getPageTable() const { return pageTable; }
+    PageTable &         getPageTable() { return pageTable; }
+    unsigned int        getFrame() const { return frame; }
+    unsigned int        getLoadsInFlight() const { return pending.size(); }
+    const StreamStats & getStats() const { return stats; }
+
+protected:
+    Streamer(const Streamer &);
+    Streamer & operator=(const Streamer &);
+
+    void    load(unsigned int key);
+
+    const TileFile &    file;
+    TileCache           cache;
+    PageTable           pageTable;
+    jobs::JobSystem *   jobs;
+    unsigned int        maxLoads;
+    unsigned int        frame;
+    StreamStats         stats;
+
+    std::unordered_set<unsigned int> pending;   // loading or loaded, not uploaded
+    std::mutex          loadedLock;
+    vector<Upload>      loaded;
+    jobs::Counter       loading;
+};
+
+// What shaders/vtfeedback.frag writes for a tile; level 255 is nothing
+void encodeFeedback(const TileId & tile, GLubyte * out);
+bool decodeFeedback(const GLubyte * in, unsigned int levels, TileId * tile);
+
+/*
+ * The textures and the feedback pass. Create and use on the GL thread.
+ */
+class VirtualTexture
+{
+public:
+    VirtualTexture();
+    ~VirtualTexture();
+
+    // The physical texture gets room for slots tiles (fewer if the GL
+    // can't make it that big); feedback is drawn at feedbackWidth x
+    // feedbackHeight, a fraction of the screen
+    bool    create(const string & fileName, unsigned int slots, GLsizei feedbackWidth, GLsizei feedbackHeight,
+                   jobs::JobSystem * jobs = NULL);
+
+    // Around drawing the scene with shaders/vtfeedback.frag. The pixels
+    // are read back through a buffer and requested a frame later, so
+    // the readback doesn't stall.
+    void    beginFeedback();
+    void    endFeedback();
+
+    // Uploads up to maxUploads tiles and the page table entries changed
+    void    update(unsigned int maxUploads = 8);
+
+    // Binds the textures and sets the uniforms both shaders use.
+    // screenWidth is what the scene is drawn at, for the feedback's lod.
+    void    setUniforms(shader::GLSLProgram & program, GLuint physicalUnit, GLuint indirectionUnit,
+                        GLsizei screenWidth);
+
+    GLuint  getPhysicalTexture() const { return physical; }
+    GLuint  getIndirectionTexture() const { return indirection; }
+    const Streamer * getStreamer() const { return streamer; }
+
+protected:
+    VirtualTexture(const VirtualTexture &);
+    VirtualTexture & operator=(const VirtualTexture &);
+
+    void    destroy();
+
+    TileFile        file;
+    Streamer *      streamer;
+    GLuint          physical, indirection;
+    unsigned int    slotsPerRow;
+    Fbo             feedback;
+    GLsizei         feedbackWidth, feedbackHeight;
+    GLuint          readback[2];    // pixel pack buffers, alternate frames
+    unsigned int    readbackFrame;  // feedback passes so far
+    vector<Upload>  uploads;
+    vector<GLubyte> entries;
+};
+
+}
+
+#endif /* VIRTUALTEXTURE_HPP_ */
@@ -18,6 +18,16 @@ public:
   GLuint  getTextureCount() { return texture_count; }
   GLuint* getTextureHandles() { return texture_handles; }
 
+  // Profiler scope for everything between enable() and disable(); a
+  // string literal, or profile::intern()ed. Unnamed FBOs aren't timed.
+  void        setName(const char * name) { this->name = name; }
+  const char* getName() { return name; }
+
+  // Framebuffer that disable() returns to. This is the window (0) unless
+  // a headless context substitutes an offscreen target for it.
+  static void   setDefaultFramebuffer(GLuint handle) { default_handle = handle; }
+  static GLuint getDefaultFramebuffer() { return default_handle; }
+
 protected:
   bool initializeFBO(bool useDepthBuffer = true );
   bool generateTexture(GLuint width, GLuint height, GLuint *handle);
@@ -28,6 +38,10 @@ protected:
   bool    enabled;            // Whether or not the FBO is enabled
   GLuint  texture_count;	  // Amount of textures attached to the FBO
   GLuint* texture_handles;	  // Texture handles for each texture
+  const char* name;           // Profiler scope name, or NULL
+  bool    timed;              // Whether enable() opened a scope
+
+  static GLuint default_handle; // Framebuffer bound when no FBO is enabled
 };
 
 
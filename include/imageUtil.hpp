@@ -3,18 +3,26 @@
 #include <IL/ilu.h>
 #include <IL/ilut.h>
 
+#include <GL/glew.h>
+
 #include <iostream>
+#include <string>
+#include <vector>
+
+#include "Stats.hpp"
 
 #ifndef IMAGE_UTIL_HPP__
 #define IMAGE_UTIL_HPP__
 
+using std::string;
+
 namespace util {
 namespace image {
 
 	// Referenced from http://r3dux.org/2010/11/single-call-opengl-texture-loader-in-devil/
 
 	// Function load a image, turn it into a texture, and return the texture ID as a GLuint for use
-	GLuint loadImage(const char* theFileName)
+	inline GLuint loadImage(const char* theFileName)
 	{
 		ILuint imageID;				// Create an image ID as a ULuint
 
@@ -78,6 +86,11 @@ namespace image {
 						 ilGetInteger(IL_IMAGE_FORMAT),	// Image format (i.e. RGB, RGBA, BGR etc.)
 						 GL_UNSIGNED_BYTE,		// Image data type
 						 ilGetData());			// The actual image data itself
+
+			STATS_COUNT(TEXTURE_BINDS, 1);
+			STATS_COUNT(TEXTURE_UPLOADS, 1);
+			STATS_COUNT(TEXTURE_BYTES, ilGetInteger(IL_IMAGE_WIDTH) * ilGetInteger(IL_IMAGE_HEIGHT) *
+			                           ilGetInteger(IL_IMAGE_BYTES_PER_PIXEL));
 		}
 		else // If we failed to open the image file in the first place...
 		{
@@ -94,7 +107,46 @@ namespace image {
 	}
 
 
-	GLuint
+	// Load an image as tightly packed RGBA pixels, bottom row first, for
+	// callers that make their own textures. False if it can't be read.
+	inline bool
+	loadPixels(const char* fileName, GLsizei* width, GLsizei* height, std::vector<GLubyte>& pixels)
+	{
+	    ILuint imageID;
+	    ilGenImages(1, &imageID);
+	    ilBindImage(imageID);
+
+	    bool success = ilLoadImage(fileName);
+	    if (success)
+	    {
+	        ILinfo ImageInfo;
+	        iluGetImageInfo(&ImageInfo);
+	        if (ImageInfo.Origin == IL_ORIGIN_UPPER_LEFT)
+	        {
+	            iluFlipImage();
+	        }
+	        success = ilConvertImage(IL_RGBA, IL_UNSIGNED_BYTE);
+	    }
+
+	    if (success)
+	    {
+	        *width = ilGetInteger(IL_IMAGE_WIDTH);
+	        *height = ilGetInteger(IL_IMAGE_HEIGHT);
+	        const GLubyte* data = ilGetData();
+	        pixels.assign(data, data + *width * *height * 4);
+	    }
+	    else
+	    {
+	        ILenum error = ilGetError();
+	        std::cout << "Image load failed - IL reports error: " << error << " - " << iluErrorString(error) << std::endl;
+	    }
+
+	    ilDeleteImages(1, &imageID);
+	    return success;
+	}
+
+
+	inline GLuint
 	loadCubemap(string filebase)
 	{
 	    glActiveTexture(GL_TEXTURE0);
@@ -104,6 +156,7 @@ namespace image {
 
         glGenTextures(1, &imageID);
         glBindTexture(GL_TEXTURE_CUBE_MAP, imageID);
+        STATS_COUNT(TEXTURE_BINDS, 1);
 
 	    string suffixes[] = {"right","left","top", "bottom","back","front"};
 	    GLuint targets[] = {
@@ -157,6 +210,10 @@ namespace image {
 	                         ilGetInteger(IL_IMAGE_FORMAT), // Image format (i.e. RGB, RGBA, BGR etc.)
 	                         GL_UNSIGNED_BYTE,      // Image data type
 	                         ilGetData());          // The actual image data itself
+
+	            STATS_COUNT(TEXTURE_UPLOADS, 1);
+	            STATS_COUNT(TEXTURE_BYTES, ilGetInteger(IL_IMAGE_WIDTH) * ilGetInteger(IL_IMAGE_HEIGHT) *
+	                                       ilGetInteger(IL_IMAGE_BYTES_PER_PIXEL));
                 
 
 	        }
@@ -183,6 +240,72 @@ namespace image {
 	    return imageID;
 	}
 
+
+	// The six faces loadCubemap() would upload, as tightly packed RGB
+	// pixels back to back in the same order (+x, -x, +y, -y, +z, -z) and
+	// with the same rows, for work on the CPU. False if a face can't be
+	// read or the faces aren't all the same square size.
+	inline bool
+	loadCubemapPixels(string filebase, GLsizei* size, std::vector<GLubyte>& pixels)
+	{
+	    string suffixes[] = {"right","left","top", "bottom","back","front"};
+	    ILuint imageID;
+	    ilGenImages(1, &imageID);
+	    ilBindImage(imageID);
+
+	    bool success = true;
+	    pixels.clear();
+	    for (int i = 0; i < 6 && success; i++) {
+	        string texName = filebase + "_" + suffixes[i] + ".png";
+	        success = ilLoadImage(texName.c_str()) && ilConvertImage(IL_RGB, IL_UNSIGNED_BYTE);
+	        if (!success)
+	        {
+	            ILenum error = ilGetError();
+	            std::cout << "Image load failed - IL reports error: " << error << " - " << iluErrorString(error) << std::endl;
+	            break;
+	        }
+
+	        GLsizei width = ilGetInteger(IL_IMAGE_WIDTH), height = ilGetInteger(IL_IMAGE_HEIGHT);
+	        if (i == 0)
+	            *size = width;
+	        if (width != *size || height != *size)
+	        {
+	            std::cout << texName << " is " << width << "x" << height << ", not " << *size << " square" << std::endl;
+	            success = false;
+	            break;
+	        }
+	        const GLubyte* data = ilGetData();
+	        pixels.insert(pixels.end(), data, data + width * height * 3);
+	    }
+
+	    ilDeleteImages(1, &imageID);
+	    return success;
+	}
+
+
+	// Write tightly packed RGBA pixels (bottom row first, as glReadPixels
+	// returns them) to disk. The format follows the file extension.
+	inline bool
+	saveImage(const char* fileName, GLuint width, GLuint height, const GLubyte* pixels)
+	{
+	    ILuint imageID;
+	    ilGenImages(1, &imageID);
+	    ilBindImage(imageID);
+
+	    ilTexImage(width, height, 1, 4, IL_RGBA, IL_UNSIGNED_BYTE, (void*)pixels);
+	    ilEnable(IL_FILE_OVERWRITE);
+
+	    bool success = ilSaveImage(fileName);
+	    if (!success)
+	    {
+	        ILenum error = ilGetError();
+	        std::cout << "Image save failed - IL reports error: " << error << " - " << iluErrorString(error) << std::endl;
+	    }
+
+	    ilDeleteImages(1, &imageID);
+	    return success;
+	}
+
 }
 }
 
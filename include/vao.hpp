@@ -24,6 +24,9 @@ public:
 				void *ptr,
 				GLuint usageType);
 
+	// Unsigned int indices for drawElements(); stays with the vertex array
+	void createIndices(GLuint count, const GLuint *indices, GLuint usageType);
+
 	void bindAttribute(const char * name,
 					   GLuint size,
 					   GLuint dataType,
@@ -32,11 +35,21 @@ public:
 					   GLvoid *offset);
 
 	void draw(GLuint mode, GLuint first, GLuint count);
+	void drawInstanced(GLuint mode, GLuint first, GLuint count, GLuint instances);
+
+	// count indices starting at index first, from createIndices()
+	void drawElements(GLuint mode, GLuint first, GLuint count);
+
+protected:
+	// The destructor deletes the GL names, so no copies
+	Vao(const Vao &);
+	Vao & operator=(const Vao &);
 
 private:
 	GLuint target;
 	GLuint shader_prog;
 	GLuint vbo_handle;
+	GLuint ibo_handle;
 	GLuint vao_handle;
 };
 
@@ -0,0 +1,48 @@
+#version 400
+
+// Image based lighting from ibl::precompute(): diffuse from the SH
+// irradiance, specular from the prefiltered cube map, with Karis's
+// analytic fit standing in for the split sum's BRDF table.
+
+in vec3 Normal;
+in vec3 ViewDir;
+in vec3 WorldNorm;
+
+uniform samplerCube Specular;
+uniform vec3 Sh[9];
+uniform float SpecularLevels;
+uniform vec3 Albedo = vec3(0.8);
+uniform float Roughness = 0.3;
+
+out vec4 FragColor;
+
+const float PI = 3.14159265358979;
+
+vec3 irradiance(vec3 n) {
+    return Sh[0] * 0.282095
+         + Sh[1] * 0.488603 * n.y + Sh[2] * 0.488603 * n.z + Sh[3] * 0.488603 * n.x
+         + Sh[4] * 1.092548 * n.x * n.y + Sh[5] * 1.092548 * n.y * n.z
+         + Sh[6] * 0.315392 * (3.0 * n.z * n.z - 1.0)
+         + Sh[7] * 1.092548 * n.x * n.z + Sh[8] * 0.546274 * (n.x * n.x - n.y * n.y);
+}
+
+vec3 envBrdf(vec3 f0, float roughness, float NdotV) {
+    const vec4 c0 = vec4(-1.0, -0.0275, -0.572, 0.022);
+    const vec4 c1 = vec4(1.0, 0.0425, 1.04, -0.04);
+    vec4 r = roughness * c0 + c1;
+    float a004 = min(r.x * r.x, exp2(-9.28 * NdotV)) * r.x + r.y;
+    vec2 ab = vec2(-1.04, 1.04) * a004 + r.zw;
+    return f0 * ab.x + ab.y;
+}
+
+void main() {
+    vec3 n = normalize(WorldNorm);
+    vec3 v = normalize(ViewDir);
+    vec3 r = reflect(-v, n);
+
+    vec3 diffuse = Albedo / PI * max(irradiance(n), vec3(0.0));
+    vec3 prefiltered = textureLod(Specular, r, Roughness * (SpecularLevels - 1.0)).rgb;
+    vec3 specular = prefiltered * envBrdf(vec3(0.04), Roughness, max(dot(n, v), 0.0));
+
+    FragColor = vec4(pow(diffuse + specular, vec3(1.0 / 2.2)), 1.0);
+}
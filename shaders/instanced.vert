@@ -0,0 +1,21 @@
+#version 400
+
+in vec3 VertexPosition;
+in vec3 VertexNormal;
+
+uniform mat4 ViewProj;
+uniform mat3 NormalMatrix;
+uniform int GridSize;
+uniform float Spacing;
+
+out vec3 Normal;
+
+void main() {
+    // Lay the instances out on a GridSize^3 lattice centred on the origin
+    int i = gl_InstanceID;
+    vec3 cell = vec3(i % GridSize, (i / GridSize) % GridSize, i / (GridSize * GridSize));
+    vec3 offset = (cell - 0.5 * float(GridSize - 1)) * Spacing;
+
+    Normal = normalize( NormalMatrix * VertexNormal );
+    gl_Position = ViewProj * vec4(VertexPosition + offset, 1.0);
+}
\ No newline at end of file
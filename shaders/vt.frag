@@ -0,0 +1,42 @@
+#version 400
+
+// Samples a vt::VirtualTexture: the indirection texture gives, for the
+// tile wanted, the physical slot to read and the level it holds, which
+// is coarser while the tile itself is still loading.
+
+in vec2 TexCoord;
+
+uniform sampler2D VtPhysical;
+uniform sampler2DArray VtIndirection;  // a layer per level
+uniform vec3 VtSize;                    // width, height, levels
+uniform vec3 VtTile;                    // tile size, border, padded size
+
+out vec4 FragColor;
+
+void main() {
+    vec2 uv = clamp(TexCoord, 0.0, 1.0);
+    vec2 texels = TexCoord * VtSize.xy;
+    vec2 dx = dFdx(texels), dy = dFdy(texels);
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy)));
+    int level = int(clamp(floor(lod), 0.0, VtSize.z - 1.0));
+
+    int tileSize = int(VtTile.x);
+    ivec2 size = max(ivec2(VtSize.xy) >> level, ivec2(1));
+    ivec2 tile = clamp(ivec2(uv * vec2(size)) / tileSize, ivec2(0), (size + tileSize - 1) / tileSize - 1);
+
+    vec4 entry = texelFetch(VtIndirection, ivec3(tile, level), 0) * 255.0;
+    if (entry.a < 0.5) {
+        FragColor = vec4(0.0);
+        return;
+    }
+
+    // Where uv falls in the tile of the level actually resident
+    int mapped = int(entry.b + 0.5);
+    ivec2 mappedSize = max(ivec2(VtSize.xy) >> mapped, ivec2(1));
+    vec2 inTiles = uv * vec2(mappedSize) / VtTile.x;
+    ivec2 mappedTiles = (mappedSize + tileSize - 1) / tileSize;
+    vec2 local = inTiles - vec2(clamp(ivec2(inTiles), ivec2(0), mappedTiles - 1));
+
+    vec2 texel = floor(entry.rg + 0.5) * VtTile.z + VtTile.y + local * VtTile.x;
+    FragColor = texture(VtPhysical, texel / vec2(textureSize(VtPhysical, 0)));
+}
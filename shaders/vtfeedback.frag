@@ -0,0 +1,29 @@
+#version 400
+
+// The feedback pass of vt::VirtualTexture: which tile of which level
+// each pixel would sample, as vt::encodeFeedback() packs it. Drawn at a
+// fraction of the screen size; VtFeedbackBias puts the lod back to what
+// the screen would use.
+
+in vec2 TexCoord;
+
+uniform vec3 VtSize;            // width, height, levels
+uniform vec3 VtTile;            // tile size, border, padded size
+uniform float VtFeedbackBias;
+
+out vec4 FragColor;
+
+void main() {
+    vec2 uv = clamp(TexCoord, 0.0, 1.0);
+    vec2 texels = TexCoord * VtSize.xy;
+    vec2 dx = dFdx(texels), dy = dFdy(texels);
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy))) - VtFeedbackBias;
+    int level = int(clamp(floor(lod), 0.0, VtSize.z - 1.0));
+
+    int tileSize = int(VtTile.x);
+    ivec2 size = max(ivec2(VtSize.xy) >> level, ivec2(1));
+    ivec2 tiles = (size + tileSize - 1) / tileSize;
+    ivec2 tile = clamp(ivec2(uv * vec2(size)) / tileSize, ivec2(0), tiles - 1);
+
+    FragColor = vec4(tile.x & 255, tile.y & 255, ((tile.x >> 8) & 15) | (((tile.y >> 8) & 15) << 4), level) / 255.0;
+}
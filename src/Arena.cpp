@@ -0,0 +1,85 @@
+/*
+ * Arena.cpp
+ *
+ * After a reset() the chunks are handed out again in order; a request
+ * that doesn't fit in the rest of one moves on to the next, and only
+ * past the last is a new one malloc'ed.
+ */
+#include "Arena.hpp"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace mem {
+
+static const size_t MAX_CHUNK_SIZE = 64 << 20;
+
+Arena::Arena(size_t chunkSize):
+    _current(0),
+    _offset(0),
+    _chunkSize(chunkSize),
+    _used(0),
+    _reserved(0)
+{
+}
+
+Arena::~Arena()
+{
+    release();
+}
+
+void *
+Arena::allocate(size_t bytes, size_t align)
+{
+    for (;;) {
+        if (_current < _chunks.size()) {
+            Chunk & chunk = _chunks[_current];
+            uintptr_t base = (uintptr_t)chunk.data;
+            size_t start = ((base + _offset + align - 1) & ~(uintptr_t)(align - 1)) - base;
+            if (start + bytes <= chunk.size) {
+                _offset = start + bytes;
+                _used += bytes;
+                return chunk.data + start;
+            }
+
+            // Too small for this; the rest of it goes unused until reset()
+            _current++;
+            _offset = 0;
+            continue;
+        }
+
+        size_t size = _chunks.empty() ? _chunkSize : std::min(_chunks.back().size * 2, MAX_CHUNK_SIZE);
+        size = std::max(std::max(size, _chunkSize), bytes + align);
+
+        Chunk chunk;
+        chunk.data = (char *)malloc(size);
+        chunk.size = size;
+        if (!chunk.data) {
+            printf("Error: arena out of memory allocating %lu bytes\n", (unsigned long)size);
+            return NULL;
+        }
+        _chunks.push_back(chunk);
+        _reserved += size;
+    }
+}
+
+void
+Arena::reset()
+{
+    _current = 0;
+    _offset = 0;
+    _used = 0;
+}
+
+void
+Arena::release()
+{
+    for (unsigned int i = 0; i < _chunks.size(); i++)
+        free(_chunks[i].data);
+    _chunks.clear();
+    _reserved = 0;
+    reset();
+}
+
+}
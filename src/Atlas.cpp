@@ -0,0 +1,511 @@
+/*
+ * Atlas.cpp
+ *
+ * MaxRects after Jukka Jylänki, "A Thousand Ways to Pack the Bin"
+ * (2010). The free list holds every maximal free rectangle; placing a
+ * cell splits each one it overlaps into the up to four pieces around
+ * it, then drops any piece that another contains.
+ *
+ * Cells are sorted biggest side first, which packs tighter, and ties
+ * go by image index so the layout only depends on the input.
+ */
+#include "Atlas.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+
+namespace atlas {
+
+// How full pages are expected to get, to guess how many are needed
+static const float EXPECTED_OCCUPANCY = 0.9f;
+
+/*
+ * MaxRects
+ */
+MaxRects::MaxRects(int width, int height):
+    width(width),
+    height(height),
+    usedArea(0)
+{
+    Rect all = { 0, 0, width, height };
+    free.push_back(all);
+}
+
+
+bool
+MaxRects::insert(int w, int h, Rect * placed)
+{
+    // Best short side fit: the free rectangle leaving the least room on
+    // its tighter side, then on its other
+    int bestShort = 0x7fffffff, bestLong = 0x7fffffff;
+    int best = -1;
+    for (unsigned int i = 0; i < free.size(); i++) {
+        const Rect & f = free[i];
+        if (f.width < w || f.height < h)
+            continue;
+        int dw = f.width - w, dh = f.height - h;
+        int shortSide = std::min(dw, dh), longSide = std::max(dw, dh);
+        if (shortSide < bestShort || (shortSide == bestShort && longSide < bestLong)) {
+            bestShort = shortSide;
+            bestLong = longSide;
+            best = i;
+        }
+    }
+    if (best < 0)
+        return false;
+
+    Rect used = { free[best].x, free[best].y, w, h };
+    place(used);
+    usedArea += (long)w * h;
+    *placed = used;
+    return true;
+}
+
+
+static bool
+contains(const MaxRects::Rect & a, const MaxRects::Rect & b)
+{
+    return b.x >= a.x && b.y >= a.y && b.x + b.width <= a.x + a.width && b.y + b.height <= a.y + a.height;
+}
+
+
+void
+MaxRects::place(const Rect & used)
+{
+    vector<Rect> split;
+    split.reserve(free.size() + 4);
+    for (unsigned int i = 0; i < free.size(); i++) {
+        const Rect & f = free[i];
+        if (used.x >= f.x + f.width || used.x + used.width <= f.x ||
+            used.y >= f.y + f.height || used.y + used.height <= f.y) {
+            split.push_back(f);
+            continue;
+        }
+
+        if (used.x > f.x) {
+            Rect left = { f.x, f.y, used.x - f.x, f.height };
+            split.push_back(left);
+        }
+        if (used.x + used.width < f.x + f.width) {
+            Rect right = { used.x + used.width, f.y, f.x + f.width - used.x - used.width, f.height };
+            split.push_back(right);
+        }
+        if (used.y > f.y) {
+            Rect below = { f.x, f.y, f.width, used.y - f.y };
+            split.push_back(below);
+        }
+        if (used.y + used.height < f.y + f.height) {
+            Rect above = { f.x, used.y + used.height, f.width, f.y + f.height - used.y - used.height };
+            split.push_back(above);
+        }
+    }
+
+    // Drop the ones inside others (of two the same, the later one)
+    free.clear();
+    for (unsigned int i = 0; i < split.size(); i++) {
+        bool inside = false;
+        for (unsigned int j = 0; j < split.size() && !inside; j++)
+            inside = j != i && contains(split[j], split[i]) && (j < i || !contains(split[i], split[j]));
+        if (!inside)
+            free.push_back(split[i]);
+    }
+}
+
+
+float
+MaxRects::getOccupancy() const
+{
+    return (float)usedArea / ((float)width * height);
+}
+
+
+/*
+ * Atlas
+ */
+Atlas::Atlas():
+    pageWidth(0),
+    pageHeight(0)
+{
+}
+
+
+static GLsizei
+roundUp(GLsizei value, GLsizei multiple)
+{
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+
+bool
+Atlas::build(const vector<Image> & images, const Options & options)
+{
+    pages.clear();
+    regions.clear();
+    names.clear();
+    byName.clear();
+
+    GLsizei align = 1;
+    while (align < options.alignment)
+        align *= 2;
+    GLsizei pad = std::max(options.padding, 0);
+    GLsizei pw = roundUp(std::max(options.pageWidth, align), align);
+    GLsizei ph = roundUp(std::max(options.pageHeight, align), align);
+
+    unsigned int count = images.size();
+    vector<MaxRects::Rect> cells(count);
+    double area = 0.0;
+    for (unsigned int i = 0; i < count; i++) {
+        cells[i].width = roundUp(images[i].width + 2 * pad, align);
+        cells[i].height = roundUp(images[i].height + 2 * pad, align);
+        if (cells[i].width > pw || cells[i].height > ph) {
+            printf("Atlas: %s (%dx%d) doesn't fit a %dx%d page\n", images[i].name.c_str(),
+                   images[i].width, images[i].height, pw, ph);
+            return false;
+        }
+        area += (double)cells[i].width * cells[i].height;
+    }
+
+    vector<unsigned int> order(count);
+    for (unsigned int i = 0; i < count; i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&cells](unsigned int a, unsigned int b) {
+        int sideA = std::max(cells[a].width, cells[a].height), sideB = std::max(cells[b].width, cells[b].height);
+        if (sideA != sideB)
+            return sideA > sideB;
+        int areaA = cells[a].width * cells[a].height, areaB = cells[b].width * cells[b].height;
+        if (areaA != areaB)
+            return areaA > areaB;
+        return a < b;
+    });
+
+    // Deal the cells onto the pages they should fill and pack each page
+    // on its own
+    unsigned int guess = std::max(1u, (unsigned int)(area / ((double)pw * ph * EXPECTED_OCCUPANCY) + 0.999));
+    vector<MaxRects> packers(guess, MaxRects(pw, ph));
+    vector<int> pageOf(count, -1);
+    jobs::parallelFor(options.jobs, guess, 1, [&](unsigned int begin, unsigned int end) {
+        for (unsigned int page = begin; page < end; page++) {
+            for (unsigned int k = page; k < count; k += guess) {
+                unsigned int i = order[k];
+                if (packers[page].insert(cells[i].width, cells[i].height, &cells[i]))
+                    pageOf[i] = page;
+            }
+        }
+    });
+
+    // The rest wherever they fit, starting new pages as needed
+    for (unsigned int k = 0; k < count; k++) {
+        unsigned int i = order[k];
+        for (unsigned int page = 0; pageOf[i] < 0; page++) {
+            if (page == packers.size())
+                packers.push_back(MaxRects(pw, ph));
+            if (packers[page].insert(cells[i].width, cells[i].height, &cells[i]))
+                pageOf[i] = page;
+        }
+    }
+
+    pageWidth = pw;
+    pageHeight = ph;
+    pages.resize(packers.size());
+    jobs::parallelFor(options.jobs, pages.size(), 1, [&](unsigned int begin, unsigned int end) {
+        for (unsigned int page = begin; page < end; page++)
+            pages[page].assign((size_t)pw * ph * 4, 0);
+    });
+
+    // Each cell is the image with its edges repeated out to the sides
+    regions.resize(count);
+    jobs::parallelFor(options.jobs, count, 0, [&](unsigned int begin, unsigned int end) {
+        for (unsigned int i = begin; i < end; i++) {
+            const Image & image = images[i];
+            const MaxRects::Rect & cell = cells[i];
+            GLubyte * page = &pages[pageOf[i]][0];
+            for (int y = 0; y < cell.height; y++) {
+                int sy = std::min(std::max(y - pad, 0), image.height - 1);
+                const GLubyte * row = image.pixels + (size_t)sy * image.width * 4;
+                GLubyte * out = page + ((size_t)(cell.y + y) * pw + cell.x) * 4;
+                for (int x = 0; x < cell.width; x++) {
+                    int sx = std::min(std::max(x - pad, 0), image.width - 1);
+                    memcpy(out + x * 4, row + sx * 4, 4);
+                }
+            }
+
+            Region & r = regions[i];
+            r.page = pageOf[i];
+            r.x = cell.x + pad;
+            r.y = cell.y + pad;
+            r.width = image.width;
+            r.height = image.height;
+            r.u0 = (float)r.x / pw;
+            r.v0 = (float)r.y / ph;
+            r.u1 = (float)(r.x + r.width) / pw;
+            r.v1 = (float)(r.y + r.height) / ph;
+        }
+    });
+
+    names.resize(count);
+    byName.resize(count);
+    for (unsigned int i = 0; i < count; i++) {
+        names[i] = images[i].name;
+        byName[i] = i;
+    }
+    std::stable_sort(byName.begin(), byName.end(), [this](unsigned int a, unsigned int b) {
+        return names[a] < names[b];
+    });
+    return true;
+}
+
+
+int
+Atlas::find(const string & name) const
+{
+    unsigned int lo = 0, hi = byName.size();
+    while (lo < hi) {
+        unsigned int mid = (lo + hi) / 2;
+        if (names[byName[mid]] < name)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < byName.size() && names[byName[lo]] == name ? (int)byName[lo] : -1;
+}
+
+
+float
+Atlas::getOccupancy() const
+{
+    if (pages.empty())
+        return 0.0f;
+    double used = 0.0;
+    for (unsigned int i = 0; i < regions.size(); i++)
+        used += (double)regions[i].width * regions[i].height;
+    return used / ((double)pageWidth * pageHeight * pages.size());
+}
+
+
+/*
+ * Atlas file
+ */
+static const char ATLAS_MAGIC[8] = { 'A', 'T', 'L', 'A', 'S', '0', '0', '1' };
+static const unsigned long long PAGE_ALIGN = 4096;
+
+// Then Region[regions], unsigned int nameOffsets[regions + 1] (into the
+// name bytes that follow), unsigned int byName[regions] at indexOffset,
+// and the pages from pagesOffset, each pageBytes apart
+struct AtlasHeader
+{
+    char magic[8];
+    unsigned int pageWidth, pageHeight, pages, regions;
+    unsigned long long indexOffset, pagesOffset, pageBytes, size;
+};
+
+static unsigned long long
+alignUp(unsigned long long value, unsigned long long multiple)
+{
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+
+bool
+Atlas::write(const string & fileName) const
+{
+    unsigned int count = regions.size();
+    vector<unsigned int> offsets(count + 1, 0);
+    for (unsigned int i = 0; i < count; i++)
+        offsets[i + 1] = offsets[i] + names[i].size();
+
+    AtlasHeader header;
+    memcpy(header.magic, ATLAS_MAGIC, sizeof(header.magic));
+    header.pageWidth = pageWidth;
+    header.pageHeight = pageHeight;
+    header.pages = pages.size();
+    header.regions = count;
+    unsigned long long namesOffset = sizeof(AtlasHeader) + count * sizeof(Region) + (count + 1) * sizeof(unsigned int);
+    header.indexOffset = alignUp(namesOffset + offsets[count], sizeof(unsigned int));
+    header.pagesOffset = alignUp(header.indexOffset + count * sizeof(unsigned int), PAGE_ALIGN);
+    header.pageBytes = alignUp((unsigned long long)pageWidth * pageHeight * 4, PAGE_ALIGN);
+    header.size = header.pagesOffset + header.pageBytes * pages.size();
+
+    int fd = ::open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("Error: can't create %s\n", fileName.c_str());
+        return false;
+    }
+    if (ftruncate(fd, header.size)) {
+        printf("Error: can't size %s to %llu bytes\n", fileName.c_str(), header.size);
+        ::close(fd);
+        return false;
+    }
+    char * data = (char *)mmap(NULL, header.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        printf("Error: can't map %s\n", fileName.c_str());
+        return false;
+    }
+
+    memcpy(data, &header, sizeof(header));
+    if (count) {
+        memcpy(data + sizeof(AtlasHeader), &regions[0], count * sizeof(Region));
+        memcpy(data + sizeof(AtlasHeader) + count * sizeof(Region), &offsets[0], offsets.size() * sizeof(unsigned int));
+        for (unsigned int i = 0; i < count; i++)
+            memcpy(data + namesOffset + offsets[i], names[i].data(), names[i].size());
+        memcpy(data + header.indexOffset, &byName[0], count * sizeof(unsigned int));
+    }
+    for (unsigned int i = 0; i < pages.size(); i++)
+        memcpy(data + header.pagesOffset + i * header.pageBytes, &pages[i][0], pages[i].size());
+
+    munmap(data, header.size);
+    return true;
+}
+
+
+AtlasFile::AtlasFile():
+    _data(NULL), _size(0), _regions(NULL)
+{
+}
+
+
+AtlasFile::~AtlasFile()
+{
+    close();
+}
+
+
+bool
+AtlasFile::open(const string & fileName)
+{
+    close();
+
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    off_t size = lseek(fd, 0, SEEK_END);
+    void * data = size >= (off_t)sizeof(AtlasHeader) ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        printf("Error: can't map %s\n", fileName.c_str());
+        return false;
+    }
+    _data = (char *)data;
+    _size = size;
+
+    const AtlasHeader * header = (const AtlasHeader *)_data;
+    unsigned long long count = header->regions;
+    unsigned long long namesOffset = sizeof(AtlasHeader) + count * sizeof(Region) + (count + 1) * sizeof(unsigned int);
+    bool ok = !memcmp(header->magic, ATLAS_MAGIC, sizeof(header->magic)) && header->size == (unsigned long long)size &&
+              namesOffset <= header->indexOffset && header->indexOffset + count * sizeof(unsigned int) <= header->pagesOffset &&
+              header->pageBytes >= (unsigned long long)header->pageWidth * header->pageHeight * 4 &&
+              header->pagesOffset + header->pageBytes * header->pages == header->size;
+    if (ok) {
+        const unsigned int * offsets = (const unsigned int *)(_data + sizeof(AtlasHeader) + count * sizeof(Region));
+        ok = namesOffset + offsets[count] <= header->indexOffset;
+    }
+    if (!ok) {
+        printf("Error: %s isn't an atlas, or is from another version\n", fileName.c_str());
+        close();
+        return false;
+    }
+
+    _regions = (const Region *)(_data + sizeof(AtlasHeader));
+    return true;
+}
+
+
+void
+AtlasFile::close()
+{
+    if (_data)
+        munmap(_data, _size);
+    _data = NULL;
+    _size = 0;
+    _regions = NULL;
+}
+
+
+unsigned int
+AtlasFile::getPageCount() const
+{
+    return _data ? ((const AtlasHeader *)_data)->pages : 0;
+}
+
+
+GLsizei
+AtlasFile::getPageWidth() const
+{
+    return _data ? ((const AtlasHeader *)_data)->pageWidth : 0;
+}
+
+
+GLsizei
+AtlasFile::getPageHeight() const
+{
+    return _data ? ((const AtlasHeader *)_data)->pageHeight : 0;
+}
+
+
+const GLubyte *
+AtlasFile::getPage(unsigned int page) const
+{
+    const AtlasHeader * header = (const AtlasHeader *)_data;
+    return (const GLubyte *)(_data + header->pagesOffset + page * header->pageBytes);
+}
+
+
+unsigned int
+AtlasFile::getRegionCount() const
+{
+    return _data ? ((const AtlasHeader *)_data)->regions : 0;
+}
+
+
+string
+AtlasFile::getName(unsigned int image) const
+{
+    unsigned int count = getRegionCount();
+    const unsigned int * offsets = (const unsigned int *)(_regions + count);
+    const char * bytes = (const char *)(offsets + count + 1);
+    return string(bytes + offsets[image], offsets[image + 1] - offsets[image]);
+}
+
+
+int
+AtlasFile::find(const string & name) const
+{
+    if (!_data)
+        return -1;
+    const AtlasHeader * header = (const AtlasHeader *)_data;
+    const unsigned int * index = (const unsigned int *)(_data + header->indexOffset);
+    unsigned int lo = 0, hi = header->regions;
+    while (lo < hi) {
+        unsigned int mid = (lo + hi) / 2;
+        if (getName(index[mid]) < name)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < header->regions && getName(index[lo]) == name ? (int)index[lo] : -1;
+}
+
+
+void
+remapMesh(mesh::TriMesh & mesh, const vector<const Region *> & materials)
+{
+    if (mesh.submeshes.empty()) {
+        if (!materials.empty() && materials[0])
+            mesh.remapUvs(vec2(materials[0]->u0, materials[0]->v0), vec2(materials[0]->u1, materials[0]->v1));
+        return;
+    }
+
+    for (unsigned int i = 0; i < mesh.submeshes.size(); i++) {
+        const mesh::SubMesh & s = mesh.submeshes[i];
+        if (s.material < 0 || (unsigned int)s.material >= materials.size() || !materials[s.material] || !s.count)
+            continue;
+        const Region * r = materials[s.material];
+        mesh.remapUvs(vec2(r->u0, r->v0), vec2(r->u1, r->v1), s.first, s.count);
+    }
+}
+
+}
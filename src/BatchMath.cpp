@@ -0,0 +1,492 @@
+/*
+ * BatchMath.cpp
+ *
+ * glm is column major, and m * v is ((m[0] v.x + m[1] v.y) + m[2] v.z)
+ * + m[3] v.w. The SIMD paths keep a column per register and do exactly
+ * that, so with no fused multiply-add they round the same as glm. AVX
+ * does two points, or two columns, per register.
+ *
+ * Normal matrices go across matrices instead: 4 or 8 at a time,
+ * transposed so each register holds one element of each. The inverse
+ * transpose of a 3x3 with columns a, b, c has columns b x c, c x a and
+ * a x b over det = a . (b x c); the scalar path does the same sums.
+ *
+ * The gtx simd_mat4 types in the bundled glm don't build with current
+ * compilers (its compiler detection predates them and leaves
+ * GLM_ALIGNED_STRUCT empty), so this uses intrinsics directly.
+ */
+#include "BatchMath.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define BATCH_X86
+    #include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #define BATCH_NEON
+    #include <arm_neon.h>
+#endif
+
+namespace batch {
+
+static_assert(sizeof(vec3) == 3 * sizeof(float) && sizeof(vec4) == 4 * sizeof(float) &&
+              sizeof(mat3) == 9 * sizeof(float) && sizeof(mat4) == 16 * sizeof(float),
+              "glm types aren't packed");
+
+cull::Isa
+getBestIsa()
+{
+#ifdef BATCH_NEON
+    return cull::NEON;
+#else
+    return cull::getBestIsa();
+#endif
+}
+
+/*
+ * Points. The SIMD functions return how many they did; the scalar one
+ * does the rest.
+ */
+static void
+pointsScalar(const mat4 & m, const vec3 * in, vec4 * out, unsigned int begin, unsigned int end)
+{
+    for (unsigned int i = begin; i < end; i++)
+        out[i] = m * vec4(in[i], 1.0f);
+}
+
+static void
+pointsScalar(const mat4 & m, const vec3 * in, vec3 * out, unsigned int begin, unsigned int end)
+{
+    for (unsigned int i = begin; i < end; i++)
+        out[i] = vec3(m * vec4(in[i], 1.0f));
+}
+
+#ifdef BATCH_X86
+// xyz of p to 3 floats, without touching the one after
+__attribute__((target("sse2"))) static inline void
+store3(float * out, __m128 p)
+{
+    _mm_storel_pi((__m64 *)out, p);
+    _mm_store_ss(out + 2, _mm_movehl_ps(p, p));
+}
+
+template <bool W>
+__attribute__((target("sse2"))) static unsigned int
+pointsSse(const mat4 & m, const vec3 * in, float * out, unsigned int count)
+{
+    __m128 c0 = _mm_loadu_ps(&m[0][0]), c1 = _mm_loadu_ps(&m[1][0]);
+    __m128 c2 = _mm_loadu_ps(&m[2][0]), c3 = _mm_loadu_ps(&m[3][0]);
+    for (unsigned int i = 0; i < count; i++) {
+        __m128 p = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_load1_ps(&in[i].x)),
+                                                    _mm_mul_ps(c1, _mm_load1_ps(&in[i].y))),
+                                         _mm_mul_ps(c2, _mm_load1_ps(&in[i].z))), c3);
+        if (W)
+            _mm_storeu_ps(out + i * 4, p);
+        else
+            store3(out + i * 3, p);
+    }
+    return count;
+}
+
+template <bool W>
+__attribute__((target("avx"))) static unsigned int
+pointsAvx(const mat4 & m, const vec3 * in, float * out, unsigned int count)
+{
+    __m256 c0 = _mm256_broadcast_ps((const __m128 *)&m[0][0]), c1 = _mm256_broadcast_ps((const __m128 *)&m[1][0]);
+    __m256 c2 = _mm256_broadcast_ps((const __m128 *)&m[2][0]), c3 = _mm256_broadcast_ps((const __m128 *)&m[3][0]);
+
+    // Points i and i + 1 in the two halves. Loading point i + 1 as four
+    // floats reads the x after it, so stop a point short of the end.
+    unsigned int i = 0;
+    for (; i + 2 < count; i += 2) {
+        __m256 p = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&in[i].x)), _mm_loadu_ps(&in[i + 1].x), 1);
+        __m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c0, _mm256_permute_ps(p, 0x00)),
+                                                             _mm256_mul_ps(c1, _mm256_permute_ps(p, 0x55))),
+                                               _mm256_mul_ps(c2, _mm256_permute_ps(p, 0xaa))), c3);
+        if (W) {
+            _mm256_storeu_ps(out + i * 4, r);
+        } else {
+            store3(out + i * 3, _mm256_castps256_ps128(r));
+            store3(out + i * 3 + 3, _mm256_extractf128_ps(r, 1));
+        }
+    }
+    return i;
+}
+#endif
+
+#ifdef BATCH_NEON
+template <bool W>
+static unsigned int
+pointsNeon(const mat4 & m, const vec3 * in, float * out, unsigned int count)
+{
+    float32x4_t c0 = vld1q_f32(&m[0][0]), c1 = vld1q_f32(&m[1][0]);
+    float32x4_t c2 = vld1q_f32(&m[2][0]), c3 = vld1q_f32(&m[3][0]);
+    for (unsigned int i = 0; i < count; i++) {
+        float32x4_t p = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(c0, in[i].x), vmulq_n_f32(c1, in[i].y)),
+                                            vmulq_n_f32(c2, in[i].z)), c3);
+        if (W) {
+            vst1q_f32(out + i * 4, p);
+        } else {
+            vst1_f32(out + i * 3, vget_low_f32(p));
+            vst1q_lane_f32(out + i * 3 + 2, p, 2);
+        }
+    }
+    return count;
+}
+#endif
+
+template <bool W, class Out>
+static void
+transformPoints(const mat4 & m, const vec3 * in, Out * out, unsigned int count, cull::Isa isa)
+{
+    if (isa == cull::BEST)
+        isa = getBestIsa();
+
+    unsigned int done = 0;
+#ifdef BATCH_X86
+    if (isa == cull::AVX)
+        done = pointsAvx<W>(m, in, &out[0].x, count);
+    else if (isa == cull::SSE)
+        done = pointsSse<W>(m, in, &out[0].x, count);
+#endif
+#ifdef BATCH_NEON
+    if (isa == cull::NEON)
+        done = pointsNeon<W>(m, in, &out[0].x, count);
+#endif
+
+    pointsScalar(m, in, out, done, count);
+}
+
+void
+transformPoints(const mat4 & m, const vec3 * in, vec4 * out, unsigned int count, cull::Isa isa)
+{
+    transformPoints<true>(m, in, out, count, isa);
+}
+
+void
+transformPoints(const mat4 & m, const vec3 * in, vec3 * out, unsigned int count, cull::Isa isa)
+{
+    transformPoints<false>(m, in, out, count, isa);
+}
+
+
+/*
+ * Matrix products. Each output column only needs its own column of b,
+ * and all of a, which is loaded first; that's what lets out be either.
+ */
+static void
+productsScalar(const mat4 * a, unsigned int aStep, const mat4 * b, mat4 * out,
+               unsigned int begin, unsigned int end)
+{
+    for (unsigned int i = begin; i < end; i++)
+        out[i] = a[i * aStep] * b[i];
+}
+
+#ifdef BATCH_X86
+template <int K>
+__attribute__((target("sse2"))) static inline __m128
+splat(__m128 v)
+{
+    return _mm_shuffle_ps(v, v, K * 0x55);
+}
+
+__attribute__((target("sse2"))) static unsigned int
+productsSse(const mat4 * a, unsigned int aStep, const mat4 * b, mat4 * out, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; i++) {
+        const float * ai = &a[i * aStep][0][0];
+        __m128 a0 = _mm_loadu_ps(ai), a1 = _mm_loadu_ps(ai + 4), a2 = _mm_loadu_ps(ai + 8), a3 = _mm_loadu_ps(ai + 12);
+        for (int j = 0; j < 4; j++) {
+            __m128 bj = _mm_loadu_ps(&b[i][j][0]);
+            _mm_storeu_ps(&out[i][j][0],
+                          _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(a0, splat<0>(bj)), _mm_mul_ps(a1, splat<1>(bj))),
+                                                _mm_mul_ps(a2, splat<2>(bj))), _mm_mul_ps(a3, splat<3>(bj))));
+        }
+    }
+    return count;
+}
+
+__attribute__((target("avx"))) static unsigned int
+productsAvx(const mat4 * a, unsigned int aStep, const mat4 * b, mat4 * out, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; i++) {
+        const __m128 * ai = (const __m128 *)&a[i * aStep][0][0];
+        __m256 a0 = _mm256_broadcast_ps(ai), a1 = _mm256_broadcast_ps(ai + 1);
+        __m256 a2 = _mm256_broadcast_ps(ai + 2), a3 = _mm256_broadcast_ps(ai + 3);
+
+        // Columns j and j + 1 in the two halves
+        for (int j = 0; j < 4; j += 2) {
+            __m256 bj = _mm256_loadu_ps(&b[i][j][0]);
+            __m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a0, _mm256_permute_ps(bj, 0x00)),
+                                                                 _mm256_mul_ps(a1, _mm256_permute_ps(bj, 0x55))),
+                                                   _mm256_mul_ps(a2, _mm256_permute_ps(bj, 0xaa))),
+                                     _mm256_mul_ps(a3, _mm256_permute_ps(bj, 0xff)));
+            _mm256_storeu_ps(&out[i][j][0], r);
+        }
+    }
+    return count;
+}
+#endif
+
+#ifdef BATCH_NEON
+static unsigned int
+productsNeon(const mat4 * a, unsigned int aStep, const mat4 * b, mat4 * out, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; i++) {
+        const float * ai = &a[i * aStep][0][0];
+        float32x4_t a0 = vld1q_f32(ai), a1 = vld1q_f32(ai + 4), a2 = vld1q_f32(ai + 8), a3 = vld1q_f32(ai + 12);
+        for (int j = 0; j < 4; j++) {
+            float32x4_t bj = vld1q_f32(&b[i][j][0]);
+            vst1q_f32(&out[i][j][0],
+                      vaddq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(a0, vgetq_lane_f32(bj, 0)),
+                                                    vmulq_n_f32(a1, vgetq_lane_f32(bj, 1))),
+                                          vmulq_n_f32(a2, vgetq_lane_f32(bj, 2))),
+                                vmulq_n_f32(a3, vgetq_lane_f32(bj, 3))));
+        }
+    }
+    return count;
+}
+#endif
+
+// out[i] = a[i * aStep] * b[i]: aStep 0 for concatenate(), 1 for multiply()
+static void
+products(const mat4 * a, unsigned int aStep, const mat4 * b, mat4 * out, unsigned int count, cull::Isa isa)
+{
+    if (isa == cull::BEST)
+        isa = getBestIsa();
+
+    unsigned int done = 0;
+#ifdef BATCH_X86
+    if (isa == cull::AVX)
+        done = productsAvx(a, aStep, b, out, count);
+    else if (isa == cull::SSE)
+        done = productsSse(a, aStep, b, out, count);
+#endif
+#ifdef BATCH_NEON
+    if (isa == cull::NEON)
+        done = productsNeon(a, aStep, b, out, count);
+#endif
+
+    productsScalar(a, aStep, b, out, done, count);
+}
+
+void
+concatenate(const mat4 & a, const mat4 * b, mat4 * out, unsigned int count, cull::Isa isa)
+{
+    // A copy, in case a is one of the outputs
+    mat4 left = a;
+    products(&left, 0, b, out, count, isa);
+}
+
+void
+multiply(const mat4 * a, const mat4 * b, mat4 * out, unsigned int count, cull::Isa isa)
+{
+    products(a, 1, b, out, count, isa);
+}
+
+
+/*
+ * Normal matrices
+ */
+static void
+normalsScalar(const mat4 * m, mat3 * out, unsigned int begin, unsigned int end)
+{
+    for (unsigned int i = begin; i < end; i++) {
+        const mat4 & n = m[i];
+        float ax = n[0][0], ay = n[0][1], az = n[0][2];
+        float bx = n[1][0], by = n[1][1], bz = n[1][2];
+        float cx = n[2][0], cy = n[2][1], cz = n[2][2];
+
+        vec3 r0(by * cz - cy * bz, bz * cx - cz * bx, bx * cy - cx * by);
+        vec3 r1(cy * az - ay * cz, cz * ax - az * cx, cx * ay - ax * cy);
+        vec3 r2(ay * bz - by * az, az * bx - bz * ax, ax * by - bx * ay);
+        float inv = 1.0f / ((ax * r0.x + ay * r0.y) + az * r0.z);
+        out[i] = mat3(r0 * inv, r1 * inv, r2 * inv);
+    }
+}
+
+#ifdef BATCH_X86
+// Column k of m[0..3], as x, y and z of each
+__attribute__((target("sse2"))) static inline void
+loadColumns(const mat4 * m, int k, __m128 & x, __m128 & y, __m128 & z)
+{
+    __m128 w;
+    x = _mm_loadu_ps(&m[0][k][0]);
+    y = _mm_loadu_ps(&m[1][k][0]);
+    z = _mm_loadu_ps(&m[2][k][0]);
+    w = _mm_loadu_ps(&m[3][k][0]);
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+}
+
+// The reverse, into column k of out[0..3]. Columns 0 and 1 spill a
+// float into the next one, so write them in order.
+__attribute__((target("sse2"))) static inline void
+storeColumns(mat3 * out, int k, __m128 x, __m128 y, __m128 z)
+{
+    __m128 w = _mm_setzero_ps();
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+    const __m128 columns[4] = { x, y, z, w };
+    for (int j = 0; j < 4; j++) {
+        if (k < 2)
+            _mm_storeu_ps(&out[j][k][0], columns[j]);
+        else
+            store3(&out[j][k][0], columns[j]);
+    }
+}
+
+__attribute__((target("sse2"))) static unsigned int
+normalsSse(const mat4 * m, mat3 * out, unsigned int count)
+{
+    unsigned int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 ax, ay, az, bx, by, bz, cx, cy, cz;
+        loadColumns(m + i, 0, ax, ay, az);
+        loadColumns(m + i, 1, bx, by, bz);
+        loadColumns(m + i, 2, cx, cy, cz);
+
+        __m128 r0x = _mm_sub_ps(_mm_mul_ps(by, cz), _mm_mul_ps(cy, bz));
+        __m128 r0y = _mm_sub_ps(_mm_mul_ps(bz, cx), _mm_mul_ps(cz, bx));
+        __m128 r0z = _mm_sub_ps(_mm_mul_ps(bx, cy), _mm_mul_ps(cx, by));
+        __m128 inv = _mm_div_ps(_mm_set1_ps(1.0f),
+                                _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, r0x), _mm_mul_ps(ay, r0y)), _mm_mul_ps(az, r0z)));
+
+        storeColumns(out + i, 0, _mm_mul_ps(r0x, inv), _mm_mul_ps(r0y, inv), _mm_mul_ps(r0z, inv));
+        storeColumns(out + i, 1, _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(cy, az), _mm_mul_ps(ay, cz)), inv),
+                     _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(cz, ax), _mm_mul_ps(az, cx)), inv),
+                     _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(cx, ay), _mm_mul_ps(ax, cy)), inv));
+        storeColumns(out + i, 2, _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(ay, bz), _mm_mul_ps(by, az)), inv),
+                     _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(az, bx), _mm_mul_ps(bz, ax)), inv),
+                     _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(ax, by), _mm_mul_ps(bx, ay)), inv));
+    }
+    return i;
+}
+
+// Column k of m[0..7]: m[0..3] in the low halves, m[4..7] in the high
+__attribute__((target("avx"))) static inline void
+loadColumns(const mat4 * m, int k, __m256 & x, __m256 & y, __m256 & z)
+{
+    __m128 lx, ly, lz, hx, hy, hz;
+    loadColumns(m, k, lx, ly, lz);
+    loadColumns(m + 4, k, hx, hy, hz);
+    x = _mm256_insertf128_ps(_mm256_castps128_ps256(lx), hx, 1);
+    y = _mm256_insertf128_ps(_mm256_castps128_ps256(ly), hy, 1);
+    z = _mm256_insertf128_ps(_mm256_castps128_ps256(lz), hz, 1);
+}
+
+__attribute__((target("avx"))) static inline void
+storeColumns(mat3 * out, int k, __m256 x, __m256 y, __m256 z)
+{
+    storeColumns(out, k, _mm256_castps256_ps128(x), _mm256_castps256_ps128(y), _mm256_castps256_ps128(z));
+    storeColumns(out + 4, k, _mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(y, 1), _mm256_extractf128_ps(z, 1));
+}
+
+__attribute__((target("avx"))) static unsigned int
+normalsAvx(const mat4 * m, mat3 * out, unsigned int count)
+{
+    unsigned int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 ax, ay, az, bx, by, bz, cx, cy, cz;
+        loadColumns(m + i, 0, ax, ay, az);
+        loadColumns(m + i, 1, bx, by, bz);
+        loadColumns(m + i, 2, cx, cy, cz);
+
+        __m256 r0x = _mm256_sub_ps(_mm256_mul_ps(by, cz), _mm256_mul_ps(cy, bz));
+        __m256 r0y = _mm256_sub_ps(_mm256_mul_ps(bz, cx), _mm256_mul_ps(cz, bx));
+        __m256 r0z = _mm256_sub_ps(_mm256_mul_ps(bx, cy), _mm256_mul_ps(cx, by));
+        __m256 inv = _mm256_div_ps(_mm256_set1_ps(1.0f),
+                                   _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, r0x), _mm256_mul_ps(ay, r0y)),
+                                                 _mm256_mul_ps(az, r0z)));
+
+        storeColumns(out + i, 0, _mm256_mul_ps(r0x, inv), _mm256_mul_ps(r0y, inv), _mm256_mul_ps(r0z, inv));
+        storeColumns(out + i, 1, _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(cy, az), _mm256_mul_ps(ay, cz)), inv),
+                     _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(cz, ax), _mm256_mul_ps(az, cx)), inv),
+                     _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(cx, ay), _mm256_mul_ps(ax, cy)), inv));
+        storeColumns(out + i, 2, _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(ay, bz), _mm256_mul_ps(by, az)), inv),
+                     _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(az, bx), _mm256_mul_ps(bz, ax)), inv),
+                     _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(ax, by), _mm256_mul_ps(bx, ay)), inv));
+    }
+    return i;
+}
+#endif
+
+#ifdef BATCH_NEON
+// Element [k][r] of m[0..3]
+static inline float32x4_t
+gather(const mat4 * m, int k, int r)
+{
+    float32x4_t v = vdupq_n_f32(m[0][k][r]);
+    v = vsetq_lane_f32(m[1][k][r], v, 1);
+    v = vsetq_lane_f32(m[2][k][r], v, 2);
+    return vsetq_lane_f32(m[3][k][r], v, 3);
+}
+
+static inline void
+scatter(mat3 * out, int k, int r, float32x4_t v)
+{
+    out[0][k][r] = vgetq_lane_f32(v, 0);
+    out[1][k][r] = vgetq_lane_f32(v, 1);
+    out[2][k][r] = vgetq_lane_f32(v, 2);
+    out[3][k][r] = vgetq_lane_f32(v, 3);
+}
+
+static inline float32x4_t
+cross(float32x4_t a, float32x4_t b, float32x4_t c, float32x4_t d)
+{
+    return vsubq_f32(vmulq_f32(a, b), vmulq_f32(c, d));
+}
+
+static unsigned int
+normalsNeon(const mat4 * m, mat3 * out, unsigned int count)
+{
+    unsigned int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        float32x4_t ax = gather(m + i, 0, 0), ay = gather(m + i, 0, 1), az = gather(m + i, 0, 2);
+        float32x4_t bx = gather(m + i, 1, 0), by = gather(m + i, 1, 1), bz = gather(m + i, 1, 2);
+        float32x4_t cx = gather(m + i, 2, 0), cy = gather(m + i, 2, 1), cz = gather(m + i, 2, 2);
+
+        float32x4_t r0x = cross(by, cz, cy, bz), r0y = cross(bz, cx, cz, bx), r0z = cross(bx, cy, cx, by);
+        float32x4_t det = vaddq_f32(vaddq_f32(vmulq_f32(ax, r0x), vmulq_f32(ay, r0y)), vmulq_f32(az, r0z));
+#ifdef __aarch64__
+        float32x4_t inv = vdivq_f32(vdupq_n_f32(1.0f), det);
+#else
+        // No vector divide on 32 bit ARM
+        float32x4_t inv = vdupq_n_f32(1.0f / vgetq_lane_f32(det, 0));
+        inv = vsetq_lane_f32(1.0f / vgetq_lane_f32(det, 1), inv, 1);
+        inv = vsetq_lane_f32(1.0f / vgetq_lane_f32(det, 2), inv, 2);
+        inv = vsetq_lane_f32(1.0f / vgetq_lane_f32(det, 3), inv, 3);
+#endif
+
+        scatter(out + i, 0, 0, vmulq_f32(r0x, inv));
+        scatter(out + i, 0, 1, vmulq_f32(r0y, inv));
+        scatter(out + i, 0, 2, vmulq_f32(r0z, inv));
+        scatter(out + i, 1, 0, vmulq_f32(cross(cy, az, ay, cz), inv));
+        scatter(out + i, 1, 1, vmulq_f32(cross(cz, ax, az, cx), inv));
+        scatter(out + i, 1, 2, vmulq_f32(cross(cx, ay, ax, cy), inv));
+        scatter(out + i, 2, 0, vmulq_f32(cross(ay, bz, by, az), inv));
+        scatter(out + i, 2, 1, vmulq_f32(cross(az, bx, bz, ax), inv));
+        scatter(out + i, 2, 2, vmulq_f32(cross(ax, by, bx, ay), inv));
+    }
+    return i;
+}
+#endif
+
+void
+normalMatrices(const mat4 * m, mat3 * out, unsigned int count, cull::Isa isa)
+{
+    if (isa == cull::BEST)
+        isa = getBestIsa();
+
+    unsigned int done = 0;
+#ifdef BATCH_X86
+    if (isa == cull::AVX)
+        done = normalsAvx(m, out, count);
+    else if (isa == cull::SSE)
+        done = normalsSse(m, out, count);
+#endif
+#ifdef BATCH_NEON
+    if (isa == cull::NEON)
+        done = normalsNeon(m, out, count);
+#endif
+
+    normalsScalar(m, out, done, count);
+}
+
+}
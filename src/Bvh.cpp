@@ -0,0 +1,454 @@
+/*
+ * Bvh.cpp
+ */
+#include "Bvh.hpp"
+
+#include <float.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "glm/gtc/matrix_transform.hpp"
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+namespace bvh {
+
+// SAH bins per axis, and subtrees big enough to get their own thread
+static const int BINS = 16;
+// Cost of visiting a node, relative to one ray/triangle test
+static const float TRAVERSAL_COST = 1.0f;
+static const unsigned int PARALLEL_MIN = 4096;
+
+/*
+ * Build state shared by all the threads working on one tree
+ */
+class Bvh::Builder
+{
+public:
+    Builder(Bvh & tree, const mesh::TriMesh & mesh, unsigned int threads):
+        tree(tree),
+        nodesUsed(2),
+        threadsLeft(threads > 0 ? threads - 1 : 0)
+    {
+        unsigned int count = mesh.vertices.size() / 3;
+        triMin.resize(count);
+        triMax.resize(count);
+        centroids.resize(count);
+
+        for (unsigned int i = 0; i < count; i++) {
+            const vec3 * v = &mesh.vertices[i * 3];
+            triMin[i] = glm::min(glm::min(v[0], v[1]), v[2]);
+            triMax[i] = glm::max(glm::max(v[0], v[1]), v[2]);
+            centroids[i] = (triMin[i] + triMax[i]) * 0.5f;
+        }
+    }
+
+    void subdivide(unsigned int index, int depth);
+    void updateBounds(Node & node);
+
+    Bvh &                       tree;
+    std::atomic<unsigned int>   nodesUsed;
+    std::atomic<int>            threadsLeft;
+
+    vector<vec3>                triMin, triMax, centroids;
+};
+
+
+void
+Bvh::Builder::updateBounds(Node & node)
+{
+    mesh::Aabb box;
+    for (unsigned int i = 0; i < node.count; i++) {
+        unsigned int tri = tree.indices[node.leftFirst + i];
+        box.add(triMin[tri]);
+        box.add(triMax[tri]);
+    }
+    tree.setBounds(node, box.min, box.max);
+}
+
+
+static float
+halfArea(const mesh::Aabb & box)
+{
+    if (box.empty())
+        return 0.0f;
+
+    vec3 e = box.max - box.min;
+    return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+
+
+void
+Bvh::Builder::subdivide(unsigned int index, int depth)
+{
+    Node & node = tree.nodes[index];
+    updateBounds(node);
+
+    if (node.count <= 2 || depth >= STACK_SIZE - 1)
+        return;
+
+    // Centroid bounds decide where the bins go
+    mesh::Aabb cbox;
+    for (unsigned int i = 0; i < node.count; i++)
+        cbox.add(centroids[tree.indices[node.leftFirst + i]]);
+
+    // Best split over all axes and bin boundaries
+    int bestAxis = -1, bestSplit = 0;
+    float bestCost = FLT_MAX;
+
+    for (int axis = 0; axis < 3; axis++) {
+        float lo = cbox.min[axis], hi = cbox.max[axis];
+        if (hi - lo < 1e-12f)
+            continue;
+
+        mesh::Aabb bins[BINS];
+        unsigned int counts[BINS] = { 0 };
+        float scale = BINS / (hi - lo);
+
+        for (unsigned int i = 0; i < node.count; i++) {
+            unsigned int tri = tree.indices[node.leftFirst + i];
+            int b = std::min(BINS - 1, (int)((centroids[tri][axis] - lo) * scale));
+            counts[b]++;
+            bins[b].add(triMin[tri]);
+            bins[b].add(triMax[tri]);
+        }
+
+        // Sweep from both sides to get the areas either side of each plane
+        float leftArea[BINS - 1], rightArea[BINS - 1];
+        unsigned int leftCount[BINS - 1], rightCount[BINS - 1];
+        mesh::Aabb left, right;
+        unsigned int leftSum = 0, rightSum = 0;
+
+        for (int i = 0; i < BINS - 1; i++) {
+            leftSum += counts[i];
+            leftCount[i] = leftSum;
+            left.add(bins[i]);
+            leftArea[i] = halfArea(left);
+
+            rightSum += counts[BINS - 1 - i];
+            rightCount[BINS - 2 - i] = rightSum;
+            right.add(bins[BINS - 1 - i]);
+            rightArea[BINS - 2 - i] = halfArea(right);
+        }
+
+        for (int i = 0; i < BINS - 1; i++) {
+            float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+            if (leftCount[i] && rightCount[i] && cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = i + 1;
+            }
+        }
+    }
+
+    // Keep the leaf if no split beats intersecting everything in it
+    mesh::Aabb nodeBox(vec3(node.min[0], node.min[1], node.min[2]),
+                       vec3(node.max[0], node.max[1], node.max[2]));
+    float area = halfArea(nodeBox);
+    if (bestAxis < 0 || TRAVERSAL_COST * area + bestCost >= node.count * area)
+        return;
+
+    // Partition the triangle range around the chosen plane
+    float lo = cbox.min[bestAxis];
+    float scale = BINS / (cbox.max[bestAxis] - lo);
+    unsigned int * first = &tree.indices[node.leftFirst];
+    unsigned int * mid = std::partition(first, first + node.count, [&](unsigned int tri) {
+        return std::min(BINS - 1, (int)((centroids[tri][bestAxis] - lo) * scale)) < bestSplit;
+    });
+
+    unsigned int leftCount = mid - first;
+    unsigned int childIndex = nodesUsed.fetch_add(2);
+
+    Node & left = tree.nodes[childIndex];
+    Node & right = tree.nodes[childIndex + 1];
+    left.leftFirst = node.leftFirst;
+    left.count = leftCount;
+    right.leftFirst = node.leftFirst + leftCount;
+    right.count = node.count - leftCount;
+
+    node.leftFirst = childIndex;
+    node.count = 0;
+
+    // Hand the left subtree to another thread while there are threads
+    // to spare and it is worth the trouble
+    bool spawn = false;
+    if (left.count >= PARALLEL_MIN) {
+        spawn = threadsLeft.fetch_sub(1) > 0;
+        if (!spawn)
+            threadsLeft++;
+    }
+
+    if (spawn) {
+        std::thread worker(&Builder::subdivide, this, childIndex, depth + 1);
+        subdivide(childIndex + 1, depth + 1);
+        worker.join();
+        threadsLeft++;
+    } else {
+        subdivide(childIndex, depth + 1);
+        subdivide(childIndex + 1, depth + 1);
+    }
+}
+
+
+/*
+ * Bvh
+ */
+Bvh::Bvh():
+    nodeCount(0)
+{
+}
+
+
+bool
+Bvh::build(const mesh::TriMesh & mesh, unsigned int threads)
+{
+    unsigned int count = mesh.vertices.size() / 3;
+    if (count == 0)
+        return false;
+
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // A binary tree over n leaves never needs more than 2n - 1 nodes
+    nodes.assign(2 * count + 1, Node());
+    indices.resize(count);
+    for (unsigned int i = 0; i < count; i++)
+        indices[i] = i;
+
+    Builder builder(*this, mesh, threads);
+
+    nodes[0].leftFirst = 0;
+    nodes[0].count = count;
+    builder.subdivide(0, 0);
+
+    nodeCount = builder.nodesUsed;
+    nodes.resize(nodeCount);
+
+    // Copy the triangles out in leaf order for the traversal
+    verts.resize(count * 3);
+    for (unsigned int i = 0; i < count; i++)
+        for (int k = 0; k < 3; k++)
+            verts[i * 3 + k] = mesh.vertices[indices[i] * 3 + k];
+
+    return true;
+}
+
+
+bool
+Bvh::refit(const mesh::TriMesh & mesh)
+{
+    if (mesh.vertices.size() != verts.size() || nodeCount == 0)
+        return false;
+
+    unsigned int count = indices.size();
+    for (unsigned int i = 0; i < count; i++)
+        for (int k = 0; k < 3; k++)
+            verts[i * 3 + k] = mesh.vertices[indices[i] * 3 + k];
+
+    // Children always come after their parent, so walking backwards
+    // sees them first. Node 1 is padding.
+    for (unsigned int i = nodeCount - 1; i != ~0u; i--) {
+        if (i == 1)
+            continue;
+
+        Node & node = nodes[i];
+        mesh::Aabb box;
+        if (node.isLeaf()) {
+            for (unsigned int t = 0; t < node.count * 3; t++)
+                box.add(verts[node.leftFirst * 3 + t]);
+        } else {
+            for (int c = 0; c < 2; c++) {
+                const Node & child = nodes[node.leftFirst + c];
+                box.add(vec3(child.min[0], child.min[1], child.min[2]));
+                box.add(vec3(child.max[0], child.max[1], child.max[2]));
+            }
+        }
+        setBounds(node, box.min, box.max);
+    }
+
+    return true;
+}
+
+
+void
+Bvh::setBounds(Node & node, const vec3 & min, const vec3 & max)
+{
+    for (int i = 0; i < 3; i++) {
+        node.min[i] = min[i];
+        node.max[i] = max[i];
+    }
+}
+
+
+/*
+ * Möller-Trumbore against every triangle in the leaf
+ */
+void
+Bvh::intersectLeaf(const Node & node, const Ray & ray, Hit & hit) const
+{
+    for (unsigned int i = node.leftFirst; i < node.leftFirst + node.count; i++) {
+        const vec3 & v0 = verts[i * 3];
+        vec3 e1 = verts[i * 3 + 1] - v0;
+        vec3 e2 = verts[i * 3 + 2] - v0;
+
+        vec3 p = glm::cross(ray.dir, e2);
+        float det = glm::dot(e1, p);
+        if (fabsf(det) < 1e-12f)
+            continue;
+
+        float inv = 1.0f / det;
+        vec3 s = ray.origin - v0;
+        float u = glm::dot(s, p) * inv;
+        if (u < 0.0f || u > 1.0f)
+            continue;
+
+        vec3 q = glm::cross(s, e1);
+        float v = glm::dot(ray.dir, q) * inv;
+        if (v < 0.0f || u + v > 1.0f)
+            continue;
+
+        float t = glm::dot(e2, q) * inv;
+        if (t > 0.0f && t < hit.t) {
+            hit.t = t;
+            hit.u = u;
+            hit.v = v;
+            hit.triangle = indices[i];
+        }
+    }
+}
+
+
+/*
+ * Slab test. Returns the entry distance, or FLT_MAX on a miss.
+ */
+#ifdef __SSE2__
+
+struct RaySse
+{
+    RaySse(const Ray & ray)
+    {
+        vec3 inv = 1.0f / ray.dir;
+        origin = _mm_set_ps(0.0f, ray.origin.z, ray.origin.y, ray.origin.x);
+        invDir = _mm_set_ps(0.0f, inv.z, inv.y, inv.x);
+        xyz = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+    }
+
+    __m128 origin, invDir;
+    __m128 xyz;             // clears the fourth lane
+};
+
+static inline float
+slab(const Node & node, const RaySse & ray, float tmax)
+{
+    // The fourth lane loads leftFirst/count; mask it off so the integer
+    // bits never get treated as (denormal) floats
+    __m128 min = _mm_and_ps(_mm_loadu_ps(node.min), ray.xyz);
+    __m128 max = _mm_and_ps(_mm_loadu_ps(node.max), ray.xyz);
+    __m128 t1 = _mm_mul_ps(_mm_sub_ps(min, ray.origin), ray.invDir);
+    __m128 t2 = _mm_mul_ps(_mm_sub_ps(max, ray.origin), ray.invDir);
+    __m128 lo = _mm_min_ps(t1, t2);
+    __m128 hi = _mm_max_ps(t1, t2);
+
+    // Only x, y and z count
+    float near = _mm_cvtss_f32(_mm_max_ss(_mm_max_ss(lo, _mm_shuffle_ps(lo, lo, 1)),
+                                          _mm_shuffle_ps(lo, lo, 2)));
+    float far = _mm_cvtss_f32(_mm_min_ss(_mm_min_ss(hi, _mm_shuffle_ps(hi, hi, 1)),
+                                         _mm_shuffle_ps(hi, hi, 2)));
+
+    return (far >= near && far > 0.0f && near < tmax) ? near : FLT_MAX;
+}
+
+#else
+
+struct RaySse
+{
+    RaySse(const Ray & ray):origin(ray.origin), invDir(1.0f / ray.dir) {}
+
+    vec3 origin, invDir;
+};
+
+static inline float
+slab(const Node & node, const RaySse & ray, float tmax)
+{
+    float near = -FLT_MAX, far = FLT_MAX;
+    for (int i = 0; i < 3; i++) {
+        float t1 = (node.min[i] - ray.origin[i]) * ray.invDir[i];
+        float t2 = (node.max[i] - ray.origin[i]) * ray.invDir[i];
+        near = std::max(near, std::min(t1, t2));
+        far = std::min(far, std::max(t1, t2));
+    }
+
+    return (far >= near && far > 0.0f && near < tmax) ? near : FLT_MAX;
+}
+
+#endif
+
+
+bool
+Bvh::intersect(const Ray & ray, Hit & hit) const
+{
+    if (nodeCount == 0)
+        return false;
+
+    hit = Hit();
+    hit.t = ray.tmax;
+
+    RaySse r(ray);
+    if (slab(nodes[0], r, hit.t) == FLT_MAX)
+        return false;
+
+    const Node * stack[STACK_SIZE];
+    int top = 0;
+    const Node * node = &nodes[0];
+
+    while (true) {
+        if (node->isLeaf()) {
+            intersectLeaf(*node, ray, hit);
+            if (top == 0)
+                break;
+            node = stack[--top];
+            continue;
+        }
+
+        // Nearer child first; the other waits on the stack
+        const Node * a = &nodes[node->leftFirst];
+        const Node * b = a + 1;
+        float da = slab(*a, r, hit.t);
+        float db = slab(*b, r, hit.t);
+        if (da > db) {
+            std::swap(a, b);
+            std::swap(da, db);
+        }
+
+        if (da == FLT_MAX) {
+            if (top == 0)
+                break;
+            node = stack[--top];
+        } else {
+            node = a;
+            if (db != FLT_MAX)
+                stack[top++] = b;
+        }
+    }
+
+    return hit.valid();
+}
+
+
+Ray
+screenRay(int x, int y, int width, int height, const mat4 & view, const mat4 & proj)
+{
+    glm::vec4 viewport(0, 0, width, height);
+    vec3 win(x + 0.5f, height - y - 0.5f, 0.0f);
+
+    vec3 near = glm::unProject(win, view, proj, viewport);
+    win.z = 1.0f;
+    vec3 far = glm::unProject(win, view, proj, viewport);
+
+    return Ray(near, glm::normalize(far - near));
+}
+
+}
@@ -0,0 +1,495 @@
+/*
+ * CommandBuffer.cpp
+ *
+ * A list's blocks are written by one recording thread and, once the
+ * frame is submitted, read by the GL thread. The queue's lock orders
+ * the two; it is taken once a frame by each side, never per command.
+ */
+#include "CommandBuffer.hpp"
+
+#include <string.h>
+#include <algorithm>
+
+#include "Profiler.hpp"
+#include "Stats.hpp"
+
+namespace render {
+
+const size_t CommandList::BLOCK_SIZE;
+
+// Commands are padded to this so headers stay aligned
+static const size_t COMMAND_ALIGN = 8;
+
+// What the uniform stream starts with; it grows to fit a frame
+static const GLsizeiptr UNIFORM_CAPACITY = 1 << 20;
+
+
+/*
+ * GL backend
+ */
+GLCommandBackend::GLCommandBackend():
+    buffer(0),
+    capacity(0),
+    offset(0),
+    needed(UNIFORM_CAPACITY),
+    alignment(256),
+    program(0),
+    vao(0)
+{
+    glGenBuffers(1, &buffer);
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    alignment = std::max(alignment, (GLint)1);
+}
+
+
+GLCommandBackend::~GLCommandBackend()
+{
+    glDeleteBuffers(1, &buffer);
+}
+
+
+void
+GLCommandBackend::beginFrame()
+{
+    // Orphan last frame's storage rather than wait for the draws using
+    // it, at a size that would have held all of last frame
+    while (capacity < needed)
+        capacity = std::max(capacity * 2, UNIFORM_CAPACITY);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferData(GL_UNIFORM_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+    STATS_COUNT(BUFFER_BINDS, 1);
+    offset = 0;
+    needed = 0;
+
+    // Whatever ran outside the queue may have changed these
+    program = ~0u;
+    vao = ~0u;
+}
+
+
+void
+GLCommandBackend::bindProgram(const BindProgram & cmd)
+{
+    if (cmd.program == program)
+        return;
+    glUseProgram(cmd.program);
+    STATS_COUNT(PROGRAM_BINDS, 1);
+    program = cmd.program;
+}
+
+
+void
+GLCommandBackend::uniformBlock(const UniformBlock & cmd, const void * data)
+{
+    GLsizeiptr start = (offset + alignment - 1) / alignment * alignment;
+    needed += start - offset + cmd.size;
+
+    // Draw callbacks may have bound their own uniform buffer since
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    if (start + cmd.size > capacity) {
+        // Out of room: orphan again, the draws so far keep the old copy
+        capacity = std::max(capacity, (GLsizeiptr)cmd.size);
+        glBufferData(GL_UNIFORM_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+        start = 0;
+    }
+
+    glBufferSubData(GL_UNIFORM_BUFFER, start, cmd.size, data);
+    glBindBufferRange(GL_UNIFORM_BUFFER, cmd.binding, buffer, start, cmd.size);
+    offset = start + cmd.size;
+
+    STATS_COUNT(UNIFORM_UPDATES, 1);
+    STATS_COUNT(BUFFER_UPLOADS, 1);
+    STATS_COUNT(BUFFER_BYTES, cmd.size);
+}
+
+
+void
+GLCommandBackend::bindTexture(const BindTexture & cmd)
+{
+    glActiveTexture(GL_TEXTURE0 + cmd.unit);
+    glBindTexture(cmd.target, cmd.texture);
+    STATS_COUNT(TEXTURE_BINDS, 1);
+}
+
+
+void
+GLCommandBackend::bindVao(const BindVao & cmd)
+{
+    if (cmd.vao == vao)
+        return;
+    glBindVertexArray(cmd.vao);
+    STATS_COUNT(VERTEX_ARRAY_BINDS, 1);
+    vao = cmd.vao;
+}
+
+
+void
+GLCommandBackend::draw(const Draw & cmd)
+{
+    if (cmd.indexType == 0) {
+        if (cmd.instances == 1)
+            glDrawArrays(cmd.mode, cmd.first, cmd.count);
+        else
+            glDrawArraysInstanced(cmd.mode, cmd.first, cmd.count, cmd.instances);
+    } else {
+        const GLvoid * indices = (const GLubyte *)NULL + cmd.offset;
+        if (cmd.instances == 1)
+            glDrawElements(cmd.mode, cmd.count, cmd.indexType, indices);
+        else
+            glDrawElementsInstanced(cmd.mode, cmd.count, cmd.indexType, indices, cmd.instances);
+    }
+    STATS_COUNT(DRAW_CALLS, 1);
+    STATS_COUNT(VERTICES, cmd.count * cmd.instances);
+}
+
+
+void
+GLCommandBackend::bindFramebuffer(const BindFramebuffer & cmd)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, cmd.framebuffer);
+    glViewport(cmd.x, cmd.y, cmd.width, cmd.height);
+    STATS_COUNT(FRAMEBUFFER_BINDS, 1);
+    if (cmd.clear) {
+        glClearColor(cmd.color[0], cmd.color[1], cmd.color[2], cmd.color[3]);
+        glClear(cmd.clear);
+    }
+}
+
+
+/*
+ * Command list
+ */
+CommandList::CommandList():
+    current(0),
+    count(0),
+    used(0)
+{
+}
+
+
+CommandList::~CommandList()
+{
+    for (unsigned int i = 0; i < blocks.size(); i++)
+        delete [] blocks[i].data;
+}
+
+
+void *
+CommandList::push(CommandType type, size_t payload)
+{
+    size_t size = (sizeof(CommandHeader) + payload + COMMAND_ALIGN - 1) & ~(COMMAND_ALIGN - 1);
+
+    // The next block that fits, adding one if none does
+    while (current < blocks.size() && blocks[current].used + size > blocks[current].size)
+        current++;
+    if (current == blocks.size()) {
+        Block block;
+        block.size = std::max(BLOCK_SIZE, size);
+        block.data = new char[block.size];
+        block.used = 0;
+        blocks.push_back(block);
+    }
+
+    Block & block = blocks[current];
+    CommandHeader * header = (CommandHeader *)(block.data + block.used);
+    header->type = type;
+    header->size = size;
+    block.used += size;
+    used += size;
+    count++;
+    return header + 1;
+}
+
+
+void
+CommandList::bindProgram(GLuint program)
+{
+    BindProgram * cmd = (BindProgram *)push(CMD_BIND_PROGRAM, sizeof(BindProgram));
+    cmd->program = program;
+}
+
+
+void
+CommandList::uniformBlock(GLuint binding, const void * data, GLuint size)
+{
+    UniformBlock * cmd = (UniformBlock *)push(CMD_UNIFORM_BLOCK, sizeof(UniformBlock) + size);
+    cmd->binding = binding;
+    cmd->size = size;
+    memcpy(cmd + 1, data, size);
+}
+
+
+void
+CommandList::bindTexture(GLuint unit, GLenum target, GLuint texture)
+{
+    BindTexture * cmd = (BindTexture *)push(CMD_BIND_TEXTURE, sizeof(BindTexture));
+    cmd->unit = unit;
+    cmd->target = target;
+    cmd->texture = texture;
+}
+
+
+void
+CommandList::bindVao(GLuint vao)
+{
+    BindVao * cmd = (BindVao *)push(CMD_BIND_VAO, sizeof(BindVao));
+    cmd->vao = vao;
+}
+
+
+void
+CommandList::draw(GLenum mode, GLint first, GLsizei count, GLsizei instances)
+{
+    Draw * cmd = (Draw *)push(CMD_DRAW, sizeof(Draw));
+    cmd->mode = mode;
+    cmd->indexType = 0;
+    cmd->first = first;
+    cmd->count = count;
+    cmd->instances = instances;
+    cmd->offset = 0;
+}
+
+
+void
+CommandList::drawElements(GLenum mode, GLsizei count, GLenum type, GLuint offset, GLsizei instances)
+{
+    Draw * cmd = (Draw *)push(CMD_DRAW, sizeof(Draw));
+    cmd->mode = mode;
+    cmd->indexType = type;
+    cmd->first = 0;
+    cmd->count = count;
+    cmd->instances = instances;
+    cmd->offset = offset;
+}
+
+
+void
+CommandList::bindFramebuffer(GLuint framebuffer, GLint x, GLint y, GLsizei width, GLsizei height,
+                             GLbitfield clear, const GLfloat * color)
+{
+    BindFramebuffer * cmd = (BindFramebuffer *)push(CMD_BIND_FRAMEBUFFER, sizeof(BindFramebuffer));
+    cmd->framebuffer = framebuffer;
+    cmd->x = x;
+    cmd->y = y;
+    cmd->width = width;
+    cmd->height = height;
+    cmd->clear = clear;
+    for (int i = 0; i < 4; i++)
+        cmd->color[i] = color ? color[i] : 0.0f;
+}
+
+
+void
+CommandList::execute(CommandBackend & backend) const
+{
+    for (unsigned int b = 0; b <= current && b < blocks.size(); b++) {
+        const char * at = blocks[b].data;
+        const char * end = at + blocks[b].used;
+        while (at < end) {
+            const CommandHeader * header = (const CommandHeader *)at;
+            const void * cmd = header + 1;
+            switch (header->type) {
+            case CMD_BIND_PROGRAM:
+                backend.bindProgram(*(const BindProgram *)cmd);
+                break;
+            case CMD_UNIFORM_BLOCK:
+                backend.uniformBlock(*(const UniformBlock *)cmd, (const UniformBlock *)cmd + 1);
+                break;
+            case CMD_BIND_TEXTURE:
+                backend.bindTexture(*(const BindTexture *)cmd);
+                break;
+            case CMD_BIND_VAO:
+                backend.bindVao(*(const BindVao *)cmd);
+                break;
+            case CMD_DRAW:
+                backend.draw(*(const Draw *)cmd);
+                break;
+            case CMD_BIND_FRAMEBUFFER:
+                backend.bindFramebuffer(*(const BindFramebuffer *)cmd);
+                break;
+            }
+            at += header->size;
+        }
+    }
+}
+
+
+void
+CommandList::reset()
+{
+    for (unsigned int i = 0; i < blocks.size(); i++)
+        blocks[i].used = 0;
+    current = 0;
+    count = 0;
+    used = 0;
+}
+
+
+size_t
+CommandList::reserved() const
+{
+    size_t total = 0;
+    for (unsigned int i = 0; i < blocks.size(); i++)
+        total += blocks[i].size;
+    return total;
+}
+
+
+/*
+ * Command buffer
+ */
+CommandBuffer::CommandBuffer(unsigned int count)
+{
+    for (unsigned int i = 0; i < std::max(count, 1u); i++)
+        lists.push_back(new CommandList);
+}
+
+
+CommandBuffer::~CommandBuffer()
+{
+    for (unsigned int i = 0; i < lists.size(); i++)
+        delete lists[i];
+}
+
+
+void
+CommandBuffer::execute(CommandBackend & backend) const
+{
+    backend.beginFrame();
+    for (unsigned int i = 0; i < lists.size(); i++)
+        lists[i]->execute(backend);
+    backend.endFrame();
+}
+
+
+void
+CommandBuffer::reset()
+{
+    for (unsigned int i = 0; i < lists.size(); i++)
+        lists[i]->reset();
+}
+
+
+unsigned int
+CommandBuffer::size() const
+{
+    unsigned int total = 0;
+    for (unsigned int i = 0; i < lists.size(); i++)
+        total += lists[i]->size();
+    return total;
+}
+
+
+/*
+ * Queue
+ */
+CommandQueue::CommandQueue(unsigned int lists):
+    ready(NULL),
+    stopping(false)
+{
+    buffers[0] = new CommandBuffer(lists);
+    buffers[1] = new CommandBuffer(lists);
+    recording = buffers[0];
+    stats.frames = 0;
+    stats.submitWait = 0.0;
+    stats.executeTime = 0.0;
+}
+
+
+CommandQueue::~CommandQueue()
+{
+    stop();
+    delete buffers[0];
+    delete buffers[1];
+}
+
+
+void
+CommandQueue::submit()
+{
+    double start = profile::now();
+    std::unique_lock<std::mutex> guard(lock);
+    while (ready)
+        changed.wait(guard);
+    stats.submitWait += profile::now() - start;
+
+    // The other buffer was replayed and emptied by now
+    ready = recording;
+    recording = recording == buffers[0] ? buffers[1] : buffers[0];
+    changed.notify_all();
+}
+
+
+void
+CommandQueue::finish()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while (ready)
+        changed.wait(guard);
+}
+
+
+bool
+CommandQueue::executeNext(CommandBackend & backend)
+{
+    CommandBuffer * frame;
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        while (!ready && !stopping)
+            changed.wait(guard);
+        if (!ready)
+            return false;
+        frame = ready;
+    }
+
+    // ready stays set, so the recording side leaves this one alone
+    double start = profile::now();
+    frame->execute(backend);
+    frame->reset();
+    double time = profile::now() - start;
+
+    std::lock_guard<std::mutex> guard(lock);
+    ready = NULL;
+    stats.frames++;
+    stats.executeTime += time;
+    changed.notify_all();
+    return true;
+}
+
+
+void
+CommandQueue::start(CommandBackend & backend, const Function & begin, const Function & present, const Function & end)
+{
+    thread = std::thread([this, &backend, begin, present, end]() {
+        if (begin)
+            begin();
+        while (executeNext(backend))
+            if (present)
+                present();
+        if (end)
+            end();
+    });
+}
+
+
+void
+CommandQueue::stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+        changed.notify_all();
+    }
+    if (thread.joinable())
+        thread.join();
+}
+
+
+QueueStats
+CommandQueue::getStats()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return stats;
+}
+
+}
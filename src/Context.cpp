@@ -0,0 +1,494 @@
+/*
+ * Context.cpp
+ *
+ * See Context.hpp for the command line options.
+ */
+#include "Context.hpp"
+
+#ifdef HAVE_EGL
+    #include <EGL/egl.h>
+    #include <EGL/eglext.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <vector>
+
+#include "imageUtil.hpp"
+#include "Profiler.hpp"
+#include "Stats.hpp"
+
+namespace context {
+
+/*
+ * Shared frame handling
+ */
+Context::Context(const Options & options):
+    options(options),
+    frame(0)
+{
+}
+
+
+void
+Context::swapBuffers()
+{
+    if (!options.capture.empty())
+        writeFrame();
+
+    present();
+    frame++;
+
+    stats::endFrame();
+    if (options.stats)
+        showStats(stats::format(stats::getLastFrame()));
+
+    if (!options.profile.empty()) {
+        profile::endFrame();
+        profile::beginFrame();
+    }
+}
+
+
+bool
+Context::isRunning()
+{
+    if (options.frames > 0 && frame >= options.frames)
+        return false;
+
+    return isOpen();
+}
+
+
+double
+Context::getTime()
+{
+    // Fixed frame counts are used for captures and automated runs, so
+    // animation has to be independent of how fast the frames come out
+    if (options.frames > 0)
+        return frame * options.timestep;
+
+    return getWallTime();
+}
+
+
+void
+Context::getMousePos(int * x, int * y)
+{
+    if (x) *x = 0;
+    if (y) *y = 0;
+}
+
+
+bool
+Context::initGlew()
+{
+    glewExperimental = GL_TRUE;
+
+    // GLEW 2.1+ built for GLX loads the GL entry points first and then
+    // fails on the GLX ones when there is no X display, which is what an
+    // EGL context on a display-less machine looks like
+    GLenum err = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    if( err == GLEW_ERROR_NO_GLX_DISPLAY )
+        err = GLEW_OK;
+#endif
+    if( err != GLEW_OK )
+    {
+        fprintf( stderr, "Failed to initialize GLEW: %s\n",
+                         glewGetErrorString(err));
+        return false;
+    }
+
+    return true;
+}
+
+
+void
+Context::startProfiling()
+{
+    if (options.profile.empty())
+        return;
+
+    profile::setEnabled(true);
+    profile::setDrawScopes(options.profileDraws);
+    profile::beginFrame();
+}
+
+
+void
+Context::stopProfiling()
+{
+    if (options.profile.empty() || !profile::isEnabled())
+        return;
+
+    profile::printReport();
+    profile::writeChromeTrace(options.profile.c_str());
+    profile::setEnabled(false);
+}
+
+
+void
+Context::showStats(const string & line)
+{
+    printf("frame %d: %s\n", frame, line.c_str());
+}
+
+
+/*
+ * Read back whatever the demo drew this frame and save it as a PNG
+ */
+bool
+Context::writeFrame()
+{
+    int width, height;
+    getSize(&width, &height);
+
+    GLuint screen = Fbo::getDefaultFramebuffer();
+    std::vector<GLubyte> pixels(width * height * 4);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, screen);
+    glReadBuffer(screen ? GL_COLOR_ATTACHMENT0 : GL_BACK);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, &pixels.front());
+
+    char name[32];
+    snprintf(name, sizeof(name), "%04d.png", frame);
+
+    return util::image::saveImage((options.capture + name).c_str(), width, height, &pixels.front());
+}
+
+
+/*
+ * GLFW backend
+ */
+bool
+GlfwContext::open(int width, int height, const char * title)
+{
+    // Initialise GLFW
+    if( !glfwInit() )
+    {
+        fprintf( stderr, "Failed to initialize GLFW\n" );
+        return false;
+    }
+
+    // We need this to get the code to compile+run on MacOSX. I have yet
+    // to confirm if this works on Linux...
+
+#ifdef __APPLE__
+    glfwOpenWindowHint(GLFW_OPENGL_VERSION_MAJOR, 3);
+    glfwOpenWindowHint(GLFW_OPENGL_VERSION_MINOR, 2);
+    glfwOpenWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwOpenWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+
+    // Open a window and create its OpenGL context
+    if( !glfwOpenWindow( width, height, 8,8,8,8,24,8, GLFW_WINDOW ) )
+    {
+        fprintf( stderr, "Failed to open GLFW window\n" );
+
+        glfwTerminate();
+        return false;
+    }
+
+    if (!initGlew())
+        return false;
+
+    this->title = title;
+    glfwSetWindowTitle( title );
+
+    // Ensure we can capture the escape key being pressed
+    glfwEnable( GLFW_STICKY_KEYS );
+
+    if (!options.capture.empty())
+        ilInit();
+
+    startProfiling();
+
+    return true;
+}
+
+
+void
+GlfwContext::close()
+{
+    stopProfiling();
+    glfwTerminate();
+}
+
+
+void
+GlfwContext::getSize(int * width, int * height)
+{
+    glfwGetWindowSize(width, height);
+}
+
+
+void
+GlfwContext::setSwapInterval(int interval)
+{
+    glfwSwapInterval(interval);
+}
+
+
+int
+GlfwContext::getKey(int key)
+{
+    return glfwGetKey(key);
+}
+
+
+int
+GlfwContext::getMouseButton(int button)
+{
+    return glfwGetMouseButton(button);
+}
+
+
+void
+GlfwContext::getMousePos(int * x, int * y)
+{
+    glfwGetMousePos(x, y);
+}
+
+
+void
+GlfwContext::present()
+{
+    glfwSwapBuffers();
+}
+
+
+bool
+GlfwContext::isOpen()
+{
+    return glfwGetKey( GLFW_KEY_ESC ) != GLFW_PRESS &&
+           glfwGetWindowParam( GLFW_OPENED );
+}
+
+
+double
+GlfwContext::getWallTime()
+{
+    return glfwGetTime();
+}
+
+
+void
+GlfwContext::showStats(const string & line)
+{
+    // Poor man's overlay
+    glfwSetWindowTitle( (title + " - " + line).c_str() );
+}
+
+
+#ifdef HAVE_EGL
+
+/*
+ * EGL backend
+ */
+EglContext::EglContext(const Options & options):
+    Context(options),
+    display(0),
+    surface(0),
+    ctx(0),
+    width(0),
+    height(0)
+{
+}
+
+
+EglContext::~EglContext()
+{
+    close();
+}
+
+
+bool
+EglContext::open(int width, int height, const char * title)
+{
+    this->width = width;
+    this->height = height;
+
+    // Prefer Mesa's surfaceless platform; it needs neither X nor a GPU
+    EGLDisplay dpy = EGL_NO_DISPLAY;
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+    if (getPlatformDisplay)
+        dpy = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if (dpy == EGL_NO_DISPLAY)
+        dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint major, minor;
+    if (dpy == EGL_NO_DISPLAY || !eglInitialize(dpy, &major, &minor)) {
+        fprintf( stderr, "Failed to initialize EGL\n" );
+        return false;
+    }
+
+    const char * extensions = eglQueryString(dpy, EGL_EXTENSIONS);
+    bool surfaceless = extensions && strstr(extensions, "EGL_KHR_surfaceless_context");
+
+    eglBindAPI(EGL_OPENGL_API);
+
+    EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE,       surfaceless ? 0 : EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE,    EGL_OPENGL_BIT,
+        EGL_RED_SIZE,           8,
+        EGL_GREEN_SIZE,         8,
+        EGL_BLUE_SIZE,          8,
+        EGL_ALPHA_SIZE,         8,
+        EGL_DEPTH_SIZE,         24,
+        EGL_NONE
+    };
+
+    EGLConfig config;
+    EGLint numConfigs;
+    if (!eglChooseConfig(dpy, configAttribs, &config, 1, &numConfigs) || numConfigs < 1) {
+        fprintf( stderr, "No suitable EGL config\n" );
+        eglTerminate(dpy);
+        return false;
+    }
+
+    EGLSurface surf = EGL_NO_SURFACE;
+    if (!surfaceless) {
+        EGLint pbufferAttribs[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+        surf = eglCreatePbufferSurface(dpy, config, pbufferAttribs);
+    }
+
+    EGLContext context = eglCreateContext(dpy, config, EGL_NO_CONTEXT, NULL);
+    if (context == EGL_NO_CONTEXT || !eglMakeCurrent(dpy, surf, surf, context)) {
+        fprintf( stderr, "Failed to create EGL context\n" );
+        eglTerminate(dpy);
+        return false;
+    }
+
+    display = dpy;
+    surface = surf;
+    ctx = context;
+
+    if (!initGlew())
+        return false;
+
+    // Everything the demo draws to "the screen" lands in this FBO
+    if (!target.create(width, height, 1)) {
+        fprintf( stderr, "Failed to create the offscreen target\n" );
+        return false;
+    }
+
+    Fbo::setDefaultFramebuffer(target.getHandle());
+    glBindFramebuffer(GL_FRAMEBUFFER, target.getHandle());
+    glViewport(0, 0, width, height);
+
+    if (!options.capture.empty())
+        ilInit();
+
+    printf("Headless context for \"%s\" (%dx%d, EGL %d.%d%s)\n", title,
+           width, height, major, minor, surfaceless ? ", surfaceless" : "");
+
+    startProfiling();
+
+    return true;
+}
+
+
+void
+EglContext::close()
+{
+    if (!display)
+        return;
+
+    stopProfiling();
+
+    Fbo::setDefaultFramebuffer(0);
+    target.reset();
+
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (ctx)
+        eglDestroyContext(display, ctx);
+    if (surface)
+        eglDestroySurface(display, surface);
+    eglTerminate(display);
+
+    display = surface = ctx = 0;
+}
+
+
+void
+EglContext::getSize(int * width, int * height)
+{
+    *width = this->width;
+    *height = this->height;
+}
+
+
+void
+EglContext::present()
+{
+    // Nothing to show; just make sure the frame is actually rendered
+    glFinish();
+}
+
+
+double
+EglContext::getWallTime()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+#endif
+
+
+Context *
+createContext(int & argc, char * argv[])
+{
+    Options options;
+    int kept = 1;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+
+        if (arg == "--headless") {
+            options.headless = true;
+        } else if (arg == "--frames" && i + 1 < argc) {
+            options.frames = atoi(argv[++i]);
+        } else if (arg == "--timestep" && i + 1 < argc) {
+            options.timestep = atof(argv[++i]);
+        } else if (arg == "--capture" && i + 1 < argc) {
+            options.capture = argv[++i];
+        } else if (arg == "--profile" && i + 1 < argc) {
+            options.profile = argv[++i];
+        } else if (arg == "--profile-draws") {
+            options.profileDraws = true;
+        } else if (arg == "--stats") {
+            options.stats = true;
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+
+    argc = kept;
+    argv[argc] = NULL;
+
+    if (options.stats && !stats::ENABLED)
+        fprintf( stderr, "--stats needs a GL_STATS build (scons stats=1)\n" );
+
+    if (options.headless) {
+#ifdef HAVE_EGL
+        if (options.frames <= 0)
+            options.frames = 1;
+
+        return new EglContext(options);
+#else
+        fprintf( stderr, "Built without EGL; falling back to a window\n" );
+#endif
+    }
+
+    return new GlfwContext(options);
+}
+
+}
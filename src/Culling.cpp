@@ -0,0 +1,378 @@
+/*
+ * Culling.cpp
+ *
+ * All three paths run the same test: an object is outside if, for any
+ * plane, dot(n, center) + w + r < 0, where r is the sphere radius or
+ * the box's projected half size |n.x| ex + |n.y| ey + |n.z| ez.
+ */
+#include "Culling.hpp"
+
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "ParallelFor.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define CULL_X86
+    #include <immintrin.h>
+#endif
+
+namespace cull {
+
+Isa
+getBestIsa()
+{
+#ifdef CULL_X86
+    static Isa best = __builtin_cpu_supports("avx") ? AVX :
+                      __builtin_cpu_supports("sse2") ? SSE : SCALAR;
+    return best;
+#else
+    return SCALAR;
+#endif
+}
+
+
+const char *
+getIsaName(Isa isa)
+{
+    switch (isa) {
+    case SCALAR:    return "scalar";
+    case SSE:       return "sse";
+    case AVX:       return "avx";
+    case NEON:      return "neon";
+    default:        return getIsaName(getBestIsa());
+    }
+}
+
+
+/*
+ * Frustum
+ */
+Frustum::Frustum(const mat4 & m)
+{
+    // Gribb & Hartmann: the planes are sums/differences of the rows
+    vec4 row[4];
+    for (int i = 0; i < 4; i++)
+        row[i] = vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+
+    planes[0] = row[3] + row[0];
+    planes[1] = row[3] - row[0];
+    planes[2] = row[3] + row[1];
+    planes[3] = row[3] - row[1];
+    planes[4] = row[3] + row[2];
+    planes[5] = row[3] - row[2];
+
+    for (int i = 0; i < 6; i++)
+        planes[i] /= glm::length(vec3(planes[i]));
+}
+
+
+bool
+Frustum::testAabb(const vec3 & center, const vec3 & extent) const
+{
+    for (int i = 0; i < 6; i++) {
+        const vec4 & n = planes[i];
+
+        // Summed in the same order as the SIMD paths so they agree exactly
+        float d = (n.x * center.x + n.y * center.y) + (n.z * center.z + n.w);
+        float r = (fabsf(n.x) * extent.x + fabsf(n.y) * extent.y) + fabsf(n.z) * extent.z;
+        if (d + r < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+
+bool
+Frustum::testSphere(const vec3 & center, float radius) const
+{
+    for (int i = 0; i < 6; i++) {
+        const vec4 & n = planes[i];
+        float d = (n.x * center.x + n.y * center.y) + (n.z * center.z + n.w);
+        if (d + radius < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+
+/*
+ * BoundsArray
+ */
+unsigned int
+BoundsArray::add(const mesh::Aabb & box, const mat4 & model)
+{
+    vec3 center = box.center();
+    vec3 extent = box.extent();
+
+    // Arvo: the new half extents are |M| times the old ones
+    vec3 worldCenter = vec3(model * vec4(center, 1.0f));
+    vec3 worldExtent;
+    for (int i = 0; i < 3; i++)
+        worldExtent[i] = fabsf(model[0][i]) * extent.x +
+                         fabsf(model[1][i]) * extent.y +
+                         fabsf(model[2][i]) * extent.z;
+
+    return add(worldCenter, worldExtent);
+}
+
+
+unsigned int
+BoundsArray::add(const vec3 & center, const vec3 & extent)
+{
+    cx.push_back(center.x);
+    cy.push_back(center.y);
+    cz.push_back(center.z);
+    ex.push_back(extent.x);
+    ey.push_back(extent.y);
+    ez.push_back(extent.z);
+    radius.push_back(glm::length(extent));
+
+    return cx.size() - 1;
+}
+
+
+void
+BoundsArray::set(unsigned int index, const vec3 & center, const vec3 & extent)
+{
+    cx[index] = center.x;
+    cy[index] = center.y;
+    cz[index] = center.z;
+    ex[index] = extent.x;
+    ey[index] = extent.y;
+    ez[index] = extent.z;
+    radius[index] = glm::length(extent);
+}
+
+
+void
+BoundsArray::reserve(unsigned int count)
+{
+    cx.reserve(count);
+    cy.reserve(count);
+    cz.reserve(count);
+    ex.reserve(count);
+    ey.reserve(count);
+    ez.reserve(count);
+    radius.reserve(count);
+}
+
+
+void
+BoundsArray::clear()
+{
+    cx.clear();
+    cy.clear();
+    cz.clear();
+    ex.clear();
+    ey.clear();
+    ez.clear();
+    radius.clear();
+}
+
+
+/*
+ * Kernels. Each handles [begin, end); the SIMD ones do whole blocks and
+ * leave the tail to the scalar one.
+ */
+template <bool Sphere>
+static unsigned int
+cullScalar(const Frustum & f, const BoundsArray & b, unsigned char * visible,
+           unsigned int begin, unsigned int end)
+{
+    unsigned int count = 0;
+    for (unsigned int i = begin; i < end; i++) {
+        vec3 center(b.cx[i], b.cy[i], b.cz[i]);
+        bool in = Sphere ? f.testSphere(center, b.radius[i])
+                         : f.testAabb(center, vec3(b.ex[i], b.ey[i], b.ez[i]));
+        visible[i] = in;
+        count += in;
+    }
+    return count;
+}
+
+
+#ifdef CULL_X86
+
+template <bool Sphere>
+__attribute__((target("sse2"))) static unsigned int
+cullSse(const Frustum & f, const BoundsArray & b, unsigned char * visible,
+        unsigned int begin, unsigned int end)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    unsigned int count = 0;
+    unsigned int i = begin;
+
+    for (; i + 4 <= end; i += 4) {
+        __m128 cx = _mm_loadu_ps(&b.cx[i]);
+        __m128 cy = _mm_loadu_ps(&b.cy[i]);
+        __m128 cz = _mm_loadu_ps(&b.cz[i]);
+        __m128 ex, ey, ez, rad;
+        if (Sphere) {
+            rad = _mm_loadu_ps(&b.radius[i]);
+        } else {
+            ex = _mm_loadu_ps(&b.ex[i]);
+            ey = _mm_loadu_ps(&b.ey[i]);
+            ez = _mm_loadu_ps(&b.ez[i]);
+        }
+
+        __m128 inside = _mm_cmpeq_ps(zero, zero);
+        for (int p = 0; p < 6; p++) {
+            __m128 nx = _mm_set1_ps(f.planes[p].x);
+            __m128 ny = _mm_set1_ps(f.planes[p].y);
+            __m128 nz = _mm_set1_ps(f.planes[p].z);
+
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)),
+                                  _mm_add_ps(_mm_mul_ps(nz, cz), _mm_set1_ps(f.planes[p].w)));
+            __m128 r;
+            if (Sphere) {
+                r = rad;
+            } else {
+                r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask, nx), ex),
+                                          _mm_mul_ps(_mm_andnot_ps(signMask, ny), ey)),
+                               _mm_mul_ps(_mm_andnot_ps(signMask, nz), ez));
+            }
+
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(d, r), zero));
+            if (!_mm_movemask_ps(inside))
+                break;
+        }
+
+        int mask = _mm_movemask_ps(inside);
+        for (int k = 0; k < 4; k++)
+            visible[i + k] = (mask >> k) & 1;
+        count += __builtin_popcount(mask);
+    }
+
+    return count + cullScalar<Sphere>(f, b, visible, i, end);
+}
+
+
+template <bool Sphere>
+__attribute__((target("avx"))) static unsigned int
+cullAvx(const Frustum & f, const BoundsArray & b, unsigned char * visible,
+        unsigned int begin, unsigned int end)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    unsigned int count = 0;
+    unsigned int i = begin;
+
+    for (; i + 8 <= end; i += 8) {
+        __m256 cx = _mm256_loadu_ps(&b.cx[i]);
+        __m256 cy = _mm256_loadu_ps(&b.cy[i]);
+        __m256 cz = _mm256_loadu_ps(&b.cz[i]);
+        __m256 ex, ey, ez, rad;
+        if (Sphere) {
+            rad = _mm256_loadu_ps(&b.radius[i]);
+        } else {
+            ex = _mm256_loadu_ps(&b.ex[i]);
+            ey = _mm256_loadu_ps(&b.ey[i]);
+            ez = _mm256_loadu_ps(&b.ez[i]);
+        }
+
+        __m256 inside = _mm256_cmp_ps(zero, zero, _CMP_EQ_OQ);
+        for (int p = 0; p < 6; p++) {
+            __m256 nx = _mm256_set1_ps(f.planes[p].x);
+            __m256 ny = _mm256_set1_ps(f.planes[p].y);
+            __m256 nz = _mm256_set1_ps(f.planes[p].z);
+
+            __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, cx), _mm256_mul_ps(ny, cy)),
+                                     _mm256_add_ps(_mm256_mul_ps(nz, cz), _mm256_set1_ps(f.planes[p].w)));
+            __m256 r;
+            if (Sphere) {
+                r = rad;
+            } else {
+                r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_andnot_ps(signMask, nx), ex),
+                                                _mm256_mul_ps(_mm256_andnot_ps(signMask, ny), ey)),
+                                  _mm256_mul_ps(_mm256_andnot_ps(signMask, nz), ez));
+            }
+
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(d, r), zero, _CMP_GE_OQ));
+            if (!_mm256_movemask_ps(inside))
+                break;
+        }
+
+        int mask = _mm256_movemask_ps(inside);
+        for (int k = 0; k < 8; k++)
+            visible[i + k] = (mask >> k) & 1;
+        count += __builtin_popcount(mask);
+    }
+
+    return count + cullScalar<Sphere>(f, b, visible, i, end);
+}
+
+#endif
+
+
+template <bool Sphere>
+static unsigned int
+cullRange(const Frustum & f, const BoundsArray & b, unsigned char * visible,
+          unsigned int begin, unsigned int end, Isa isa)
+{
+    if (isa == BEST)
+        isa = getBestIsa();
+
+#ifdef CULL_X86
+    if (isa == AVX)
+        return cullAvx<Sphere>(f, b, visible, begin, end);
+    if (isa == SSE)
+        return cullSse<Sphere>(f, b, visible, begin, end);
+#endif
+
+    return cullScalar<Sphere>(f, b, visible, begin, end);
+}
+
+
+unsigned int
+cullAabbs(const Frustum & frustum, const BoundsArray & bounds,
+          unsigned char * visible, Isa isa)
+{
+    return cullRange<false>(frustum, bounds, visible, 0, bounds.size(), isa);
+}
+
+
+unsigned int
+cullSpheres(const Frustum & frustum, const BoundsArray & bounds,
+            unsigned char * visible, Isa isa)
+{
+    return cullRange<true>(frustum, bounds, visible, 0, bounds.size(), isa);
+}
+
+
+unsigned int
+cullAabbsParallel(const Frustum & frustum, const BoundsArray & bounds,
+                  unsigned char * visible, unsigned int threads, Isa isa)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // Split in whole AVX blocks so only the last range has a tail
+    unsigned int total = bounds.size();
+    std::atomic<unsigned int> count(0);
+    util::parallelFor((total + 7) / 8, threads, [&](unsigned int begin, unsigned int end) {
+        count += cullRange<false>(frustum, bounds, visible, begin * 8, std::min(end * 8, total), isa);
+    });
+    return count;
+}
+
+
+unsigned int
+cullAabbsParallel(const Frustum & frustum, const BoundsArray & bounds,
+                  unsigned char * visible, jobs::JobSystem & jobs, Isa isa)
+{
+    // A few whole AVX blocks per thread, so idle threads can steal some
+    unsigned int total = bounds.size();
+    unsigned int grain = (total / (jobs.getThreadCount() * 4) + 8) & ~7u;
+
+    std::atomic<unsigned int> count(0);
+    jobs.parallelFor(total, std::max(grain, 1024u), [&](unsigned int begin, unsigned int end) {
+        count += cullRange<false>(frustum, bounds, visible, begin, end, isa);
+    });
+    return count;
+}
+
+}
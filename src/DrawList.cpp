@@ -0,0 +1,220 @@
+/*
+ * DrawList.cpp
+ *
+ * The radix sort moves (key, index) pairs, a byte of key per pass. In
+ * parallel, each job counts digits over its own slice, the counts are
+ * turned into a starting offset per (digit, slice), and each job
+ * scatters its slice from there; slices are taken in order, so the
+ * sort stays stable.
+ */
+#include "DrawList.hpp"
+
+#include <algorithm>
+
+namespace render {
+
+// Below this a single thread sorts faster than it can hand out slices
+static const unsigned int PARALLEL_MIN = 1 << 16;
+
+static const int TARGET_BITS = 8, PROGRAM_BITS = 10, TEXTURE_BITS = 14, VAO_BITS = 14, DEPTH_BITS = 18;
+
+static SortKey
+field(unsigned int value, int bits)
+{
+    return value & ((1u << bits) - 1);
+}
+
+
+SortKey
+makeSortKey(const DrawState & state, float depth)
+{
+    const unsigned int depthMax = (1u << DEPTH_BITS) - 1;
+    unsigned int d = (unsigned int)(std::min(std::max(depth, 0.0f), 1.0f) * depthMax);
+
+    SortKey key = field(state.target, TARGET_BITS);
+    key = key << PROGRAM_BITS | field(state.program, PROGRAM_BITS);
+    key = key << TEXTURE_BITS | field(state.texture, TEXTURE_BITS);
+    key = key << VAO_BITS | field(state.vao, VAO_BITS);
+    key = key << DEPTH_BITS | d;
+    return key;
+}
+
+
+/*
+ * Radix sort
+ */
+struct SortEntry
+{
+    SortKey         key;
+    unsigned int    index;
+};
+
+void
+radixSort(const vector<SortKey> & keys, vector<unsigned int> & order, jobs::JobSystem * jobs)
+{
+    unsigned int count = keys.size();
+    order.resize(count);
+    if (count == 0)
+        return;
+    unsigned int slices = jobs && count >= PARALLEL_MIN ? jobs->getThreadCount() : 1;
+    unsigned int slice = (count + slices - 1) / slices;
+
+    vector<SortEntry> a(count), b(count);
+    for (unsigned int i = 0; i < count; i++) {
+        a[i].key = keys[i];
+        a[i].index = i;
+    }
+
+    // Bits that differ between any two keys; bytes without any need no pass
+    SortKey varying = 0;
+    for (unsigned int i = 1; i < count; i++)
+        varying |= keys[i] ^ keys[0];
+
+    vector<unsigned int> counts(slices * 256);
+    SortEntry * src = &a[0], * dst = &b[0];
+    for (int shift = 0; shift < 64; shift += 8) {
+        if (!((varying >> shift) & 0xff))
+            continue;
+
+        std::fill(counts.begin(), counts.end(), 0);
+        jobs::parallelFor(jobs, slices, 1, [&](unsigned int first, unsigned int last) {
+            for (unsigned int s = first; s < last; s++) {
+                unsigned int * c = &counts[s * 256];
+                for (unsigned int i = s * slice; i < std::min((s + 1) * slice, count); i++)
+                    c[(src[i].key >> shift) & 0xff]++;
+            }
+        });
+
+        // Digit major, slice minor: where each slice's run of each digit starts
+        unsigned int offset = 0;
+        for (unsigned int digit = 0; digit < 256; digit++) {
+            for (unsigned int s = 0; s < slices; s++) {
+                unsigned int n = counts[s * 256 + digit];
+                counts[s * 256 + digit] = offset;
+                offset += n;
+            }
+        }
+
+        jobs::parallelFor(jobs, slices, 1, [&](unsigned int first, unsigned int last) {
+            for (unsigned int s = first; s < last; s++) {
+                unsigned int * c = &counts[s * 256];
+                for (unsigned int i = s * slice; i < std::min((s + 1) * slice, count); i++)
+                    dst[c[(src[i].key >> shift) & 0xff]++] = src[i];
+            }
+        });
+        std::swap(src, dst);
+    }
+
+    for (unsigned int i = 0; i < count; i++)
+        order[i] = src[i].index;
+}
+
+
+/*
+ * Draw list
+ */
+DrawList::DrawList():
+    sorted(false)
+{
+}
+
+
+unsigned int
+DrawList::addTarget(const BindFramebuffer & target)
+{
+    targets.push_back(target);
+    return targets.size() - 1;
+}
+
+
+void
+DrawList::add(const DrawState & state, const Draw & draw, float depth, const void * uniforms, GLuint size)
+{
+    Item item;
+    item.state = state;
+    item.draw = draw;
+    item.uniforms = uniformData.size();
+    item.uniformSize = uniforms ? size : 0;
+    if (item.uniformSize)
+        uniformData.insert(uniformData.end(), (const unsigned char *)uniforms,
+                           (const unsigned char *)uniforms + size);
+
+    order.push_back(draws.size());
+    draws.push_back(item);
+    keys.push_back(makeSortKey(state, depth));
+    sorted = false;
+}
+
+
+void
+DrawList::sort(jobs::JobSystem * jobs)
+{
+    if (sorted)
+        return;
+    radixSort(keys, order, jobs);
+    sorted = true;
+}
+
+
+DrawListStats
+DrawList::record(CommandList & list, GLuint uniformBinding, bool elide) const
+{
+    DrawListStats stats = { 0, 0, 0, 0, 0 };
+
+    // Nothing is known to be bound to start with
+    bool first = true;
+    DrawState bound = { 0, 0, 0, 0 };
+    vector<bool> cleared(targets.size(), false);
+
+    for (unsigned int k = 0; k < order.size(); k++) {
+        const Item & item = draws[order[k]];
+        const DrawState & state = item.state;
+        bool all = first || !elide;
+
+        if (all || state.target != bound.target) {
+            const BindFramebuffer & t = targets[state.target];
+            list.bindFramebuffer(t.framebuffer, t.x, t.y, t.width, t.height,
+                                 cleared[state.target] ? 0 : t.clear, t.color);
+            cleared[state.target] = true;
+            stats.targetBinds++;
+        }
+        if (all || state.program != bound.program) {
+            list.bindProgram(state.program);
+            stats.programBinds++;
+        }
+        if (all || state.texture != bound.texture) {
+            list.bindTexture(0, GL_TEXTURE_2D, state.texture);
+            stats.textureBinds++;
+        }
+        if (all || state.vao != bound.vao) {
+            list.bindVao(state.vao);
+            stats.vaoBinds++;
+        }
+        bound = state;
+        first = false;
+
+        if (item.uniformSize)
+            list.uniformBlock(uniformBinding, &uniformData[item.uniforms], item.uniformSize);
+        const Draw & d = item.draw;
+        if (d.indexType)
+            list.drawElements(d.mode, d.count, d.indexType, d.offset, d.instances);
+        else
+            list.draw(d.mode, d.first, d.count, d.instances);
+        stats.draws++;
+    }
+    return stats;
+}
+
+
+void
+DrawList::clear()
+{
+    targets.clear();
+    draws.clear();
+    keys.clear();
+    order.clear();
+    uniformData.clear();
+    sorted = false;
+}
+
+}
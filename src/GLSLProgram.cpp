@@ -4,6 +4,9 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <fstream>
 
+#include "Profiler.hpp"
+#include "Stats.hpp"
+
 namespace shader {
 
 GLSLProgram::GLSLProgram()
@@ -35,6 +38,7 @@ GLSLProgram::compileShaderFromFile(const string & filename, GLSLShaderType type)
 		case GEOMETRY: shaderType = GL_GEOMETRY_SHADER; break;
 		case TESS_CONTROL: shaderType = GL_TESS_CONTROL_SHADER; break;
 		case TESS_EVALUATION: shaderType = GL_TESS_EVALUATION_SHADER; break;
+		case COMPUTE: shaderType = GL_COMPUTE_SHADER; break;
 		default:
 		{
 			logString += "Unable to identify shader type for file " + filename + ".\n";
@@ -128,8 +132,12 @@ GLSLProgram::link()
 bool
 GLSLProgram::use()
 {
-	if (linked)
+	PROFILE_SCOPE("GLSLProgram::use");
+
+	if (linked) {
 		glUseProgram(handle);
+		STATS_COUNT(PROGRAM_BINDS, 1);
+	}
 
 	return linked;
 }
@@ -168,6 +176,7 @@ GLSLProgram::setUniform(const char * name, float x, float y, float z)
 {
 	GLuint loc = getUniformLocation(name);
 	glUniform3f(loc, x, y, z);
+	STATS_COUNT(UNIFORM_UPDATES, 1);
 }
 
 
@@ -176,6 +185,7 @@ GLSLProgram::setUniform(const char * name, const vec3 & v)
 {
 	GLuint loc = getUniformLocation(name);
 	glUniform3f(loc, v.x, v.y, v.z);
+	STATS_COUNT(UNIFORM_UPDATES, 1);
 }
 
 
@@ -184,6 +194,7 @@ GLSLProgram::setUniform(const char * name, const vec4 & v)
 {
 	GLuint loc = getUniformLocation(name);
 	glUniform4f(loc, v.x, v.y, v.z, v.w);
+	STATS_COUNT(UNIFORM_UPDATES, 1);
 }
 
 
@@ -192,6 +203,7 @@ GLSLProgram::setUniform(const char * name, const mat3 & m)
 {
 	GLuint loc = getUniformLocation(name);
 	glUniformMatrix3fv(loc, 1, GL_FALSE, glm::value_ptr(m));
+	STATS_COUNT(UNIFORM_UPDATES, 1);
 }
 
 
@@ -200,6 +212,7 @@ GLSLProgram::setUniform(const char * name, const mat4 & m)
 {
 	GLuint loc = getUniformLocation(name);
 	glUniformMatrix4fv(loc, 1, GL_FALSE, glm::value_ptr(m));
+	STATS_COUNT(UNIFORM_UPDATES, 1);
 }
 
 
@@ -208,6 +221,7 @@ GLSLProgram::setUniform(const char * name, float val)
 {
 	GLuint loc = getUniformLocation(name);
 	glUniform1f(loc, val);
+	STATS_COUNT(UNIFORM_UPDATES, 1);
 }
 
 
@@ -216,6 +230,7 @@ GLSLProgram::setUniform(const char * name, int val)
 {
 	GLuint loc = getUniformLocation(name);
 	glUniform1i(loc, val);
+	STATS_COUNT(UNIFORM_UPDATES, 1);
 }
 
 
@@ -224,6 +239,7 @@ GLSLProgram::setUniform(const char * name, bool val)
 {
 	GLuint loc = getUniformLocation(name);
 	glUniform1i(loc, val ? 1 : 0);
+	STATS_COUNT(UNIFORM_UPDATES, 1);
 }
 
 
@@ -0,0 +1,253 @@
+/*
+ * Hierarchy.cpp
+ *
+ * A level's nodes read only their parents' world matrices and dirty
+ * flags, which the level before finished writing, and write only their
+ * own; so threads can take any split of a level.
+ */
+#include "Hierarchy.hpp"
+
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "ParallelFor.hpp"
+
+namespace scene {
+
+const unsigned int Hierarchy::NONE;
+
+// Levels smaller than this aren't worth splitting across threads
+static const unsigned int PARALLEL_MIN = 4096;
+
+Hierarchy::Hierarchy():
+    flat(true)
+{
+}
+
+
+unsigned int
+Hierarchy::add(unsigned int parent, const vec3 & translation, const quat & rotation, const vec3 & scale)
+{
+    // New nodes go on the end, which keeps parents before children
+    // until flatten() sorts them into levels
+    unsigned int id = ids.size();
+    parents.push_back(parent == NONE ? NONE : slots[parent]);
+    translations.push_back(translation);
+    rotations.push_back(rotation);
+    scales.push_back(scale);
+    worlds.push_back(mat4(1.0f));
+    dirty.push_back(1);
+    ids.push_back(id);
+    slots.push_back(id);
+    flat = false;
+    return id;
+}
+
+
+void
+Hierarchy::setTranslation(unsigned int id, const vec3 & translation)
+{
+    translations[slots[id]] = translation;
+    dirty[slots[id]] = 1;
+}
+
+
+void
+Hierarchy::setRotation(unsigned int id, const quat & rotation)
+{
+    rotations[slots[id]] = rotation;
+    dirty[slots[id]] = 1;
+}
+
+
+void
+Hierarchy::setScale(unsigned int id, const vec3 & scale)
+{
+    scales[slots[id]] = scale;
+    dirty[slots[id]] = 1;
+}
+
+
+unsigned int
+Hierarchy::getParent(unsigned int id) const
+{
+    unsigned int parent = parents[slots[id]];
+    return parent == NONE ? NONE : ids[parent];
+}
+
+
+void
+Hierarchy::reserve(unsigned int count)
+{
+    parents.reserve(count);
+    translations.reserve(count);
+    rotations.reserve(count);
+    scales.reserve(count);
+    worlds.reserve(count);
+    dirty.reserve(count);
+    ids.reserve(count);
+    slots.reserve(count);
+}
+
+
+void
+Hierarchy::clear()
+{
+    parents.clear();
+    translations.clear();
+    rotations.clear();
+    scales.clear();
+    worlds.clear();
+    dirty.clear();
+    ids.clear();
+    slots.clear();
+    levels.clear();
+    flat = true;
+}
+
+
+/*
+ * Breadth-first order: the roots, then their children, then theirs...
+ * with each node's children together, in the order they were added.
+ */
+void
+Hierarchy::flatten()
+{
+    unsigned int count = ids.size();
+
+    // Children of each slot, as ranges of one array
+    vector<unsigned int> first(count + 1, 0), children(count);
+    for (unsigned int i = 0; i < count; i++)
+        if (parents[i] != NONE)
+            first[parents[i] + 1]++;
+    for (unsigned int i = 0; i < count; i++)
+        first[i + 1] += first[i];
+    vector<unsigned int> fill(first.begin(), first.end() - 1);
+    for (unsigned int i = 0; i < count; i++)
+        if (parents[i] != NONE)
+            children[fill[parents[i]]++] = i;
+
+    // order[new slot] = old slot, a level at a time
+    vector<unsigned int> order;
+    order.reserve(count);
+    levels.clear();
+    levels.push_back(0);
+    for (unsigned int i = 0; i < count; i++)
+        if (parents[i] == NONE)
+            order.push_back(i);
+    for (unsigned int begin = 0; begin < order.size(); ) {
+        unsigned int end = order.size();
+        levels.push_back(end);
+        for (unsigned int k = begin; k < end; k++)
+            for (unsigned int c = first[order[k]]; c < first[order[k] + 1]; c++)
+                order.push_back(children[c]);
+        begin = end;
+    }
+
+    vector<unsigned int> newSlot(count);
+    for (unsigned int i = 0; i < count; i++)
+        newSlot[order[i]] = i;
+
+    vector<unsigned int> newParents(count), newIds(count);
+    vector<vec3> newTranslations(count), newScales(count);
+    vector<quat> newRotations(count);
+    vector<mat4> newWorlds(count);
+    vector<unsigned char> newDirty(count);
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int old = order[i];
+        newParents[i] = parents[old] == NONE ? NONE : newSlot[parents[old]];
+        newIds[i] = ids[old];
+        newTranslations[i] = translations[old];
+        newRotations[i] = rotations[old];
+        newScales[i] = scales[old];
+        newWorlds[i] = worlds[old];
+        newDirty[i] = dirty[old];
+        slots[ids[old]] = i;
+    }
+
+    parents.swap(newParents);
+    ids.swap(newIds);
+    translations.swap(newTranslations);
+    rotations.swap(newRotations);
+    scales.swap(newScales);
+    worlds.swap(newWorlds);
+    dirty.swap(newDirty);
+    flat = true;
+}
+
+
+unsigned int
+Hierarchy::updateRange(unsigned int begin, unsigned int end)
+{
+    unsigned int updated = 0;
+    for (unsigned int i = begin; i < end; i++) {
+        unsigned int parent = parents[i];
+        if (!dirty[i] && (parent == NONE || !dirty[parent]))
+            continue;
+
+        // Children look at this to see whether their parent moved
+        dirty[i] = 1;
+
+        // translate * rotate * scale, without the matrix products
+        glm::mat3 rotation = glm::mat3_cast(rotations[i]);
+        mat4 local(rotation);
+        local[0] *= scales[i].x;
+        local[1] *= scales[i].y;
+        local[2] *= scales[i].z;
+        local[3] = glm::vec4(translations[i], 1.0f);
+
+        worlds[i] = parent == NONE ? local : worlds[parent] * local;
+        updated++;
+    }
+    return updated;
+}
+
+
+// parallel(count, fn) runs fn(begin, end) over [0, count) somehow
+template <class ParallelFor>
+unsigned int
+Hierarchy::updateLevels(ParallelFor parallel)
+{
+    if (!flat)
+        flatten();
+
+    std::atomic<unsigned int> updated(0);
+    for (unsigned int level = 0; level + 1 < levels.size(); level++) {
+        unsigned int begin = levels[level], size = levels[level + 1] - begin;
+        if (size < PARALLEL_MIN) {
+            updated += updateRange(begin, begin + size);
+            continue;
+        }
+        parallel(size, [&](unsigned int from, unsigned int to) {
+            updated += updateRange(begin + from, begin + to);
+        });
+    }
+
+    memset(dirty.data(), 0, dirty.size());
+    return updated;
+}
+
+
+unsigned int
+Hierarchy::update(unsigned int threads)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    return updateLevels([threads](unsigned int count, std::function<void(unsigned int, unsigned int)> fn) {
+        util::parallelFor(count, threads, fn);
+    });
+}
+
+
+unsigned int
+Hierarchy::update(jobs::JobSystem & jobs)
+{
+    return updateLevels([&jobs](unsigned int count, std::function<void(unsigned int, unsigned int)> fn) {
+        jobs.parallelFor(count, PARALLEL_MIN / 4, fn);
+    });
+}
+
+}
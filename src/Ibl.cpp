@@ -0,0 +1,863 @@
+/*
+ * Ibl.cpp
+ *
+ * A texel's solid angle on a face at distance 1 is (2 / size)^2 /
+ * (1 + s^2 + t^2)^(3/2); the projection sums with that weight and then
+ * scales the total to 4 pi, which takes out most of the error of
+ * treating texels as points.
+ *
+ * The GGX samples are the same for every texel of a level, once N = V:
+ * N.H is the sample's cos theta, N.L = 2 (N.H)^2 - 1 and the pdf is
+ * D / 4, so the weights and source levels are worked out once per
+ * level and only L is per texel. The SSE path does the direction and
+ * tangent frame work four texels at a time, in the scalar path's order;
+ * the cube map reads stay scalar.
+ */
+#include "Ibl.hpp"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "Profiler.hpp"
+#include "Stats.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define IBL_X86
+    #include <immintrin.h>
+#endif
+
+namespace ibl {
+
+static const float PI = 3.14159265358979f;
+
+// A face's texel at s, t in [-1, 1] points along ORIGIN + s * RIGHT +
+// t * UP (the GL cube map table, read backwards)
+static const float ORIGIN[6][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+static const float RIGHT[6][3] = { { 0, 0, -1 }, { 0, 0, 1 }, { 1, 0, 0 }, { 1, 0, 0 }, { 1, 0, 0 }, { -1, 0, 0 } };
+static const float UP[6][3] = { { 0, -1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }, { 0, -1, 0 }, { 0, -1, 0 } };
+
+
+/*
+ * Cube map
+ */
+Cubemap::Cubemap():
+    size(0)
+{
+}
+
+
+Cubemap::Cubemap(GLsizei size, unsigned int levels):
+    size(size),
+    data(std::max(levels, 1u))
+{
+    for (unsigned int l = 0; l < data.size(); l++)
+        data[l].assign((size_t)6 * getSize(l) * getSize(l) * 3, 0.0f);
+}
+
+
+Cubemap
+Cubemap::fromPixels(GLsizei size, const GLubyte * rgb, bool srgb)
+{
+    float table[256];
+    for (int i = 0; i < 256; i++) {
+        float c = i / 255.0f;
+        table[i] = !srgb ? c : c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+    }
+
+    Cubemap cube(size);
+    vector<float> & texels = cube.data[0];
+    for (size_t i = 0; i < texels.size(); i++)
+        texels[i] = table[rgb[i]];
+    return cube;
+}
+
+
+Cubemap
+Cubemap::fromTexture(GLuint texture, bool srgb)
+{
+    GLint size = 0;
+    glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+    glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_TEXTURE_WIDTH, &size);
+
+    vector<GLubyte> pixels((size_t)6 * size * size * 3);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    for (int face = 0; face < 6 && size > 0; face++)
+        glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGB, GL_UNSIGNED_BYTE,
+                      &pixels[(size_t)face * size * size * 3]);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    STATS_COUNT(TEXTURE_BINDS, 2);
+
+    return size > 0 ? fromPixels(size, &pixels[0], srgb) : Cubemap();
+}
+
+
+void
+Cubemap::buildMips()
+{
+    data.resize(1);
+    while (getSize(data.size() - 1) > 1) {
+        unsigned int level = data.size();
+        GLsizei n = getSize(level), above = getSize(level - 1);
+        data.push_back(vector<float>((size_t)6 * n * n * 3));
+        for (int face = 0; face < 6; face++)
+            for (int y = 0; y < n; y++)
+                for (int x = 0; x < n; x++) {
+                    int x0 = 2 * x, x1 = std::min(2 * x + 1, above - 1);
+                    int y0 = 2 * y, y1 = std::min(2 * y + 1, above - 1);
+                    const float * a = getTexel(level - 1, face, x0, y0), * b = getTexel(level - 1, face, x1, y0);
+                    const float * c = getTexel(level - 1, face, x0, y1), * d = getTexel(level - 1, face, x1, y1);
+                    float * out = getTexel(level, face, x, y);
+                    for (int k = 0; k < 3; k++)
+                        out[k] = 0.25f * (a[k] + b[k] + c[k] + d[k]);
+                }
+    }
+}
+
+
+// The face a direction is on and where, s and t in [0, 1]
+static void
+faceCoords(float x, float y, float z, int * face, float * s, float * t)
+{
+    float ax = fabsf(x), ay = fabsf(y), az = fabsf(z);
+    float sc, tc, ma;
+    if (ax >= ay && ax >= az) {
+        ma = ax;
+        *face = x >= 0.0f ? 0 : 1;
+        sc = x >= 0.0f ? -z : z;
+        tc = -y;
+    } else if (ay >= az) {
+        ma = ay;
+        *face = y >= 0.0f ? 2 : 3;
+        sc = x;
+        tc = y >= 0.0f ? z : -z;
+    } else {
+        ma = az;
+        *face = z >= 0.0f ? 4 : 5;
+        sc = z >= 0.0f ? x : -x;
+        tc = -y;
+    }
+    *s = 0.5f * (sc / ma + 1.0f);
+    *t = 0.5f * (tc / ma + 1.0f);
+}
+
+
+static void
+bilinear(const Cubemap & cube, unsigned int level, int face, float s, float t, float weight, float * out)
+{
+    GLsizei n = cube.getSize(level);
+    float fx = s * n - 0.5f, fy = t * n - 0.5f;
+    float bx = floorf(fx), by = floorf(fy);
+    float wx = fx - bx, wy = fy - by;
+    int x0 = std::min(std::max((int)bx, 0), n - 1), x1 = std::min(std::max((int)bx + 1, 0), n - 1);
+    int y0 = std::min(std::max((int)by, 0), n - 1), y1 = std::min(std::max((int)by + 1, 0), n - 1);
+
+    const float * a = cube.getTexel(level, face, x0, y0), * b = cube.getTexel(level, face, x1, y0);
+    const float * c = cube.getTexel(level, face, x0, y1), * d = cube.getTexel(level, face, x1, y1);
+    for (int k = 0; k < 3; k++) {
+        float top = a[k] + (b[k] - a[k]) * wx, bottom = c[k] + (d[k] - c[k]) * wx;
+        out[k] += weight * (top + (bottom - top) * wy);
+    }
+}
+
+
+// Adds weight times the trilinear sample along (x, y, z) to out
+static void
+fetch(const Cubemap & cube, float x, float y, float z, float lod, float weight, float * out)
+{
+    int face;
+    float s, t;
+    faceCoords(x, y, z, &face, &s, &t);
+
+    float top = (float)(cube.getLevels() - 1);
+    lod = std::min(std::max(lod, 0.0f), top);
+    unsigned int l0 = (unsigned int)lod;
+    float f = lod - l0;
+    if (f == 0.0f || l0 + 1 >= cube.getLevels()) {
+        bilinear(cube, l0, face, s, t, weight, out);
+        return;
+    }
+    bilinear(cube, l0, face, s, t, weight * (1.0f - f), out);
+    bilinear(cube, l0 + 1, face, s, t, weight * f, out);
+}
+
+
+vec3
+Cubemap::sample(const vec3 & dir, float lod) const
+{
+    float out[3] = { 0.0f, 0.0f, 0.0f };
+    fetch(*this, dir.x, dir.y, dir.z, lod, 1.0f, out);
+    return vec3(out[0], out[1], out[2]);
+}
+
+
+GLuint
+Cubemap::createTexture() const
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+    glTexStorage2D(GL_TEXTURE_CUBE_MAP, getLevels(), GL_RGB16F, size, size);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    size_t bytes = 0;
+    for (unsigned int l = 0; l < getLevels(); l++) {
+        GLsizei n = getSize(l);
+        for (int face = 0; face < 6; face++)
+            glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, l, 0, 0, n, n, GL_RGB, GL_FLOAT,
+                            getTexel(l, face, 0, 0));
+        bytes += (size_t)6 * n * n * 3 * sizeof(float);
+    }
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, getLevels() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+    STATS_COUNT(TEXTURE_BINDS, 2);
+    STATS_COUNT(TEXTURE_UPLOADS, getLevels() * 6);
+    STATS_COUNT(TEXTURE_BYTES, bytes);
+    return texture;
+}
+
+
+vec3
+texelDirection(int face, GLsizei size, int x, int y)
+{
+    float s = (2.0f * x + 1.0f) / size - 1.0f, t = (2.0f * y + 1.0f) / size - 1.0f;
+    return glm::normalize(vec3(ORIGIN[face][0] + s * RIGHT[face][0] + t * UP[face][0],
+                               ORIGIN[face][1] + s * RIGHT[face][1] + t * UP[face][1],
+                               ORIGIN[face][2] + s * RIGHT[face][2] + t * UP[face][2]));
+}
+
+
+/*
+ * Irradiance
+ */
+static const float SH_SCALE[9] = { 0.282095f, 0.488603f, 0.488603f, 0.488603f,
+                                   1.092548f, 1.092548f, 0.315392f, 1.092548f, 0.546274f };
+
+// The cosine lobe's factor per band
+static const float SH_LOBE[9] = { PI, 2.0f * PI / 3.0f, 2.0f * PI / 3.0f, 2.0f * PI / 3.0f,
+                                  PI / 4.0f, PI / 4.0f, PI / 4.0f, PI / 4.0f, PI / 4.0f };
+
+// Order: 1, y, z, x, xy, yz, 3z^2 - 1, xz, x^2 - y^2
+static void
+shBasis(float x, float y, float z, float * b)
+{
+    b[0] = SH_SCALE[0];
+    b[1] = SH_SCALE[1] * y;
+    b[2] = SH_SCALE[2] * z;
+    b[3] = SH_SCALE[3] * x;
+    b[4] = SH_SCALE[4] * (x * y);
+    b[5] = SH_SCALE[5] * (y * z);
+    b[6] = SH_SCALE[6] * (3.0f * (z * z) - 1.0f);
+    b[7] = SH_SCALE[7] * (x * z);
+    b[8] = SH_SCALE[8] * (x * x - y * y);
+}
+
+
+vec3
+Sh9::evaluate(const vec3 & n) const
+{
+    float b[9];
+    shBasis(n.x, n.y, n.z, b);
+    vec3 e(0.0f);
+    for (int k = 0; k < 9; k++)
+        e += c[k] * b[k];
+    return e;
+}
+
+
+// Texels [begin, size) of a row: 27 weighted sums, then the weight
+static void
+projectScalar(const Cubemap & cube, int face, int y, int begin, float * sums)
+{
+    GLsizei n = cube.getSize();
+    float t = (2.0f * y + 1.0f) / n - 1.0f;
+    for (int x = begin; x < n; x++) {
+        float s = (2.0f * x + 1.0f) / n - 1.0f;
+        float dx = ORIGIN[face][0] + s * RIGHT[face][0] + t * UP[face][0];
+        float dy = ORIGIN[face][1] + s * RIGHT[face][1] + t * UP[face][1];
+        float dz = ORIGIN[face][2] + s * RIGHT[face][2] + t * UP[face][2];
+        float d2 = 1.0f + s * s + t * t;
+        float inv = 1.0f / sqrtf(d2);
+        float w = inv / d2;
+
+        float b[9];
+        shBasis(dx * inv, dy * inv, dz * inv, b);
+        const float * c = cube.getTexel(0, face, x, y);
+        for (int k = 0; k < 9; k++) {
+            float bw = b[k] * w;
+            sums[k * 3] += bw * c[0];
+            sums[k * 3 + 1] += bw * c[1];
+            sums[k * 3 + 2] += bw * c[2];
+        }
+        sums[27] += w;
+    }
+}
+
+
+#ifdef IBL_X86
+
+__attribute__((target("sse2"))) static float
+horizontalSum(__m128 v)
+{
+    float lanes[4];
+    _mm_storeu_ps(lanes, v);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+
+// Four texels at a time, the rest of the row scalar
+__attribute__((target("sse2"))) static void
+projectSse(const Cubemap & cube, int face, int y, float * sums)
+{
+    GLsizei n = cube.getSize();
+    const __m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f), three = _mm_set1_ps(3.0f);
+    const __m128 size = _mm_set1_ps((float)n);
+    float ts = (2.0f * y + 1.0f) / n - 1.0f;
+    const __m128 t = _mm_set1_ps(ts);
+    const __m128 tt = _mm_set1_ps(ts * ts);
+
+    __m128 acc[28];
+    for (int k = 0; k < 28; k++)
+        acc[k] = _mm_setzero_ps();
+
+    int x = 0;
+    for (; x + 4 <= n; x += 4) {
+        __m128 xs = _mm_set_ps((float)(x + 3), (float)(x + 2), (float)(x + 1), (float)x);
+        __m128 s = _mm_sub_ps(_mm_div_ps(_mm_add_ps(_mm_mul_ps(two, xs), one), size), one);
+        __m128 d[3];
+        for (int k = 0; k < 3; k++)
+            d[k] = _mm_add_ps(_mm_add_ps(_mm_set1_ps(ORIGIN[face][k]), _mm_mul_ps(s, _mm_set1_ps(RIGHT[face][k]))),
+                              _mm_mul_ps(t, _mm_set1_ps(UP[face][k])));
+        __m128 d2 = _mm_add_ps(_mm_add_ps(one, _mm_mul_ps(s, s)), tt);
+        __m128 inv = _mm_div_ps(one, _mm_sqrt_ps(d2));
+        __m128 w = _mm_div_ps(inv, d2);
+        __m128 dx = _mm_mul_ps(d[0], inv), dy = _mm_mul_ps(d[1], inv), dz = _mm_mul_ps(d[2], inv);
+
+        __m128 b[9];
+        b[0] = _mm_set1_ps(SH_SCALE[0]);
+        b[1] = _mm_mul_ps(_mm_set1_ps(SH_SCALE[1]), dy);
+        b[2] = _mm_mul_ps(_mm_set1_ps(SH_SCALE[2]), dz);
+        b[3] = _mm_mul_ps(_mm_set1_ps(SH_SCALE[3]), dx);
+        b[4] = _mm_mul_ps(_mm_set1_ps(SH_SCALE[4]), _mm_mul_ps(dx, dy));
+        b[5] = _mm_mul_ps(_mm_set1_ps(SH_SCALE[5]), _mm_mul_ps(dy, dz));
+        b[6] = _mm_mul_ps(_mm_set1_ps(SH_SCALE[6]), _mm_sub_ps(_mm_mul_ps(three, _mm_mul_ps(dz, dz)), one));
+        b[7] = _mm_mul_ps(_mm_set1_ps(SH_SCALE[7]), _mm_mul_ps(dx, dz));
+        b[8] = _mm_mul_ps(_mm_set1_ps(SH_SCALE[8]), _mm_sub_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+
+        // The four texels' RGB are 12 floats in a row
+        const float * c = cube.getTexel(0, face, x, y);
+        __m128 r = _mm_set_ps(c[9], c[6], c[3], c[0]);
+        __m128 g = _mm_set_ps(c[10], c[7], c[4], c[1]);
+        __m128 bl = _mm_set_ps(c[11], c[8], c[5], c[2]);
+        for (int k = 0; k < 9; k++) {
+            __m128 bw = _mm_mul_ps(b[k], w);
+            acc[k * 3] = _mm_add_ps(acc[k * 3], _mm_mul_ps(bw, r));
+            acc[k * 3 + 1] = _mm_add_ps(acc[k * 3 + 1], _mm_mul_ps(bw, g));
+            acc[k * 3 + 2] = _mm_add_ps(acc[k * 3 + 2], _mm_mul_ps(bw, bl));
+        }
+        acc[27] = _mm_add_ps(acc[27], w);
+    }
+
+    for (int k = 0; k < 28; k++)
+        sums[k] += horizontalSum(acc[k]);
+    projectScalar(cube, face, y, x, sums);
+}
+
+#endif
+
+
+Sh9
+computeIrradiance(const Cubemap & source, jobs::JobSystem * jobs, cull::Isa isa)
+{
+    if (isa == cull::BEST)
+        isa = cull::getBestIsa();
+
+    // A sum per row, added up in order after, so the thread count
+    // doesn't change the result
+    GLsizei n = source.getSize();
+    unsigned int rows = 6 * n;
+    vector<double> rowSums((size_t)rows * 28, 0.0);
+    jobs::parallelFor(jobs, rows, 0, [&](unsigned int begin, unsigned int end) {
+        for (unsigned int row = begin; row < end; row++) {
+            float sums[28] = { 0.0f };
+#ifdef IBL_X86
+            if (isa != cull::SCALAR)
+                projectSse(source, row / n, row % n, sums);
+            else
+#endif
+                projectScalar(source, row / n, row % n, 0, sums);
+            for (int k = 0; k < 28; k++)
+                rowSums[(size_t)row * 28 + k] = sums[k];
+        }
+    });
+
+    double total[28] = { 0.0 };
+    for (unsigned int row = 0; row < rows; row++)
+        for (int k = 0; k < 28; k++)
+            total[k] += rowSums[(size_t)row * 28 + k];
+
+    Sh9 sh;
+    double norm = total[27] > 0.0 ? 4.0 * PI / total[27] : 0.0;
+    for (int k = 0; k < 9; k++)
+        sh.c[k] = vec3(total[k * 3], total[k * 3 + 1], total[k * 3 + 2]) * (float)(norm * SH_LOBE[k]);
+    return sh;
+}
+
+
+/*
+ * Specular
+ */
+struct LobeSample
+{
+    float x, y, z;      // H in the tangent frame
+    float weight;       // N.L
+    float lod;          // source level to read
+};
+
+static float
+radicalInverse(unsigned int bits)
+{
+    bits = (bits << 16) | (bits >> 16);
+    bits = ((bits & 0x55555555u) << 1) | ((bits & 0xAAAAAAAAu) >> 1);
+    bits = ((bits & 0x33333333u) << 2) | ((bits & 0xCCCCCCCCu) >> 2);
+    bits = ((bits & 0x0F0F0F0Fu) << 4) | ((bits & 0xF0F0F0F0u) >> 4);
+    bits = ((bits & 0x00FF00FFu) << 8) | ((bits & 0xFF00FF00u) >> 8);
+    return bits * 2.3283064365386963e-10f;
+}
+
+
+// The samples of a GGX lobe of this roughness that land above the
+// surface, for an output level outSize square
+static vector<LobeSample>
+lobeSamples(float roughness, unsigned int count, GLsizei sourceSize, GLsizei outSize)
+{
+    float a = roughness * roughness, a2 = a * a;
+    float texelAngle = 4.0f * PI / (6.0f * sourceSize * sourceSize);
+    float minLod = std::max(0.0f, log2f((float)sourceSize / outSize));
+
+    vector<LobeSample> samples;
+    for (unsigned int i = 0; i < count; i++) {
+        float phi = 2.0f * PI * i / count;
+        float xi = radicalInverse(i);
+        float cosTheta = sqrtf((1.0f - xi) / (1.0f + (a2 - 1.0f) * xi));
+        float sinTheta = sqrtf(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+
+        LobeSample sample;
+        sample.x = sinTheta * cosf(phi);
+        sample.y = sinTheta * sinf(phi);
+        sample.z = cosTheta;
+        sample.weight = 2.0f * cosTheta * cosTheta - 1.0f;
+        if (sample.weight <= 0.0f)
+            continue;
+
+        float denominator = cosTheta * cosTheta * (a2 - 1.0f) + 1.0f;
+        float pdf = a2 / (PI * denominator * denominator) / 4.0f;
+        float sampleAngle = 1.0f / (count * pdf);
+        sample.lod = std::max(minLod, 0.5f * log2f(sampleAngle / texelAngle) + 1.0f);
+        samples.push_back(sample);
+    }
+    return samples;
+}
+
+
+static void
+prefilterScalar(const Cubemap & source, const vector<LobeSample> & samples, int face, GLsizei n, int y,
+                int begin, float * out)
+{
+    float t = (2.0f * y + 1.0f) / n - 1.0f;
+    for (int x = begin; x < n; x++) {
+        float s = (2.0f * x + 1.0f) / n - 1.0f;
+        float nx = ORIGIN[face][0] + s * RIGHT[face][0] + t * UP[face][0];
+        float ny = ORIGIN[face][1] + s * RIGHT[face][1] + t * UP[face][1];
+        float nz = ORIGIN[face][2] + s * RIGHT[face][2] + t * UP[face][2];
+        float inv = 1.0f / sqrtf(nx * nx + ny * ny + nz * nz);
+        nx = nx * inv;
+        ny = ny * inv;
+        nz = nz * inv;
+
+        // T = normalize(cross(up, N)), up being z unless N nearly is
+        bool zUp = fabsf(nz) < 0.999f;
+        float tx = zUp ? -ny : 0.0f, ty = zUp ? nx : -nz, tz = zUp ? 0.0f : ny;
+        float tInv = 1.0f / sqrtf(tx * tx + ty * ty + tz * tz);
+        tx = tx * tInv;
+        ty = ty * tInv;
+        tz = tz * tInv;
+        float bx = ny * tz - nz * ty, by = nz * tx - nx * tz, bz = nx * ty - ny * tx;
+
+        float color[3] = { 0.0f, 0.0f, 0.0f }, total = 0.0f;
+        for (unsigned int i = 0; i < samples.size(); i++) {
+            const LobeSample & h = samples[i];
+            float hx = tx * h.x + bx * h.y + nx * h.z;
+            float hy = ty * h.x + by * h.y + ny * h.z;
+            float hz = tz * h.x + bz * h.y + nz * h.z;
+            float twice = 2.0f * h.z;
+            fetch(source, twice * hx - nx, twice * hy - ny, twice * hz - nz, h.lod, h.weight, color);
+            total += h.weight;
+        }
+
+        float * o = out + x * 3;
+        for (int k = 0; k < 3; k++)
+            o[k] = color[k] / total;
+    }
+}
+
+
+#ifdef IBL_X86
+
+__attribute__((target("sse2"))) static void
+prefilterSse(const Cubemap & source, const vector<LobeSample> & samples, int face, GLsizei n, int y, float * out)
+{
+    const __m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f);
+    const __m128 sign = _mm_set1_ps(-0.0f), limit = _mm_set1_ps(0.999f);
+    const __m128 size = _mm_set1_ps((float)n);
+    const __m128 t = _mm_set1_ps((2.0f * y + 1.0f) / n - 1.0f);
+
+    int x = 0;
+    for (; x + 4 <= n; x += 4) {
+        __m128 xs = _mm_set_ps((float)(x + 3), (float)(x + 2), (float)(x + 1), (float)x);
+        __m128 s = _mm_sub_ps(_mm_div_ps(_mm_add_ps(_mm_mul_ps(two, xs), one), size), one);
+        __m128 d[3];
+        for (int k = 0; k < 3; k++)
+            d[k] = _mm_add_ps(_mm_add_ps(_mm_set1_ps(ORIGIN[face][k]), _mm_mul_ps(s, _mm_set1_ps(RIGHT[face][k]))),
+                              _mm_mul_ps(t, _mm_set1_ps(UP[face][k])));
+        __m128 inv = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], d[0]), _mm_mul_ps(d[1], d[1])),
+                                                            _mm_mul_ps(d[2], d[2]))));
+        __m128 nx = _mm_mul_ps(d[0], inv), ny = _mm_mul_ps(d[1], inv), nz = _mm_mul_ps(d[2], inv);
+
+        __m128 zUp = _mm_cmplt_ps(_mm_andnot_ps(sign, nz), limit);
+        __m128 tx = _mm_and_ps(zUp, _mm_xor_ps(ny, sign));
+        __m128 ty = _mm_or_ps(_mm_and_ps(zUp, nx), _mm_andnot_ps(zUp, _mm_xor_ps(nz, sign)));
+        __m128 tz = _mm_andnot_ps(zUp, ny);
+        __m128 tInv = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, tx), _mm_mul_ps(ty, ty)),
+                                                             _mm_mul_ps(tz, tz))));
+        tx = _mm_mul_ps(tx, tInv);
+        ty = _mm_mul_ps(ty, tInv);
+        tz = _mm_mul_ps(tz, tInv);
+        __m128 bx = _mm_sub_ps(_mm_mul_ps(ny, tz), _mm_mul_ps(nz, ty));
+        __m128 by = _mm_sub_ps(_mm_mul_ps(nz, tx), _mm_mul_ps(nx, tz));
+        __m128 bz = _mm_sub_ps(_mm_mul_ps(nx, ty), _mm_mul_ps(ny, tx));
+
+        float color[4][3] = { { 0.0f } }, total = 0.0f;
+        float lx[4], ly[4], lz[4];
+        for (unsigned int i = 0; i < samples.size(); i++) {
+            const LobeSample & h = samples[i];
+            __m128 sx = _mm_set1_ps(h.x), sy = _mm_set1_ps(h.y), sz = _mm_set1_ps(h.z);
+            __m128 hx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, sx), _mm_mul_ps(bx, sy)), _mm_mul_ps(nx, sz));
+            __m128 hy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ty, sx), _mm_mul_ps(by, sy)), _mm_mul_ps(ny, sz));
+            __m128 hz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(tz, sx), _mm_mul_ps(bz, sy)), _mm_mul_ps(nz, sz));
+            __m128 twice = _mm_set1_ps(2.0f * h.z);
+            _mm_storeu_ps(lx, _mm_sub_ps(_mm_mul_ps(twice, hx), nx));
+            _mm_storeu_ps(ly, _mm_sub_ps(_mm_mul_ps(twice, hy), ny));
+            _mm_storeu_ps(lz, _mm_sub_ps(_mm_mul_ps(twice, hz), nz));
+            for (int lane = 0; lane < 4; lane++)
+                fetch(source, lx[lane], ly[lane], lz[lane], h.lod, h.weight, color[lane]);
+            total += h.weight;
+        }
+
+        for (int lane = 0; lane < 4; lane++)
+            for (int k = 0; k < 3; k++)
+                out[(x + lane) * 3 + k] = color[lane][k] / total;
+    }
+
+    prefilterScalar(source, samples, face, n, y, x, out);
+}
+
+#endif
+
+
+// The size and level count options ask for, given the source
+static void
+resolve(GLsizei sourceSize, const Options & options, GLsizei * size, unsigned int * levels)
+{
+    *size = std::max(1, std::min(options.size, sourceSize));
+    unsigned int most = 1;
+    while ((*size >> most) > 0)
+        most++;
+    unsigned int toEight = 1;
+    while ((*size >> toEight) >= 8)
+        toEight++;
+    *levels = options.levels ? std::min(options.levels, most) : toEight;
+}
+
+
+Cubemap
+prefilterSpecular(const Cubemap & source, const Options & options)
+{
+    cull::Isa isa = options.isa == cull::BEST ? cull::getBestIsa() : options.isa;
+    GLsizei size;
+    unsigned int levels;
+    resolve(source.getSize(), options, &size, &levels);
+
+    Cubemap out(size, levels);
+    for (unsigned int l = 0; l < levels; l++) {
+        GLsizei n = out.getSize(l);
+        float roughness = levels > 1 ? (float)l / (levels - 1) : 0.0f;
+
+        // Roughness 0 is the source itself, resampled
+        vector<LobeSample> samples;
+        if (roughness > 0.0f) {
+            samples = lobeSamples(roughness, std::max(options.samples, 1u), source.getSize(), n);
+        } else {
+            LobeSample mirror = { 0.0f, 0.0f, 1.0f, 1.0f, std::max(0.0f, log2f((float)source.getSize() / n)) };
+            samples.push_back(mirror);
+        }
+
+        jobs::parallelFor(options.jobs, 6 * n, 0, [&](unsigned int begin, unsigned int end) {
+            for (unsigned int row = begin; row < end; row++) {
+                float * texels = out.getTexel(l, row / n, 0, row % n);
+#ifdef IBL_X86
+                if (isa != cull::SCALAR) {
+                    prefilterSse(source, samples, row / n, n, row % n, texels);
+                    continue;
+                }
+#endif
+                prefilterScalar(source, samples, row / n, n, row % n, 0, texels);
+            }
+        });
+    }
+    return out;
+}
+
+
+void
+precompute(Cubemap & source, const Options & options, Environment * environment, Timing * timing)
+{
+    double start = profile::now();
+    if (source.getLevels() == 1 && source.getSize() > 1)
+        source.buildMips();
+    double mipsDone = profile::now();
+    environment->irradiance = computeIrradiance(source, options.jobs, options.isa);
+    double irradianceDone = profile::now();
+    environment->specular = prefilterSpecular(source, options);
+    double specularDone = profile::now();
+
+    if (timing) {
+        timing->mips = mipsDone - start;
+        timing->irradiance = irradianceDone - mipsDone;
+        timing->specular = specularDone - irradianceDone;
+    }
+}
+
+
+/*
+ * Cache
+ */
+static const char CACHE_MAGIC[8] = { 'I', 'B', 'L', 'C', 'A', 'C', 'H', '1' };
+
+// Then the specular levels' floats, back to back
+struct CacheHeader
+{
+    char magic[8];
+    unsigned long long key;
+    float irradiance[27];
+    unsigned int size, levels;
+    unsigned long long bytes;
+};
+
+static unsigned long long
+fnv(unsigned long long hash, const void * data, size_t bytes)
+{
+    const unsigned char * p = (const unsigned char *)data;
+    for (size_t i = 0; i < bytes; i++)
+        hash = (hash ^ p[i]) * 0x100000001b3ull;
+    return hash;
+}
+
+
+unsigned long long
+cacheKey(const Cubemap & source, const Options & options)
+{
+    GLsizei size;
+    unsigned int levels;
+    resolve(source.getSize(), options, &size, &levels);
+    unsigned int settings[4] = { (unsigned int)source.getSize(), (unsigned int)size, levels, options.samples };
+
+    unsigned long long hash = fnv(0xcbf29ce484222325ull, settings, sizeof(settings));
+    const vector<float> & texels = source.getLevel(0);
+    return fnv(hash, &texels[0], texels.size() * sizeof(float));
+}
+
+
+bool
+writeCache(const string & fileName, const Environment & environment, unsigned long long key)
+{
+    const Cubemap & specular = environment.specular;
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.key = key;
+    for (int k = 0; k < 9; k++)
+        for (int c = 0; c < 3; c++)
+            header.irradiance[k * 3 + c] = environment.irradiance.c[k][c];
+    header.size = specular.getSize();
+    header.levels = specular.getLevels();
+    header.bytes = sizeof(CacheHeader);
+    for (unsigned int l = 0; l < specular.getLevels(); l++)
+        header.bytes += specular.getLevel(l).size() * sizeof(float);
+
+    int fd = ::open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("Error: can't create %s\n", fileName.c_str());
+        return false;
+    }
+    if (ftruncate(fd, header.bytes)) {
+        printf("Error: can't size %s to %llu bytes\n", fileName.c_str(), header.bytes);
+        ::close(fd);
+        return false;
+    }
+    char * data = (char *)mmap(NULL, header.bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        printf("Error: can't map %s\n", fileName.c_str());
+        return false;
+    }
+
+    memcpy(data, &header, sizeof(header));
+    size_t offset = sizeof(header);
+    for (unsigned int l = 0; l < specular.getLevels(); l++) {
+        const vector<float> & level = specular.getLevel(l);
+        memcpy(data + offset, &level[0], level.size() * sizeof(float));
+        offset += level.size() * sizeof(float);
+    }
+    munmap(data, header.bytes);
+    return true;
+}
+
+
+bool
+readCache(const string & fileName, Environment * environment, unsigned long long key)
+{
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    off_t size = lseek(fd, 0, SEEK_END);
+    void * mapped = size >= (off_t)sizeof(CacheHeader) ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (mapped == MAP_FAILED)
+        return false;
+
+    const char * data = (const char *)mapped;
+    const CacheHeader * header = (const CacheHeader *)data;
+    bool ok = !memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) && header->bytes == (unsigned long long)size &&
+              header->size > 0 && header->size <= 0x7fffffff && header->levels > 0 && header->levels <= 32;
+    if (ok) {
+        // The levels have to fill the rest of the file exactly, checked
+        // before anything is allocated for them: each one's texel count
+        // against the bytes still left, so a damaged size can't overflow
+        unsigned long long bytes = sizeof(CacheHeader);
+        for (unsigned int l = 0; ok && l < header->levels; l++) {
+            unsigned long long n = std::max(header->size >> l, 1u);
+            ok = n * n <= (header->bytes - bytes) / (6 * 3 * sizeof(float));
+            bytes += ok ? n * n * 6 * 3 * sizeof(float) : 0;
+        }
+        ok = ok && bytes == header->bytes;
+
+        // A stale cache is no error, just a miss
+        if (ok && header->key == key) {
+            Cubemap specular(header->size, header->levels);
+            size_t offset = sizeof(CacheHeader);
+            for (unsigned int l = 0; l < specular.getLevels(); l++) {
+                vector<float> & level = specular.getLevel(l);
+                memcpy(&level[0], data + offset, level.size() * sizeof(float));
+                offset += level.size() * sizeof(float);
+            }
+            for (int k = 0; k < 9; k++)
+                environment->irradiance.c[k] = vec3(header->irradiance[k * 3], header->irradiance[k * 3 + 1],
+                                                    header->irradiance[k * 3 + 2]);
+            environment->specular = specular;
+        }
+        ok = ok && header->key == key;
+    } else {
+        printf("Error: %s isn't a lighting cache, or is from another version\n", fileName.c_str());
+    }
+
+    munmap(mapped, size);
+    return ok;
+}
+
+
+bool
+loadOrPrecompute(const string & fileName, Cubemap & source, const Options & options, Environment * environment,
+                 Timing * timing)
+{
+    if (readCache(fileName, environment, cacheKey(source, options))) {
+        if (timing)
+            memset(timing, 0, sizeof(*timing));
+        return true;
+    }
+
+    unsigned long long key = cacheKey(source, options);
+    precompute(source, options, environment, timing);
+    writeCache(fileName, *environment, key);
+    return false;
+}
+
+
+/*
+ * GL
+ */
+GLuint
+prefilterOnGpu(GLuint source, GLsizei sourceSize, const Options & options, shader::GLSLProgram & program)
+{
+    if (!GLEW_ARB_compute_shader) {
+        printf("prefilterOnGpu: needs compute shaders (GL 4.3)\n");
+        return 0;
+    }
+
+    GLsizei size;
+    unsigned int levels;
+    resolve(sourceSize, options, &size, &levels);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, source);
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+    GLuint out;
+    glGenTextures(1, &out);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, out);
+    glTexStorage2D(GL_TEXTURE_CUBE_MAP, levels, GL_RGBA16F, size, size);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, source);
+
+    program.use();
+    program.setUniform("Source", 0);
+    program.setUniform("SourceSize", (float)sourceSize);
+    program.setUniform("Samples", (int)std::max(options.samples, 1u));
+    for (unsigned int l = 0; l < levels; l++) {
+        GLsizei n = std::max(size >> l, 1);
+        glBindImageTexture(0, out, l, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+        program.setUniform("Roughness", levels > 1 ? (float)l / (levels - 1) : 0.0f);
+        program.setUniform("Size", (int)n);
+        glDispatchCompute((n + 7) / 8, (n + 7) / 8, 6);
+    }
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    STATS_COUNT(TEXTURE_BINDS, 4);
+    return out;
+}
+
+
+void
+setUniforms(shader::GLSLProgram & program, const Sh9 & irradiance, unsigned int specularLevels)
+{
+    for (int k = 0; k < 9; k++) {
+        char name[16];
+        snprintf(name, sizeof(name), "Sh[%d]", k);
+        program.setUniform(name, irradiance.c[k]);
+    }
+    program.setUniform("SpecularLevels", (float)specularLevels);
+}
+
+}
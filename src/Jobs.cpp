@@ -0,0 +1,396 @@
+/*
+ * Jobs.cpp
+ *
+ * The deque is the fixed size version from Le, Pop, Cohen and Zappa
+ * Nardelli, "Correct and Efficient Work-Stealing for Weak Memory
+ * Models" (2013). A push that finds it full runs the job right away
+ * instead.
+ *
+ * Idle workers spin briefly, then sleep. A thread queuing work checks
+ * for sleepers after a full fence, and a sleeper looks for work again
+ * after announcing itself, so one of the two always sees the other.
+ */
+#include "Jobs.hpp"
+
+namespace jobs {
+
+struct Job
+{
+    Function    fn;
+    Counter *   signal;
+};
+
+class Deque
+{
+public:
+    static const long CAPACITY = 4096;
+
+    Deque():top(0), bottom(0)
+    {
+        for (long i = 0; i < CAPACITY; i++)
+            slots[i].store(NULL, std::memory_order_relaxed);
+    }
+
+    // Owner only
+    bool push(Job * job)
+    {
+        long b = bottom.load(std::memory_order_relaxed);
+        long t = top.load(std::memory_order_acquire);
+        if (b - t >= CAPACITY)
+            return false;
+        slots[b & (CAPACITY - 1)].store(job, std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Owner only
+    Job * pop()
+    {
+        long b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long t = top.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return NULL;
+        }
+        Job * job = slots[b & (CAPACITY - 1)].load(std::memory_order_relaxed);
+        if (t == b) {
+            // The last one: race the thieves for it
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                job = NULL;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+    // Any thread. NULL if empty or if another thread got there first.
+    Job * steal()
+    {
+        long t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long b = bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return NULL;
+        Job * job = slots[t & (CAPACITY - 1)].load(std::memory_order_relaxed);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return NULL;
+        return job;
+    }
+
+    bool empty() const
+    {
+        return top.load(std::memory_order_relaxed) >= bottom.load(std::memory_order_relaxed);
+    }
+
+protected:
+    std::atomic<long>   top;
+    char                padding[64];    // thieves and owner on separate lines
+    std::atomic<long>   bottom;
+    std::atomic<Job *>  slots[CAPACITY];
+};
+
+
+// Which pool, and which of its threads, this thread is
+static thread_local const JobSystem * currentSystem = NULL;
+static thread_local int currentIndex = -1;
+
+// Spins through the queues before a worker goes to sleep
+static const int IDLE_SPINS = 64;
+
+
+JobSystem::JobSystem(unsigned int threads):
+    stats(threads ? threads : std::max(1u, std::thread::hardware_concurrency())),
+    sharedCount(0),
+    mainCount(0),
+    onMain(0),
+    sleepers(0),
+    pending(0),
+    stopping(false)
+{
+    unsigned int count = stats.size();
+    for (unsigned int i = 0; i < count; i++)
+        deques.push_back(new Deque);
+    resetStats();
+
+    currentSystem = this;
+    currentIndex = 0;
+    for (unsigned int i = 1; i < count; i++)
+        workers.push_back(std::thread(&JobSystem::workerLoop, this, i));
+}
+
+
+JobSystem::~JobSystem()
+{
+    while (pending.load() > 0)
+        if (!runOne(currentThread(), isMainThread()))
+            std::this_thread::yield();
+
+    {
+        std::lock_guard<std::mutex> lock(sleepLock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (unsigned int i = 0; i < workers.size(); i++)
+        workers[i].join();
+    for (unsigned int i = 0; i < deques.size(); i++)
+        delete deques[i];
+    if (currentSystem == this)
+        currentSystem = NULL;
+}
+
+
+int
+JobSystem::currentThread() const
+{
+    return currentSystem == this ? currentIndex : -1;
+}
+
+
+bool
+JobSystem::isMainThread() const
+{
+    return currentThread() == 0;
+}
+
+
+void
+JobSystem::run(const Function & fn, Counter * signal, Counter * after)
+{
+    Job * job = new Job;
+    job->fn = fn;
+    job->signal = signal;
+    if (signal)
+        signal->count.fetch_add(1, std::memory_order_relaxed);
+    pending.fetch_add(1, std::memory_order_relaxed);
+
+    if (after) {
+        // Checked under the lock that execute() takes once the count
+        // reaches zero, so the job is either seen there or queued here
+        std::lock_guard<std::mutex> lock(after->lock);
+        if (after->count.load(std::memory_order_acquire) > 0) {
+            after->waiting.push_back(job);
+            return;
+        }
+    }
+    submit(job);
+}
+
+
+void
+JobSystem::runOnMain(const Function & fn, Counter * signal)
+{
+    Job * job = new Job;
+    job->fn = fn;
+    job->signal = signal;
+    if (signal)
+        signal->count.fetch_add(1, std::memory_order_relaxed);
+    pending.fetch_add(1, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(mainLock);
+    mainJobs.push_back(job);
+    mainCount.fetch_add(1, std::memory_order_release);
+}
+
+
+void
+JobSystem::submit(Job * job)
+{
+    int self = currentThread();
+    if (self >= 0) {
+        if (!deques[self]->push(job)) {
+            execute(job, self);
+            return;
+        }
+    } else {
+        std::lock_guard<std::mutex> lock(sharedLock);
+        shared.push_back(job);
+        sharedCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers.load(std::memory_order_relaxed) > 0) {
+        std::lock_guard<std::mutex> lock(sleepLock);
+        wake.notify_one();
+    }
+}
+
+
+void
+JobSystem::execute(Job * job, int self)
+{
+    job->fn();
+    if (self >= 0)
+        stats[self].executed.fetch_add(1, std::memory_order_relaxed);
+
+    Counter * signal = job->signal;
+    delete job;
+
+    // Whoever waits on signal may destroy it as soon as it's done(), so
+    // mark it busy until the last touch
+    if (signal) {
+        signal->busy.fetch_add(1, std::memory_order_acq_rel);
+        if (signal->count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            vector<Job *> released;
+            {
+                std::lock_guard<std::mutex> lock(signal->lock);
+                released.swap(signal->waiting);
+            }
+            for (unsigned int i = 0; i < released.size(); i++)
+                submit(released[i]);
+        }
+        signal->busy.fetch_sub(1, std::memory_order_acq_rel);
+    }
+    pending.fetch_sub(1, std::memory_order_release);
+}
+
+
+// One job from, in order: the main thread queue (main thread only), our
+// own deque, the shared queue, another thread's deque
+bool
+JobSystem::runOne(int self, bool main)
+{
+    Job * job = NULL;
+
+    if (main && mainCount.load(std::memory_order_acquire) > 0) {
+        std::lock_guard<std::mutex> lock(mainLock);
+        if (!mainJobs.empty()) {
+            job = mainJobs.front();
+            mainJobs.pop_front();
+            mainCount.fetch_sub(1, std::memory_order_relaxed);
+        }
+        if (job)
+            onMain.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (!job && self >= 0)
+        job = deques[self]->pop();
+
+    if (!job && sharedCount.load(std::memory_order_relaxed) > 0) {
+        std::lock_guard<std::mutex> lock(sharedLock);
+        if (!shared.empty()) {
+            job = shared.back();
+            shared.pop_back();
+            sharedCount.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    if (!job) {
+        // Start at a different victim each time so thieves spread out
+        unsigned int count = deques.size();
+        static thread_local unsigned int next = 0;
+        for (unsigned int k = 0; k < count && !job; k++) {
+            unsigned int victim = (next + k) % count;
+            if ((int)victim == self || deques[victim]->empty())
+                continue;
+            if (self >= 0)
+                stats[self].stealAttempts.fetch_add(1, std::memory_order_relaxed);
+            job = deques[victim]->steal();
+            if (job && self >= 0)
+                stats[self].stolen.fetch_add(1, std::memory_order_relaxed);
+        }
+        next++;
+    }
+
+    if (!job)
+        return false;
+    execute(job, self);
+    return true;
+}
+
+
+bool
+JobSystem::haveWork() const
+{
+    if (sharedCount.load(std::memory_order_relaxed) > 0)
+        return true;
+    for (unsigned int i = 0; i < deques.size(); i++)
+        if (!deques[i]->empty())
+            return true;
+    return false;
+}
+
+
+void
+JobSystem::workerLoop(int self)
+{
+    currentSystem = this;
+    currentIndex = self;
+
+    int idle = 0;
+    while (!stopping.load(std::memory_order_relaxed)) {
+        if (runOne(self, false)) {
+            idle = 0;
+            continue;
+        }
+        if (++idle < IDLE_SPINS) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepLock);
+        sleepers.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!haveWork() && !stopping.load(std::memory_order_relaxed))
+            wake.wait(lock);
+        sleepers.fetch_sub(1, std::memory_order_relaxed);
+        idle = 0;
+    }
+}
+
+
+void
+JobSystem::wait(Counter & counter)
+{
+    int self = currentThread();
+    bool main = self == 0;
+    while (!counter.done())
+        if (!runOne(self, main))
+            std::this_thread::yield();
+}
+
+
+unsigned int
+JobSystem::pumpMain()
+{
+    if (!isMainThread())
+        return 0;
+
+    std::deque<Job *> jobs;
+    {
+        std::lock_guard<std::mutex> lock(mainLock);
+        jobs.swap(mainJobs);
+        mainCount.store(0, std::memory_order_relaxed);
+    }
+    for (unsigned int i = 0; i < jobs.size(); i++)
+        execute(jobs[i], 0);
+    onMain.fetch_add(jobs.size(), std::memory_order_relaxed);
+    return jobs.size();
+}
+
+
+Stats
+JobSystem::getStats() const
+{
+    Stats s = { 0, 0, 0, onMain.load() };
+    for (unsigned int i = 0; i < stats.size(); i++) {
+        s.executed += stats[i].executed.load();
+        s.stolen += stats[i].stolen.load();
+        s.stealAttempts += stats[i].stealAttempts.load();
+    }
+    return s;
+}
+
+
+void
+JobSystem::resetStats()
+{
+    for (unsigned int i = 0; i < stats.size(); i++) {
+        stats[i].executed = 0;
+        stats[i].stolen = 0;
+        stats[i].stealAttempts = 0;
+    }
+    onMain = 0;
+}
+
+}
@@ -1,215 +1,931 @@
+/*
+ * Loader.cpp
+ *
+ * Files are read a line at a time through a fixed window and walked
+ * with one pointer: statements are told apart by their first characters
+ * and numbers are parsed in place, with no copies and no scanf. Faces of
+ * any size are fanned into triangles as they are read, and their indices
+ * resolved right away, since negative ones count back from whatever has
+ * been read so far.
+ *
+ * The same parser does loadObj() in one pass and scanObj()/readObj() in
+ * two, handing what it reads to a handler for each. Nothing keeps per
+ * corner indices: corners are written out as soon as their face is read.
+ */
 #include "Loader.hpp"
-#include <iostream>
-#include <fstream>
+#include "Normals.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
 #include <vector>
 
 using std::vector;
 
 namespace mesh {
-    TriMesh
-    loadObj(string filename)
-    {
-        TriMesh m;
 
-        std::ifstream fin(filename.c_str());
+    static const unsigned int NONE = ~0u;
 
-        float x, y, z;
-        unsigned int iv1, it1, in1;
-        unsigned int iv2, it2, in2;
-        unsigned int iv3, it3, in3;
-        unsigned int iv4, it4, in4;
+    // Exact as doubles, so one multiply or divide by them rounds correctly
+    static const double powersOfTen[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
 
-        vector<vec3> vertices;
-        vector<vec2> uvs;
-        vector<vec3> normals;
+    static inline bool
+    isBlank(char c)
+    {
+        return c == ' ' || c == '\t';
+    }
 
-        vector<unsigned int> vertexIndices;
-        vector<unsigned int> normalIndices;
-        vector<unsigned int> uvIndices;
+    static inline bool
+    isLineEnd(char c)
+    {
+        return c == '\n' || c == '\r' || c == '\0' || c == '#';
+    }
 
-        bool hasUvs = true;
-        bool hasNormals = true;
-        int type = 0; // 0 == EMPTY, 1 == QUADS, 2 == TRIANGLES
+    static inline bool
+    isDigit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    static inline const char *
+    skipBlanks(const char * p)
+    {
+        while (isBlank(*p))
+            p++;
+        return p;
+    }
 
-        string s;
-        while (getline( fin, s )) {
+    // The statement's name, if p starts with it followed by a blank or
+    // the end of the line. Returns what follows, or NULL.
+    static inline const char *
+    keyword(const char * p, const char * name)
+    {
+        size_t length = strlen(name);
+        if (strncmp(p, name, length) || !(isBlank(p[length]) || isLineEnd(p[length])))
+            return NULL;
+        return skipBlanks(p + length);
+    }
 
-            // Vertex
-            if (sscanf(s.c_str(), "v %f %f %f", &x, &y, &z) == 3) {
-                vertices.push_back(vec3(x,y,z));
-                continue;
-            }
+    // From p to the end of the line, without surrounding blanks
+    static string
+    restOfLine(const char * p)
+    {
+        p = skipBlanks(p);
+        const char * end = p;
+        while (*end && *end != '\r')
+            end++;
+        while (end > p && isBlank(end[-1]))
+            end--;
+        return string(p, end);
+    }
 
-            // Vertex UV
-            if (sscanf(s.c_str(), "vt %f %f", &x, &y) == 2) {
-                uvs.push_back(vec2(x,y));
-                printf("TEXTURE: %f %f\n", x, y);
-                continue;
+    // Decimal floats with up to 17 significant digits and small exponents,
+    // which is everything exporters write, are parsed here with a single
+    // correctly rounded multiply or divide; anything else goes to strtod.
+    // Returns p unchanged if there is no number.
+    static const char *
+    parseFloat(const char * p, float & value)
+    {
+        const char * start = p;
+        bool negative = false;
+        if (*p == '-' || *p == '+')
+            negative = *p++ == '-';
+
+        unsigned long long mantissa = 0;
+        int exponent = 0;
+        bool digits = false, exact = true;
+        for (; isDigit(*p); p++, digits = true) {
+            if (mantissa < 100000000000000000ULL)
+                mantissa = mantissa * 10 + (*p - '0');
+            else
+                exact = false;
+        }
+        if (*p == '.') {
+            for (p++; isDigit(*p); p++, digits = true) {
+                if (mantissa < 100000000000000000ULL) {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    exponent--;
+                } else {
+                    exact = false;
+                }
             }
+        }
 
-            // Vertex normal
-            if (sscanf(s.c_str(), "vn %f %f %f", &x, &y, &z) == 3) {
-                normals.push_back(vec3(x,y,z));
-                continue;
+        if (digits && (*p == 'e' || *p == 'E')) {
+            const char * e = p + 1;
+            bool negativeExponent = false;
+            if (*e == '-' || *e == '+')
+                negativeExponent = *e++ == '-';
+            if (isDigit(*e)) {
+                int power = 0;
+                for (; isDigit(*e); e++)
+                    if (power < 10000)
+                        power = power * 10 + (*e - '0');
+                exponent += negativeExponent ? -power : power;
+                p = e;
             }
+        }
 
-            // Face (Quad)
-            if (sscanf(s.c_str(), "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d",
-                       &iv1, &it1, &in1,
-                       &iv2, &it2, &in2,
-                       &iv3, &it3, &in3,
-                       &iv4, &it4, &in4) == 12) {
+        // nan, inf, hex, very long or very small: let the C library do it
+        if (!digits || !exact || mantissa > (1ULL << 53) || exponent < -22 || exponent > 22) {
+            char * end;
+            double d = strtod(start, &end);
+            if (end == start)
+                return start;
+            value = (float)d;
+            return end;
+        }
 
-                if (type) {
-                    if (type != 1)
-                        printf("Error: Model has both quads and triangles.\n");
-                } else {
-                    type = 1; // QUADS
-                }
+        double d = (double)mantissa;
+        d = exponent < 0 ? d / powersOfTen[-exponent] : d * powersOfTen[exponent];
+        value = (float)(negative ? -d : d);
+        return p;
+    }
 
-                if(iv1 < 1 || iv1 >= vertices.size() ||
-                   iv2 < 1 || iv2 >= vertices.size() ||
-                   iv3 < 1 || iv3 >= vertices.size() ||
-                   iv4 < 1 || iv4 >= vertices.size()) {
-                    printf("Error: vertex index out of bounds:\n\t[%s]\n", s.c_str());
-                    continue;
+    // Up to max blank separated floats; returns how many there were
+    static inline int
+    parseFloats(const char * p, float * values, int max)
+    {
+        int count = 0;
+        for (p = skipBlanks(p); count < max; count++) {
+            const char * next = parseFloat(p, values[count]);
+            if (next == p || !(isBlank(*next) || isLineEnd(*next)))
+                break;
+            p = skipBlanks(next);
+        }
+        return count;
+    }
+
+    // Returns p unchanged if there is no number
+    static inline const char *
+    parseInt(const char * p, int & value)
+    {
+        const char * start = p;
+        bool negative = false;
+        if (*p == '-' || *p == '+')
+            negative = *p++ == '-';
+        if (!isDigit(*p))
+            return start;
+
+        long long v = 0;
+        for (; isDigit(*p); p++)
+            if (v < 0x7fffffff)
+                v = v * 10 + (*p - '0');
+        value = (int)(negative ? -std::min(v, 0x7fffffffLL) : std::min(v, 0x7fffffffLL));
+        return p;
+    }
+
+    // .obj indices start at 1; negative ones count back from the last
+    // element read so far. NONE if it is out of range.
+    static inline unsigned int
+    resolve(int index, size_t count)
+    {
+        long long i = index > 0 ? (long long)index - 1 : (long long)count + index;
+        return index == 0 || i < 0 || i >= (long long)count ? NONE : (unsigned int)i;
+    }
+
+    // Hands out the lines of a file through a buffer of a fixed size,
+    // which only grows if a single line doesn't fit. Continuation lines
+    // come back joined. The buffer comes from the arena if there is one.
+    class LineWindow
+    {
+    public:
+        LineWindow(FILE * file, mem::Arena * arena, size_t size = 1 << 20):
+            _file(file), _arena(arena), _start(0), _scan(0), _filled(0), _end(false)
+        {
+            allocate(size);
+        }
+
+        // The next line, NUL terminated in place of its '\n', or NULL
+        char *
+        next()
+        {
+            for (;;) {
+                char * newline = (char *)memchr(_data + _scan, '\n', _filled - _scan);
+                if (newline) {
+                    // A backslash at the end joins the next line on
+                    char * last = newline;
+                    if (last > _data + _start && last[-1] == '\r')
+                        last--;
+                    if (last > _data + _start && last[-1] == '\\') {
+                        memset(last - 1, ' ', newline - last + 2);
+                        _scan = newline + 1 - _data;
+                        continue;
+                    }
+
+                    *newline = '\0';
+                    char * line = _data + _start;
+                    _start = _scan = newline + 1 - _data;
+                    return line;
                 }
-                if(in1 < 1 || in1 >= normals.size() ||
-                   in2 < 1 || in2 >= normals.size() ||
-                   in3 < 1 || in3 >= normals.size() ||
-                   in4 < 1 || in4 >= normals.size()) {
-                    printf("Error: normal index out of bounds:\n\t[%s]\n", s.c_str());
-                    continue;
+
+                if (_end) {
+                    if (_start == _filled)
+                        return NULL;
+                    _data[_filled] = '\0';
+                    char * line = _data + _start;
+                    _start = _scan = _filled;
+                    return line;
                 }
-                if(it1 < 1 || it1 >= uvs.size() ||
-                   it2 < 1 || it2 >= uvs.size() ||
-                   it3 < 1 || it3 >= uvs.size() ||
-                   it4 < 1 || it4 >= uvs.size()) {
-                    printf("Error: uv index out of bounds:\n\t[%s]\n", s.c_str());
-                    continue;
+
+                // Keep the partial line, and read more after it
+                size_t partial = _filled - _start;
+                if (partial == _size) {
+                    char * old = _data;
+                    allocate(_size * 2);
+                    memcpy(_data, old + _start, partial);
+                } else {
+                    memmove(_data, _data + _start, partial);
                 }
+                _scan -= _start;
+                _start = 0;
+                _filled = partial;
+
+                size_t read = fread(_data + _filled, 1, _size - _filled, _file);
+                _filled += read;
+                _end = read == 0;
+            }
+        }
 
-                vertexIndices.push_back(iv1);
-                vertexIndices.push_back(iv2);
-                vertexIndices.push_back(iv3);
-                vertexIndices.push_back(iv4);
+    protected:
+        // Room for size bytes and a NUL; what was there stays valid
+        // until the next call
+        void
+        allocate(size_t size)
+        {
+            if (_arena) {
+                _data = _arena->allocate<char>(size + 1);
+            } else {
+                _previous.swap(_own);
+                _own.resize(size + 1);
+                _data = &_own[0];
+            }
+            _size = size;
+        }
 
-                normalIndices.push_back(in1);
-                normalIndices.push_back(in2);
-                normalIndices.push_back(in3);
-                normalIndices.push_back(in4);
+        FILE * _file;
+        mem::Arena * _arena;
+        vector<char> _own, _previous;
+        char * _data;
+        size_t _size, _start, _scan, _filled;
+        bool _end;
+    };
+
+    // Reads filename, counting into info as it goes and passing the
+    // handler every vertex, uv and normal, and every triangle once its
+    // indices are resolved and checked (NONE for a missing uv or normal).
+    // Complains about bad lines only if report is set.
+    template <typename Handler>
+    static bool
+    parseObj(const string & filename, Handler & handler, ObjInfo & info, bool report,
+             mem::Arena * arena = NULL)
+    {
+        FILE * f = fopen(filename.c_str(), "rb");
+        if (!f) {
+            printf("Error: can't read %s\n", filename.c_str());
+            return false;
+        }
 
-                uvIndices.push_back(it1);
-                uvIndices.push_back(it2);
-                uvIndices.push_back(it3);
-                uvIndices.push_back(it4);
+        info = ObjInfo();
+        LineWindow window(f, arena);
 
-                continue;
-            }
+        // The face being read
+        vector<unsigned int> faceVertices, faceUvs, faceNormals;
 
-            // Face
-            if (sscanf(s.c_str(), "f %d/%d/%d %d/%d/%d %d/%d/%d",
-                       &iv1, &it1, &in1,
-                       &iv2, &it2, &in2,
-                       &iv3, &it3, &in3) == 9) {
+        string object, group;
+        int material = -1;
+        bool newSubMesh = true;
 
-                if (type) {
-                    if (type != 2)
-                        printf("Error: Model has both quads and triangles.\n");
-                } else {
-                    type = 2; // TRIANGLES
-                }
+        for (char * line; (line = window.next()); ) {
+            const char * p = skipBlanks(line);
+            const char * args;
+            float values[3];
 
-                if(iv1 < 1 || iv1 > vertices.size() ||
-                   iv2 < 1 || iv2 > vertices.size() ||
-                   iv3 < 1 || iv3 > vertices.size()) {
-                    printf("Error: vertex index out of bounds:\n\t[%s]\n", s.c_str());
+            // Vertex, ignoring w and colours
+            if (p[0] == 'v' && isBlank(p[1])) {
+                if (parseFloats(p + 1, values, 3) == 3) {
+                    handler.position(vec3(values[0], values[1], values[2]));
+                    info.positions++;
+                    continue;
                 }
-                if(in1 < 1 || in1 > normals.size() ||
-                   in2 < 1 || in2 > normals.size() ||
-                   in3 < 1 || in3 > normals.size()) {
-                    printf("Error: normal index out of bounds:\n\t[%s]\n", s.c_str());
+            }
+
+            // Vertex UV; v is optional and w is ignored
+            else if (p[0] == 'v' && p[1] == 't' && isBlank(p[2])) {
+                values[1] = 0.0f;
+                if (parseFloats(p + 2, values, 2) >= 1) {
+                    handler.uv(vec2(values[0], values[1]));
+                    info.uvs++;
+                    continue;
                 }
-                if(it1 < 1 || it1 > uvs.size() ||
-                   it2 < 1 || it2 > uvs.size() ||
-                   it3 < 1 || it3 > uvs.size()) {
-                    printf("Error: uv index out of bounds:\n\t[%s]\n", s.c_str());
+            }
+
+            // Vertex normal
+            else if (p[0] == 'v' && p[1] == 'n' && isBlank(p[2])) {
+                if (parseFloats(p + 2, values, 3) == 3) {
+                    handler.normal(vec3(values[0], values[1], values[2]));
+                    info.normals++;
+                    continue;
                 }
+            }
 
-                vertexIndices.push_back(iv1);
-                vertexIndices.push_back(iv2);
-                vertexIndices.push_back(iv3);
+            // Face: v, v/t, v//n or v/t/n corners, as many as it has
+            else if (p[0] == 'f' && isBlank(p[1])) {
+                faceVertices.clear();
+                faceUvs.clear();
+                faceNormals.clear();
+
+                const char * q = skipBlanks(p + 1);
+                bool parsed = true, inRange = true;
+                while (!isLineEnd(*q)) {
+                    int v, t, n;
+                    const char * next = parseInt(q, v);
+                    if (next == q) {
+                        parsed = false;
+                        break;
+                    }
+                    q = next;
+
+                    unsigned int uv = NONE, normal = NONE;
+                    bool withUv = false, withNormal = false;
+                    if (*q == '/') {
+                        q++;
+                        if (*q != '/') {
+                            if ((next = parseInt(q, t)) == q) {
+                                parsed = false;
+                                break;
+                            }
+                            q = next;
+                            withUv = true;
+                            uv = resolve(t, info.uvs);
+                        }
+                        if (*q == '/') {
+                            q++;
+                            if ((next = parseInt(q, n)) == q) {
+                                parsed = false;
+                                break;
+                            }
+                            q = next;
+                            withNormal = true;
+                            normal = resolve(n, info.normals);
+                        }
+                    }
+                    if (!isBlank(*q) && !isLineEnd(*q)) {
+                        parsed = false;
+                        break;
+                    }
+
+                    unsigned int vertex = resolve(v, info.positions);
+                    inRange = inRange && vertex != NONE && (!withUv || uv != NONE) &&
+                              (!withNormal || normal != NONE);
+                    faceVertices.push_back(vertex);
+                    faceUvs.push_back(uv);
+                    faceNormals.push_back(normal);
+                    q = skipBlanks(q);
+                }
 
-                normalIndices.push_back(in1);
-                normalIndices.push_back(in2);
-                normalIndices.push_back(in3);
+                if (parsed && faceVertices.size() >= 3) {
+                    if (!inRange) {
+                        if (report)
+                            printf("Error: index out of bounds:\n\t[%s]\n", restOfLine(line).c_str());
+                        continue;
+                    }
+
+                    if (newSubMesh) {
+                        SubMesh s;
+                        s.object = object;
+                        s.group = group;
+                        s.material = material;
+                        s.first = info.corners;
+                        info.submeshes.push_back(s);
+                        newSubMesh = false;
+                    }
+
+                    // Fan from the first corner
+                    for (unsigned int i = 1; i + 1 < faceVertices.size(); i++) {
+                        const unsigned int v[3] = { faceVertices[0], faceVertices[i], faceVertices[i + 1] };
+                        const unsigned int t[3] = { faceUvs[0], faceUvs[i], faceUvs[i + 1] };
+                        const unsigned int n[3] = { faceNormals[0], faceNormals[i], faceNormals[i + 1] };
+                        handler.triangle(v, t, n);
+                        info.corners += 3;
+                    }
+                    for (unsigned int i = 0; i < faceVertices.size(); i++) {
+                        info.hasUvs = info.hasUvs && faceUvs[i] != NONE;
+                        info.hasNormals = info.hasNormals && faceNormals[i] != NONE;
+                    }
+                    continue;
+                }
+            }
 
-                uvIndices.push_back(it1);
-                uvIndices.push_back(it2);
-                uvIndices.push_back(it3);
+            // Objects, groups and materials start a new submesh with the
+            // next face, if anything changed
+            else if ((args = keyword(p, "o"))) {
+                string name = restOfLine(args);
+                newSubMesh = newSubMesh || name != object;
+                object = name;
+                continue;
+            }
+            else if ((args = keyword(p, "g"))) {
+                string name = restOfLine(args);
+                if (name.empty())
+                    name = "default";
+                newSubMesh = newSubMesh || name != group;
+                group = name;
+                continue;
+            }
+            else if ((args = keyword(p, "usemtl"))) {
+                string name = restOfLine(args);
+                int id = -1;
+                for (unsigned int i = 0; i < info.materials.size() && id < 0; i++)
+                    if (info.materials[i] == name)
+                        id = i;
+                if (id < 0) {
+                    id = info.materials.size();
+                    info.materials.push_back(name);
+                }
+                newSubMesh = newSubMesh || id != material;
+                material = id;
+                continue;
+            }
+            else if ((args = keyword(p, "mtllib"))) {
+                // Any number of file names
+                while (!isLineEnd(*args)) {
+                    const char * end = args;
+                    while (*end && !isBlank(*end) && *end != '\r')
+                        end++;
+                    info.materialLibraries.push_back(string(args, end));
+                    args = skipBlanks(end);
+                }
+                continue;
+            }
 
-                //printf("ADDED TRI\n");
+            // Comments, blank lines, smoothing groups (the normals, or
+            // the crease angle when they're generated, decide instead),
+            // and lines, points and free-form geometry, which aren't
+            // triangles
+            else if (isLineEnd(*p) || keyword(p, "s") || keyword(p, "l") || keyword(p, "p") ||
+                     keyword(p, "vp") || keyword(p, "cstype") || keyword(p, "deg") ||
+                     keyword(p, "curv") || keyword(p, "curv2") || keyword(p, "surf") ||
+                     keyword(p, "parm") || keyword(p, "trim") || keyword(p, "hole") ||
+                     keyword(p, "end")) {
                 continue;
             }
 
-            // Face (no UVs)
-            if (sscanf(s.c_str(), "f %d//%d %d//%d %d//%d",
-                       &iv1, &in1,
-                       &iv2, &in2,
-                       &iv3, &in3) == 6) {
+            if (report)
+                printf("Ignoring line:\n\t[%s]\n", restOfLine(line).c_str());
+        }
+        fclose(f);
 
-                if (type) {
-                    if (type != 2)
-                        printf("Error: Model has both quads and triangles.\n");
-                } else {
-                    type = 2; // TRIANGLES
-                }
+        for (unsigned int i = 0; i < info.submeshes.size(); ++i) {
+            unsigned int end = i + 1 < info.submeshes.size() ? info.submeshes[i + 1].first : info.corners;
+            info.submeshes[i].count = end - info.submeshes[i].first;
+        }
+        if (!info.corners)
+            info.hasUvs = info.hasNormals = false;
+        return true;
+    }
 
-                if(iv1 < 1 || iv1 > vertices.size() ||
-                   iv2 < 1 || iv2 > vertices.size() ||
-                   iv3 < 1 || iv3 > vertices.size()) {
-                    printf("Error: vertex index out of bounds:\n\t[%s]\n", s.c_str());
-                    printf("\tMax size: %u\n", (unsigned int)vertices.size());
-                }
-                if(in1 < 1 || in1 > normals.size() ||
-                   in2 < 1 || in2 > normals.size() ||
-                   in3 < 1 || in3 > normals.size()) {
-                    printf("Error: normal index out of bounds:\n\t[%s]\n", s.c_str());
-                    printf("\tMax size: %u\n", (unsigned int)normals.size());
-                }
+    // loadObj(): everything grows as it's read. Uvs and normals are
+    // dropped as soon as a face turns up without them.
+    class GrowingHandler
+    {
+    public:
+        GrowingHandler(TriMesh & m):_m(m), _withUvs(true), _withNormals(true){}
 
-                vertexIndices.push_back(iv1);
-                vertexIndices.push_back(iv2);
-                vertexIndices.push_back(iv3);
+        void position(const vec3 & p) { _vertices.push_back(p); }
+        void uv(const vec2 & uv) { _uvs.push_back(uv); }
+        void normal(const vec3 & n) { _normals.push_back(n); }
 
-                normalIndices.push_back(in1);
-                normalIndices.push_back(in2);
-                normalIndices.push_back(in3);
+        void
+        triangle(const unsigned int * v, const unsigned int * t, const unsigned int * n)
+        {
+            if (_withUvs && (t[0] == NONE || t[1] == NONE || t[2] == NONE)) {
+                _withUvs = false;
+                vector<vec2>().swap(_m.uvs);
+            }
+            if (_withNormals && (n[0] == NONE || n[1] == NONE || n[2] == NONE)) {
+                _withNormals = false;
+                vector<vec3>().swap(_m.normals);
+            }
 
-                hasUvs = false;
+            for (int k = 0; k < 3; k++) {
+                _m.vertices.push_back(_vertices[v[k]]);
+                if (_withUvs)
+                    _m.uvs.push_back(_uvs[t[k]]);
+                if (_withNormals)
+                    _m.normals.push_back(_normals[n[k]]);
+            }
+        }
 
-                continue;
+    protected:
+        TriMesh & _m;
+        vector<vec3> _vertices;
+        vector<vec2> _uvs;
+        vector<vec3> _normals;
+        bool _withUvs, _withNormals;
+    };
+
+    // loadObj() with an arena: the file's arrays and the corners go into
+    // blocks from it, which never move, and the mesh's vectors are
+    // allocated once at the end at their exact size
+    class ArenaHandler
+    {
+    public:
+        ArenaHandler(mem::Arena & arena):
+            _vertices(arena), _uvs(arena), _normals(arena),
+            _cornerVertices(arena), _cornerUvs(arena), _cornerNormals(arena),
+            _withUvs(true), _withNormals(true)
+        {}
+
+        void position(const vec3 & p) { _vertices.push_back(p); }
+        void uv(const vec2 & uv) { _uvs.push_back(uv); }
+        void normal(const vec3 & n) { _normals.push_back(n); }
+
+        void
+        triangle(const unsigned int * v, const unsigned int * t, const unsigned int * n)
+        {
+            _withUvs = _withUvs && t[0] != NONE && t[1] != NONE && t[2] != NONE;
+            _withNormals = _withNormals && n[0] != NONE && n[1] != NONE && n[2] != NONE;
+
+            for (int k = 0; k < 3; k++) {
+                _cornerVertices.push_back(_vertices[v[k]]);
+                if (_withUvs)
+                    _cornerUvs.push_back(_uvs[t[k]]);
+                if (_withNormals)
+                    _cornerNormals.push_back(_normals[n[k]]);
             }
+        }
 
-            printf("Ignoring line:\n\t[%s]\n", s.c_str());
+        void
+        finish(TriMesh & m) const
+        {
+            _cornerVertices.appendTo(m.vertices);
+            if (_withUvs)
+                _cornerUvs.appendTo(m.uvs);
+            if (_withNormals)
+                _cornerNormals.appendTo(m.normals);
         }
 
-        unsigned int vertexIndex, uvIndex, normalIndex;
-        for (unsigned int i = 0; i < vertexIndices.size(); ++i)
+    protected:
+        mem::ArenaArray<vec3> _vertices;
+        mem::ArenaArray<vec2> _uvs;
+        mem::ArenaArray<vec3> _normals;
+        mem::ArenaArray<vec3> _cornerVertices;
+        mem::ArenaArray<vec2> _cornerUvs;
+        mem::ArenaArray<vec3> _cornerNormals;
+        bool _withUvs, _withNormals;
+    };
+
+    // scanObj(): parseObj() does the counting
+    class CountingHandler
+    {
+    public:
+        void position(const vec3 &) {}
+        void uv(const vec2 &) {}
+        void normal(const vec3 &) {}
+        void triangle(const unsigned int *, const unsigned int *, const unsigned int *) {}
+    };
+
+    // readObj(): the file's own arrays are allocated exactly, and corners
+    // go straight to the caller's memory. Counts what doesn't fit, should
+    // the file have changed since it was scanned.
+    class FixedHandler
+    {
+    public:
+        FixedHandler(const ObjInfo & info, vec3 * vertices, vec3 * normals, vec2 * uvs):
+            _info(info), _outVertices(vertices), _outNormals(normals), _outUvs(uvs), _corner(0), _overflow(0)
         {
-            vertexIndex = vertexIndices[i];
-            m.vertices.push_back(vertices[vertexIndex - 1]);
+            _vertices.reserve(info.positions);
+            if (uvs)
+                _uvs.reserve(info.uvs);
+            if (normals)
+                _normals.reserve(info.normals);
+        }
+
+        void position(const vec3 & p) { _vertices.size() < _info.positions ? _vertices.push_back(p) : overflow(); }
+        void uv(const vec2 & uv) { if (_outUvs) _uvs.size() < _info.uvs ? _uvs.push_back(uv) : overflow(); }
+        void normal(const vec3 & n) { if (_outNormals) _normals.size() < _info.normals ? _normals.push_back(n) : overflow(); }
 
-            if(hasNormals) {
-                normalIndex = normalIndices[i];
-                m.normals.push_back(normals[normalIndex - 1]);
+        void
+        triangle(const unsigned int * v, const unsigned int * t, const unsigned int * n)
+        {
+            if (_corner + 3 > _info.corners ||
+                (_outUvs && (t[0] == NONE || t[1] == NONE || t[2] == NONE)) ||
+                (_outNormals && (n[0] == NONE || n[1] == NONE || n[2] == NONE))) {
+                overflow();
+                return;
+            }
+
+            for (int k = 0; k < 3; k++, _corner++) {
+                _outVertices[_corner] = _vertices[v[k]];
+                if (_outUvs)
+                    _outUvs[_corner] = _uvs[t[k]];
+                if (_outNormals)
+                    _outNormals[_corner] = _normals[n[k]];
             }
-            if(hasUvs) {
-                uvIndex = uvIndices[i];
-                m.uvs.push_back(uvs[uvIndex - 1]);
+        }
+
+        bool matched() const { return !_overflow && _corner == _info.corners; }
+
+    protected:
+        void overflow() { _overflow++; }
+
+        const ObjInfo & _info;
+        vec3 * _outVertices, * _outNormals;
+        vec2 * _outUvs;
+        vector<vec3> _vertices;
+        vector<vec2> _uvs;
+        vector<vec3> _normals;
+        unsigned int _corner, _overflow;
+    };
+
+    TriMesh
+    loadObj(string filename, mem::Arena * arena)
+    {
+        TriMesh m;
+        ObjInfo info;
+        bool ok;
+
+        if (arena) {
+            ArenaHandler handler(*arena);
+            ok = parseObj(filename, handler, info, true, arena);
+            if (ok)
+                handler.finish(m);
+        } else {
+            GrowingHandler handler(m);
+            ok = parseObj(filename, handler, info, true);
+        }
+
+        if (ok) {
+            if (!info.hasNormals)
+                computeNormals(m);
+
+            m.submeshes.swap(info.submeshes);
+            m.materials.swap(info.materials);
+            m.materialLibraries.swap(info.materialLibraries);
+        }
+
+        m.computeBounds();
+        return m;
+    }
+
+    bool
+    scanObj(const string & filename, ObjInfo & info)
+    {
+        CountingHandler handler;
+        return parseObj(filename, handler, info, true);
+    }
+
+    bool
+    readObj(const string & filename, const ObjInfo & info, vec3 * vertices, vec3 * normals, vec2 * uvs)
+    {
+        if ((normals && !info.hasNormals) || (uvs && !info.hasUvs)) {
+            printf("Error: %s doesn't have %s on every face\n", filename.c_str(), normals && !info.hasNormals ? "normals" : "uvs");
+            return false;
+        }
+
+        ObjInfo again;
+        FixedHandler handler(info, vertices, normals, uvs);
+        if (!parseObj(filename, handler, again, false))
+            return false;
+
+        if (!handler.matched() || again.corners != info.corners || again.positions != info.positions) {
+            printf("Error: %s changed since it was scanned\n", filename.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    /*
+     * Binary cache
+     *
+     * A header, then the corners' positions, normals and uvs as flat
+     * arrays, then the submeshes and names. Native byte order.
+     */
+
+    static const char CACHE_MAGIC[8] = { 'O', 'B', 'J', 'C', 'A', 'C', 'H', '1' };
+
+    struct CacheHeader
+    {
+        char magic[8];
+        unsigned int corners;
+        unsigned int hasNormals, hasUvs;
+        unsigned int submeshes, materials, materialLibraries;
+        float bounds[6];
+        unsigned long long namesOffset, size;
+    };
+
+    static void
+    putString(vector<char> & out, const string & s)
+    {
+        unsigned int length = s.size();
+        out.insert(out.end(), (const char *)&length, (const char *)&length + sizeof(length));
+        out.insert(out.end(), s.begin(), s.end());
+    }
+
+    static bool
+    getString(const char * & p, const char * end, string & s)
+    {
+        unsigned int length;
+        if (end - p < (long)sizeof(length))
+            return false;
+        memcpy(&length, p, sizeof(length));
+        p += sizeof(length);
+        if ((unsigned long)(end - p) < length)
+            return false;
+        s.assign(p, length);
+        p += length;
+        return true;
+    }
+
+    bool
+    writeObjCache(const string & objFile, const string & cacheFile)
+    {
+        ObjInfo info;
+        if (!scanObj(objFile, info))
+            return false;
+
+        // Submeshes and names are small; everything else goes straight
+        // into the mapped file
+        vector<char> names;
+        for (unsigned int i = 0; i < info.submeshes.size(); i++) {
+            const SubMesh & s = info.submeshes[i];
+            const unsigned int range[3] = { (unsigned int)s.material, s.first, s.count };
+            names.insert(names.end(), (const char *)range, (const char *)range + sizeof(range));
+            putString(names, s.object);
+            putString(names, s.group);
+        }
+        for (unsigned int i = 0; i < info.materials.size(); i++)
+            putString(names, info.materials[i]);
+        for (unsigned int i = 0; i < info.materialLibraries.size(); i++)
+            putString(names, info.materialLibraries[i]);
+
+        unsigned long long corners = info.corners;
+        unsigned long long namesOffset = sizeof(CacheHeader) + corners * (sizeof(vec3) +
+            (info.hasNormals ? sizeof(vec3) : 0) + (info.hasUvs ? sizeof(vec2) : 0));
+        unsigned long long size = namesOffset + names.size();
+
+        int fd = ::open(cacheFile.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            printf("Error: can't create %s\n", cacheFile.c_str());
+            return false;
+        }
+        if (ftruncate(fd, size)) {
+            printf("Error: can't size %s to %llu bytes\n", cacheFile.c_str(), size);
+            ::close(fd);
+            return false;
+        }
+        char * data = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            printf("Error: can't map %s\n", cacheFile.c_str());
+            return false;
+        }
+
+        vec3 * vertices = (vec3 *)(data + sizeof(CacheHeader));
+        vec3 * normals = info.hasNormals ? vertices + corners : NULL;
+        vec2 * uvs = info.hasUvs ? (vec2 *)(vertices + corners * (info.hasNormals ? 2 : 1)) : NULL;
+        bool ok = readObj(objFile, info, vertices, normals, uvs);
+
+        if (ok) {
+            Aabb bounds;
+            for (unsigned long long i = 0; i < corners; i++)
+                bounds.add(vertices[i]);
+
+            CacheHeader header;
+            memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+            header.corners = info.corners;
+            header.hasNormals = info.hasNormals;
+            header.hasUvs = info.hasUvs;
+            header.submeshes = info.submeshes.size();
+            header.materials = info.materials.size();
+            header.materialLibraries = info.materialLibraries.size();
+            memcpy(header.bounds, &bounds.min, sizeof(vec3));
+            memcpy(header.bounds + 3, &bounds.max, sizeof(vec3));
+            header.namesOffset = namesOffset;
+            header.size = size;
+            memcpy(data, &header, sizeof(header));
+            if (!names.empty())
+                memcpy(data + namesOffset, &names[0], names.size());
+        }
+
+        munmap(data, size);
+        if (!ok)
+            unlink(cacheFile.c_str());
+        return ok;
+    }
+
+    ObjCache::ObjCache():
+        _data(NULL), _size(0), _corners(0), _vertices(NULL), _normals(NULL), _uvs(NULL)
+    {}
+
+    ObjCache::~ObjCache()
+    {
+        close();
+    }
+
+    bool
+    ObjCache::open(const string & cacheFile)
+    {
+        close();
+
+        int fd = ::open(cacheFile.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        off_t size = lseek(fd, 0, SEEK_END);
+        void * data = size >= (off_t)sizeof(CacheHeader) ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            printf("Error: can't map %s\n", cacheFile.c_str());
+            return false;
+        }
+        _data = (char *)data;
+        _size = size;
+
+        CacheHeader header;
+        memcpy(&header, _data, sizeof(header));
+        unsigned long long arrays = header.corners * (unsigned long long)(sizeof(vec3) +
+            (header.hasNormals ? sizeof(vec3) : 0) + (header.hasUvs ? sizeof(vec2) : 0));
+        if (memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) || header.size != (unsigned long long)size ||
+            header.namesOffset != sizeof(CacheHeader) + arrays || header.namesOffset > header.size) {
+            printf("Error: %s isn't a mesh cache, or is from another version\n", cacheFile.c_str());
+            close();
+            return false;
+        }
+
+        _corners = header.corners;
+        _vertices = (const vec3 *)(_data + sizeof(CacheHeader));
+        _normals = header.hasNormals ? _vertices + _corners : NULL;
+        _uvs = header.hasUvs ? (const vec2 *)(_vertices + _corners * (header.hasNormals ? 2 : 1)) : NULL;
+        _bounds = Aabb(glm::make_vec3(header.bounds), glm::make_vec3(header.bounds + 3));
+
+        const char * p = _data + header.namesOffset, * end = _data + _size;
+        bool ok = true;
+        _submeshes.resize(header.submeshes);
+        for (unsigned int i = 0; ok && i < header.submeshes; i++) {
+            unsigned int range[3];
+            ok = end - p >= (long)sizeof(range);
+            if (ok) {
+                memcpy(range, p, sizeof(range));
+                p += sizeof(range);
+                _submeshes[i].material = (int)range[0];
+                _submeshes[i].first = range[1];
+                _submeshes[i].count = range[2];
+                ok = getString(p, end, _submeshes[i].object) && getString(p, end, _submeshes[i].group);
             }
         }
+        _materials.resize(header.materials);
+        for (unsigned int i = 0; ok && i < header.materials; i++)
+            ok = getString(p, end, _materials[i]);
+        _materialLibraries.resize(header.materialLibraries);
+        for (unsigned int i = 0; ok && i < header.materialLibraries; i++)
+            ok = getString(p, end, _materialLibraries[i]);
+
+        if (!ok) {
+            printf("Error: %s is truncated\n", cacheFile.c_str());
+            close();
+        }
+        return ok;
+    }
+
+    void
+    ObjCache::close()
+    {
+        if (_data)
+            munmap(_data, _size);
+        _data = NULL;
+        _size = 0;
+        _corners = 0;
+        _vertices = _normals = NULL;
+        _uvs = NULL;
+        _bounds = Aabb();
+        _submeshes.clear();
+        _materials.clear();
+        _materialLibraries.clear();
+    }
 
+    TriMesh
+    ObjCache::toTriMesh() const
+    {
+        TriMesh m;
+        m.vertices.assign(_vertices, _vertices + _corners);
+        if (_uvs)
+            m.uvs.assign(_uvs, _uvs + _corners);
+        if (_normals)
+            m.normals.assign(_normals, _normals + _corners);
+        else
+            computeNormals(m);
+
+        m.submeshes = _submeshes;
+        m.materials = _materials;
+        m.materialLibraries = _materialLibraries;
+        m.bounds = _bounds;
         return m;
     }
 }
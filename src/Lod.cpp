@@ -0,0 +1,705 @@
+/*
+ * Lod.cpp
+ *
+ * Every vertex carries two quadrics: the geometric one (squared
+ * distances to the planes of the triangles it has absorbed, plus
+ * planes through open borders to hold them in place) and an attribute
+ * one. For each triangle and attribute, Hoppe fits a linear function
+ * g.p + d that matches the attribute at the three corners; the
+ * attribute error of putting a vertex with value a at p is then the
+ * sum of (a - g.p - d)^2 over the triangles. Both are weighted by
+ * area and divided by the total, so errors are mean squared distances.
+ *
+ * Collapses come off a heap, cheapest first. A vertex's stamp changes
+ * whenever its quadric does, which is how stale entries are spotted.
+ */
+#include "Lod.hpp"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+
+#include "Loader.hpp"
+#include "ParallelFor.hpp"
+
+namespace lod {
+
+// Normals and uvs at most
+static const int MAX_ATTRIBUTES = 5;
+
+// Border planes against the triangles' own
+static const double BORDER_WEIGHT = 10.0;
+
+// Cosine past which a moved triangle counts as flipped. Not 0, or a
+// run of collapses just short of 90 degrees each can still flip one.
+static const float FLIP_COS = 0.25f;
+
+enum Kind
+{
+    MANIFOLD,
+    BORDER,     // on an open edge; only moves along it
+    LOCKED      // seam or non-manifold; never moves
+};
+
+struct Quadric
+{
+    Quadric():a00(0), a11(0), a22(0), a01(0), a02(0), a12(0), b0(0), b1(0), b2(0), c(0), w(0) {}
+
+    // weight * (n.p + d)^2
+    void addPlane(const glm::dvec3 & n, double d, double weight)
+    {
+        a00 += weight * n.x * n.x;
+        a11 += weight * n.y * n.y;
+        a22 += weight * n.z * n.z;
+        a01 += weight * n.x * n.y;
+        a02 += weight * n.x * n.z;
+        a12 += weight * n.y * n.z;
+        b0 += weight * n.x * d;
+        b1 += weight * n.y * d;
+        b2 += weight * n.z * d;
+        c += weight * d * d;
+    }
+
+    double evaluate(const glm::dvec3 & p) const
+    {
+        return a00 * p.x * p.x + a11 * p.y * p.y + a22 * p.z * p.z +
+               2.0 * (a01 * p.x * p.y + a02 * p.x * p.z + a12 * p.y * p.z) +
+               2.0 * (b0 * p.x + b1 * p.y + b2 * p.z) + c;
+    }
+
+    Quadric & operator+=(const Quadric & o)
+    {
+        a00 += o.a00; a11 += o.a11; a22 += o.a22;
+        a01 += o.a01; a02 += o.a02; a12 += o.a12;
+        b0 += o.b0; b1 += o.b1; b2 += o.b2;
+        c += o.c;
+        w += o.w;
+        return *this;
+    }
+
+    double a00, a11, a22, a01, a02, a12, b0, b1, b2, c;
+    double w;   // total area
+};
+
+// Sums of area * (g, d) for one attribute
+struct Gradient
+{
+    Gradient():g(0.0), d(0.0) {}
+
+    glm::dvec3  g;
+    double      d;
+};
+
+struct Collapse
+{
+    float           cost;
+    unsigned int    from, to;
+    unsigned int    fromStamp, toStamp;
+
+    bool operator<(const Collapse & o) const { return cost > o.cost; }
+};
+
+
+class Simplifier
+{
+public:
+    Simplifier(const mesh::IndexedMesh & m, const Options & options);
+
+    // Collapses until target triangles are left or nothing more can
+    // go. Returns the number left.
+    unsigned int run(unsigned int target);
+
+    void getIndices(vector<unsigned int> & out) const;
+
+    // Largest geometric error so far, object space
+    float getError() const { return sqrtf(maxError) * scale; }
+
+protected:
+    void classify();
+    void computeQuadrics();
+    void pushEdges(unsigned int v);
+    void fillHeap();
+
+    bool evaluate(unsigned int from, unsigned int to, float & cost, float & geometric) const;
+    bool isValid(unsigned int from, unsigned int to);
+    void collapse(unsigned int from, unsigned int to);
+
+    unsigned int vertexCount, attributeCount, liveTriangles;
+    float scale;
+
+    vector<glm::dvec3>      positions;  // relative to the mesh's size
+    vector<double>          attributes; // attributeCount per vertex, weighted
+    vector<unsigned int>    indices;
+    vector<bool>            deadTriangles;
+    vector< vector<unsigned int> > vertexTriangles;
+
+    vector<Kind>            kinds;
+    vector<bool>            alive;
+    vector<unsigned int>    stamps;
+    vector<Quadric>         geometric, attribute;
+    vector<Gradient>        gradients;  // attributeCount per vertex
+
+    std::priority_queue<Collapse> heap;
+    float                   maxError;
+
+    // Scratch for isValid()
+    vector<unsigned int>    fromNeighbours, toNeighbours;
+};
+
+
+Simplifier::Simplifier(const mesh::IndexedMesh & m, const Options & options):
+    vertexCount(m.vertices.size()),
+    attributeCount(0),
+    liveTriangles(m.triangleCount()),
+    scale(1.0f),
+    indices(m.indices),
+    deadTriangles(m.triangleCount(), false),
+    vertexTriangles(m.vertices.size()),
+    kinds(m.vertices.size(), MANIFOLD),
+    alive(m.vertices.size(), true),
+    stamps(m.vertices.size(), 0),
+    geometric(m.vertices.size()),
+    attribute(m.vertices.size()),
+    maxError(0.0f)
+{
+    mesh::Aabb box;
+    for (unsigned int i = 0; i < vertexCount; i++)
+        box.add(m.vertices[i]);
+
+    vec3 size = box.max - box.min;
+    scale = std::max(std::max(size.x, size.y), std::max(size.z, 1e-12f));
+
+    positions.resize(vertexCount);
+    for (unsigned int i = 0; i < vertexCount; i++)
+        positions[i] = glm::dvec3((m.vertices[i] - box.min) / scale);
+
+    // Weights go into the values, so every attribute's a^2 term has
+    // the same coefficient
+    bool hasNormals = m.normals.size() == vertexCount;
+    bool hasUvs = m.uvs.size() == vertexCount;
+    attributeCount = (hasNormals ? 3 : 0) + (hasUvs ? 2 : 0);
+    attributes.resize(vertexCount * attributeCount);
+
+    double normalScale = sqrt(options.normalWeight);
+    double uvScale = sqrt(options.uvWeight);
+    for (unsigned int i = 0; i < vertexCount; i++) {
+        double * a = &attributes[i * attributeCount];
+        if (hasNormals) {
+            for (int k = 0; k < 3; k++)
+                *a++ = m.normals[i][k] * normalScale;
+        }
+        if (hasUvs) {
+            for (int k = 0; k < 2; k++)
+                *a++ = m.uvs[i][k] * uvScale;
+        }
+    }
+
+    for (unsigned int t = 0; t < liveTriangles; t++)
+        for (int k = 0; k < 3; k++)
+            vertexTriangles[indices[t * 3 + k]].push_back(t);
+
+    classify();
+    computeQuadrics();
+}
+
+
+static inline unsigned long long
+edgeKey(unsigned int a, unsigned int b)
+{
+    return a < b ? ((unsigned long long)a << 32) | b : ((unsigned long long)b << 32) | a;
+}
+
+
+void
+Simplifier::classify()
+{
+    // Edges used once are borders, more than twice non-manifold
+    std::unordered_map<unsigned long long, unsigned int> edges;
+    for (unsigned int i = 0; i < indices.size(); i++) {
+        unsigned int a = indices[i], b = indices[i % 3 == 2 ? i - 2 : i + 1];
+        edges[edgeKey(a, b)]++;
+    }
+
+    for (std::unordered_map<unsigned long long, unsigned int>::iterator it = edges.begin();
+         it != edges.end(); ++it) {
+        unsigned int a = it->first >> 32, b = it->first & 0xffffffffu;
+        Kind kind = it->second == 1 ? BORDER : it->second > 2 ? LOCKED : MANIFOLD;
+        kinds[a] = std::max(kinds[a], kind);
+        kinds[b] = std::max(kinds[b], kind);
+    }
+
+    // Seams: border vertices that share their place with another vertex.
+    // Coincident vertices inside closed surfaces are only coincidence, so
+    // moving one of them cannot open a crack.
+    std::unordered_map<unsigned long long, unsigned int> places;
+    for (unsigned int i = 0; i < vertexCount; i++) {
+        if (kinds[i] != BORDER)
+            continue;
+
+        const glm::dvec3 & p = positions[i];
+        unsigned long long key = 1469598103934665603ull;
+        for (int k = 0; k < 3; k++) {
+            float f = (float)p[k];
+            unsigned int bits;
+            memcpy(&bits, &f, sizeof(bits));
+            key = (key ^ bits) * 1099511628211ull;
+        }
+
+        std::pair<std::unordered_map<unsigned long long, unsigned int>::iterator, bool> found =
+            places.insert(std::make_pair(key, i));
+        if (!found.second && positions[found.first->second] == p) {
+            kinds[i] = LOCKED;
+            kinds[found.first->second] = LOCKED;
+        }
+    }
+}
+
+
+void
+Simplifier::computeQuadrics()
+{
+    gradients.resize(vertexCount * attributeCount);
+
+    for (unsigned int t = 0; t < indices.size() / 3; t++) {
+        const unsigned int * v = &indices[t * 3];
+        glm::dvec3 p0 = positions[v[0]], p1 = positions[v[1]], p2 = positions[v[2]];
+        glm::dvec3 e1 = p1 - p0, e2 = p2 - p0;
+        glm::dvec3 n = glm::cross(e1, e2);
+        double length = glm::length(n);
+        if (length == 0.0)
+            continue;
+
+        double area = length * 0.5;
+        glm::dvec3 unit = n / length;
+
+        Quadric plane;
+        plane.addPlane(unit, -glm::dot(unit, p0), area);
+        plane.w = area;
+
+        // Attribute a as g.p + d over the triangle, g in its plane
+        Quadric fit;
+        fit.w = area;
+        Gradient grads[MAX_ATTRIBUTES];
+        for (unsigned int k = 0; k < attributeCount; k++) {
+            double a0 = attributes[v[0] * attributeCount + k];
+            double a1 = attributes[v[1] * attributeCount + k];
+            double a2 = attributes[v[2] * attributeCount + k];
+
+            glm::dvec3 g = ((a1 - a0) * glm::cross(e2, n) + (a2 - a0) * glm::cross(n, e1)) / (length * length);
+            double d = a0 - glm::dot(g, p0);
+
+            fit.addPlane(g, d, area);
+            grads[k].g = g * area;
+            grads[k].d = d * area;
+        }
+
+        for (int i = 0; i < 3; i++) {
+            geometric[v[i]] += plane;
+            attribute[v[i]] += fit;
+            for (unsigned int k = 0; k < attributeCount; k++) {
+                gradients[v[i] * attributeCount + k].g += grads[k].g;
+                gradients[v[i] * attributeCount + k].d += grads[k].d;
+            }
+        }
+
+        // A plane through each border edge, square to the triangle
+        for (int i = 0; i < 3; i++) {
+            unsigned int a = v[i], b = v[(i + 1) % 3];
+            if (kinds[a] == MANIFOLD || kinds[b] == MANIFOLD)
+                continue;
+
+            unsigned int shared = 0;
+            for (unsigned int j = 0; j < vertexTriangles[a].size(); j++) {
+                const unsigned int * o = &indices[vertexTriangles[a][j] * 3];
+                shared += o[0] == b || o[1] == b || o[2] == b;
+            }
+            if (shared != 1)
+                continue;
+
+            glm::dvec3 edge = positions[b] - positions[a];
+            glm::dvec3 normal = glm::cross(edge, unit);
+            double edgeLength = glm::length(normal);
+            if (edgeLength == 0.0)
+                continue;
+
+            normal /= edgeLength;
+            Quadric border;
+            border.addPlane(normal, -glm::dot(normal, positions[a]), BORDER_WEIGHT * edgeLength * edgeLength);
+            geometric[a] += border;
+            geometric[b] += border;
+        }
+    }
+}
+
+
+// Error of moving from onto to, with to's position and attributes
+bool
+Simplifier::evaluate(unsigned int from, unsigned int to, float & cost, float & geo) const
+{
+    Quadric g = geometric[from];
+    g += geometric[to];
+    Quadric a = attribute[from];
+    a += attribute[to];
+
+    double weight = g.w;
+    if (weight <= 0.0)
+        return false;
+
+    const glm::dvec3 & p = positions[to];
+    double geoError = g.evaluate(p);
+    double attrError = a.evaluate(p);
+
+    for (unsigned int k = 0; k < attributeCount; k++) {
+        const Gradient & gf = gradients[from * attributeCount + k];
+        const Gradient & gt = gradients[to * attributeCount + k];
+        double value = attributes[to * attributeCount + k];
+        attrError += a.w * value * value - 2.0 * value * (glm::dot(gf.g + gt.g, p) + gf.d + gt.d);
+    }
+
+    geo = (float)std::max(0.0, geoError / weight);
+    cost = geo + (float)std::max(0.0, attrError / weight);
+    return true;
+}
+
+
+void
+Simplifier::pushEdges(unsigned int v)
+{
+    vector<unsigned int> & neighbours = toNeighbours;
+    neighbours.clear();
+    for (unsigned int i = 0; i < vertexTriangles[v].size(); i++) {
+        unsigned int t = vertexTriangles[v][i];
+        if (deadTriangles[t])
+            continue;
+        for (int k = 0; k < 3; k++)
+            if (indices[t * 3 + k] != v)
+                neighbours.push_back(indices[t * 3 + k]);
+    }
+    std::sort(neighbours.begin(), neighbours.end());
+    neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+
+    for (unsigned int i = 0; i < neighbours.size(); i++) {
+        unsigned int n = neighbours[i];
+        unsigned int pairs[2][2] = { { v, n }, { n, v } };
+        for (int k = 0; k < 2; k++) {
+            unsigned int from = pairs[k][0], to = pairs[k][1];
+            if (kinds[from] == LOCKED)
+                continue;
+
+            Collapse c;
+            float geo;
+            if (!evaluate(from, to, c.cost, geo))
+                continue;
+            c.from = from;
+            c.to = to;
+            c.fromStamp = stamps[from];
+            c.toStamp = stamps[to];
+            heap.push(c);
+        }
+    }
+}
+
+
+void
+Simplifier::fillHeap()
+{
+    heap = std::priority_queue<Collapse>();
+    for (unsigned int v = 0; v < vertexCount; v++) {
+        if (!alive[v])
+            continue;
+
+        // Each edge once, from its lower end
+        for (unsigned int i = 0; i < vertexTriangles[v].size(); i++) {
+            unsigned int t = vertexTriangles[v][i];
+            if (deadTriangles[t])
+                continue;
+            for (int k = 0; k < 3; k++) {
+                unsigned int n = indices[t * 3 + k];
+                if (n <= v)
+                    continue;
+
+                unsigned int pairs[2][2] = { { v, n }, { n, v } };
+                for (int j = 0; j < 2; j++) {
+                    unsigned int from = pairs[j][0], to = pairs[j][1];
+                    if (kinds[from] == LOCKED)
+                        continue;
+
+                    Collapse c;
+                    float geo;
+                    if (!evaluate(from, to, c.cost, geo))
+                        continue;
+                    c.from = from;
+                    c.to = to;
+                    c.fromStamp = stamps[from];
+                    c.toStamp = stamps[to];
+                    heap.push(c);
+                }
+            }
+        }
+    }
+}
+
+
+bool
+Simplifier::isValid(unsigned int from, unsigned int to)
+{
+    // Neighbours of both ends, and the triangles on the edge
+    fromNeighbours.clear();
+    toNeighbours.clear();
+    unsigned int shared = 0;
+
+    for (unsigned int i = 0; i < vertexTriangles[from].size(); i++) {
+        unsigned int t = vertexTriangles[from][i];
+        if (deadTriangles[t])
+            continue;
+
+        const unsigned int * v = &indices[t * 3];
+        bool onEdge = v[0] == to || v[1] == to || v[2] == to;
+        shared += onEdge;
+        for (int k = 0; k < 3; k++)
+            if (v[k] != from)
+                fromNeighbours.push_back(v[k]);
+
+        if (onEdge)
+            continue;
+
+        // The triangle must not turn over when from moves to to. Ones
+        // that start out degenerate have no side to turn over from.
+        int corner = v[0] == from ? 0 : v[1] == from ? 1 : 2;
+        glm::dvec3 a = positions[v[(corner + 1) % 3]], b = positions[v[(corner + 2) % 3]];
+        glm::dvec3 before = glm::cross(a - positions[from], b - positions[from]);
+        glm::dvec3 after = glm::cross(a - positions[to], b - positions[to]);
+        double area = glm::length(before);
+        if (area > 0.0 && glm::dot(before, after) <= FLIP_COS * area * glm::length(after))
+            return false;
+    }
+
+    if (shared == 0 || (kinds[from] == BORDER && shared != 1))
+        return false;
+
+    for (unsigned int i = 0; i < vertexTriangles[to].size(); i++) {
+        unsigned int t = vertexTriangles[to][i];
+        if (deadTriangles[t])
+            continue;
+        for (int k = 0; k < 3; k++)
+            if (indices[t * 3 + k] != to)
+                toNeighbours.push_back(indices[t * 3 + k]);
+    }
+
+    // Link condition: the ends may only share the vertices opposite
+    // the edge, or the collapse pinches the surface
+    std::sort(fromNeighbours.begin(), fromNeighbours.end());
+    fromNeighbours.erase(std::unique(fromNeighbours.begin(), fromNeighbours.end()), fromNeighbours.end());
+    std::sort(toNeighbours.begin(), toNeighbours.end());
+    toNeighbours.erase(std::unique(toNeighbours.begin(), toNeighbours.end()), toNeighbours.end());
+
+    unsigned int common = 0;
+    for (unsigned int i = 0, j = 0; i < fromNeighbours.size() && j < toNeighbours.size();) {
+        if (fromNeighbours[i] < toNeighbours[j])
+            i++;
+        else if (fromNeighbours[i] > toNeighbours[j])
+            j++;
+        else {
+            common += fromNeighbours[i] != to;
+            i++;
+            j++;
+        }
+    }
+    return common == shared;
+}
+
+
+void
+Simplifier::collapse(unsigned int from, unsigned int to)
+{
+    for (unsigned int i = 0; i < vertexTriangles[from].size(); i++) {
+        unsigned int t = vertexTriangles[from][i];
+        if (deadTriangles[t])
+            continue;
+
+        unsigned int * v = &indices[t * 3];
+        if (v[0] == to || v[1] == to || v[2] == to) {
+            deadTriangles[t] = true;
+            liveTriangles--;
+            continue;
+        }
+
+        for (int k = 0; k < 3; k++)
+            if (v[k] == from)
+                v[k] = to;
+        vertexTriangles[to].push_back(t);
+    }
+    vertexTriangles[from].clear();
+
+    geometric[to] += geometric[from];
+    attribute[to] += attribute[from];
+    for (unsigned int k = 0; k < attributeCount; k++) {
+        gradients[to * attributeCount + k].g += gradients[from * attributeCount + k].g;
+        gradients[to * attributeCount + k].d += gradients[from * attributeCount + k].d;
+    }
+
+    alive[from] = false;
+    stamps[to]++;
+}
+
+
+unsigned int
+Simplifier::run(unsigned int target)
+{
+    while (liveTriangles > target) {
+        if (heap.empty()) {
+            // Collapses turned down earlier may be fine now
+            fillHeap();
+            if (heap.empty())
+                break;
+        }
+
+        unsigned int before = liveTriangles;
+        unsigned int done = 0;
+        while (liveTriangles > target && !heap.empty()) {
+            Collapse c = heap.top();
+            heap.pop();
+
+            if (!alive[c.from] || !alive[c.to] || stamps[c.from] != c.fromStamp ||
+                stamps[c.to] != c.toStamp || !isValid(c.from, c.to))
+                continue;
+
+            float cost, geo;
+            evaluate(c.from, c.to, cost, geo);
+            maxError = std::max(maxError, geo);
+
+            collapse(c.from, c.to);
+            pushEdges(c.to);
+            done++;
+        }
+
+        if (!done || liveTriangles == before)
+            break;
+    }
+    return liveTriangles;
+}
+
+
+void
+Simplifier::getIndices(vector<unsigned int> & out) const
+{
+    out.clear();
+    for (unsigned int t = 0; t < deadTriangles.size(); t++) {
+        if (deadTriangles[t])
+            continue;
+        out.insert(out.end(), &indices[t * 3], &indices[t * 3] + 3);
+    }
+}
+
+
+/*
+ * LodMesh
+ */
+unsigned int
+LodMesh::select(float distance, float pixelsPerUnit, float maxPixels) const
+{
+    if (distance <= 0.0f)
+        return 0;
+
+    for (unsigned int l = levels.size() - 1; l > 0; l--) {
+        if (levels[l].error * pixelsPerUnit / distance <= maxPixels)
+            return l;
+    }
+    return 0;
+}
+
+
+float
+getPixelsPerUnit(float fovy, int height)
+{
+    return height / (2.0f * tanf(glm::radians(fovy) * 0.5f));
+}
+
+
+vector<unsigned int>
+simplify(const mesh::IndexedMesh & m, unsigned int targetTriangles, const Options & options, float * error)
+{
+    Simplifier simplifier(m, options);
+    simplifier.run(targetTriangles);
+
+    vector<unsigned int> out;
+    simplifier.getIndices(out);
+    if (error)
+        *error = simplifier.getError();
+    return out;
+}
+
+
+LodMesh
+build(const mesh::TriMesh & m, const Options & options)
+{
+    LodMesh lods;
+    lods.mesh = mesh::IndexedMesh(m);
+
+    Level full = { 0, (unsigned int)lods.mesh.indices.size(), 0.0f };
+    lods.levels.push_back(full);
+
+    // Each level carries on from the one before
+    Simplifier simplifier(lods.mesh, options);
+    unsigned int previous = lods.mesh.triangleCount();
+    vector<unsigned int> level;
+
+    while (lods.levels.size() < options.levels) {
+        unsigned int target = (unsigned int)(previous * options.ratio);
+        if (target < 1)
+            break;
+
+        // Stop once the seams and borders hold it back to less than
+        // half the reduction asked for
+        unsigned int left = simplifier.run(target);
+        if (left > previous - (previous - target) / 2)
+            break;
+
+        simplifier.getIndices(level);
+        Level l = { (unsigned int)lods.mesh.indices.size(), (unsigned int)level.size(), simplifier.getError() };
+        lods.mesh.indices.insert(lods.mesh.indices.end(), level.begin(), level.end());
+        lods.levels.push_back(l);
+        previous = left;
+    }
+
+    return lods;
+}
+
+
+vector<LodMesh>
+buildBatch(const vector<const mesh::TriMesh *> & meshes, const Options & options, unsigned int threads)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    vector<LodMesh> out(meshes.size());
+    util::parallelFor(meshes.size(), threads, [&](unsigned int begin, unsigned int end) {
+        for (unsigned int i = begin; i < end; i++)
+            out[i] = build(*meshes[i], options);
+    });
+    return out;
+}
+
+
+vector<LodMesh>
+buildBatch(const vector<const mesh::TriMesh *> & meshes, const Options & options, jobs::JobSystem & jobs)
+{
+    vector<LodMesh> out(meshes.size());
+    jobs.parallelFor(meshes.size(), 1, [&](unsigned int begin, unsigned int end) {
+        for (unsigned int i = begin; i < end; i++)
+            out[i] = build(*meshes[i], options);
+    });
+    return out;
+}
+
+
+LodMesh
+loadObj(const string & filename, const Options & options)
+{
+    return build(mesh::loadObj(filename), options);
+}
+
+}
@@ -0,0 +1,447 @@
+/*
+ * Meshlet.cpp
+ *
+ * The cone test is meshoptimizer's. If every triangle normal is within
+ * acos(mindp) of the axis, cutoff = sqrt(1 - mindp^2) is the sine of
+ * that angle, and a camera that sees the sphere's center far enough
+ * behind the cone (widened by the radius, so it holds for every point
+ * in the sphere) can only be behind every triangle's plane.
+ */
+#include "Meshlet.hpp"
+
+#include <math.h>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define MESHLET_X86
+    #include <immintrin.h>
+#endif
+
+namespace meshlet {
+
+// Cones wider than this (the smallest dot between the axis and a
+// triangle normal) are not worth testing; they'd hardly ever cull
+static const float MIN_CONE_DOT = 0.1f;
+
+void
+MeshletArray::clear()
+{
+    vertexOffset.clear();
+    vertexCount.clear();
+    triangleOffset.clear();
+    triangleCount.clear();
+    vertices.clear();
+    triangles.clear();
+    cx.clear();
+    cy.clear();
+    cz.clear();
+    radius.clear();
+    ax.clear();
+    ay.clear();
+    az.clear();
+    cutoff.clear();
+}
+
+
+vector<unsigned int>
+MeshletArray::getIndices() const
+{
+    vector<unsigned int> indices(triangles.size());
+    for (unsigned int m = 0; m < size(); m++) {
+        const unsigned int * local = &vertices[vertexOffset[m]];
+        for (unsigned int i = triangleOffset[m] * 3; i < (triangleOffset[m] + triangleCount[m]) * 3; i++)
+            indices[i] = local[triangles[i]];
+    }
+    return indices;
+}
+
+
+/*
+ * Building
+ */
+class Builder
+{
+public:
+    Builder(const mesh::IndexedMesh & m, const Options & options, MeshletArray & out):
+        m(m),
+        options(options),
+        out(out),
+        triangleCount(m.triangleCount()),
+        used(triangleCount, false),
+        local(m.vertices.size(), -1)
+    {
+        // Triangles around each vertex, packed
+        firstTriangle.assign(m.vertices.size() + 1, 0);
+        for (unsigned int i = 0; i < m.indices.size(); i++)
+            firstTriangle[m.indices[i] + 1]++;
+        for (unsigned int v = 0; v < m.vertices.size(); v++)
+            firstTriangle[v + 1] += firstTriangle[v];
+
+        vertexTriangles.resize(m.indices.size());
+        vector<unsigned int> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+        for (unsigned int i = 0; i < m.indices.size(); i++)
+            vertexTriangles[fill[m.indices[i]]++] = i / 3;
+
+        centroids.resize(triangleCount);
+        normals.resize(triangleCount);
+        for (unsigned int t = 0; t < triangleCount; t++) {
+            const vec3 & a = m.vertices[m.indices[t * 3 + 0]];
+            const vec3 & b = m.vertices[m.indices[t * 3 + 1]];
+            const vec3 & c = m.vertices[m.indices[t * 3 + 2]];
+            centroids[t] = (a + b + c) / 3.0f;
+
+            vec3 n = glm::cross(b - a, c - a);
+            float length = glm::length(n);
+            normals[t] = length > 0.0f ? n / length : vec3(0.0f);
+        }
+    }
+
+    void run()
+    {
+        out.clear();
+        unsigned int seed = 0, done = 0;
+        while (done < triangleCount) {
+            done += grow(seed);
+            finish();
+            seed = nextSeed();
+        }
+    }
+
+protected:
+    // Adds triangles to a new meshlet starting from seed until nothing
+    // else fits. Returns how many it took.
+    unsigned int grow(unsigned int seed)
+    {
+        meshletVertices.clear();
+        meshletTriangles.clear();
+        centroidSum = vec3(0.0f);
+        normalSum = vec3(0.0f);
+        add(seed);
+
+        while (meshletTriangles.size() < options.maxTriangles) {
+            vec3 center = centroidSum / (float)meshletTriangles.size();
+            float normalLength = glm::length(normalSum);
+            vec3 axis = normalLength > 0.0f ? normalSum / normalLength : vec3(0.0f);
+
+            // Neighbours of what we have so far: fewest new vertices
+            // first, then nearest, stretched by how far they bend
+            unsigned int best = ~0u, bestExtra = 4;
+            float bestCost = 0.0f;
+            for (unsigned int i = 0; i < meshletVertices.size(); i++) {
+                unsigned int v = meshletVertices[i];
+                for (unsigned int j = firstTriangle[v]; j < firstTriangle[v + 1]; j++) {
+                    unsigned int t = vertexTriangles[j];
+                    if (used[t])
+                        continue;
+
+                    unsigned int extra = 0;
+                    for (int k = 0; k < 3; k++)
+                        extra += local[m.indices[t * 3 + k]] < 0;
+                    if (meshletVertices.size() + extra > options.maxVertices || extra > bestExtra)
+                        continue;
+
+                    float spread = 1.0f - glm::dot(normals[t], axis);
+                    float cost = glm::length(centroids[t] - center) * (1.0f + options.coneWeight * spread);
+                    if (extra < bestExtra || cost < bestCost) {
+                        best = t;
+                        bestExtra = extra;
+                        bestCost = cost;
+                    }
+                }
+            }
+
+            if (best == ~0u)
+                break;
+            add(best);
+        }
+
+        return meshletTriangles.size();
+    }
+
+    void add(unsigned int t)
+    {
+        used[t] = true;
+        for (int k = 0; k < 3; k++) {
+            unsigned int v = m.indices[t * 3 + k];
+            if (local[v] < 0) {
+                local[v] = meshletVertices.size();
+                meshletVertices.push_back(v);
+            }
+        }
+        meshletTriangles.push_back(t);
+        centroidSum += centroids[t];
+        normalSum += normals[t];
+    }
+
+    // Writes out the current meshlet and its bounds
+    void finish()
+    {
+        out.vertexOffset.push_back(out.vertices.size());
+        out.vertexCount.push_back(meshletVertices.size());
+        out.triangleOffset.push_back(out.triangles.size() / 3);
+        out.triangleCount.push_back(meshletTriangles.size());
+
+        for (unsigned int i = 0; i < meshletTriangles.size(); i++)
+            for (int k = 0; k < 3; k++)
+                out.triangles.push_back(local[m.indices[meshletTriangles[i] * 3 + k]]);
+        out.vertices.insert(out.vertices.end(), meshletVertices.begin(), meshletVertices.end());
+
+        computeSphere();
+        computeCone();
+
+        lastCenter = vec3(out.cx.back(), out.cy.back(), out.cz.back());
+        for (unsigned int i = 0; i < meshletVertices.size(); i++)
+            local[meshletVertices[i]] = -1;
+    }
+
+    // Ritter: start from the farthest apart of the extreme points along
+    // the axes, then grow to take in whatever is left outside
+    void computeSphere()
+    {
+        unsigned int extremes[6] = { 0, 0, 0, 0, 0, 0 };
+        for (unsigned int i = 0; i < meshletVertices.size(); i++) {
+            const vec3 & p = m.vertices[meshletVertices[i]];
+            for (int k = 0; k < 3; k++) {
+                if (p[k] < m.vertices[meshletVertices[extremes[k * 2]]][k])
+                    extremes[k * 2] = i;
+                if (p[k] > m.vertices[meshletVertices[extremes[k * 2 + 1]]][k])
+                    extremes[k * 2 + 1] = i;
+            }
+        }
+
+        vec3 a, b;
+        float widest = -1.0f;
+        for (int k = 0; k < 3; k++) {
+            const vec3 & lo = m.vertices[meshletVertices[extremes[k * 2]]];
+            const vec3 & hi = m.vertices[meshletVertices[extremes[k * 2 + 1]]];
+            float d = glm::length(hi - lo);
+            if (d > widest) {
+                widest = d;
+                a = lo;
+                b = hi;
+            }
+        }
+
+        vec3 center = (a + b) * 0.5f;
+        float r = widest * 0.5f;
+        for (unsigned int i = 0; i < meshletVertices.size(); i++) {
+            const vec3 & p = m.vertices[meshletVertices[i]];
+            float d = glm::length(p - center);
+            if (d > r) {
+                float grown = (r + d) * 0.5f;
+                center += (p - center) * ((grown - r) / d);
+                r = grown;
+            }
+        }
+
+        // Float rounding in the growth steps can leave a point a hair
+        // outside; make sure none is
+        for (unsigned int i = 0; i < meshletVertices.size(); i++)
+            r = std::max(r, glm::length(m.vertices[meshletVertices[i]] - center));
+
+        out.cx.push_back(center.x);
+        out.cy.push_back(center.y);
+        out.cz.push_back(center.z);
+        out.radius.push_back(r);
+    }
+
+    void computeCone()
+    {
+        vec3 sum(0.0f);
+        for (unsigned int i = 0; i < meshletTriangles.size(); i++)
+            sum += normals[meshletTriangles[i]];
+
+        float length = glm::length(sum);
+        vec3 axis = length > 0.0f ? sum / length : vec3(0.0f);
+
+        float mindp = 1.0f;
+        for (unsigned int i = 0; i < meshletTriangles.size(); i++) {
+            const vec3 & n = normals[meshletTriangles[i]];
+            if (n != vec3(0.0f))
+                mindp = std::min(mindp, glm::dot(n, axis));
+        }
+
+        out.ax.push_back(axis.x);
+        out.ay.push_back(axis.y);
+        out.az.push_back(axis.z);
+        out.cutoff.push_back(length > 0.0f && mindp > MIN_CONE_DOT ? sqrtf(1.0f - mindp * mindp) : 1.0f);
+    }
+
+    // Unused triangles around a triangle's corners: few means it is
+    // nearly hemmed in and would end up in a scrap meshlet if left
+    unsigned int countLive(unsigned int t) const
+    {
+        unsigned int live = 0;
+        for (int k = 0; k < 3; k++) {
+            unsigned int v = m.indices[t * 3 + k];
+            for (unsigned int j = firstTriangle[v]; j < firstTriangle[v + 1]; j++)
+                live += !used[vertexTriangles[j]];
+        }
+        return live;
+    }
+
+    // The most hemmed in unused triangle touching the meshlet just
+    // finished (nearest its center if that's a tie), so meshlets stay
+    // next to each other and don't leave islands behind; failing that
+    // the nearest unused triangle anywhere
+    unsigned int nextSeed()
+    {
+        unsigned int offset = out.vertexOffset.back(), count = out.vertexCount.back();
+        unsigned int best = ~0u, bestLive = ~0u;
+        float bestDistance = 1e30f;
+        for (unsigned int i = offset; i < offset + count; i++) {
+            unsigned int v = out.vertices[i];
+            for (unsigned int j = firstTriangle[v]; j < firstTriangle[v + 1]; j++) {
+                unsigned int t = vertexTriangles[j];
+                if (used[t])
+                    continue;
+
+                unsigned int live = countLive(t);
+                float d = glm::length(centroids[t] - lastCenter);
+                if (live < bestLive || (live == bestLive && d < bestDistance)) {
+                    best = t;
+                    bestLive = live;
+                    bestDistance = d;
+                }
+            }
+        }
+        if (best != ~0u)
+            return best;
+
+        for (unsigned int t = 0; t < triangleCount; t++) {
+            float d = glm::length(centroids[t] - lastCenter);
+            if (!used[t] && d < bestDistance) {
+                best = t;
+                bestDistance = d;
+            }
+        }
+        return best;
+    }
+
+    const mesh::IndexedMesh &   m;
+    const Options &             options;
+    MeshletArray &              out;
+
+    unsigned int                triangleCount;
+    vector<bool>                used;
+    vector<int>                 local;          // meshlet vertex, or -1
+    vector<unsigned int>        firstTriangle, vertexTriangles;
+    vector<vec3>                centroids, normals;
+
+    // The meshlet being grown
+    vector<unsigned int>        meshletVertices, meshletTriangles;
+    vec3                        centroidSum, normalSum, lastCenter;
+};
+
+
+MeshletArray
+build(const mesh::IndexedMesh & m, const Options & options)
+{
+    Options clamped = options;
+    clamped.maxVertices = std::max(3u, std::min(options.maxVertices, 256u));
+    clamped.maxTriangles = std::max(1u, options.maxTriangles);
+
+    MeshletArray out;
+    if (m.indices.empty())
+        return out;
+
+    Builder builder(m, clamped, out);
+    builder.run();
+    return out;
+}
+
+
+/*
+ * Culling. Sums are in the same order in every path so they agree.
+ */
+static unsigned int
+cullScalar(const cull::Frustum & f, const vec3 & camera, const MeshletArray & b,
+           unsigned char * visible, int tests, unsigned int begin, unsigned int end)
+{
+    unsigned int count = 0;
+    for (unsigned int i = begin; i < end; i++) {
+        vec3 center(b.cx[i], b.cy[i], b.cz[i]);
+        bool in = !(tests & FRUSTUM) || f.testSphere(center, b.radius[i]);
+
+        if (in && (tests & BACKFACE)) {
+            float dx = center.x - camera.x, dy = center.y - camera.y, dz = center.z - camera.z;
+            float d = (dx * b.ax[i] + dy * b.ay[i]) + dz * b.az[i];
+            float length = sqrtf((dx * dx + dy * dy) + dz * dz);
+            in = d < b.cutoff[i] * length + b.radius[i];
+        }
+
+        visible[i] = in;
+        count += in;
+    }
+    return count;
+}
+
+
+#ifdef MESHLET_X86
+
+__attribute__((target("sse2"))) static unsigned int
+cullSse(const cull::Frustum & f, const vec3 & camera, const MeshletArray & b,
+        unsigned char * visible, int tests, unsigned int begin, unsigned int end)
+{
+    const __m128 zero = _mm_setzero_ps();
+    unsigned int count = 0;
+    unsigned int i = begin;
+
+    for (; i + 4 <= end; i += 4) {
+        __m128 cx = _mm_loadu_ps(&b.cx[i]);
+        __m128 cy = _mm_loadu_ps(&b.cy[i]);
+        __m128 cz = _mm_loadu_ps(&b.cz[i]);
+        __m128 rad = _mm_loadu_ps(&b.radius[i]);
+
+        __m128 inside = _mm_cmpeq_ps(zero, zero);
+        if (tests & FRUSTUM) {
+            for (int p = 0; p < 6; p++) {
+                __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(f.planes[p].x), cx),
+                                                 _mm_mul_ps(_mm_set1_ps(f.planes[p].y), cy)),
+                                      _mm_add_ps(_mm_mul_ps(_mm_set1_ps(f.planes[p].z), cz),
+                                                 _mm_set1_ps(f.planes[p].w)));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(d, rad), zero));
+            }
+        }
+
+        if ((tests & BACKFACE) && _mm_movemask_ps(inside)) {
+            __m128 dx = _mm_sub_ps(cx, _mm_set1_ps(camera.x));
+            __m128 dy = _mm_sub_ps(cy, _mm_set1_ps(camera.y));
+            __m128 dz = _mm_sub_ps(cz, _mm_set1_ps(camera.z));
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, _mm_loadu_ps(&b.ax[i])),
+                                             _mm_mul_ps(dy, _mm_loadu_ps(&b.ay[i]))),
+                                  _mm_mul_ps(dz, _mm_loadu_ps(&b.az[i])));
+            __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                                                   _mm_mul_ps(dz, dz)));
+            __m128 limit = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&b.cutoff[i]), length), rad);
+            inside = _mm_and_ps(inside, _mm_cmplt_ps(d, limit));
+        }
+
+        int mask = _mm_movemask_ps(inside);
+        for (int k = 0; k < 4; k++)
+            visible[i + k] = (mask >> k) & 1;
+        count += __builtin_popcount(mask);
+    }
+
+    return count + cullScalar(f, camera, b, visible, tests, i, end);
+}
+
+#endif
+
+
+unsigned int
+cullMeshlets(const cull::Frustum & frustum, const vec3 & camera, const MeshletArray & meshlets,
+             unsigned char * visible, int tests, cull::Isa isa)
+{
+    if (isa == cull::BEST)
+        isa = cull::getBestIsa();
+
+#ifdef MESHLET_X86
+    if (isa != cull::SCALAR)
+        return cullSse(frustum, camera, meshlets, visible, tests, 0, meshlets.size());
+#endif
+
+    return cullScalar(frustum, camera, meshlets, visible, tests, 0, meshlets.size());
+}
+
+}
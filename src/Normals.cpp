@@ -0,0 +1,280 @@
+/*
+ * Normals.cpp
+ *
+ * Corners are grouped (by position for normals, by position, normal, uv
+ * and mirroring for tangents) with one hash pass, which stays serial:
+ * that keeps the group numbering, and so the order everything is summed
+ * in, fixed. It is memory bound and the biggest part of the time on big
+ * meshes; the per-face work and the per-corner gathers run on threads.
+ */
+#include "Normals.hpp"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+
+#include "ParallelFor.hpp"
+
+namespace mesh {
+
+// Exact bits of whatever identifies a group of corners. -0 is made +0
+// first so the two don't end up apart.
+struct GroupKey
+{
+    GroupKey() { memset(data, 0, sizeof(data)); }
+
+    void set(int i, float f) { data[i] = f + 0.0f; }
+    bool operator==(const GroupKey & o) const { return !memcmp(data, o.data, sizeof(data)); }
+
+    float data[9];
+};
+
+// Corners of each group, listed group after group in corner order:
+// group g's are corners[first[g]] up to corners[first[g + 1]]
+class Groups
+{
+public:
+    template <typename KeyFunction>
+    Groups(unsigned int count, KeyFunction key)
+    {
+        // Open addressing on a table at least twice the corner count;
+        // each slot holds a group number + 1
+        unsigned int tableSize = 1;
+        while (tableSize < count * 2)
+            tableSize *= 2;
+        vector<unsigned int> table(tableSize, 0);
+        vector<GroupKey> keys;
+
+        group.resize(count);
+        for (unsigned int i = 0; i < count; i++) {
+            GroupKey k = key(i);
+            unsigned int slot = hash(k) & (tableSize - 1);
+            while (table[slot] && !(keys[table[slot] - 1] == k))
+                slot = (slot + 1) & (tableSize - 1);
+
+            if (!table[slot]) {
+                keys.push_back(k);
+                table[slot] = keys.size();
+            }
+            group[i] = table[slot] - 1;
+        }
+
+        first.assign(keys.size() + 1, 0);
+        for (unsigned int i = 0; i < count; i++)
+            first[group[i] + 1]++;
+        for (unsigned int g = 0; g < keys.size(); g++)
+            first[g + 1] += first[g];
+
+        corners.resize(count);
+        vector<unsigned int> fill(first.begin(), first.end() - 1);
+        for (unsigned int i = 0; i < count; i++)
+            corners[fill[group[i]]++] = i;
+    }
+
+    vector<unsigned int> group;     // per corner
+    vector<unsigned int> first;
+    vector<unsigned int> corners;
+
+protected:
+    static unsigned int hash(const GroupKey & k)
+    {
+        unsigned int words[9];
+        memcpy(words, k.data, sizeof(words));
+        unsigned int h = 2166136261u;
+        for (int i = 0; i < 9; i++)
+            h = (h ^ words[i]) * 16777619u;
+
+        // The multiplies only carry upwards, and the slot comes from the
+        // low bits; mix the high ones back down (MurmurHash3's finalizer)
+        h ^= h >> 16;
+        h *= 0x85ebca6bu;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35u;
+        return h ^ (h >> 16);
+    }
+};
+
+// Angle of the triangle at corner k, between its two edges
+static float
+cornerAngle(const vec3 * p, int k)
+{
+    vec3 a = p[(k + 1) % 3] - p[k], b = p[(k + 2) % 3] - p[k];
+    float la = glm::length(a), lb = glm::length(b);
+    if (la == 0.0f || lb == 0.0f)
+        return 0.0f;
+    return acosf(glm::clamp(glm::dot(a, b) / (la * lb), -1.0f, 1.0f));
+}
+
+
+// computeNormals() for any storage: position(i) gives corner i's
+// position and store(i, n) takes its normal
+template <typename Position, typename Store>
+static void
+generateNormals(unsigned int count, const NormalOptions & options, Position position, Store store)
+{
+    unsigned int threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+
+    // Unit face normals, and how much each corner's face counts at it
+    vector<vec3> faceNormals(count / 3);
+    vector<float> weights(count);
+    util::parallelFor(count / 3, threads, [&](unsigned int begin, unsigned int end) {
+        for (unsigned int f = begin; f < end; f++) {
+            const vec3 v[3] = { position(f * 3), position(f * 3 + 1), position(f * 3 + 2) };
+            vec3 n = glm::cross(v[1] - v[0], v[2] - v[0]);
+            float area = glm::length(n);
+            faceNormals[f] = area > 0.0f ? n / area : vec3(0.0f);
+
+            for (int k = 0; k < 3; k++)
+                weights[f * 3 + k] = options.weighting == AREA_WEIGHTED ? area * 0.5f : cornerAngle(v, k);
+        }
+    });
+
+    Groups positions(count, [&](unsigned int i) {
+        GroupKey key;
+        vec3 p = position(i);
+        for (int k = 0; k < 3; k++)
+            key.set(k, p[k]);
+        return key;
+    });
+
+    // Each corner gathers the faces around its position that are within
+    // the crease angle of its own
+    float minCos = cosf(glm::radians(std::min(options.creaseAngle, 180.0f)));
+    util::parallelFor(count, threads, [&](unsigned int begin, unsigned int end) {
+        for (unsigned int i = begin; i < end; i++) {
+            const vec3 & own = faceNormals[i / 3];
+            unsigned int g = positions.group[i];
+
+            vec3 sum(0.0f);
+            for (unsigned int j = positions.first[g]; j < positions.first[g + 1]; j++) {
+                unsigned int c = positions.corners[j];
+                const vec3 & n = faceNormals[c / 3];
+                if (c / 3 == i / 3 || own == vec3(0.0f) || glm::dot(n, own) >= minCos)
+                    sum += n * weights[c];
+            }
+
+            float length = glm::length(sum);
+            store(i, length > 0.0f ? sum / length : own);
+        }
+    });
+}
+
+void
+computeNormals(TriMesh & m, const NormalOptions & options)
+{
+    unsigned int count = m.vertices.size() / 3 * 3;
+    const vec3 * p = count ? &m.vertices.front() : NULL;
+
+    m.normals.resize(count);
+    vec3 * normals = count ? &m.normals.front() : NULL;
+    generateNormals(count, options,
+                    [p](unsigned int i) { return p[i]; },
+                    [normals](unsigned int i, const vec3 & n) { normals[i] = n; });
+}
+
+void
+computeNormals(SoaMesh & m, const NormalOptions & options)
+{
+    unsigned int count = m.size() / 3 * 3;
+    m.setNormals(true);
+    generateNormals(count, options,
+                    [&m](unsigned int i) { return vec3(m.x[i], m.y[i], m.z[i]); },
+                    [&m](unsigned int i, const vec3 & n) { m.nx[i] = n.x; m.ny[i] = n.y; m.nz[i] = n.z; });
+    m.repad();
+}
+
+bool
+computeTangents(TriMesh & m, unsigned int threads)
+{
+    unsigned int count = m.vertices.size() / 3 * 3;
+    m.tangents.clear();
+    if (count == 0 || m.normals.size() < count || m.uvs.size() < count)
+        return false;
+
+    threads = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+    const vec3 * p = &m.vertices.front();
+    const vec3 * n = &m.normals.front();
+    const vec2 * uv = &m.uvs.front();
+
+    // Per face: the directions of +u and +v over the surface, and
+    // whether the uvs are mirrored (wound the other way round)
+    vector<vec3> faceTangents(count / 3), faceBitangents(count / 3);
+    vector<unsigned char> mirrored(count / 3);
+    util::parallelFor(count / 3, threads, [&](unsigned int begin, unsigned int end) {
+        for (unsigned int f = begin; f < end; f++) {
+            vec3 e1 = p[f * 3 + 1] - p[f * 3], e2 = p[f * 3 + 2] - p[f * 3];
+            vec2 d1 = uv[f * 3 + 1] - uv[f * 3], d2 = uv[f * 3 + 2] - uv[f * 3];
+            float area = d1.x * d2.y - d2.x * d1.y;
+
+            // Only the directions matter, so scale by the sign of the uv
+            // area rather than dividing by it
+            float sign = area < 0.0f ? -1.0f : 1.0f;
+            faceTangents[f] = (e1 * d2.y - e2 * d1.y) * sign;
+            faceBitangents[f] = (e2 * d1.x - e1 * d2.x) * sign;
+            mirrored[f] = area < 0.0f;
+        }
+    });
+
+    Groups groups(count, [&](unsigned int i) {
+        GroupKey key;
+        for (int k = 0; k < 3; k++) {
+            key.set(k, p[i][k]);
+            key.set(3 + k, n[i][k]);
+        }
+        key.set(6, uv[i].x);
+        key.set(7, uv[i].y);
+        key.set(8, mirrored[i / 3]);
+        return key;
+    });
+
+    // Each corner's share: its face's frame flattened onto the corner's
+    // normal plane, weighted by the angle there
+    vector<vec3> cornerTangents(count), cornerBitangents(count);
+    util::parallelFor(count / 3, threads, [&](unsigned int begin, unsigned int end) {
+        for (unsigned int f = begin; f < end; f++) {
+            for (int k = 0; k < 3; k++) {
+                unsigned int i = f * 3 + k;
+                vec3 t = faceTangents[f] - n[i] * glm::dot(n[i], faceTangents[f]);
+                vec3 b = faceBitangents[f] - n[i] * glm::dot(n[i], faceBitangents[f]);
+                float lt = glm::length(t), lb = glm::length(b);
+
+                float angle = cornerAngle(p + f * 3, k);
+                cornerTangents[i] = lt > 0.0f ? t * (angle / lt) : vec3(0.0f);
+                cornerBitangents[i] = lb > 0.0f ? b * (angle / lb) : vec3(0.0f);
+            }
+        }
+    });
+
+    m.tangents.resize(count);
+    util::parallelFor(count, threads, [&](unsigned int begin, unsigned int end) {
+        for (unsigned int i = begin; i < end; i++) {
+            unsigned int g = groups.group[i];
+            vec3 t(0.0f), b(0.0f);
+            for (unsigned int j = groups.first[g]; j < groups.first[g + 1]; j++) {
+                t += cornerTangents[groups.corners[j]];
+                b += cornerBitangents[groups.corners[j]];
+            }
+
+            // Gram-Schmidt against the normal, and any direction in the
+            // plane if the uvs gave nothing to go on
+            t -= n[i] * glm::dot(n[i], t);
+            float length = glm::length(t);
+            if (length > 0.0f) {
+                t /= length;
+            } else {
+                vec3 axis = fabsf(n[i].x) < 0.9f ? vec3(1, 0, 0) : vec3(0, 1, 0);
+                t = glm::cross(axis, n[i]);
+                length = glm::length(t);
+                t = length > 0.0f ? t / length : axis;
+            }
+
+            float w = glm::dot(glm::cross(n[i], t), b) < 0.0f ? -1.0f : 1.0f;
+            m.tangents[i] = vec4(t, w);
+        }
+    });
+
+    return true;
+}
+
+}
@@ -0,0 +1,625 @@
+/*
+ * Occlusion.cpp
+ */
+#include "Occlusion.hpp"
+
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+
+#include "ParallelFor.hpp"
+#include "Profiler.hpp"
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+namespace cull {
+
+// Occluder triangles with a vertex this close to the eye plane (or
+// behind it) are dropped, and boxes reaching it are never occluded
+static const float NEAR_W = 1e-3f;
+
+OcclusionCuller::OcclusionCuller(int width, int height, unsigned int threads):
+    width(width),
+    height(height),
+    stride((width + 3) & ~3),
+    threads(threads ? threads : std::max(1u, std::thread::hardware_concurrency())),
+    bounds(NULL),
+    visible(NULL),
+    visibleCount(0),
+    rasterTime(0.0),
+    testTime(0.0)
+{
+    // Level 0 has whole SSE blocks per row; the rest are packed
+    int w = width, h = height;
+    levels.push_back(vector<float>(stride * height, 0.0f));
+    levelWidths.push_back(w);
+    levelHeights.push_back(h);
+
+    while (w > 1 || h > 1) {
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+        levels.push_back(vector<float>(w * h, 0.0f));
+        levelWidths.push_back(w);
+        levelHeights.push_back(h);
+    }
+}
+
+
+OcclusionCuller::~OcclusionCuller()
+{
+    if (worker.joinable())
+        worker.join();
+}
+
+
+// An edge and the triangle it belongs to, endpoints in sorted order
+struct Edge
+{
+    vec3            lo, hi;
+    unsigned int    triangle;
+    int             edge;
+    bool            flipped;    // runs hi to lo in the triangle
+
+    bool operator<(const Edge & other) const
+    {
+        for (int i = 0; i < 3; i++) {
+            if (lo[i] != other.lo[i])
+                return lo[i] < other.lo[i];
+        }
+        for (int i = 0; i < 3; i++) {
+            if (hi[i] != other.hi[i])
+                return hi[i] < other.hi[i];
+        }
+        return false;
+    }
+};
+
+
+static bool
+lessPosition(const vec3 & a, const vec3 & b)
+{
+    return a.x != b.x ? a.x < b.x : a.y != b.y ? a.y < b.y : a.z < b.z;
+}
+
+
+// Pairs up triangles by the edges they share. Edges used by one
+// triangle, or by more than two, have no neighbour and count as
+// outline whatever way the triangles face.
+static void
+findNeighbours(const mesh::TriMesh & mesh, vector<int> & neighbours)
+{
+    unsigned int count = mesh.vertices.size() / 3;
+    vector<Edge> edges;
+    edges.reserve(count * 3);
+
+    for (unsigned int t = 0; t < count; t++) {
+        for (int i = 0; i < 3; i++) {
+            Edge e;
+            e.lo = mesh.vertices[t * 3 + (i + 1) % 3];
+            e.hi = mesh.vertices[t * 3 + (i + 2) % 3];
+            e.flipped = lessPosition(e.hi, e.lo);
+            if (e.flipped)
+                std::swap(e.lo, e.hi);
+            e.triangle = t;
+            e.edge = i;
+            edges.push_back(e);
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+
+    // Each entry is the other triangle times two, plus one if the edge
+    // runs the same way in both
+    neighbours.assign(count * 3, -1);
+    for (unsigned int i = 0; i < edges.size(); ) {
+        unsigned int j = i + 1;
+        while (j < edges.size() && !(edges[i] < edges[j]))
+            j++;
+
+        if (j == i + 2) {
+            const Edge & a = edges[i];
+            const Edge & b = edges[i + 1];
+            int same = a.flipped == b.flipped ? 1 : 0;
+            neighbours[a.triangle * 3 + a.edge] = (int)(b.triangle * 2) + same;
+            neighbours[b.triangle * 3 + b.edge] = (int)(a.triangle * 2) + same;
+        }
+        i = j;
+    }
+}
+
+
+unsigned int
+OcclusionCuller::addOccluder(const mesh::TriMesh & mesh, const mat4 & model)
+{
+    Occluder occluder;
+    occluder.mesh = &mesh;
+    occluder.model = model;
+
+    // Occluders often share a mesh
+    for (unsigned int i = occluders.size(); i-- > 0; ) {
+        if (occluders[i].mesh == &mesh) {
+            occluder.neighbours = occluders[i].neighbours;
+            break;
+        }
+    }
+    if (occluder.neighbours.empty())
+        findNeighbours(mesh, occluder.neighbours);
+
+    occluders.push_back(occluder);
+    return occluders.size() - 1;
+}
+
+
+void
+OcclusionCuller::setOccluderModel(unsigned int index, const mat4 & model)
+{
+    occluders[index].model = model;
+}
+
+
+void
+OcclusionCuller::clearOccluders()
+{
+    occluders.clear();
+}
+
+
+void
+OcclusionCuller::start(const mat4 & viewProj, const BoundsArray & bounds, unsigned char * visible)
+{
+    if (worker.joinable())
+        worker.join();
+
+    this->viewProj = viewProj;
+    this->bounds = &bounds;
+    this->visible = visible;
+    worker = std::thread(&OcclusionCuller::run, this);
+}
+
+
+unsigned int
+OcclusionCuller::finish()
+{
+    if (worker.joinable())
+        worker.join();
+    return visibleCount;
+}
+
+
+unsigned int
+OcclusionCuller::cull(const mat4 & viewProj, const BoundsArray & bounds, unsigned char * visible)
+{
+    start(viewProj, bounds, visible);
+    return finish();
+}
+
+
+void
+OcclusionCuller::run()
+{
+    double begin = profile::now();
+
+    std::fill(levels[0].begin(), levels[0].end(), 0.0f);
+    setupTriangles();
+
+    // Threads own bands of rows, so none of them share a pixel
+    util::parallelFor(height, threads, [this](unsigned int y0, unsigned int y1) {
+        rasterizeRows(y0, y1);
+    });
+
+    buildPyramid();
+
+    double tested = profile::now();
+    rasterTime = tested - begin;
+
+    unsigned int count = bounds->size();
+    std::atomic<unsigned int> total(0);
+    util::parallelFor(count, threads, [&](unsigned int b, unsigned int e) {
+        total += testRange(b, e);
+    });
+    visibleCount = total;
+
+    testTime = profile::now() - tested;
+}
+
+
+/*
+ * Triangle setup
+ */
+// Screen positions and signed area; false if the triangle is dropped
+static bool
+project(const vec4 clip[3], int width, int height, float x[3], float y[3], float invW[3], float & area)
+{
+    for (int i = 0; i < 3; i++) {
+        if (!(clip[i].w > NEAR_W))
+            return false;
+        invW[i] = 1.0f / clip[i].w;
+        x[i] = (clip[i].x * invW[i] * 0.5f + 0.5f) * width;
+        y[i] = (clip[i].y * invW[i] * 0.5f + 0.5f) * height;
+    }
+
+    area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    return area != 0.0f && area == area;
+}
+
+
+// inner has bit i set if edge i (the one opposite vertex i) is shared
+// with a triangle on its other side, rather than part of the outline
+static bool
+setupTriangle(const vec4 clip[3], int width, int height, int inner, OcclusionCuller::Triangle & tri)
+{
+    float x[3], y[3], invW[3], area;
+    if (!project(clip, width, height, x, y, invW, area))
+        return false;
+
+    // Both windings are drawn; the nearest surface wins either way
+    if (area < 0.0f) {
+        std::swap(x[1], x[2]);
+        std::swap(y[1], y[2]);
+        std::swap(invW[1], invW[2]);
+        inner = (inner & 1) | ((inner & 2) << 1) | ((inner & 4) >> 1);
+        area = -area;
+    }
+
+    tri.wa = tri.wb = tri.wc = 0.0f;
+    for (int i = 0; i < 3; i++) {
+        int j = (i + 1) % 3, k = (i + 2) % 3;
+        tri.a[i] = y[j] - y[k];
+        tri.b[i] = x[k] - x[j];
+        tri.c[i] = -(tri.a[i] * x[j] + tri.b[i] * y[j]);
+
+        // Edge i is area at vertex i and 0 on the opposite side, so the
+        // 1/w plane is the sum of the edges weighted by 1/w / area
+        tri.wa += tri.a[i] * invW[i] / area;
+        tri.wb += tri.b[i] * invW[i] / area;
+        tri.wc += tri.c[i] * invW[i] / area;
+    }
+
+    // Coverage is conservative: outline edges are pulled in by half a
+    // pixel's worth of their slope, so a pixel the occluder only partly
+    // covers is left alone. Inner edges stay sampled at pixel centers,
+    // where the triangle on the other side takes the rest of the pixel
+    // and no crack opens between them. The depth written is the
+    // farthest anywhere in the pixel: the plane moved back the same
+    // way, but no farther than the triangle goes.
+    for (int i = 0; i < 3; i++) {
+        if (!(inner & (1 << i)))
+            tri.c[i] -= 0.5f * (fabsf(tri.a[i]) + fabsf(tri.b[i]));
+    }
+    tri.wc -= 0.5f * (fabsf(tri.wa) + fabsf(tri.wb));
+    tri.wmin = std::min(std::min(invW[0], invW[1]), invW[2]);
+
+    // Clamped as floats first; vertices near w = 0 land far off screen
+    tri.minX = (int)glm::clamp(floorf(std::min(std::min(x[0], x[1]), x[2])), 0.0f, (float)width);
+    tri.minY = (int)glm::clamp(floorf(std::min(std::min(y[0], y[1]), y[2])), 0.0f, (float)height);
+    tri.maxX = (int)glm::clamp(ceilf(std::max(std::max(x[0], x[1]), x[2])) - 1.0f, -1.0f, (float)width - 1);
+    tri.maxY = (int)glm::clamp(ceilf(std::max(std::max(y[0], y[1]), y[2])) - 1.0f, -1.0f, (float)height - 1);
+
+    return tri.minX <= tri.maxX && tri.minY <= tri.maxY;
+}
+
+
+void
+OcclusionCuller::setupTriangles()
+{
+    // Triangles of all the occluders, numbered back to back
+    vector<unsigned int> firsts(occluders.size() + 1, 0);
+    for (unsigned int i = 0; i < occluders.size(); i++)
+        firsts[i + 1] = firsts[i] + occluders[i].mesh->vertices.size() / 3;
+
+    unsigned int count = firsts.back();
+    unsigned int chunks = std::min(threads, std::max(1u, count / 256));
+    unsigned int chunk = std::max(1u, (count + chunks - 1) / chunks);
+    vector< vector<Triangle> > chunkTriangles(chunks);
+
+    // Project everything first: whether an edge is on the outline
+    // depends on which way the triangle across it faces
+    clipped.resize(count * 3);
+    windings.resize(count);
+
+    util::parallelFor(count, chunks, [&](unsigned int begin, unsigned int end) {
+        if (begin == end)
+            return;
+
+        unsigned int o = std::upper_bound(firsts.begin(), firsts.end(), begin) - firsts.begin() - 1;
+        mat4 mvp = viewProj * occluders[o].model;
+        float x[3], y[3], invW[3], area;
+
+        for (unsigned int t = begin; t < end; t++) {
+            while (t >= firsts[o + 1]) {
+                o++;
+                mvp = viewProj * occluders[o].model;
+            }
+
+            const vector<vec3> & vertices = occluders[o].mesh->vertices;
+            unsigned int first = (t - firsts[o]) * 3;
+            for (int i = 0; i < 3; i++)
+                clipped[t * 3 + i] = mvp * vec4(vertices[first + i], 1.0f);
+
+            windings[t] = 0;
+            if (project(&clipped[t * 3], width, height, x, y, invW, area))
+                windings[t] = area > 0.0f ? 1 : -1;
+        }
+    });
+
+    util::parallelFor(count, chunks, [&](unsigned int begin, unsigned int end) {
+        if (begin == end)
+            return;
+
+        vector<Triangle> & out = chunkTriangles[begin / chunk];
+        unsigned int o = std::upper_bound(firsts.begin(), firsts.end(), begin) - firsts.begin() - 1;
+        Triangle tri;
+
+        for (unsigned int t = begin; t < end; t++) {
+            if (!windings[t])
+                continue;
+            while (t >= firsts[o + 1])
+                o++;
+
+            // The two are on either side of the edge if they face the
+            // same way and run along it in opposite directions, or the
+            // other way round
+            const int * across = &occluders[o].neighbours[(t - firsts[o]) * 3];
+            int inner = 0;
+            for (int i = 0; i < 3; i++) {
+                if (across[i] < 0)
+                    continue;
+                bool sameWinding = windings[firsts[o] + (across[i] >> 1)] == windings[t];
+                if (sameWinding != (bool)(across[i] & 1))
+                    inner |= 1 << i;
+            }
+
+            if (setupTriangle(&clipped[t * 3], width, height, inner, tri))
+                out.push_back(tri);
+        }
+    });
+
+    triangles.clear();
+    for (unsigned int i = 0; i < chunks; i++)
+        triangles.insert(triangles.end(), chunkTriangles[i].begin(), chunkTriangles[i].end());
+}
+
+
+/*
+ * Rasterization. Pixels outside the triangle's box always fail the edge
+ * tests, so blocks of 4 start on a multiple of 4 and need no masking;
+ * the ones past the right edge land in the row padding.
+ */
+void
+OcclusionCuller::rasterizeRows(int y0, int y1)
+{
+    float * depth = &levels[0].front();
+
+    for (unsigned int t = 0; t < triangles.size(); t++) {
+        const Triangle & tri = triangles[t];
+        int minY = std::max(tri.minY, y0), maxY = std::min(tri.maxY, y1 - 1);
+
+        for (int y = minY; y <= maxY; y++) {
+            float py = y + 0.5f;
+            float row0 = tri.b[0] * py + tri.c[0];
+            float row1 = tri.b[1] * py + tri.c[1];
+            float row2 = tri.b[2] * py + tri.c[2];
+            float rowW = tri.wb * py + tri.wc;
+            float * out = depth + y * stride;
+
+            for (int x = tri.minX & ~3; x <= tri.maxX; x += 4) {
+#ifdef __SSE2__
+                __m128 px = _mm_add_ps(_mm_cvtepi32_ps(_mm_set_epi32(x + 3, x + 2, x + 1, x)),
+                                       _mm_set1_ps(0.5f));
+                __m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.a[0]), px), _mm_set1_ps(row0));
+                __m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.a[1]), px), _mm_set1_ps(row1));
+                __m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.a[2]), px), _mm_set1_ps(row2));
+                __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, _mm_setzero_ps()),
+                                                      _mm_cmpge_ps(e1, _mm_setzero_ps())),
+                                           _mm_cmpge_ps(e2, _mm_setzero_ps()));
+                if (!_mm_movemask_ps(inside))
+                    continue;
+
+                __m128 w = _mm_max_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.wa), px), _mm_set1_ps(rowW)),
+                                      _mm_set1_ps(tri.wmin));
+                __m128 d = _mm_loadu_ps(out + x);
+                d = _mm_or_ps(_mm_and_ps(inside, _mm_max_ps(d, w)), _mm_andnot_ps(inside, d));
+                _mm_storeu_ps(out + x, d);
+#else
+                for (int k = 0; k < 4; k++) {
+                    float px = (float)(x + k) + 0.5f;
+                    if (tri.a[0] * px + row0 >= 0.0f && tri.a[1] * px + row1 >= 0.0f &&
+                        tri.a[2] * px + row2 >= 0.0f)
+                        out[x + k] = std::max(out[x + k], std::max(tri.wa * px + rowW, tri.wmin));
+                }
+#endif
+            }
+        }
+    }
+}
+
+
+void
+OcclusionCuller::buildPyramid()
+{
+    for (unsigned int l = 1; l < levels.size(); l++) {
+        const vector<float> & src = levels[l - 1];
+        int srcWidth = levelWidths[l - 1], srcHeight = levelHeights[l - 1];
+        int srcStride = l == 1 ? stride : srcWidth;
+        int w = levelWidths[l], h = levelHeights[l];
+
+        for (int y = 0; y < h; y++) {
+            int sy0 = y * 2, sy1 = std::min(sy0 + 1, srcHeight - 1);
+            for (int x = 0; x < w; x++) {
+                int sx0 = x * 2, sx1 = std::min(sx0 + 1, srcWidth - 1);
+                levels[l][y * w + x] = std::min(std::min(src[sy0 * srcStride + sx0], src[sy0 * srcStride + sx1]),
+                                                std::min(src[sy1 * srcStride + sx0], src[sy1 * srcStride + sx1]));
+            }
+        }
+    }
+}
+
+
+/*
+ * Box tests
+ */
+bool
+OcclusionCuller::isOccluded(const vec3 & center, const vec3 & extent) const
+{
+    // Corners are the projected center plus or minus the projected
+    // axes. Only x, y and w are needed; the sums are in the same order
+    // as in the SSE path so the two agree exactly.
+    static const int rows[3] = { 0, 1, 3 };
+    const mat4 & m = viewProj;
+    float c[3], ax[3], ay[3], az[3];
+    for (int r = 0; r < 3; r++) {
+        int k = rows[r];
+        c[r] = ((m[0][k] * center.x + m[1][k] * center.y) + m[2][k] * center.z) + m[3][k];
+        ax[r] = m[0][k] * extent.x;
+        ay[r] = m[1][k] * extent.y;
+        az[r] = m[2][k] * extent.z;
+    }
+
+    float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f;
+    float nearest = 0.0f;
+    for (int i = 0; i < 8; i++) {
+        float p[3];
+        for (int r = 0; r < 3; r++) {
+            p[r] = (i & 1) ? c[r] + ax[r] : c[r] - ax[r];
+            p[r] = (i & 2) ? p[r] + ay[r] : p[r] - ay[r];
+            p[r] = (i & 4) ? p[r] + az[r] : p[r] - az[r];
+        }
+        if (!(p[2] > NEAR_W))
+            return false;
+
+        float invW = 1.0f / p[2];
+        float x = (p[0] * invW * 0.5f + 0.5f) * width;
+        float y = (p[1] * invW * 0.5f + 0.5f) * height;
+        minX = std::min(minX, x);
+        maxX = std::max(maxX, x);
+        minY = std::min(minY, y);
+        maxY = std::max(maxY, y);
+        nearest = std::max(nearest, invW);
+    }
+
+    return isRectOccluded(minX, minY, maxX, maxY, nearest);
+}
+
+
+bool
+OcclusionCuller::isRectOccluded(float minX, float minY, float maxX, float maxY, float nearest) const
+{
+    // Off screen is the frustum's business
+    if (maxX < 0.0f || maxY < 0.0f || minX >= width || minY >= height)
+        return false;
+
+    // One pixel wider all round: an occluder edge pixel can be covered
+    // at its center but not everywhere, and then its outer neighbour is
+    // what the box may show through
+    int x0 = std::max(0, (int)minX - 1), x1 = std::min(width - 1, (int)maxX + 1);
+    int y0 = std::max(0, (int)minY - 1), y1 = std::min(height - 1, (int)maxY + 1);
+
+    // The first level where the box spans at most 2x2 texels
+    unsigned int l = 0;
+    while ((x1 >> l) - (x0 >> l) > 1 || (y1 >> l) - (y0 >> l) > 1)
+        l++;
+
+    const vector<float> & level = levels[l];
+    int levelStride = l == 0 ? stride : levelWidths[l];
+    float farthest = 1e30f;
+    for (int y = y0 >> l; y <= y1 >> l; y++)
+        for (int x = x0 >> l; x <= x1 >> l; x++)
+            farthest = std::min(farthest, level[y * levelStride + x]);
+
+    return nearest < farthest;
+}
+
+
+unsigned int
+OcclusionCuller::testRange(unsigned int begin, unsigned int end)
+{
+    const BoundsArray & b = *bounds;
+    unsigned int count = 0;
+    unsigned int i = begin;
+
+#ifdef __SSE2__
+    // Four boxes at a time through the projection; the pyramid lookups
+    // that follow are scalar
+    static const int rows[3] = { 0, 1, 3 };
+    __m128 m[4][3];
+    for (int col = 0; col < 4; col++)
+        for (int r = 0; r < 3; r++)
+            m[col][r] = _mm_set1_ps(viewProj[col][rows[r]]);
+
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 nearW = _mm_set1_ps(NEAR_W);
+    const __m128 size[2] = { _mm_set1_ps((float)width), _mm_set1_ps((float)height) };
+
+    for (; i + 4 <= end; i += 4) {
+        if (!(visible[i] | visible[i + 1] | visible[i + 2] | visible[i + 3]))
+            continue;
+
+        __m128 cx = _mm_loadu_ps(&b.cx[i]), cy = _mm_loadu_ps(&b.cy[i]), cz = _mm_loadu_ps(&b.cz[i]);
+        __m128 ex = _mm_loadu_ps(&b.ex[i]), ey = _mm_loadu_ps(&b.ey[i]), ez = _mm_loadu_ps(&b.ez[i]);
+
+        __m128 c[3], ax[3], ay[3], az[3];
+        for (int r = 0; r < 3; r++) {
+            c[r] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0][r], cx), _mm_mul_ps(m[1][r], cy)),
+                                         _mm_mul_ps(m[2][r], cz)), m[3][r]);
+            ax[r] = _mm_mul_ps(m[0][r], ex);
+            ay[r] = _mm_mul_ps(m[1][r], ey);
+            az[r] = _mm_mul_ps(m[2][r], ez);
+        }
+
+        __m128 lo[2] = { _mm_set1_ps(1e30f), _mm_set1_ps(1e30f) };
+        __m128 hi[2] = { _mm_set1_ps(-1e30f), _mm_set1_ps(-1e30f) };
+        __m128 nearest = _mm_setzero_ps();
+        __m128 behind = _mm_setzero_ps();
+
+        for (int k = 0; k < 8; k++) {
+            __m128 p[3];
+            for (int r = 0; r < 3; r++) {
+                p[r] = (k & 1) ? _mm_add_ps(c[r], ax[r]) : _mm_sub_ps(c[r], ax[r]);
+                p[r] = (k & 2) ? _mm_add_ps(p[r], ay[r]) : _mm_sub_ps(p[r], ay[r]);
+                p[r] = (k & 4) ? _mm_add_ps(p[r], az[r]) : _mm_sub_ps(p[r], az[r]);
+            }
+            behind = _mm_or_ps(behind, _mm_cmpngt_ps(p[2], nearW));
+
+            __m128 invW = _mm_div_ps(_mm_set1_ps(1.0f), p[2]);
+            for (int a = 0; a < 2; a++) {
+                __m128 s = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(p[a], invW), half), half), size[a]);
+                lo[a] = _mm_min_ps(lo[a], s);
+                hi[a] = _mm_max_ps(hi[a], s);
+            }
+            nearest = _mm_max_ps(nearest, invW);
+        }
+
+        float minX[4], minY[4], maxX[4], maxY[4], near[4];
+        _mm_storeu_ps(minX, lo[0]);
+        _mm_storeu_ps(minY, lo[1]);
+        _mm_storeu_ps(maxX, hi[0]);
+        _mm_storeu_ps(maxY, hi[1]);
+        _mm_storeu_ps(near, nearest);
+        int crossing = _mm_movemask_ps(behind);
+
+        for (int k = 0; k < 4; k++) {
+            if (!visible[i + k])
+                continue;
+
+            if (!((crossing >> k) & 1) && isRectOccluded(minX[k], minY[k], maxX[k], maxY[k], near[k]))
+                visible[i + k] = 0;
+            else
+                count++;
+        }
+    }
+#endif
+
+    for (; i < end; i++) {
+        if (!visible[i])
+            continue;
+
+        if (isOccluded(vec3(b.cx[i], b.cy[i], b.cz[i]), vec3(b.ex[i], b.ey[i], b.ez[i])))
+            visible[i] = 0;
+        else
+            count++;
+    }
+    return count;
+}
+
+}
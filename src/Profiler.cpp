@@ -0,0 +1,565 @@
+/*
+ * Profiler.cpp
+ *
+ * See Profiler.hpp for an overview.
+ */
+#include "Profiler.hpp"
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <time.h>
+#include <vector>
+
+using std::map;
+using std::set;
+using std::string;
+using std::vector;
+
+namespace profile {
+
+namespace {
+
+const unsigned int RING_SIZE = 1 << 14;         // events per thread
+const int          MAX_DEPTH = 32;              // nested CPU scopes
+const unsigned int STAT_WINDOW = 512;           // frames kept per scope
+const size_t       MAX_TRACE_EVENTS = 1 << 20;
+const int          GPU_TID = 1000;              // trace row for GPU scopes
+
+struct CpuEvent
+{
+    const char *    name;
+    double          start, end;
+};
+
+/*
+ * Single producer (the owning thread), single consumer (endFrame).
+ * The producer only moves head, the consumer only moves tail.
+ */
+struct ThreadRing
+{
+    ThreadRing(int id):id(id), head(0), tail(0), depth(0), dropped(0){}
+
+    int                         id;
+    CpuEvent                    events[RING_SIZE];
+    std::atomic<unsigned int>   head, tail;
+
+    // Open scopes; only ever touched by the owning thread
+    const char *                names[MAX_DEPTH];
+    double                      starts[MAX_DEPTH];
+    int                         depth;
+
+    std::atomic<unsigned int>   dropped;
+};
+
+struct TraceEvent
+{
+    const char *    name;
+    double          start, duration;
+    int             tid;
+};
+
+// Rolling window of per-frame totals for one scope
+struct Series
+{
+    Series():next(0), frameTotal(0.0), touched(false){}
+
+    void add(double value)
+    {
+        if (samples.size() < STAT_WINDOW)
+            samples.push_back(value);
+        else
+            samples[next] = value;
+        next = (next + 1) % STAT_WINDOW;
+    }
+
+    vector<double>  samples;
+    unsigned int    next;
+    double          frameTotal;
+    bool            touched;
+};
+
+struct GpuScopeQuery
+{
+    const char *    name;
+    GLuint          begin, end;
+};
+
+// Queries issued during one frame, waiting GPU_LATENCY frames for results
+struct GpuFrame
+{
+    GpuFrame():used(0), pending(false){}
+
+    vector<GpuScopeQuery>   scopes;
+    vector<GLuint>          pool;
+    unsigned int            used;
+    bool                    pending;
+};
+
+std::atomic<bool>       enabled(false);
+std::atomic<bool>       drawScopes(false);
+std::mutex              namesLock;
+set<string>             names;
+std::mutex              ringsLock;
+vector<ThreadRing*>     rings;
+thread_local ThreadRing * localRing = NULL;
+
+map<string, Series>     cpuSeries;
+map<string, Series>     gpuSeries;
+vector<TraceEvent>      trace;
+
+bool                    gpuAvailable = false;
+double                  gpuOffset = 0.0;
+GpuFrame                gpuFrames[GPU_LATENCY];
+vector<int>             gpuOpen;
+unsigned int            frameIndex = 0;
+double                  frameStart = -1.0;
+unsigned int            droppedGpuFrames = 0;
+
+
+ThreadRing *
+threadRing()
+{
+    if (!localRing) {
+        std::lock_guard<std::mutex> lock(ringsLock);
+        localRing = new ThreadRing((int)rings.size());
+        rings.push_back(localRing);
+    }
+    return localRing;
+}
+
+
+void
+addTrace(const char * name, double start, double end, int tid)
+{
+    if (trace.size() >= MAX_TRACE_EVENTS)
+        return;
+
+    TraceEvent e = { name, start, end - start, tid };
+    trace.push_back(e);
+}
+
+
+void
+accumulate(map<string, Series> & series, const char * name, double duration)
+{
+    Series & s = series[name];
+    s.frameTotal += duration;
+    s.touched = true;
+}
+
+
+// Turn this frame's accumulated totals into samples
+void
+closeFrame(map<string, Series> & series)
+{
+    for (map<string, Series>::iterator it = series.begin(); it != series.end(); ++it) {
+        if (!it->second.touched)
+            continue;
+
+        it->second.add(it->second.frameTotal);
+        it->second.frameTotal = 0.0;
+        it->second.touched = false;
+    }
+}
+
+
+void
+drainRings()
+{
+    vector<ThreadRing*> current;
+    {
+        std::lock_guard<std::mutex> lock(ringsLock);
+        current = rings;
+    }
+
+    for (unsigned int r = 0; r < current.size(); r++) {
+        ThreadRing * ring = current[r];
+        unsigned int tail = ring->tail.load(std::memory_order_relaxed);
+        unsigned int head = ring->head.load(std::memory_order_acquire);
+
+        for (; tail != head; tail++) {
+            const CpuEvent & e = ring->events[tail & (RING_SIZE - 1)];
+            accumulate(cpuSeries, e.name, e.end - e.start);
+            addTrace(e.name, e.start, e.end, ring->id);
+        }
+
+        ring->tail.store(tail, std::memory_order_release);
+    }
+}
+
+
+GLuint
+nextQuery(GpuFrame & f)
+{
+    if (f.used == f.pool.size()) {
+        GLuint q;
+        glGenQueries(1, &q);
+        f.pool.push_back(q);
+    }
+    return f.pool[f.used++];
+}
+
+
+/*
+ * Collect the results of a frame issued GPU_LATENCY frames ago. Queries
+ * finish in order, so if the last timestamp is done every scope is too.
+ * If the GPU is running even further behind we drop the frame rather
+ * than wait for it.
+ *
+ * Scopes use GL_TIMESTAMP pairs rather than GL_TIME_ELAPSED because
+ * elapsed-time queries can't nest, and a pass inside the frame is
+ * exactly the nesting we want.
+ */
+void
+resolveGpuFrame(GpuFrame & f)
+{
+    if (!f.pending)
+        return;
+
+    f.pending = false;
+    if (!f.used)
+        return;
+
+    GLuint available = 0;
+    glGetQueryObjectuiv(f.pool[f.used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+        droppedGpuFrames++;
+        return;
+    }
+
+    for (unsigned int i = 0; i < f.scopes.size(); i++) {
+        if (!f.scopes[i].end)
+            continue;
+
+        GLuint64 begin, end;
+        glGetQueryObjectui64v(f.scopes[i].begin, GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(f.scopes[i].end, GL_QUERY_RESULT, &end);
+
+        double start = begin * 1e-9 + gpuOffset;
+        double stop = end * 1e-9 + gpuOffset;
+        accumulate(gpuSeries, f.scopes[i].name, stop - start);
+        addTrace(f.scopes[i].name, start, stop, GPU_TID);
+    }
+
+    closeFrame(gpuSeries);
+}
+
+
+bool
+computeStats(map<string, Series> & series, const char * name, Stats & stats)
+{
+    map<string, Series>::iterator it = series.find(name);
+    if (it == series.end() || it->second.samples.empty())
+        return false;
+
+    vector<double> sorted = it->second.samples;
+    std::sort(sorted.begin(), sorted.end());
+
+    double sum = 0.0;
+    for (unsigned int i = 0; i < sorted.size(); i++)
+        sum += sorted[i];
+
+    unsigned int rank = (unsigned int)(0.99 * sorted.size() + 0.5);
+    rank = rank > 0 ? rank - 1 : 0;
+
+    stats.min = sorted.front();
+    stats.avg = sum / sorted.size();
+    stats.p99 = sorted[std::min(rank, (unsigned int)sorted.size() - 1)];
+    stats.samples = sorted.size();
+    return true;
+}
+
+
+void
+printSeries(FILE * out, const char * side, map<string, Series> & series)
+{
+    for (map<string, Series>::iterator it = series.begin(); it != series.end(); ++it) {
+        Stats s;
+        if (!computeStats(series, it->first.c_str(), s))
+            continue;
+
+        fprintf(out, "  %s  %-24s %9.3f %9.3f %9.3f %8u\n", side, it->first.c_str(),
+                s.min * 1e3, s.avg * 1e3, s.p99 * 1e3, s.samples);
+    }
+}
+
+// s as a JSON string, quotes included; scope names can be anything,
+// shader paths with backslashes among them
+void
+writeJsonString(FILE * out, const char * s)
+{
+    fputc('"', out);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(out, "\\u%04x", c);
+        else
+            fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+}
+
+
+void
+setEnabled(bool enable)
+{
+    if (enable && !enabled) {
+        gpuAvailable = GLEW_ARB_timer_query;
+
+        // Line the GPU clock up with ours so both show in one trace
+        if (gpuAvailable) {
+            GLint64 gpuNow;
+            glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+            gpuOffset = now() - gpuNow * 1e-9;
+        }
+    }
+
+    enabled = enable;
+}
+
+
+bool
+isEnabled()
+{
+    return enabled;
+}
+
+
+void
+setDrawScopes(bool enable)
+{
+    drawScopes = enable;
+}
+
+
+bool
+getDrawScopes()
+{
+    return drawScopes;
+}
+
+
+const char *
+intern(const string & name)
+{
+    // set nodes don't move, so the pointer stays good
+    std::lock_guard<std::mutex> lock(namesLock);
+    return names.insert(name).first->c_str();
+}
+
+
+double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+void
+beginFrame()
+{
+    if (!enabled)
+        return;
+
+    frameStart = now();
+
+    if (gpuAvailable) {
+        GpuFrame & f = gpuFrames[frameIndex % GPU_LATENCY];
+        resolveGpuFrame(f);
+
+        f.used = 0;
+        f.scopes.clear();
+        gpuOpen.clear();
+        beginGpu("frame");
+    }
+}
+
+
+void
+endFrame()
+{
+    if (!enabled || frameStart < 0.0)
+        return;
+
+    double frameEnd = now();
+
+    if (gpuAvailable) {
+        // Closes the frame scope along with anything left open
+        while (!gpuOpen.empty())
+            endGpu();
+
+        gpuFrames[frameIndex % GPU_LATENCY].pending = true;
+    }
+
+    drainRings();
+    accumulate(cpuSeries, "frame", frameEnd - frameStart);
+    addTrace("frame", frameStart, frameEnd, 0);
+    closeFrame(cpuSeries);
+
+    frameStart = -1.0;
+    frameIndex++;
+}
+
+
+void
+beginCpu(const char * name)
+{
+    if (!enabled)
+        return;
+
+    ThreadRing * ring = threadRing();
+    if (ring->depth < MAX_DEPTH) {
+        ring->names[ring->depth] = name;
+        ring->starts[ring->depth] = now();
+    }
+    ring->depth++;
+}
+
+
+void
+endCpu()
+{
+    // Deliberately not checking 'enabled' so scopes stay balanced if
+    // profiling is switched off while one is open
+    ThreadRing * ring = localRing;
+    if (!ring || ring->depth == 0)
+        return;
+
+    ring->depth--;
+    if (ring->depth >= MAX_DEPTH)
+        return;
+
+    unsigned int head = ring->head.load(std::memory_order_relaxed);
+    unsigned int tail = ring->tail.load(std::memory_order_acquire);
+    if (head - tail >= RING_SIZE) {
+        ring->dropped++;
+        return;
+    }
+
+    CpuEvent & e = ring->events[head & (RING_SIZE - 1)];
+    e.name = ring->names[ring->depth];
+    e.start = ring->starts[ring->depth];
+    e.end = now();
+
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+
+void
+beginGpu(const char * name)
+{
+    if (!enabled || !gpuAvailable || frameStart < 0.0)
+        return;
+
+    GpuFrame & f = gpuFrames[frameIndex % GPU_LATENCY];
+    GpuScopeQuery scope = { name, nextQuery(f), 0 };
+
+    glQueryCounter(scope.begin, GL_TIMESTAMP);
+
+    gpuOpen.push_back(f.scopes.size());
+    f.scopes.push_back(scope);
+}
+
+
+void
+endGpu()
+{
+    if (gpuOpen.empty())
+        return;
+
+    GpuFrame & f = gpuFrames[frameIndex % GPU_LATENCY];
+    GpuScopeQuery & scope = f.scopes[gpuOpen.back()];
+    gpuOpen.pop_back();
+
+    scope.end = nextQuery(f);
+    glQueryCounter(scope.end, GL_TIMESTAMP);
+}
+
+
+bool
+getCpuStats(const char * name, Stats & stats)
+{
+    return computeStats(cpuSeries, name, stats);
+}
+
+
+bool
+getGpuStats(const char * name, Stats & stats)
+{
+    return computeStats(gpuSeries, name, stats);
+}
+
+
+void
+printReport(FILE * out)
+{
+    fprintf(out, "Frame breakdown (ms per frame over the last %u frames)\n", STAT_WINDOW);
+    fprintf(out, "       %-24s %9s %9s %9s %8s\n", "scope", "min", "avg", "p99", "frames");
+    printSeries(out, "cpu", cpuSeries);
+    printSeries(out, "gpu", gpuSeries);
+
+    unsigned int dropped = 0;
+    {
+        std::lock_guard<std::mutex> lock(ringsLock);
+        for (unsigned int i = 0; i < rings.size(); i++)
+            dropped += rings[i]->dropped;
+    }
+
+    if (dropped || droppedGpuFrames)
+        fprintf(out, "  (dropped %u CPU events, %u GPU frames)\n", dropped, droppedGpuFrames);
+}
+
+
+bool
+writeChromeTrace(const char * filename)
+{
+    FILE * out = fopen(filename, "w");
+    if (!out) {
+        printf("Unable to write trace to %s\n", filename);
+        return false;
+    }
+
+    double origin = trace.empty() ? 0.0 : trace[0].start;
+    for (unsigned int i = 1; i < trace.size(); i++)
+        origin = std::min(origin, trace[i].start);
+
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                 "\"args\":{\"name\":\"GPU\"}}", GPU_TID);
+
+    for (unsigned int i = 0; i < trace.size(); i++) {
+        const TraceEvent & e = trace[i];
+        fprintf(out, ",\n{\"name\":");
+        writeJsonString(out, e.name);
+        fprintf(out, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+                e.tid == GPU_TID ? "gpu" : "cpu", (e.start - origin) * 1e6, e.duration * 1e6, e.tid);
+    }
+
+    fprintf(out, "\n]}\n");
+    fclose(out);
+    return true;
+}
+
+
+void
+reset()
+{
+    cpuSeries.clear();
+    gpuSeries.clear();
+    trace.clear();
+    droppedGpuFrames = 0;
+}
+
+}
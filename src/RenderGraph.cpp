@@ -0,0 +1,657 @@
+/*
+ * RenderGraph.cpp
+ *
+ * See RenderGraph.hpp for an overview.
+ */
+#include "RenderGraph.hpp"
+
+#include <stdio.h>
+
+#include "Profiler.hpp"
+
+namespace render {
+
+/*
+ * GL backend
+ */
+GLBackend::~GLBackend()
+{
+    for (unsigned int i = 0; i < targets.size(); i++) {
+        targets[i]->reset();
+        delete targets[i];
+    }
+}
+
+
+int
+GLBackend::createTarget(const TargetDesc & desc)
+{
+    Fbo * fbo = new Fbo();
+    if (!fbo->create(desc.width, desc.height, desc.count))
+        printf("RenderGraph: failed to create %ux%u target\n", desc.width, desc.height);
+
+    targets.push_back(fbo);
+    return (int)targets.size() - 1;
+}
+
+
+void
+GLBackend::bindTarget(int target)
+{
+    // Fbo keeps its own enabled flag, so always go through enable/disable
+    for (unsigned int i = 0; i < targets.size(); i++) {
+        if ((int)i != target)
+            targets[i]->disable();
+    }
+
+    if (target == DEFAULT_TARGET)
+        glBindFramebuffer(GL_FRAMEBUFFER, Fbo::getDefaultFramebuffer());
+    else
+        targets[target]->enable();
+}
+
+
+void
+GLBackend::invalidateTarget(int target, bool color, bool depth)
+{
+    if (target == DEFAULT_TARGET || !GLEW_ARB_invalidate_subdata)
+        return;
+
+    Fbo * fbo = targets[target];
+    vector<GLenum> attachments;
+
+    if (color) {
+        for (GLuint i = 0; i < fbo->getTextureCount(); i++)
+            attachments.push_back(GL_COLOR_ATTACHMENT0 + i);
+    }
+    if (depth)
+        attachments.push_back(GL_DEPTH_ATTACHMENT);
+
+    if (attachments.empty())
+        return;
+
+    // glInvalidateFramebuffer acts on whatever is bound
+    bindTarget(target);
+    glInvalidateFramebuffer(GL_FRAMEBUFFER, attachments.size(), &attachments.front());
+}
+
+
+void
+GLBackend::memoryBarrier(GLbitfield barriers)
+{
+    if (GLEW_ARB_shader_image_load_store)
+        glMemoryBarrier(barriers);
+}
+
+
+GLuint
+GLBackend::getTexture(int target, GLuint index)
+{
+    if (target == DEFAULT_TARGET || index >= targets[target]->getTextureCount())
+        return 0;
+
+    return targets[target]->getTextureHandles()[index];
+}
+
+
+/*
+ * Pass context
+ */
+GLuint
+PassContext::getTexture(const string & resource, GLuint index)
+{
+    int r = graph.findResource(resource);
+    if (r < 0)
+        return 0;
+
+    return graph.backend.getTexture(graph.resources[r].target, index);
+}
+
+
+/*
+ * Graph construction
+ */
+RenderGraph::RenderGraph(GraphBackend & backend):
+    backend(backend),
+    compiled(false)
+{
+}
+
+
+void
+RenderGraph::createTarget(const string & name, GLuint width, GLuint height, GLuint count)
+{
+    Resource r;
+    r.name = name;
+    r.desc.width = width;
+    r.desc.height = height;
+    r.desc.count = count;
+    r.imported = false;
+    r.output = false;
+    r.target = DEFAULT_TARGET;
+    resources.push_back(r);
+    compiled = false;
+}
+
+
+void
+RenderGraph::importTarget(const string & name, int target)
+{
+    Resource r;
+    r.name = name;
+    r.desc.width = r.desc.height = r.desc.count = 0;
+    r.imported = true;
+    r.output = false;
+    r.target = target;
+    resources.push_back(r);
+    compiled = false;
+}
+
+
+void
+RenderGraph::markOutput(const string & name)
+{
+    int r = findResource(name);
+    if (r < 0) {
+        logString += "Unknown output resource " + name + ".\n";
+        return;
+    }
+
+    resources[r].output = true;
+    compiled = false;
+}
+
+
+int
+RenderGraph::addPass(const string & name, PassCallback callback, bool sideEffect)
+{
+    Pass p;
+    p.name = name;
+    p.scope = profile::intern(name);
+    p.callback = callback;
+    p.sideEffect = sideEffect;
+    p.live = false;
+    passes.push_back(p);
+    compiled = false;
+
+    return (int)passes.size() - 1;
+}
+
+
+void
+RenderGraph::read(int pass, const string & resource, Access access)
+{
+    int r = findResource(resource);
+    if (r < 0) {
+        logString += "Pass " + passes[pass].name + " reads unknown resource " + resource + ".\n";
+        return;
+    }
+
+    Use u = { r, access };
+    passes[pass].uses.push_back(u);
+    compiled = false;
+}
+
+
+void
+RenderGraph::write(int pass, const string & resource, Access access)
+{
+    int r = findResource(resource);
+    if (r < 0) {
+        logString += "Pass " + passes[pass].name + " writes unknown resource " + resource + ".\n";
+        return;
+    }
+
+    if (access == WRITE_TARGET && renderTargetOf(passes[pass]) >= 0) {
+        logString += "Pass " + passes[pass].name + " already has a render target.\n";
+        return;
+    }
+
+    Use u = { r, access };
+    passes[pass].uses.push_back(u);
+    compiled = false;
+}
+
+
+void
+RenderGraph::reset()
+{
+    resources.clear();
+    passes.clear();
+    schedule.clear();
+    compiled = false;
+    logString = "";
+}
+
+
+int
+RenderGraph::findResource(const string & name)
+{
+    for (unsigned int i = 0; i < resources.size(); i++) {
+        if (resources[i].name == name)
+            return i;
+    }
+    return -1;
+}
+
+
+int
+RenderGraph::renderTargetOf(const Pass & pass)
+{
+    for (unsigned int i = 0; i < pass.uses.size(); i++) {
+        if (pass.uses[i].access == WRITE_TARGET)
+            return pass.uses[i].resource;
+    }
+    return -1;
+}
+
+
+static bool
+isWrite(Access access)
+{
+    return access == WRITE_TARGET || access == WRITE_IMAGE;
+}
+
+
+static void
+addUnique(vector<int> & list, int value)
+{
+    for (unsigned int i = 0; i < list.size(); i++) {
+        if (list[i] == value)
+            return;
+    }
+    list.push_back(value);
+}
+
+
+/*
+ * Compilation
+ */
+bool
+RenderGraph::compile()
+{
+    schedule.clear();
+
+    buildDependencies();
+    cull();
+
+    vector<int> sorted;
+    if (!order(sorted))
+        return false;
+
+    computeLifetimes(sorted);
+    allocateTargets(sorted);
+    placeBarriers(sorted);
+
+    compiled = true;
+    return true;
+}
+
+
+/*
+ * Walk the passes in declaration order and record read-after-write,
+ * write-after-write and write-after-read hazards. A write to a resource
+ * that already has contents keeps them (draws accumulate), so the
+ * previous writer counts as a producer.
+ */
+void
+RenderGraph::buildDependencies()
+{
+    vector<int> lastWriter(resources.size(), -1);
+    vector< vector<int> > readers(resources.size());
+
+    for (unsigned int p = 0; p < passes.size(); p++) {
+        Pass & pass = passes[p];
+        pass.producers.clear();
+        pass.after.clear();
+
+        for (unsigned int u = 0; u < pass.uses.size(); u++) {
+            int r = pass.uses[u].resource;
+            int writer = lastWriter[r];
+
+            if (writer >= 0 && writer != (int)p) {
+                addUnique(pass.producers, writer);
+                addUnique(pass.after, writer);
+            }
+
+            if (isWrite(pass.uses[u].access)) {
+                for (unsigned int i = 0; i < readers[r].size(); i++) {
+                    if (readers[r][i] != (int)p)
+                        addUnique(pass.after, readers[r][i]);
+                }
+                readers[r].clear();
+                lastWriter[r] = p;
+            } else {
+                readers[r].push_back(p);
+            }
+        }
+    }
+}
+
+
+/*
+ * A pass survives if it has side effects, produces the final contents
+ * of an output, or feeds a pass that survives.
+ */
+void
+RenderGraph::cull()
+{
+    vector<int> stack;
+
+    for (unsigned int p = 0; p < passes.size(); p++) {
+        passes[p].live = false;
+        if (passes[p].sideEffect)
+            stack.push_back(p);
+    }
+
+    for (unsigned int r = 0; r < resources.size(); r++) {
+        if (!resources[r].output)
+            continue;
+
+        for (int p = (int)passes.size() - 1; p >= 0; p--) {
+            bool writes = false;
+            for (unsigned int u = 0; u < passes[p].uses.size(); u++) {
+                if (passes[p].uses[u].resource == (int)r && isWrite(passes[p].uses[u].access))
+                    writes = true;
+            }
+            if (writes) {
+                stack.push_back(p);
+                break;
+            }
+        }
+    }
+
+    while (!stack.empty()) {
+        int p = stack.back();
+        stack.pop_back();
+
+        if (passes[p].live)
+            continue;
+
+        passes[p].live = true;
+        for (unsigned int i = 0; i < passes[p].producers.size(); i++)
+            stack.push_back(passes[p].producers[i]);
+    }
+}
+
+
+/*
+ * Topological sort of the live passes. Among the passes that are ready,
+ * prefer one drawing into the target that is already bound so we don't
+ * pay for a framebuffer switch; otherwise keep declaration order.
+ */
+bool
+RenderGraph::order(vector<int> & sorted)
+{
+    vector<int> pending(passes.size(), 0);
+    vector<bool> done(passes.size(), false);
+    int liveCount = 0;
+
+    for (unsigned int p = 0; p < passes.size(); p++) {
+        if (!passes[p].live)
+            continue;
+
+        liveCount++;
+        for (unsigned int i = 0; i < passes[p].after.size(); i++) {
+            if (passes[passes[p].after[i]].live)
+                pending[p]++;
+        }
+    }
+
+    int boundTarget = -1;
+    while ((int)sorted.size() < liveCount) {
+        int next = -1;
+
+        for (unsigned int p = 0; p < passes.size(); p++) {
+            if (!passes[p].live || done[p] || pending[p] > 0)
+                continue;
+
+            if (next < 0)
+                next = p;
+
+            if (boundTarget >= 0 && renderTargetOf(passes[p]) == boundTarget) {
+                next = p;
+                break;
+            }
+        }
+
+        if (next < 0) {
+            logString += "Render graph contains a dependency cycle.\n";
+            return false;
+        }
+
+        done[next] = true;
+        sorted.push_back(next);
+
+        int target = renderTargetOf(passes[next]);
+        if (target >= 0)
+            boundTarget = target;
+
+        for (unsigned int p = 0; p < passes.size(); p++) {
+            if (!passes[p].live || done[p])
+                continue;
+            for (unsigned int i = 0; i < passes[p].after.size(); i++) {
+                if (passes[p].after[i] == next)
+                    pending[p]--;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+void
+RenderGraph::computeLifetimes(const vector<int> & sorted)
+{
+    for (unsigned int r = 0; r < resources.size(); r++) {
+        resources[r].firstUse = -1;
+        resources[r].lastUse = -1;
+        resources[r].lastRead = -1;
+    }
+
+    for (unsigned int s = 0; s < sorted.size(); s++) {
+        const Pass & pass = passes[sorted[s]];
+
+        for (unsigned int u = 0; u < pass.uses.size(); u++) {
+            Resource & res = resources[pass.uses[u].resource];
+
+            if (res.firstUse < 0)
+                res.firstUse = s;
+            res.lastUse = s;
+            if (!isWrite(pass.uses[u].access))
+                res.lastRead = s;
+        }
+    }
+}
+
+
+int
+RenderGraph::acquire(const TargetDesc & desc)
+{
+    for (unsigned int i = 0; i < pool.size(); i++) {
+        if (!pool[i].busy && pool[i].desc == desc) {
+            pool[i].busy = true;
+            return pool[i].target;
+        }
+    }
+
+    PoolEntry e;
+    e.desc = desc;
+    e.target = backend.createTarget(desc);
+    e.busy = true;
+    pool.push_back(e);
+
+    return e.target;
+}
+
+
+/*
+ * Transient resources borrow a pooled target for [firstUse, lastUse].
+ * Resources whose lifetimes don't overlap end up sharing a target, and
+ * the pool carries over between frames.
+ */
+void
+RenderGraph::allocateTargets(const vector<int> & sorted)
+{
+    for (unsigned int i = 0; i < pool.size(); i++)
+        pool[i].busy = false;
+
+    for (unsigned int s = 0; s < sorted.size(); s++) {
+        for (unsigned int r = 0; r < resources.size(); r++) {
+            if (!resources[r].imported && resources[r].firstUse == (int)s)
+                resources[r].target = acquire(resources[r].desc);
+        }
+
+        for (unsigned int r = 0; r < resources.size(); r++) {
+            Resource & res = resources[r];
+            if (res.imported || res.output || res.lastUse != (int)s)
+                continue;
+
+            for (unsigned int i = 0; i < pool.size(); i++) {
+                if (pool[i].target == res.target)
+                    pool[i].busy = false;
+            }
+        }
+    }
+}
+
+
+static GLbitfield
+barrierFor(Access access)
+{
+    switch (access) {
+        case READ_TEXTURE: return GL_TEXTURE_FETCH_BARRIER_BIT;
+        case WRITE_TARGET: return GL_FRAMEBUFFER_BARRIER_BIT;
+        default:           return GL_SHADER_IMAGE_ACCESS_BARRIER_BIT;
+    }
+}
+
+
+/*
+ * Only image stores are incoherent; render-to-texture followed by a
+ * texture fetch is ordered by GL itself. So a barrier is emitted just
+ * before the first pass that consumes an image store in a given way,
+ * and one barrier covers every resource with outstanding stores.
+ */
+void
+RenderGraph::placeBarriers(const vector<int> & sorted)
+{
+    vector<bool> dirty(resources.size(), false);
+    vector<GLbitfield> issued(resources.size(), 0);
+
+    for (unsigned int s = 0; s < sorted.size(); s++) {
+        const Pass & pass = passes[sorted[s]];
+        ScheduledPass step;
+
+        step.pass = sorted[s];
+        step.target = DEFAULT_TARGET;
+        step.barriers = 0;
+        step.discardColor = step.discardDepth = false;
+        step.invalidateDepth = false;
+
+        for (unsigned int u = 0; u < pass.uses.size(); u++) {
+            int r = pass.uses[u].resource;
+            GLbitfield bit = barrierFor(pass.uses[u].access);
+
+            if (dirty[r] && !(issued[r] & bit))
+                step.barriers |= bit;
+        }
+
+        for (unsigned int r = 0; r < resources.size(); r++) {
+            if (dirty[r])
+                issued[r] |= step.barriers;
+        }
+
+        for (unsigned int u = 0; u < pass.uses.size(); u++) {
+            if (pass.uses[u].access == WRITE_IMAGE) {
+                dirty[pass.uses[u].resource] = true;
+                issued[pass.uses[u].resource] = 0;
+            }
+        }
+
+        int rt = renderTargetOf(pass);
+        if (rt >= 0) {
+            const Resource & res = resources[rt];
+            step.target = res.target;
+
+            if (!res.imported) {
+                // Nothing written yet this frame; don't load stale contents
+                if (res.firstUse == (int)s)
+                    step.discardColor = step.discardDepth = true;
+
+                // Depth lives in a renderbuffer and can't be sampled, so it
+                // is dead as soon as no later pass draws into the target
+                bool drawnAgain = false;
+                for (unsigned int t = s + 1; t < sorted.size(); t++) {
+                    if (renderTargetOf(passes[sorted[t]]) == rt)
+                        drawnAgain = true;
+                }
+
+                step.invalidateDepth = !drawnAgain && !res.output;
+            }
+        }
+
+        // Whichever pass uses a transient resource last ends its
+        // contents, be it the pass drawing it or one sampling it
+        for (unsigned int r = 0; r < resources.size(); r++) {
+            const Resource & res = resources[r];
+            if (!res.imported && !res.output && res.lastUse == (int)s)
+                step.retired.push_back(res.target);
+        }
+
+        schedule.push_back(step);
+    }
+}
+
+
+void
+RenderGraph::execute()
+{
+    if (!compiled && !compile()) {
+        printf("%s", logString.c_str());
+        return;
+    }
+
+    PassContext ctx(*this);
+    bool bound = false;
+
+    for (unsigned int s = 0; s < schedule.size(); s++) {
+        const ScheduledPass & step = schedule[s];
+        Pass & pass = passes[step.pass];
+        PROFILE_GPU_SCOPE(pass.scope);
+
+        if (step.barriers)
+            backend.memoryBarrier(step.barriers);
+
+        if (renderTargetOf(pass) >= 0) {
+            backend.bindTarget(step.target);
+            bound = step.target != DEFAULT_TARGET;
+
+            if (step.discardColor || step.discardDepth)
+                backend.invalidateTarget(step.target, step.discardColor, step.discardDepth);
+        }
+
+        if (pass.callback)
+            pass.callback(ctx);
+
+        // One call for the pass's own target when both die here.
+        // Invalidating binds, so the default framebuffer goes back on
+        // at the end.
+        bool depth = step.invalidateDepth;
+        for (unsigned int i = 0; i < step.retired.size(); i++) {
+            bool own = step.retired[i] == step.target;
+            backend.invalidateTarget(step.retired[i], true, depth && own);
+            depth = depth && !own;
+            bound = true;
+        }
+        if (depth)
+            backend.invalidateTarget(step.target, false, true);
+    }
+
+    // Leave the default framebuffer bound, as Fbo::disable() would
+    if (bound)
+        backend.bindTarget(DEFAULT_TARGET);
+}
+
+}
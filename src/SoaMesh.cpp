@@ -0,0 +1,523 @@
+/*
+ * SoaMesh.cpp
+ *
+ * The SSE and AVX loops do the same operations in the same order as the
+ * scalar ones (and these targets have no fused multiply-add), so all
+ * three give the same bits. They run over the padded length; the
+ * padding is fixed up after anything that writes.
+ */
+#include "SoaMesh.hpp"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include "glm/gtc/matrix_inverse.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define SOA_X86
+    #include <immintrin.h>
+#endif
+
+namespace mesh {
+
+SoaMesh::SoaMesh():
+    x(NULL), y(NULL), z(NULL),
+    nx(NULL), ny(NULL), nz(NULL),
+    u(NULL), v(NULL),
+    _count(0),
+    _padded(0)
+{
+}
+
+SoaMesh::SoaMesh(const TriMesh & m):
+    x(NULL), y(NULL), z(NULL),
+    nx(NULL), ny(NULL), nz(NULL),
+    u(NULL), v(NULL),
+    _count(0),
+    _padded(0)
+{
+    unsigned int count = m.vertices.size();
+    resize(count);
+    setNormals(m.normals.size() == count && count);
+    setUvs(m.uvs.size() == count && count);
+
+    for (unsigned int i = 0; i < count; i++) {
+        x[i] = m.vertices[i].x;
+        y[i] = m.vertices[i].y;
+        z[i] = m.vertices[i].z;
+    }
+    if (nx) {
+        for (unsigned int i = 0; i < count; i++) {
+            nx[i] = m.normals[i].x;
+            ny[i] = m.normals[i].y;
+            nz[i] = m.normals[i].z;
+        }
+    }
+    if (u) {
+        for (unsigned int i = 0; i < count; i++) {
+            u[i] = m.uvs[i].x;
+            v[i] = m.uvs[i].y;
+        }
+    }
+    repad();
+    bounds = m.bounds;
+}
+
+SoaMesh::SoaMesh(const SoaMesh & other):
+    x(NULL), y(NULL), z(NULL),
+    nx(NULL), ny(NULL), nz(NULL),
+    u(NULL), v(NULL),
+    _count(0),
+    _padded(0)
+{
+    *this = other;
+}
+
+SoaMesh &
+SoaMesh::operator=(const SoaMesh & other)
+{
+    if (this == &other)
+        return *this;
+
+    resize(other._count);
+    setNormals(other.hasNormals());
+    setUvs(other.hasUvs());
+
+    size_t bytes = _padded * sizeof(float);
+    float * const * from[8] = { &other.x, &other.y, &other.z, &other.nx, &other.ny, &other.nz, &other.u, &other.v };
+    float ** to[8] = { &x, &y, &z, &nx, &ny, &nz, &u, &v };
+    for (int i = 0; i < 8; i++)
+        if (*to[i])
+            memcpy(*to[i], *from[i], bytes);
+
+    bounds = other.bounds;
+    return *this;
+}
+
+SoaMesh::~SoaMesh()
+{
+    resize(0);
+}
+
+float *
+SoaMesh::allocate()
+{
+    if (!_padded)
+        return NULL;
+
+    void * p = NULL;
+    if (posix_memalign(&p, ALIGNMENT, _padded * sizeof(float))) {
+        printf("Error: out of memory for %u floats\n", _padded);
+        return NULL;
+    }
+    return (float *)p;
+}
+
+void
+SoaMesh::release(float * & array)
+{
+    free(array);
+    array = NULL;
+}
+
+void
+SoaMesh::resize(unsigned int count)
+{
+    release(x);
+    release(y);
+    release(z);
+    release(nx);
+    release(ny);
+    release(nz);
+    release(u);
+    release(v);
+
+    _count = count;
+    _padded = (count + PADDING - 1) / PADDING * PADDING;
+    x = allocate();
+    y = allocate();
+    z = allocate();
+    bounds = Aabb();
+}
+
+void
+SoaMesh::setNormals(bool present)
+{
+    if (present && !nx && _padded) {
+        nx = allocate();
+        ny = allocate();
+        nz = allocate();
+        memset(nx, 0, _padded * sizeof(float));
+        memset(ny, 0, _padded * sizeof(float));
+        memset(nz, 0, _padded * sizeof(float));
+    } else if (!present) {
+        release(nx);
+        release(ny);
+        release(nz);
+    }
+}
+
+void
+SoaMesh::setUvs(bool present)
+{
+    if (present && !u && _padded) {
+        u = allocate();
+        v = allocate();
+        memset(u, 0, _padded * sizeof(float));
+        memset(v, 0, _padded * sizeof(float));
+    } else if (!present) {
+        release(u);
+        release(v);
+    }
+}
+
+void
+SoaMesh::pad(float * array)
+{
+    if (array && _count)
+        std::fill(array + _count, array + _padded, array[_count - 1]);
+}
+
+void
+SoaMesh::repad()
+{
+    pad(x);
+    pad(y);
+    pad(z);
+    pad(nx);
+    pad(ny);
+    pad(nz);
+    pad(u);
+    pad(v);
+}
+
+TriMesh
+SoaMesh::toTriMesh() const
+{
+    TriMesh m;
+    m.vertices.resize(_count);
+    for (unsigned int i = 0; i < _count; i++)
+        m.vertices[i] = vec3(x[i], y[i], z[i]);
+
+    if (nx) {
+        m.normals.resize(_count);
+        for (unsigned int i = 0; i < _count; i++)
+            m.normals[i] = vec3(nx[i], ny[i], nz[i]);
+    }
+    if (u) {
+        m.uvs.resize(_count);
+        for (unsigned int i = 0; i < _count; i++)
+            m.uvs[i] = vec2(u[i], v[i]);
+    }
+    m.bounds = bounds;
+    return m;
+}
+
+void
+SoaMesh::interleave(float * out, unsigned int stride) const
+{
+    if (!stride)
+        stride = interleavedFloats();
+
+    for (unsigned int i = 0; i < _count; i++, out += stride) {
+        float * o = out;
+        *o++ = x[i];
+        *o++ = y[i];
+        *o++ = z[i];
+        if (nx) {
+            *o++ = nx[i];
+            *o++ = ny[i];
+            *o++ = nz[i];
+        }
+        if (u) {
+            *o++ = u[i];
+            *o++ = v[i];
+        }
+    }
+}
+
+/*
+ * Bounds
+ */
+static void
+boundsScalar(const float * const * p, unsigned int count, vec3 & lo, vec3 & hi)
+{
+    lo = hi = vec3(p[0][0], p[1][0], p[2][0]);
+    for (unsigned int i = 1; i < count; i++) {
+        lo.x = std::min(lo.x, p[0][i]);
+        hi.x = std::max(hi.x, p[0][i]);
+        lo.y = std::min(lo.y, p[1][i]);
+        hi.y = std::max(hi.y, p[1][i]);
+        lo.z = std::min(lo.z, p[2][i]);
+        hi.z = std::max(hi.z, p[2][i]);
+    }
+}
+
+#ifdef SOA_X86
+__attribute__((target("sse2"))) static void
+boundsSse(const float * const * p, unsigned int padded, vec3 & lo, vec3 & hi)
+{
+    for (int k = 0; k < 3; k++) {
+        __m128 mn = _mm_load_ps(p[k]), mx = mn;
+        for (unsigned int i = 4; i < padded; i += 4) {
+            __m128 a = _mm_load_ps(p[k] + i);
+            mn = _mm_min_ps(mn, a);
+            mx = _mm_max_ps(mx, a);
+        }
+        float lanes[8];
+        _mm_storeu_ps(lanes, mn);
+        _mm_storeu_ps(lanes + 4, mx);
+        lo[k] = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+        hi[k] = std::max(std::max(lanes[4], lanes[5]), std::max(lanes[6], lanes[7]));
+    }
+}
+
+__attribute__((target("avx"))) static void
+boundsAvx(const float * const * p, unsigned int padded, vec3 & lo, vec3 & hi)
+{
+    for (int k = 0; k < 3; k++) {
+        __m256 mn = _mm256_load_ps(p[k]), mx = mn;
+        for (unsigned int i = 8; i < padded; i += 8) {
+            __m256 a = _mm256_load_ps(p[k] + i);
+            mn = _mm256_min_ps(mn, a);
+            mx = _mm256_max_ps(mx, a);
+        }
+        float lanes[16];
+        _mm256_storeu_ps(lanes, mn);
+        _mm256_storeu_ps(lanes + 8, mx);
+        lo[k] = *std::min_element(lanes, lanes + 8);
+        hi[k] = *std::max_element(lanes + 8, lanes + 16);
+    }
+}
+#endif
+
+void
+SoaMesh::computeBounds(cull::Isa isa)
+{
+    bounds = Aabb();
+    if (!_count)
+        return;
+
+    const float * p[3] = { x, y, z };
+    vec3 lo, hi;
+    if (isa == cull::BEST)
+        isa = cull::getBestIsa();
+
+#ifdef SOA_X86
+    if (isa == cull::AVX)
+        boundsAvx(p, _padded, lo, hi);
+    else if (isa == cull::SSE)
+        boundsSse(p, _padded, lo, hi);
+    else
+#endif
+        boundsScalar(p, _count, lo, hi);
+
+    bounds = Aabb(lo, hi);
+}
+
+/*
+ * Normalize: p = (p - center) * scale
+ */
+static void
+offsetScaleScalar(float * p, unsigned int count, float offset, float scale)
+{
+    for (unsigned int i = 0; i < count; i++)
+        p[i] = (p[i] - offset) * scale;
+}
+
+#ifdef SOA_X86
+__attribute__((target("sse2"))) static void
+offsetScaleSse(float * p, unsigned int padded, float offset, float scale)
+{
+    __m128 o = _mm_set1_ps(offset), s = _mm_set1_ps(scale);
+    for (unsigned int i = 0; i < padded; i += 4)
+        _mm_store_ps(p + i, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(p + i), o), s));
+}
+
+__attribute__((target("avx"))) static void
+offsetScaleAvx(float * p, unsigned int padded, float offset, float scale)
+{
+    __m256 o = _mm256_set1_ps(offset), s = _mm256_set1_ps(scale);
+    for (unsigned int i = 0; i < padded; i += 8)
+        _mm256_store_ps(p + i, _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(p + i), o), s));
+}
+#endif
+
+void
+SoaMesh::normalize(float radius, cull::Isa isa)
+{
+    computeBounds(isa);
+    if (!_count)
+        return;
+
+    vec3 size = bounds.max - bounds.min;
+    float scale = radius / std::max(size.x, std::max(size.y, size.z));
+    vec3 center = bounds.center();
+    if (isa == cull::BEST)
+        isa = cull::getBestIsa();
+
+    float * p[3] = { x, y, z };
+    for (int k = 0; k < 3; k++) {
+#ifdef SOA_X86
+        if (isa == cull::AVX)
+            offsetScaleAvx(p[k], _padded, center[k], scale);
+        else if (isa == cull::SSE)
+            offsetScaleSse(p[k], _padded, center[k], scale);
+        else
+#endif
+            offsetScaleScalar(p[k], _count, center[k], scale);
+    }
+    // The SIMD loops already wrote the padding; the scalar one didn't
+    repad();
+
+    bounds = Aabb((bounds.min - center) * scale, (bounds.max - center) * scale);
+}
+
+/*
+ * Transform. m and n are the 3x4 and 3x3 matrices row by row, as
+ * m[row * 4 + column] and n[row * 3 + column].
+ */
+static void
+transformScalar(SoaMesh & mesh, unsigned int count, const float * m, const float * n)
+{
+    for (unsigned int i = 0; i < count; i++) {
+        float px = mesh.x[i], py = mesh.y[i], pz = mesh.z[i];
+        mesh.x[i] = ((m[0] * px + m[1] * py) + m[2] * pz) + m[3];
+        mesh.y[i] = ((m[4] * px + m[5] * py) + m[6] * pz) + m[7];
+        mesh.z[i] = ((m[8] * px + m[9] * py) + m[10] * pz) + m[11];
+    }
+    if (!mesh.hasNormals())
+        return;
+
+    for (unsigned int i = 0; i < count; i++) {
+        float qx = mesh.nx[i], qy = mesh.ny[i], qz = mesh.nz[i];
+        float a = (n[0] * qx + n[1] * qy) + n[2] * qz;
+        float b = (n[3] * qx + n[4] * qy) + n[5] * qz;
+        float c = (n[6] * qx + n[7] * qy) + n[8] * qz;
+        float length = sqrtf((a * a + b * b) + c * c);
+        if (length > 0.0f) {
+            a /= length;
+            b /= length;
+            c /= length;
+        }
+        mesh.nx[i] = a;
+        mesh.ny[i] = b;
+        mesh.nz[i] = c;
+    }
+}
+
+#ifdef SOA_X86
+__attribute__((target("sse2"))) static void
+transformSse(SoaMesh & mesh, unsigned int padded, const float * m, const float * n)
+{
+    __m128 r[12];
+    for (int k = 0; k < 12; k++)
+        r[k] = _mm_set1_ps(m[k]);
+    for (unsigned int i = 0; i < padded; i += 4) {
+        __m128 px = _mm_load_ps(mesh.x + i), py = _mm_load_ps(mesh.y + i), pz = _mm_load_ps(mesh.z + i);
+        for (int row = 0; row < 3; row++) {
+            __m128 out = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(r[row * 4], px), _mm_mul_ps(r[row * 4 + 1], py)),
+                                               _mm_mul_ps(r[row * 4 + 2], pz)), r[row * 4 + 3]);
+            _mm_store_ps((row == 0 ? mesh.x : row == 1 ? mesh.y : mesh.z) + i, out);
+        }
+    }
+    if (!mesh.hasNormals())
+        return;
+
+    __m128 q[9];
+    for (int k = 0; k < 9; k++)
+        q[k] = _mm_set1_ps(n[k]);
+    const __m128 zero = _mm_setzero_ps();
+    for (unsigned int i = 0; i < padded; i += 4) {
+        __m128 qx = _mm_load_ps(mesh.nx + i), qy = _mm_load_ps(mesh.ny + i), qz = _mm_load_ps(mesh.nz + i);
+        __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(q[0], qx), _mm_mul_ps(q[1], qy)), _mm_mul_ps(q[2], qz));
+        __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(q[3], qx), _mm_mul_ps(q[4], qy)), _mm_mul_ps(q[5], qz));
+        __m128 c = _mm_add_ps(_mm_add_ps(_mm_mul_ps(q[6], qx), _mm_mul_ps(q[7], qy)), _mm_mul_ps(q[8], qz));
+        __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(a, a), _mm_mul_ps(b, b)), _mm_mul_ps(c, c)));
+
+        // Divide only where length > 0; elsewhere keep a, b, c
+        __m128 positive = _mm_cmpgt_ps(length, zero);
+        __m128 divisor = _mm_or_ps(_mm_and_ps(positive, length), _mm_andnot_ps(positive, _mm_set1_ps(1.0f)));
+        _mm_store_ps(mesh.nx + i, _mm_div_ps(a, divisor));
+        _mm_store_ps(mesh.ny + i, _mm_div_ps(b, divisor));
+        _mm_store_ps(mesh.nz + i, _mm_div_ps(c, divisor));
+    }
+}
+
+__attribute__((target("avx"))) static void
+transformAvx(SoaMesh & mesh, unsigned int padded, const float * m, const float * n)
+{
+    __m256 r[12];
+    for (int k = 0; k < 12; k++)
+        r[k] = _mm256_set1_ps(m[k]);
+    for (unsigned int i = 0; i < padded; i += 8) {
+        __m256 px = _mm256_load_ps(mesh.x + i), py = _mm256_load_ps(mesh.y + i), pz = _mm256_load_ps(mesh.z + i);
+        for (int row = 0; row < 3; row++) {
+            __m256 out = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r[row * 4], px),
+                                                                   _mm256_mul_ps(r[row * 4 + 1], py)),
+                                                     _mm256_mul_ps(r[row * 4 + 2], pz)), r[row * 4 + 3]);
+            _mm256_store_ps((row == 0 ? mesh.x : row == 1 ? mesh.y : mesh.z) + i, out);
+        }
+    }
+    if (!mesh.hasNormals())
+        return;
+
+    __m256 q[9];
+    for (int k = 0; k < 9; k++)
+        q[k] = _mm256_set1_ps(n[k]);
+    const __m256 zero = _mm256_setzero_ps();
+    for (unsigned int i = 0; i < padded; i += 8) {
+        __m256 qx = _mm256_load_ps(mesh.nx + i), qy = _mm256_load_ps(mesh.ny + i), qz = _mm256_load_ps(mesh.nz + i);
+        __m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(q[0], qx), _mm256_mul_ps(q[1], qy)), _mm256_mul_ps(q[2], qz));
+        __m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(q[3], qx), _mm256_mul_ps(q[4], qy)), _mm256_mul_ps(q[5], qz));
+        __m256 c = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(q[6], qx), _mm256_mul_ps(q[7], qy)), _mm256_mul_ps(q[8], qz));
+        __m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a, a), _mm256_mul_ps(b, b)),
+                                                     _mm256_mul_ps(c, c)));
+
+        __m256 positive = _mm256_cmp_ps(length, zero, _CMP_GT_OQ);
+        __m256 divisor = _mm256_blendv_ps(_mm256_set1_ps(1.0f), length, positive);
+        _mm256_store_ps(mesh.nx + i, _mm256_div_ps(a, divisor));
+        _mm256_store_ps(mesh.ny + i, _mm256_div_ps(b, divisor));
+        _mm256_store_ps(mesh.nz + i, _mm256_div_ps(c, divisor));
+    }
+}
+#endif
+
+void
+SoaMesh::transform(const mat4 & matrix, cull::Isa isa)
+{
+    if (!_count)
+        return;
+
+    // glm is column major: matrix[column][row]
+    float m[12], n[9];
+    glm::mat3 normalMatrix = glm::inverseTranspose(glm::mat3(matrix));
+    for (int row = 0; row < 3; row++) {
+        for (int column = 0; column < 4; column++)
+            m[row * 4 + column] = matrix[column][row];
+        for (int column = 0; column < 3; column++)
+            n[row * 3 + column] = normalMatrix[column][row];
+    }
+
+    if (isa == cull::BEST)
+        isa = cull::getBestIsa();
+
+#ifdef SOA_X86
+    if (isa == cull::AVX)
+        transformAvx(*this, _padded, m, n);
+    else if (isa == cull::SSE)
+        transformSse(*this, _padded, m, n);
+    else
+#endif
+    {
+        transformScalar(*this, _count, m, n);
+        repad();
+    }
+
+    computeBounds(isa);
+}
+
+}
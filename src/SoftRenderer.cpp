@@ -0,0 +1,421 @@
+/*
+ * SoftRenderer.cpp
+ */
+#include "SoftRenderer.hpp"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "imageUtil.hpp"
+#include "ParallelFor.hpp"
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+namespace soft {
+
+/*
+ * Framebuffer
+ */
+Framebuffer::Framebuffer():
+    width(0),
+    height(0),
+    blocksX(0),
+    blocksY(0)
+{
+}
+
+
+void
+Framebuffer::create(int width, int height)
+{
+    this->width = width;
+    this->height = height;
+    blocksX = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    blocksY = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    color.resize(width * height * 4);
+    depth.resize(width * height);
+    blockMax.resize(blocksX * blocksY);
+    clear();
+}
+
+
+void
+Framebuffer::clear(const vec4 & clearColor, float clearDepth)
+{
+    uint8_t rgba[4];
+    for (int i = 0; i < 4; i++)
+        rgba[i] = (uint8_t)(glm::clamp(clearColor[i], 0.0f, 1.0f) * 255.0f + 0.5f);
+
+    for (int i = 0; i < width * height; i++)
+        memcpy(&color[i * 4], rgba, 4);
+
+    std::fill(depth.begin(), depth.end(), clearDepth);
+    std::fill(blockMax.begin(), blockMax.end(), clearDepth);
+}
+
+
+uint32_t
+Framebuffer::getPixel(int x, int y) const
+{
+    uint32_t pixel;
+    memcpy(&pixel, &color[(y * width + x) * 4], 4);
+    return pixel;
+}
+
+
+bool
+Framebuffer::save(const char * fileName) const
+{
+    static bool ilReady = false;
+    if (!ilReady) {
+        ilInit();
+        ilReady = true;
+    }
+
+    return util::image::saveImage(fileName, width, height, &color.front());
+}
+
+
+void
+Framebuffer::updateBlockDepth(int bx, int by)
+{
+    int x1 = std::min(width, (bx + 1) * BLOCK_SIZE);
+    int y1 = std::min(height, (by + 1) * BLOCK_SIZE);
+
+    float farthest = 0.0f;
+    for (int y = by * BLOCK_SIZE; y < y1; y++)
+        for (int x = bx * BLOCK_SIZE; x < x1; x++)
+            farthest = std::max(farthest, depth[y * width + x]);
+
+    blockMax[by * blocksX + bx] = farthest;
+}
+
+
+/*
+ * Renderer
+ */
+Renderer::Renderer(unsigned int threads):
+    threads(threads ? threads : std::max(1u, std::thread::hardware_concurrency())),
+    cullBack(false),
+    tilesX(0),
+    tilesY(0)
+{
+}
+
+
+void
+Renderer::draw(Framebuffer & target, const mesh::TriMesh & mesh, const Shader & shader)
+{
+    if (mesh.vertices.size() < 3 || target.width == 0)
+        return;
+
+    shadeVertices(mesh, shader);
+    setupTriangles(target.width, target.height, shader.getVaryingCount());
+
+    // Bin by tile, keeping submission order within every bin
+    tilesX = (target.width + TILE_SIZE - 1) / TILE_SIZE;
+    tilesY = (target.height + TILE_SIZE - 1) / TILE_SIZE;
+    bins.resize(tilesX * tilesY);
+    for (unsigned int i = 0; i < bins.size(); i++)
+        bins[i].clear();
+
+    for (unsigned int i = 0; i < triangles.size(); i++) {
+        const Triangle & tri = triangles[i];
+        for (int ty = tri.minY / TILE_SIZE; ty <= tri.maxY / TILE_SIZE; ty++)
+            for (int tx = tri.minX / TILE_SIZE; tx <= tri.maxX / TILE_SIZE; tx++)
+                bins[ty * tilesX + tx].push_back(i);
+    }
+
+    // Whole tiles per thread, so no two threads share a pixel
+    std::atomic<unsigned int> next(0);
+    auto worker = [&](unsigned int, unsigned int) {
+        unsigned int tile;
+        while ((tile = next++) < bins.size()) {
+            if (!bins[tile].empty())
+                rasterizeTile(target, tile, shader);
+        }
+    };
+    util::parallelFor(threads, threads, worker);
+}
+
+
+void
+Renderer::shadeVertices(const mesh::TriMesh & mesh, const Shader & shader)
+{
+    unsigned int count = mesh.vertices.size();
+    clipPos.resize(count);
+    vertexVaryings.resize(count * MAX_VARYINGS);
+
+    util::parallelFor(count, threads, [&](unsigned int begin, unsigned int end) {
+        for (unsigned int i = begin; i < end; i++)
+            clipPos[i] = shader.vertex(mesh, i, &vertexVaryings[i * MAX_VARYINGS]);
+    });
+}
+
+
+/*
+ * Clipping and triangle setup
+ */
+struct ClipVertex
+{
+    vec4    pos;
+    float   varyings[MAX_VARYINGS];
+};
+
+
+// Clip against the near plane (z >= -w). Everything else is left to
+// the bounding box clamp and the depth test.
+static int
+clipNear(const ClipVertex * in, ClipVertex * out, int varyingCount)
+{
+    int count = 0;
+    for (int i = 0; i < 3; i++) {
+        const ClipVertex & a = in[i];
+        const ClipVertex & b = in[(i + 1) % 3];
+        float da = a.pos.z + a.pos.w;
+        float db = b.pos.z + b.pos.w;
+
+        if (da >= 0.0f)
+            out[count++] = a;
+
+        if ((da >= 0.0f) != (db >= 0.0f)) {
+            float t = da / (da - db);
+            ClipVertex & v = out[count++];
+            v.pos = a.pos + (b.pos - a.pos) * t;
+            for (int k = 0; k < varyingCount; k++)
+                v.varyings[k] = a.varyings[k] + (b.varyings[k] - a.varyings[k]) * t;
+        }
+    }
+    return count;
+}
+
+
+static bool
+setupTriangle(const ClipVertex * v[3], int width, int height, int varyingCount,
+              bool cullBack, Renderer::Triangle & tri)
+{
+    float x[3], y[3], z[3], invW[3];
+    for (int i = 0; i < 3; i++) {
+        const vec4 & p = v[i]->pos;
+        invW[i] = 1.0f / p.w;
+        x[i] = (p.x * invW[i] * 0.5f + 0.5f) * width;
+        y[i] = (p.y * invW[i] * 0.5f + 0.5f) * height;
+        z[i] = p.z * invW[i] * 0.5f + 0.5f;
+    }
+
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (area == 0.0f || area != area || (cullBack && area < 0.0f))
+        return false;
+
+    // Clockwise triangles (back faces) are turned round
+    int order[3] = { 0, 1, 2 };
+    if (area < 0.0f) {
+        order[1] = 2;
+        order[2] = 1;
+        area = -area;
+    }
+
+    float sx[3], sy[3];
+    for (int i = 0; i < 3; i++) {
+        int o = order[i];
+        sx[i] = x[o];
+        sy[i] = y[o];
+        tri.z[i] = z[o];
+        tri.invW[i] = invW[o];
+        memcpy(tri.varyings[i], v[o]->varyings, varyingCount * sizeof(float));
+    }
+
+    for (int i = 0; i < 3; i++) {
+        int j = (i + 1) % 3, k = (i + 2) % 3;
+        float dx = sx[k] - sx[j], dy = sy[k] - sy[j];
+
+        tri.a[i] = -dy;
+        tri.b[i] = dx;
+        tri.c[i] = -(tri.a[i] * sx[j] + tri.b[i] * sy[j]);
+
+        // Counter-clockwise with y up: left edges run downwards, top
+        // edges run towards -x
+        tri.topLeft[i] = dy < 0.0f || (dy == 0.0f && dx < 0.0f);
+    }
+
+    tri.invArea = 1.0f / area;
+    tri.zmin = std::min(std::min(tri.z[0], tri.z[1]), tri.z[2]);
+
+    // Clamped as floats first; vertices near w = 0 land far off screen
+    tri.minX = (int)glm::clamp(floorf(std::min(std::min(sx[0], sx[1]), sx[2])), 0.0f, (float)width);
+    tri.minY = (int)glm::clamp(floorf(std::min(std::min(sy[0], sy[1]), sy[2])), 0.0f, (float)height);
+    tri.maxX = (int)glm::clamp(ceilf(std::max(std::max(sx[0], sx[1]), sx[2])), -1.0f, (float)width - 1);
+    tri.maxY = (int)glm::clamp(ceilf(std::max(std::max(sy[0], sy[1]), sy[2])), -1.0f, (float)height - 1);
+
+    return tri.minX <= tri.maxX && tri.minY <= tri.maxY;
+}
+
+
+void
+Renderer::setupTriangles(int width, int height, int varyingCount)
+{
+    unsigned int count = clipPos.size() / 3;
+    unsigned int chunks = std::min(threads, std::max(1u, count / 256));
+    unsigned int chunk = (count + chunks - 1) / chunks;
+    vector< vector<Triangle> > chunkTriangles(chunks);
+
+    util::parallelFor(count, chunks, [&](unsigned int begin, unsigned int end) {
+        vector<Triangle> & out = chunkTriangles[begin / chunk];
+        ClipVertex in[3], clipped[4];
+        Triangle tri;
+
+        for (unsigned int t = begin; t < end; t++) {
+            for (int i = 0; i < 3; i++) {
+                in[i].pos = clipPos[t * 3 + i];
+                memcpy(in[i].varyings, &vertexVaryings[(t * 3 + i) * MAX_VARYINGS],
+                       varyingCount * sizeof(float));
+            }
+
+            int n = clipNear(in, clipped, varyingCount);
+
+            // A clipped triangle is a quad at most; fan it out
+            for (int i = 1; i + 1 < n; i++) {
+                const ClipVertex * v[3] = { &clipped[0], &clipped[i], &clipped[i + 1] };
+                if (setupTriangle(v, width, height, varyingCount, cullBack, tri))
+                    out.push_back(tri);
+            }
+        }
+    });
+
+    triangles.clear();
+    for (unsigned int i = 0; i < chunks; i++)
+        triangles.insert(triangles.end(), chunkTriangles[i].begin(), chunkTriangles[i].end());
+}
+
+
+/*
+ * Rasterization
+ */
+
+// Coverage of the 4 pixels starting at (x, y) as a bit mask, and their
+// edge values. Both paths compute every value the same way.
+static inline int
+coverage4(const Renderer::Triangle & tri, int x, int y, float e[3][4])
+{
+    float py = y + 0.5f;
+
+#ifdef __SSE2__
+    __m128 px = _mm_add_ps(_mm_cvtepi32_ps(_mm_set_epi32(x + 3, x + 2, x + 1, x)), _mm_set1_ps(0.5f));
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+    for (int i = 0; i < 3; i++) {
+        __m128 edge = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.a[i]), px),
+                                 _mm_set1_ps(tri.b[i] * py + tri.c[i]));
+        __m128 in = _mm_cmpgt_ps(edge, _mm_setzero_ps());
+        if (tri.topLeft[i])
+            in = _mm_or_ps(in, _mm_cmpeq_ps(edge, _mm_setzero_ps()));
+
+        inside = _mm_and_ps(inside, in);
+        _mm_storeu_ps(e[i], edge);
+    }
+
+    return _mm_movemask_ps(inside);
+#else
+    int mask = 0xf;
+    for (int i = 0; i < 3; i++) {
+        float row = tri.b[i] * py + tri.c[i];
+        for (int k = 0; k < 4; k++) {
+            float edge = tri.a[i] * ((float)(x + k) + 0.5f) + row;
+            bool in = edge > 0.0f || (edge == 0.0f && tri.topLeft[i]);
+            if (!in)
+                mask &= ~(1 << k);
+            e[i][k] = edge;
+        }
+    }
+    return mask;
+#endif
+}
+
+
+void
+Renderer::rasterizeTile(Framebuffer & fb, int tile, const Shader & shader)
+{
+    int tileX = (tile % tilesX) * TILE_SIZE;
+    int tileY = (tile / tilesX) * TILE_SIZE;
+    int tileX1 = std::min(fb.width, tileX + TILE_SIZE) - 1;
+    int tileY1 = std::min(fb.height, tileY + TILE_SIZE) - 1;
+
+    int varyingCount = shader.getVaryingCount();
+    float varyings[MAX_VARYINGS];
+    float e[3][4];
+
+    const vector<unsigned int> & bin = bins[tile];
+    for (unsigned int t = 0; t < bin.size(); t++) {
+        const Triangle & tri = triangles[bin[t]];
+
+        int minX = std::max(tri.minX, tileX), maxX = std::min(tri.maxX, tileX1);
+        int minY = std::max(tri.minY, tileY), maxY = std::min(tri.maxY, tileY1);
+
+        for (int by = minY / BLOCK_SIZE; by <= maxY / BLOCK_SIZE; by++) {
+            for (int bx = minX / BLOCK_SIZE; bx <= maxX / BLOCK_SIZE; bx++) {
+
+                // Entirely behind what's already in this block
+                if (tri.zmin >= fb.blockMax[by * fb.blocksX + bx])
+                    continue;
+
+                int x0 = std::max(minX, bx * BLOCK_SIZE);
+                int x1 = std::min(maxX, bx * BLOCK_SIZE + BLOCK_SIZE - 1);
+                int y0 = std::max(minY, by * BLOCK_SIZE);
+                int y1 = std::min(maxY, by * BLOCK_SIZE + BLOCK_SIZE - 1);
+                bool written = false;
+
+                for (int y = y0; y <= y1; y++) {
+                    for (int x = x0; x <= x1; x += 4) {
+                        int mask = coverage4(tri, x, y, e);
+                        if (x1 - x < 3)
+                            mask &= (1 << (x1 - x + 1)) - 1;
+
+                        for (int k = 0; mask; k++, mask >>= 1) {
+                            if (!(mask & 1))
+                                continue;
+
+                            float l0 = e[0][k] * tri.invArea;
+                            float l1 = e[1][k] * tri.invArea;
+                            float l2 = e[2][k] * tri.invArea;
+
+                            int index = y * fb.width + x + k;
+                            float z = l0 * tri.z[0] + l1 * tri.z[1] + l2 * tri.z[2];
+                            if (!(z < fb.depth[index]))
+                                continue;
+
+                            // Perspective correct weights
+                            float p0 = l0 * tri.invW[0], p1 = l1 * tri.invW[1], p2 = l2 * tri.invW[2];
+                            float norm = 1.0f / (p0 + p1 + p2);
+                            p0 *= norm;
+                            p1 *= norm;
+                            p2 *= norm;
+
+                            for (int v = 0; v < varyingCount; v++)
+                                varyings[v] = p0 * tri.varyings[0][v] + p1 * tri.varyings[1][v] +
+                                              p2 * tri.varyings[2][v];
+
+                            vec4 color = glm::clamp(shader.fragment(varyings), 0.0f, 1.0f);
+                            uint8_t * out = &fb.color[index * 4];
+                            for (int c = 0; c < 4; c++)
+                                out[c] = (uint8_t)(color[c] * 255.0f + 0.5f);
+
+                            fb.depth[index] = z;
+                            written = true;
+                        }
+                    }
+                }
+
+                if (written)
+                    fb.updateBlockDepth(bx, by);
+            }
+        }
+    }
+}
+
+}
@@ -0,0 +1,181 @@
+/*
+ * SoftShaders.cpp
+ */
+#include "SoftShaders.hpp"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "imageUtil.hpp"
+
+namespace soft {
+
+/*
+ * Cubemap
+ */
+bool
+Cubemap::load(const string & filebase)
+{
+    static const char * suffixes[] = { "right", "left", "top", "bottom", "back", "front" };
+
+    ILuint imageID;
+    ilGenImages(1, &imageID);
+    ilBindImage(imageID);
+
+    for (int i = 0; i < 6; i++) {
+        string texName = filebase + "_" + suffixes[i] + ".png";
+
+        // No flip, like loadCubemap
+        if (!ilLoadImage(texName.c_str()) || !ilConvertImage(IL_RGB, IL_UNSIGNED_BYTE)) {
+            ILenum error = ilGetError();
+            printf("Cubemap face %s failed: %s\n", texName.c_str(), iluErrorString(error));
+            ilDeleteImages(1, &imageID);
+            return false;
+        }
+
+        size[i][0] = ilGetInteger(IL_IMAGE_WIDTH);
+        size[i][1] = ilGetInteger(IL_IMAGE_HEIGHT);
+        faces[i].assign(ilGetData(), ilGetData() + size[i][0] * size[i][1] * 3);
+    }
+
+    ilDeleteImages(1, &imageID);
+    return true;
+}
+
+
+vec4
+Cubemap::texel(int face, int x, int y) const
+{
+    x = glm::clamp(x, 0, size[face][0] - 1);
+    y = glm::clamp(y, 0, size[face][1] - 1);
+
+    const uint8_t * p = &faces[face][(y * size[face][0] + x) * 3];
+    return vec4(p[0], p[1], p[2], 255.0f) / 255.0f;
+}
+
+
+vec4
+Cubemap::sample(const vec3 & dir) const
+{
+    // Face selection and (s, t) from the GL spec's cube map table
+    vec3 a = glm::abs(dir);
+    int face;
+    float sc, tc, ma;
+
+    if (a.x >= a.y && a.x >= a.z) {
+        face = dir.x > 0.0f ? 0 : 1;
+        sc = dir.x > 0.0f ? -dir.z : dir.z;
+        tc = -dir.y;
+        ma = a.x;
+    } else if (a.y >= a.z) {
+        face = dir.y > 0.0f ? 2 : 3;
+        sc = dir.x;
+        tc = dir.y > 0.0f ? dir.z : -dir.z;
+        ma = a.y;
+    } else {
+        face = dir.z > 0.0f ? 4 : 5;
+        sc = dir.z > 0.0f ? dir.x : -dir.x;
+        tc = -dir.y;
+        ma = a.z;
+    }
+
+    if (ma == 0.0f || faces[face].empty())
+        return vec4(0.0f);
+
+    // Bilinear between texel centers
+    float u = ((sc / ma + 1.0f) * 0.5f) * size[face][0] - 0.5f;
+    float v = ((tc / ma + 1.0f) * 0.5f) * size[face][1] - 0.5f;
+    int x = (int)floorf(u), y = (int)floorf(v);
+    float fx = u - x, fy = v - y;
+
+    return glm::mix(glm::mix(texel(face, x, y), texel(face, x + 1, y), fx),
+                    glm::mix(texel(face, x, y + 1), texel(face, x + 1, y + 1), fx), fy);
+}
+
+
+/*
+ * basicshade
+ */
+vec4
+BasicShadeShader::vertex(const mesh::TriMesh & mesh, unsigned int i, float * varyings) const
+{
+    vec3 Normal = glm::normalize( NormalMatrix * mesh.normals[i] );
+    memcpy(varyings, &Normal[0], sizeof(Normal));
+
+    return MVP * vec4(mesh.vertices[i], 1.0f);
+}
+
+
+vec4
+BasicShadeShader::fragment(const float * varyings) const
+{
+    vec3 Normal(varyings[0], varyings[1], varyings[2]);
+
+    vec3 LightDir = vec3(1, 1, 1);
+    LightDir = glm::normalize( LightDir );
+
+    vec3 Color = vec3(1,1,1);
+    float Intensity = glm::dot(Normal, LightDir);
+    Color = Color * Intensity;
+    return vec4(glm::max(vec3(0.1f,0.1f,0.1f), Color), 1.0f);
+}
+
+
+/*
+ * env
+ */
+vec4
+EnvShader::vertex(const mesh::TriMesh & mesh, unsigned int i, float * varyings) const
+{
+    const vec3 & VertexPosition = mesh.vertices[i];
+    const vec3 & VertexNormal = mesh.normals[i];
+
+    vec3 worldPos = vec3( ModelMatrix * vec4(VertexPosition, 1.0f) );
+    vec3 worldNorm = vec3( ModelMatrix * vec4(VertexNormal, 1.0f) );
+    vec3 worldView = glm::normalize( WorldCameraPosition - worldPos );
+
+    vec3 Normal = glm::normalize( NormalMatrix * VertexNormal );
+
+    memcpy(varyings, &Normal[0], sizeof(vec3));
+    memcpy(varyings + 3, &worldView[0], sizeof(vec3));
+    memcpy(varyings + 6, &worldNorm[0], sizeof(vec3));
+
+    return MVP * vec4(VertexPosition, 1.0f);
+}
+
+
+vec4
+EnvShader::fragment(const float * varyings) const
+{
+    vec3 Normal(varyings[0], varyings[1], varyings[2]);
+    vec3 ViewDir(varyings[3], varyings[4], varyings[5]);
+    vec3 WorldNorm(varyings[6], varyings[7], varyings[8]);
+
+    float transparencyAmt = 0.0f;
+
+    float refractContrib = 0.0f;
+    float reflectContrib = 0.8f;
+    vec4 diffuse = vec4(1.0f);
+
+    vec3 ReflectDir = glm::reflect(-ViewDir, WorldNorm);
+    vec3 RefractDir = glm::refract(-ViewDir, WorldNorm, 1.2f);
+    float intensity = std::max(0.3f, glm::dot(Normal, vec3(1,1,1)));
+    vec4 color = diffuse * intensity;
+
+    vec4 reflectColor = Tex1 ? Tex1->sample(ReflectDir) : vec4(0.0f);
+    vec4 refractColor = Tex1 ? Tex1->sample(RefractDir) : vec4(0.0f);
+    vec4 transparentColor = Tex1 ? Tex1->sample(ViewDir) : vec4(0.0f);
+
+    if (glm::length(RefractDir) < 0.1f) {
+        reflectContrib = reflectContrib + refractContrib;
+        refractContrib = 0.0f;
+    }
+
+    vec4 rflColor = glm::mix(reflectColor, refractColor, refractContrib / (reflectContrib + refractContrib));
+
+    return glm::mix(glm::mix(rflColor * diffuse, color, 1 - (reflectContrib + refractContrib)),
+                    transparentColor, transparencyAmt);
+}
+
+}
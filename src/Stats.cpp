@@ -0,0 +1,131 @@
+/*
+ * Stats.cpp
+ */
+#include "Stats.hpp"
+
+#include <string.h>
+
+namespace stats {
+
+Frame current;
+
+static Frame lastFrame;
+static Frame totals;
+static unsigned int frameCount = 0;
+
+static const char * names[COUNTER_COUNT] = {
+    "draw_calls",
+    "vertices",
+    "program_binds",
+    "vertex_array_binds",
+    "buffer_binds",
+    "framebuffer_binds",
+    "texture_binds",
+    "uniform_updates",
+    "buffer_uploads",
+    "buffer_bytes",
+    "texture_uploads",
+    "texture_bytes",
+};
+
+
+Frame::Frame()
+{
+    memset(counts, 0, sizeof(counts));
+}
+
+
+unsigned long
+Frame::stateChanges() const
+{
+    return counts[PROGRAM_BINDS] + counts[VERTEX_ARRAY_BINDS] + counts[BUFFER_BINDS] +
+           counts[FRAMEBUFFER_BINDS] + counts[TEXTURE_BINDS];
+}
+
+
+void
+endFrame()
+{
+    for (int i = 0; i < COUNTER_COUNT; i++)
+        totals.counts[i] += current.counts[i];
+
+    lastFrame = current;
+    current = Frame();
+    frameCount++;
+}
+
+
+const Frame &
+getLastFrame()
+{
+    return lastFrame;
+}
+
+
+const Frame &
+getTotals()
+{
+    return totals;
+}
+
+
+unsigned int
+getFrameCount()
+{
+    return frameCount;
+}
+
+
+void
+reset()
+{
+    current = lastFrame = totals = Frame();
+    frameCount = 0;
+}
+
+
+const char *
+getName(Counter counter)
+{
+    return names[counter];
+}
+
+
+static string
+formatAmount(double value, const char * suffixes[])
+{
+    int i = 0;
+    while (value >= 1000.0 && suffixes[i + 1]) {
+        value /= 1000.0;
+        i++;
+    }
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), i ? "%.1f%s" : "%.0f%s", value, suffixes[i]);
+    return buf;
+}
+
+
+string
+format(const Frame & frame)
+{
+    static const char * units[] = { "", "k", "M", "G", NULL };
+    static const char * bytes[] = { " B", " kB", " MB", " GB", NULL };
+
+    char buf[256];
+    snprintf(buf, sizeof(buf), "draws %lu (%s verts) | state %lu | uniforms %lu | upload %s buf, %s tex",
+             frame[DRAW_CALLS], formatAmount(frame[VERTICES], units).c_str(),
+             frame.stateChanges(), frame[UNIFORM_UPDATES],
+             formatAmount(frame[BUFFER_BYTES], bytes).c_str(),
+             formatAmount(frame[TEXTURE_BYTES], bytes).c_str());
+    return buf;
+}
+
+
+void
+print(const Frame & frame, FILE * out)
+{
+    fprintf(out, "%s\n", format(frame).c_str());
+}
+
+}
@@ -0,0 +1,306 @@
+/*
+ * TextureArrays.cpp
+ *
+ * Arrays get immutable storage (glTexStorage3D) for their capacity and
+ * all mip levels; a bindless handle fixes a texture's storage and
+ * sampling state, but its contents can still change, so layers are
+ * uploaded into arrays that are already resident. Only growing one
+ * needs new storage, and so a new handle.
+ */
+#include "TextureArrays.hpp"
+
+#include <stdio.h>
+#include <algorithm>
+
+#include "Stats.hpp"
+#include "imageUtil.hpp"
+
+namespace render {
+
+const unsigned int TextureArrays::MAX_ARRAYS;
+
+
+/*
+ * Layer allocator
+ */
+LayerAllocator::LayerAllocator(unsigned int layersPerArray):
+    layersPerArray(std::min(std::max(layersPerArray, 1u), 0x10000u))
+{
+}
+
+
+TextureRef
+LayerAllocator::allocate(GLsizei width, GLsizei height, bool * created)
+{
+    if (created)
+        *created = false;
+
+    TextureRef ref = { 0, 0 };
+    for (unsigned int a = 0; a < arrays.size(); a++) {
+        Array & array = arrays[a];
+        if (array.width != width || array.height != height || array.live == layersPerArray)
+            continue;
+
+        // Lowest free layer, which is a freed one if there is any below
+        // the layers never used
+        unsigned int layer = 0;
+        while (array.used[layer])
+            layer++;
+        array.used[layer] = 1;
+        array.live++;
+        if (layer >= array.capacity)
+            array.capacity = std::min(array.capacity * 2, layersPerArray);
+        ref.array = a;
+        ref.layer = layer;
+        return ref;
+    }
+
+    Array array;
+    array.width = width;
+    array.height = height;
+    array.used.assign(layersPerArray, 0);
+    array.used[0] = 1;
+    array.live = 1;
+    array.capacity = 1;
+    arrays.push_back(array);
+    if (created)
+        *created = true;
+
+    ref.array = arrays.size() - 1;
+    return ref;
+}
+
+
+void
+LayerAllocator::free(TextureRef ref)
+{
+    if (ref.array >= arrays.size() || ref.layer >= layersPerArray || !arrays[ref.array].used[ref.layer])
+        return;
+    arrays[ref.array].used[ref.layer] = 0;
+    arrays[ref.array].live--;
+}
+
+
+unsigned int
+LayerAllocator::getUsedLayers(unsigned int array) const
+{
+    return arrays[array].live;
+}
+
+
+/*
+ * Texture arrays
+ */
+TextureArrays::TextureArrays(unsigned int layersPerArray, bool bindless):
+    allocator(layersPerArray),
+    bindless(bindless && GLEW_ARB_bindless_texture),
+    handleBuffer(0),
+    handlesChanged(false),
+    warned(false)
+{
+    GLint maxLayers = 256;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+    if ((GLint)layersPerArray > maxLayers)
+        allocator = LayerAllocator(maxLayers);
+
+    if (this->bindless) {
+        glGenBuffers(1, &handleBuffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, handleBuffer);
+        glBufferData(GL_UNIFORM_BUFFER, MAX_ARRAYS * 4 * sizeof(GLuint), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        STATS_COUNT(BUFFER_BINDS, 2);
+    }
+}
+
+
+TextureArrays::~TextureArrays()
+{
+    for (unsigned int i = 0; i < handles.size(); i++)
+        if (handles[i])
+            glMakeTextureHandleNonResidentARB(handles[i]);
+    if (!textures.empty())
+        glDeleteTextures(textures.size(), &textures[0]);
+    if (handleBuffer)
+        glDeleteBuffers(1, &handleBuffer);
+}
+
+
+GLuint
+TextureArrays::createArray(GLsizei width, GLsizei height, GLsizei layers)
+{
+    GLsizei levels = 1;
+    while ((std::max(width, height) >> levels) > 0)
+        levels++;
+
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGBA8, width, height, layers);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    STATS_COUNT(TEXTURE_BINDS, 1);
+    return texture;
+}
+
+
+/*
+ * Moves an array into storage for the allocator's capacity. Only level
+ * 0 is copied: the layer that made it grow is about to be uploaded, so
+ * update() rebuilds the mipmaps anyway.
+ */
+void
+TextureArrays::grow(unsigned int array)
+{
+    GLsizei width = allocator.getWidth(array), height = allocator.getHeight(array);
+    GLuint texture = createArray(width, height, allocator.getCapacity(array));
+
+    if (GLEW_VERSION_4_3 || GLEW_ARB_copy_image) {
+        glCopyImageSubData(textures[array], GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+                           texture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, width, height, layers[array]);
+    } else {
+        // Through memory; it only happens a few times per array
+        vector<GLubyte> pixels((size_t)width * height * 4 * layers[array]);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textures[array]);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, width, height, layers[array],
+                        GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+        STATS_COUNT(TEXTURE_BINDS, 2);
+        STATS_COUNT(TEXTURE_UPLOADS, 1);
+        STATS_COUNT(TEXTURE_BYTES, pixels.size());
+    }
+
+    // The old handle goes with the old storage; update() makes the new one
+    if (handles[array]) {
+        glMakeTextureHandleNonResidentARB(handles[array]);
+        handles[array] = 0;
+    }
+    glDeleteTextures(1, &textures[array]);
+    textures[array] = texture;
+    layers[array] = allocator.getCapacity(array);
+}
+
+
+TextureRef
+TextureArrays::add(GLsizei width, GLsizei height, const GLubyte * pixels)
+{
+    bool created;
+    TextureRef ref = allocator.allocate(width, height, &created);
+
+    if (created) {
+        textures.push_back(createArray(width, height, allocator.getCapacity(ref.array)));
+        layers.push_back(allocator.getCapacity(ref.array));
+        handles.push_back(0);
+        dirty.push_back(0);
+    } else if ((unsigned int)layers[ref.array] < allocator.getCapacity(ref.array)) {
+        grow(ref.array);
+    } else {
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textures[ref.array]);
+        STATS_COUNT(TEXTURE_BINDS, 1);
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, ref.layer, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    dirty[ref.array] = 1;
+
+    STATS_COUNT(TEXTURE_BINDS, 1);
+    STATS_COUNT(TEXTURE_UPLOADS, 1);
+    STATS_COUNT(TEXTURE_BYTES, width * height * 4);
+    return ref;
+}
+
+
+bool
+TextureArrays::load(const char * fileName, TextureRef * ref)
+{
+    GLsizei width, height;
+    vector<GLubyte> pixels;
+    if (!util::image::loadPixels(fileName, &width, &height, pixels))
+        return false;
+
+    *ref = add(width, height, &pixels[0]);
+    return true;
+}
+
+
+void
+TextureArrays::remove(TextureRef ref)
+{
+    allocator.free(ref);
+}
+
+
+void
+TextureArrays::update()
+{
+    for (unsigned int i = 0; i < textures.size(); i++) {
+        if (!dirty[i])
+            continue;
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textures[i]);
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        STATS_COUNT(TEXTURE_BINDS, 1);
+        dirty[i] = 0;
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    if (!bindless)
+        return;
+
+    for (unsigned int i = 0; i < textures.size() && i < MAX_ARRAYS; i++) {
+        if (handles[i])
+            continue;
+        handles[i] = glGetTextureHandleARB(textures[i]);
+        glMakeTextureHandleResidentARB(handles[i]);
+        handlesChanged = true;
+    }
+    if (textures.size() > MAX_ARRAYS && !warned) {
+        printf("TextureArrays: more than %u arrays, only the first %u can be sampled\n",
+               MAX_ARRAYS, MAX_ARRAYS);
+        warned = true;
+    }
+
+    if (handlesChanged) {
+        // std140 puts each array element 16 bytes apart: a uvec4 per
+        // handle, the handle in xy
+        unsigned int count = std::min((unsigned int)handles.size(), MAX_ARRAYS);
+        vector<GLuint> data(count * 4, 0);
+        for (unsigned int i = 0; i < count; i++) {
+            data[i * 4] = (GLuint)handles[i];
+            data[i * 4 + 1] = (GLuint)(handles[i] >> 32);
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, handleBuffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, data.size() * sizeof(GLuint), &data[0]);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        STATS_COUNT(BUFFER_BINDS, 2);
+        STATS_COUNT(BUFFER_UPLOADS, 1);
+        STATS_COUNT(BUFFER_BYTES, data.size() * sizeof(GLuint));
+        handlesChanged = false;
+    }
+}
+
+
+unsigned int
+TextureArrays::bindArrays(GLuint binding, GLuint firstUnit, GLuint maxUnits)
+{
+    if (bindless) {
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, handleBuffer);
+        STATS_COUNT(BUFFER_BINDS, 1);
+        return std::min((unsigned int)textures.size(), MAX_ARRAYS);
+    }
+
+    unsigned int count = std::min((unsigned int)textures.size(), (unsigned int)maxUnits);
+    for (unsigned int i = 0; i < count; i++) {
+        glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textures[i]);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    STATS_COUNT(TEXTURE_BINDS, count);
+    return count;
+}
+
+}
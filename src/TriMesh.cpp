@@ -1,4 +1,10 @@
 #include "TriMesh.hpp"
+#include "Stats.hpp"
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <unordered_map>
 
 #define VERT2_INDEX(tri,vert) tri*2+vert
 #define VERT3_INDEX(tri,vert) tri*3+vert
@@ -14,41 +20,31 @@ enum {
 
 namespace mesh {
 
+    void
+    TriMesh::computeBounds()
+    {
+        bounds = Aabb();
+        for (unsigned int i = 0; i < this->vertices.size(); i++)
+            bounds.add(this->vertices[i]);
+    }
+
+    void
+    TriMesh::remapUvs(vec2 const & min, vec2 const & max, unsigned int first, unsigned int count)
+    {
+        unsigned int end = count ? std::min(first + count, (unsigned int)uvs.size()) : uvs.size();
+        vec2 scale = max - min;
+        for (unsigned int i = first; i < end; i++)
+            uvs[i] = min + glm::clamp(uvs[i], vec2(0.0f), vec2(1.0f)) * scale;
+    }
+
     void
     TriMesh::normalize(float radius)
     {
-        float min_x, min_y, min_z;
-        float max_x, max_y, max_z;
-        vec3 cur = this->vertices[0];
-
-        min_x = cur.x;
-        min_y = cur.y;
-        min_z = cur.z;
-        max_x = cur.x;
-        max_y = cur.y;
-        max_z = cur.z;
-
-        for (unsigned int i = 1; i < this->vertices.size(); i++)
-        {
-            cur = this->vertices[i];
-            if (cur.x < min_x)
-                min_x = cur.x;
-            if (cur.y < min_y)
-                min_y = cur.y;
-            if (cur.z < min_z)
-                min_z = cur.z;
-
-            if (cur.x > max_x)
-                max_x = cur.x;
-            if (cur.y > max_y)
-                max_y = cur.y;
-            if (cur.z > max_z)
-                max_z = cur.z;
-        }
+        vec3 cur;
+
+        computeBounds();
 
-        vec3 size((max_x - min_x),
-                  (max_y - min_y),
-                  (max_z - min_z));
+        vec3 size = bounds.max - bounds.min;
 
         float size_max;
         // Find out the biggest
@@ -66,11 +62,7 @@ namespace mesh {
             }
         }
 
-        vec3 min(min_x, min_y, min_z);
-        vec3 max(max_x, max_y, max_z);
-
-        vec3 center = (max + min);
-        center *= 0.5;
+        vec3 center = bounds.center();
 
         float scale = radius / size_max;
 
@@ -86,6 +78,77 @@ namespace mesh {
             this->vertices[i] = cur;
 
         }
+
+        bounds = Aabb((bounds.min - center) * scale, (bounds.max - center) * scale);
+    }
+
+    // Exact bit patterns of a corner's attributes
+    struct CornerKey
+    {
+        float data[8];
+
+        bool operator==(CornerKey const & o) const { return !memcmp(data, o.data, sizeof(data)); }
+    };
+
+    struct CornerHash
+    {
+        size_t operator()(CornerKey const & key) const
+        {
+            uint32_t bits[8];
+            memcpy(bits, key.data, sizeof(bits));
+
+            size_t h = 2166136261u;
+            for (int i = 0; i < 8; i++)
+                h = (h ^ bits[i]) * 16777619u;
+            return h;
+        }
+    };
+
+    IndexedMesh::IndexedMesh(TriMesh const & m)
+    {
+        bool hasNormals = m.normals.size() == m.vertices.size();
+        bool hasUvs = m.uvs.size() == m.vertices.size();
+
+        std::unordered_map<CornerKey, unsigned int, CornerHash> corners;
+        indices.reserve(m.vertices.size());
+
+        for (unsigned int i = 0; i < m.vertices.size(); i++) {
+            CornerKey key;
+            memset(key.data, 0, sizeof(key.data));
+            memcpy(key.data, &m.vertices[i], sizeof(vec3));
+            if (hasNormals)
+                memcpy(key.data + 3, &m.normals[i], sizeof(vec3));
+            if (hasUvs)
+                memcpy(key.data + 6, &m.uvs[i], sizeof(vec2));
+
+            std::pair<std::unordered_map<CornerKey, unsigned int, CornerHash>::iterator, bool> found =
+                corners.insert(std::make_pair(key, (unsigned int)vertices.size()));
+            if (found.second) {
+                vertices.push_back(m.vertices[i]);
+                if (hasNormals)
+                    normals.push_back(m.normals[i]);
+                if (hasUvs)
+                    uvs.push_back(m.uvs[i]);
+            }
+            indices.push_back(found.first->second);
+        }
+
+        bounds = m.bounds;
+    }
+
+    TriMesh
+    IndexedMesh::expand() const
+    {
+        TriMesh m;
+        for (unsigned int i = 0; i < indices.size(); i++) {
+            m.vertices.push_back(vertices[indices[i]]);
+            if (!normals.empty())
+                m.normals.push_back(normals[indices[i]]);
+            if (!uvs.empty())
+                m.uvs.push_back(uvs[indices[i]]);
+        }
+        m.computeBounds();
+        return m;
     }
 
     CompressedTriMesh::CompressedTriMesh(TriMesh const & m, GLint renderType):
@@ -141,6 +204,12 @@ namespace mesh {
 
         glDrawArrays(_renderType, 0, _count);
 
+        // Client-side arrays are copied over on every draw
+        STATS_COUNT(DRAW_CALLS, 1);
+        STATS_COUNT(VERTICES, _count);
+        STATS_COUNT(BUFFER_UPLOADS, 3);
+        STATS_COUNT(BUFFER_BYTES, _count * 8 * sizeof(float));
+
     }
 
 }
@@ -0,0 +1,892 @@
+/*
+ * VirtualTexture.cpp
+ *
+ * The tile file is written through a MAP_SHARED mapping, so each level
+ * can be filtered from the tiles of the one below as soon as they are
+ * in it, without a second copy of anything.
+ *
+ * The page table is refreshed from the changed tile down: an entry is
+ * its own tile if that is resident and its parent's entry otherwise,
+ * so going coarse to fine every parent is already right. A change at
+ * level l touches at most 4^l entries, and usually far fewer.
+ */
+#include "VirtualTexture.hpp"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <utility>
+
+#include "Stats.hpp"
+
+namespace vt {
+
+static const unsigned long long TILE_ALIGN = 4096;
+
+/*
+ * Layout
+ */
+Layout::Layout(GLsizei width, GLsizei height, GLsizei tileSize, GLsizei border):
+    width(width),
+    height(height),
+    tileSize(tileSize),
+    border(border),
+    levels(1)
+{
+    while (std::max(levelWidth(levels - 1), levelHeight(levels - 1)) > tileSize)
+        levels++;
+}
+
+
+TileId
+Layout::parent(const TileId & tile) const
+{
+    // Halving a level rounds down, so the last column or row of tiles
+    // can end up past the edge of the level above
+    TileId up = { tile.level + 1, std::min(tile.x / 2, tilesX(tile.level + 1) - 1),
+                  std::min(tile.y / 2, tilesY(tile.level + 1) - 1) };
+    return up;
+}
+
+
+/*
+ * Tile file
+ */
+static const char TILE_MAGIC[8] = { 'V', 'T', 'I', 'L', 'E', 'S', '0', '1' };
+
+// Then unsigned int firstTile[levels], the index of each level's first
+// tile, and the tiles from tilesOffset, tileBytes apart, level by level
+// and row by row
+struct TileHeader
+{
+    char magic[8];
+    unsigned int width, height, tileSize, border, levels, tiles;
+    unsigned long long tilesOffset, tileBytes, size;
+};
+
+static unsigned long long
+alignUp(unsigned long long value, unsigned long long multiple)
+{
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+static GLsizei
+clamp(GLsizei value, GLsizei low, GLsizei high)
+{
+    return std::min(std::max(value, low), high);
+}
+
+
+bool
+writeTileFile(const string & fileName, GLsizei width, GLsizei height, const Source & source,
+              GLsizei tileSize, GLsizei border, jobs::JobSystem * jobs)
+{
+    if (width <= 0 || height <= 0 || tileSize <= 0 || border < 0) {
+        printf("writeTileFile: bad size %dx%d, tiles of %d, border %d\n", width, height, tileSize, border);
+        return false;
+    }
+    Layout layout(width, height, tileSize, border);
+    if (layout.tilesX(0) > 4096 || layout.tilesY(0) > 4096 || layout.levels > 255) {
+        printf("writeTileFile: %dx%d needs more than 4096 tiles of %d a side\n", width, height, tileSize);
+        return false;
+    }
+
+    vector<unsigned int> firstTile(layout.levels);
+    unsigned int tiles = 0;
+    for (unsigned int level = 0; level < layout.levels; level++) {
+        firstTile[level] = tiles;
+        tiles += layout.tilesX(level) * layout.tilesY(level);
+    }
+
+    GLsizei padded = layout.paddedSize();
+    TileHeader header;
+    memcpy(header.magic, TILE_MAGIC, sizeof(header.magic));
+    header.width = width;
+    header.height = height;
+    header.tileSize = tileSize;
+    header.border = border;
+    header.levels = layout.levels;
+    header.tiles = tiles;
+    header.tilesOffset = alignUp(sizeof(TileHeader) + layout.levels * sizeof(unsigned int), TILE_ALIGN);
+    header.tileBytes = alignUp((unsigned long long)padded * padded * 4, TILE_ALIGN);
+    header.size = header.tilesOffset + header.tileBytes * tiles;
+
+    int fd = ::open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("Error: can't create %s\n", fileName.c_str());
+        return false;
+    }
+    if (ftruncate(fd, header.size)) {
+        printf("Error: can't size %s to %llu bytes\n", fileName.c_str(), header.size);
+        ::close(fd);
+        return false;
+    }
+    char * data = (char *)mmap(NULL, header.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        printf("Error: can't map %s\n", fileName.c_str());
+        return false;
+    }
+    memcpy(data, &header, sizeof(header));
+    memcpy(data + sizeof(header), &firstTile[0], firstTile.size() * sizeof(unsigned int));
+
+    GLubyte * tileData = (GLubyte *)(data + header.tilesOffset);
+    unsigned long long tileBytes = header.tileBytes;
+    auto texel = [&](unsigned int level, GLsizei x, GLsizei y) -> const GLubyte * {
+        unsigned int tile = firstTile[level] + (y / tileSize) * layout.tilesX(level) + x / tileSize;
+        return tileData + tile * tileBytes + ((size_t)(y % tileSize + border) * padded + x % tileSize + border) * 4;
+    };
+
+    for (unsigned int level = 0; level < layout.levels; level++) {
+        unsigned int across = layout.tilesX(level);
+        unsigned int count = across * layout.tilesY(level);
+        GLsizei lw = layout.levelWidth(level), lh = layout.levelHeight(level);
+        GLsizei below = level ? layout.levelWidth(level - 1) - 1 : 0;
+        GLsizei belowY = level ? layout.levelHeight(level - 1) - 1 : 0;
+
+        jobs::parallelFor(jobs, count, 0, [&](unsigned int begin, unsigned int end) {
+            vector<GLubyte> texels;
+            for (unsigned int i = begin; i < end; i++) {
+                GLubyte * out = tileData + (firstTile[level] + i) * tileBytes;
+                GLsizei x0 = (i % across) * tileSize - border, y0 = (i / across) * tileSize - border;
+
+                // Texels past the edge of the level repeat the edge
+                if (level == 0) {
+                    GLsizei sx0 = clamp(x0, 0, lw - 1), sx1 = clamp(x0 + padded - 1, 0, lw - 1);
+                    GLsizei sy0 = clamp(y0, 0, lh - 1), sy1 = clamp(y0 + padded - 1, 0, lh - 1);
+                    GLsizei sw = sx1 - sx0 + 1;
+                    texels.resize((size_t)sw * (sy1 - sy0 + 1) * 4);
+                    source(sx0, sy0, sw, sy1 - sy0 + 1, &texels[0]);
+                    for (GLsizei y = 0; y < padded; y++) {
+                        const GLubyte * row = &texels[(size_t)(clamp(y0 + y, sy0, sy1) - sy0) * sw * 4];
+                        for (GLsizei x = 0; x < padded; x++)
+                            memcpy(out + ((size_t)y * padded + x) * 4, row + (clamp(x0 + x, sx0, sx1) - sx0) * 4, 4);
+                    }
+                    continue;
+                }
+
+                // The 2x2 texels under each one, from the level below
+                for (GLsizei y = 0; y < padded; y++) {
+                    GLsizei ly = clamp(y0 + y, 0, lh - 1);
+                    GLsizei ya = std::min(ly * 2, belowY), yb = std::min(ly * 2 + 1, belowY);
+                    for (GLsizei x = 0; x < padded; x++) {
+                        GLsizei lx = clamp(x0 + x, 0, lw - 1);
+                        GLsizei xa = std::min(lx * 2, below), xb = std::min(lx * 2 + 1, below);
+                        const GLubyte * a = texel(level - 1, xa, ya), * b = texel(level - 1, xb, ya);
+                        const GLubyte * c = texel(level - 1, xa, yb), * d = texel(level - 1, xb, yb);
+                        GLubyte * o = out + ((size_t)y * padded + x) * 4;
+                        for (int k = 0; k < 4; k++)
+                            o[k] = (a[k] + b[k] + c[k] + d[k] + 2) >> 2;
+                    }
+                }
+            }
+        });
+    }
+
+    munmap(data, header.size);
+    return true;
+}
+
+
+TileFile::TileFile():
+    _data(NULL), _size(0), _firstTile(NULL)
+{
+}
+
+
+TileFile::~TileFile()
+{
+    close();
+}
+
+
+bool
+TileFile::open(const string & fileName)
+{
+    close();
+
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    off_t size = lseek(fd, 0, SEEK_END);
+    void * data = size >= (off_t)sizeof(TileHeader) ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        printf("Error: can't map %s\n", fileName.c_str());
+        return false;
+    }
+    _data = (char *)data;
+    _size = size;
+
+    const TileHeader * header = (const TileHeader *)_data;
+    bool ok = !memcmp(header->magic, TILE_MAGIC, sizeof(header->magic)) && header->size == (unsigned long long)size &&
+              header->width > 0 && header->height > 0 && header->tileSize > 0 && header->levels < 256 &&
+              header->tilesOffset >= sizeof(TileHeader) + header->levels * sizeof(unsigned int);
+    if (ok) {
+        layout = Layout(header->width, header->height, header->tileSize, header->border);
+        _firstTile = (const unsigned int *)(_data + sizeof(TileHeader));
+        unsigned long long padded = layout.paddedSize();
+        unsigned int tiles = 0;
+        ok = layout.levels == header->levels && header->tileBytes >= padded * padded * 4;
+        for (unsigned int level = 0; ok && level < layout.levels; level++) {
+            ok = _firstTile[level] == tiles;
+            tiles += layout.tilesX(level) * layout.tilesY(level);
+        }
+        ok = ok && tiles == header->tiles && header->tilesOffset + header->tileBytes * tiles == header->size;
+    }
+    if (!ok) {
+        printf("Error: %s isn't a tile file, or is from another version\n", fileName.c_str());
+        close();
+        return false;
+    }
+    return true;
+}
+
+
+void
+TileFile::close()
+{
+    if (_data)
+        munmap(_data, _size);
+    _data = NULL;
+    _size = 0;
+    _firstTile = NULL;
+    layout = Layout();
+}
+
+
+const GLubyte *
+TileFile::getTile(const TileId & tile) const
+{
+    const TileHeader * header = (const TileHeader *)_data;
+    unsigned int index = _firstTile[tile.level] + tile.y * layout.tilesX(tile.level) + tile.x;
+    return (const GLubyte *)(_data + header->tilesOffset + index * header->tileBytes);
+}
+
+
+size_t
+TileFile::getTileBytes() const
+{
+    return (size_t)layout.paddedSize() * layout.paddedSize() * 4;
+}
+
+
+/*
+ * Tile cache
+ */
+TileCache::TileCache(unsigned int count):
+    slots(std::max(count, 1u)),
+    head(-1),
+    tail(-1)
+{
+    for (int i = slots.size() - 1; i >= 0; i--) {
+        Slot & slot = slots[i];
+        slot.key = NO_TILE;
+        slot.frame = 0;
+        slot.prev = slot.next = -1;
+        slot.pinned = false;
+        free.push_back(i);
+    }
+}
+
+
+int
+TileCache::find(unsigned int key) const
+{
+    std::unordered_map<unsigned int, int>::const_iterator it = byKey.find(key);
+    return it == byKey.end() ? -1 : it->second;
+}
+
+
+void
+TileCache::unlink(int slot)
+{
+    Slot & s = slots[slot];
+    if (s.prev >= 0)
+        slots[s.prev].next = s.next;
+    else
+        head = s.next;
+    if (s.next >= 0)
+        slots[s.next].prev = s.prev;
+    else
+        tail = s.prev;
+    s.prev = s.next = -1;
+}
+
+
+void
+TileCache::pushFront(int slot)
+{
+    Slot & s = slots[slot];
+    s.prev = -1;
+    s.next = head;
+    if (head >= 0)
+        slots[head].prev = slot;
+    head = slot;
+    if (tail < 0)
+        tail = slot;
+}
+
+
+void
+TileCache::touch(int slot, unsigned int frame)
+{
+    slots[slot].frame = frame;
+    if (slots[slot].pinned || head == slot)
+        return;
+    unlink(slot);
+    pushFront(slot);
+}
+
+
+int
+TileCache::insert(unsigned int key, unsigned int frame, unsigned int * evicted, bool pinned)
+{
+    *evicted = NO_TILE;
+
+    int slot;
+    if (!free.empty()) {
+        slot = free.back();
+        free.pop_back();
+    } else {
+        // Touching moves a slot to the front, so if the last one was used
+        // this frame they all were
+        if (tail < 0 || slots[tail].frame == frame)
+            return -1;
+        slot = tail;
+        unlink(slot);
+        *evicted = slots[slot].key;
+        byKey.erase(*evicted);
+    }
+
+    slots[slot].key = key;
+    slots[slot].frame = frame;
+    slots[slot].pinned = pinned;
+    byKey[key] = slot;
+    if (!pinned)
+        pushFront(slot);
+    return slot;
+}
+
+
+void
+TileCache::remove(unsigned int key)
+{
+    int slot = find(key);
+    if (slot < 0)
+        return;
+    if (!slots[slot].pinned)
+        unlink(slot);
+    slots[slot].key = NO_TILE;
+    slots[slot].pinned = false;
+    byKey.erase(key);
+    free.push_back(slot);
+}
+
+
+/*
+ * Page table
+ */
+PageTable::PageTable(const Layout & layout):
+    layout(layout),
+    resident(layout.levels),
+    mappings(layout.levels),
+    dirty(layout.levels)
+{
+    Mapping none = { -1, layout.levels - 1 };
+    for (unsigned int level = 0; level < layout.levels; level++) {
+        unsigned int count = layout.tilesX(level) * layout.tilesY(level);
+        resident[level].assign(count, -1);
+        mappings[level].assign(count, none);
+        Rect all = { 0, 0, layout.tilesX(level), layout.tilesY(level) };
+        dirty[level] = all;
+    }
+}
+
+
+void
+PageTable::map(const TileId & tile, int slot)
+{
+    resident[tile.level][tile.y * layout.tilesX(tile.level) + tile.x] = slot;
+    refresh(tile);
+}
+
+
+void
+PageTable::unmap(const TileId & tile)
+{
+    resident[tile.level][tile.y * layout.tilesX(tile.level) + tile.x] = -1;
+    refresh(tile);
+}
+
+
+void
+PageTable::refresh(const TileId & tile)
+{
+    unsigned int x0 = tile.x, x1 = tile.x + 1, y0 = tile.y, y1 = tile.y + 1;
+    for (int level = tile.level; level >= 0; level--) {
+        if (level < (int)tile.level) {
+            // The children, and in the last column or row, the ones
+            // past the edge of this level that lead back to it
+            unsigned int across = layout.tilesX(level), down = layout.tilesY(level);
+            x1 = x1 == layout.tilesX(level + 1) ? across : std::min(x1 * 2, across);
+            y1 = y1 == layout.tilesY(level + 1) ? down : std::min(y1 * 2, down);
+            x0 = std::min(x0 * 2, x1);
+            y0 = std::min(y0 * 2, y1);
+        }
+
+        unsigned int across = layout.tilesX(level);
+        bool top = level == (int)layout.levels - 1;
+        for (unsigned int y = y0; y < y1; y++)
+            for (unsigned int x = x0; x < x1; x++) {
+                unsigned int i = y * across + x;
+                if (resident[level][i] >= 0) {
+                    Mapping own = { resident[level][i], (unsigned int)level };
+                    mappings[level][i] = own;
+                } else if (top) {
+                    Mapping none = { -1, (unsigned int)level };
+                    mappings[level][i] = none;
+                } else {
+                    TileId here = { (unsigned int)level, x, y };
+                    mappings[level][i] = lookup(layout.parent(here));
+                }
+            }
+
+        Rect & d = dirty[level];
+        if (d.x0 >= d.x1 || d.y0 >= d.y1) {
+            Rect changed = { x0, y0, x1, y1 };
+            d = changed;
+        } else {
+            d.x0 = std::min(d.x0, x0);
+            d.y0 = std::min(d.y0, y0);
+            d.x1 = std::max(d.x1, x1);
+            d.y1 = std::max(d.y1, y1);
+        }
+    }
+}
+
+
+bool
+PageTable::getDirty(unsigned int level, unsigned int * x0, unsigned int * y0, unsigned int * x1, unsigned int * y1) const
+{
+    const Rect & d = dirty[level];
+    if (d.x0 >= d.x1 || d.y0 >= d.y1)
+        return false;
+    *x0 = d.x0;
+    *y0 = d.y0;
+    *x1 = d.x1;
+    *y1 = d.y1;
+    return true;
+}
+
+
+void
+PageTable::clearDirty()
+{
+    Rect none = { 0, 0, 0, 0 };
+    for (unsigned int level = 0; level < dirty.size(); level++)
+        dirty[level] = none;
+}
+
+
+/*
+ * Feedback
+ */
+void
+encodeFeedback(const TileId & tile, GLubyte * out)
+{
+    out[0] = tile.x & 0xff;
+    out[1] = tile.y & 0xff;
+    out[2] = ((tile.x >> 8) & 0xf) | ((tile.y >> 8) & 0xf) << 4;
+    out[3] = tile.level;
+}
+
+
+bool
+decodeFeedback(const GLubyte * in, unsigned int levels, TileId * tile)
+{
+    if (in[3] >= levels)
+        return false;
+    tile->level = in[3];
+    tile->x = in[0] | (in[2] & 0xf) << 8;
+    tile->y = in[1] | (in[2] >> 4) << 8;
+    return true;
+}
+
+
+/*
+ * Streamer
+ */
+Streamer::Streamer(const TileFile & file, unsigned int slots, jobs::JobSystem * jobs, unsigned int maxLoads):
+    file(file),
+    cache(std::max(slots, 2u)),
+    pageTable(file.getLayout()),
+    jobs(jobs && jobs->getThreadCount() > 1 ? jobs : NULL),
+    maxLoads(std::max(maxLoads, 1u)),
+    frame(0)
+{
+    memset(&stats, 0, sizeof(stats));
+
+    // The coarsest level, which everything else falls back to
+    TileId top = { file.getLayout().levels - 1, 0, 0 };
+    load(top.packed());
+}
+
+
+Streamer::~Streamer()
+{
+    if (jobs)
+        jobs->wait(loading);
+}
+
+
+void
+Streamer::beginFrame()
+{
+    frame++;
+}
+
+
+void
+Streamer::load(unsigned int key)
+{
+    pending.insert(key);
+    stats.loads++;
+
+    // Reading the mapping is what waits for the disk
+    auto copy = [this, key]() {
+        Upload upload;
+        upload.tile = TileId::unpack(key);
+        upload.slot = -1;
+        const GLubyte * texels = file.getTile(upload.tile);
+        upload.pixels.assign(texels, texels + file.getTileBytes());
+
+        std::lock_guard<std::mutex> hold(loadedLock);
+        loaded.push_back(std::move(upload));
+    };
+
+    if (jobs)
+        jobs->run(copy, &loading);
+    else
+        copy();
+}
+
+
+void
+Streamer::request(const GLubyte * feedback, unsigned int pixels)
+{
+    const Layout & layout = file.getLayout();
+
+    // Neighbouring pixels mostly want the same tile, so runs are
+    // counted before they are hashed
+    std::unordered_map<unsigned int, unsigned int> seen;
+    unsigned int run = NO_TILE, runLength = 0;
+    for (unsigned int i = 0; i < pixels; i++) {
+        TileId tile;
+        if (!decodeFeedback(feedback + i * 4, layout.levels, &tile) ||
+            tile.x >= layout.tilesX(tile.level) || tile.y >= layout.tilesY(tile.level))
+            continue;
+        unsigned int key = tile.packed();
+        if (key != run) {
+            if (runLength)
+                seen[run] += runLength;
+            run = key;
+            runLength = 0;
+        }
+        runLength++;
+    }
+    if (runLength)
+        seen[run] += runLength;
+
+    // What stands in for a missing tile is used as much as a tile
+    vector<std::pair<unsigned int, unsigned int> > missing;
+    for (std::unordered_map<unsigned int, unsigned int>::const_iterator it = seen.begin(); it != seen.end(); ++it) {
+        TileId tile = TileId::unpack(it->first);
+        const PageTable::Mapping & mapping = pageTable.lookup(tile);
+        stats.requested++;
+        if (mapping.slot >= 0)
+            cache.touch(mapping.slot, frame);
+        if (pageTable.isResident(tile))
+            stats.resident++;
+        else if (!pending.count(it->first))
+            missing.push_back(*it);
+    }
+
+    std::sort(missing.begin(), missing.end(),
+              [](const std::pair<unsigned int, unsigned int> & a, const std::pair<unsigned int, unsigned int> & b) {
+        if (a.first >> 24 != b.first >> 24)
+            return a.first >> 24 > b.first >> 24;
+        if (a.second != b.second)
+            return a.second > b.second;
+        return a.first < b.first;
+    });
+
+    // With the view needing more tiles than there are slots, loading
+    // more would only have them dropped
+    if (!cache.hasRoom(frame))
+        return;
+    for (unsigned int i = 0; i < missing.size() && pending.size() < maxLoads; i++)
+        load(missing[i].first);
+}
+
+
+void
+Streamer::update(unsigned int maxUploads, vector<Upload> & uploads)
+{
+    uploads.clear();
+    {
+        std::lock_guard<std::mutex> hold(loadedLock);
+        unsigned int count = std::min((unsigned int)loaded.size(), maxUploads);
+        for (unsigned int i = 0; i < count; i++)
+            uploads.push_back(std::move(loaded[i]));
+        loaded.erase(loaded.begin(), loaded.begin() + count);
+    }
+
+    unsigned int top = file.getLayout().levels - 1;
+    unsigned int kept = 0;
+    for (unsigned int i = 0; i < uploads.size(); i++) {
+        Upload & upload = uploads[i];
+        unsigned int key = upload.tile.packed(), evicted;
+        pending.erase(key);
+
+        // Asked for again by the feedback if it's still wanted
+        upload.slot = cache.insert(key, frame, &evicted, upload.tile.level == top);
+        if (upload.slot < 0) {
+            stats.dropped++;
+            continue;
+        }
+        if (evicted != NO_TILE) {
+            pageTable.unmap(TileId::unpack(evicted));
+            stats.evictions++;
+        }
+        pageTable.map(upload.tile, upload.slot);
+        stats.uploads++;
+        if (kept != i)
+            uploads[kept] = std::move(upload);
+        kept++;
+    }
+    uploads.resize(kept);
+}
+
+
+/*
+ * Virtual texture
+ */
+VirtualTexture::VirtualTexture():
+    streamer(NULL),
+    physical(0),
+    indirection(0),
+    slotsPerRow(0),
+    feedbackWidth(0),
+    feedbackHeight(0),
+    readbackFrame(0)
+{
+    readback[0] = readback[1] = 0;
+}
+
+
+VirtualTexture::~VirtualTexture()
+{
+    destroy();
+}
+
+
+void
+VirtualTexture::destroy()
+{
+    delete streamer;
+    streamer = NULL;
+    if (physical)
+        glDeleteTextures(1, &physical);
+    if (indirection)
+        glDeleteTextures(1, &indirection);
+    if (readback[0])
+        glDeleteBuffers(2, readback);
+    physical = indirection = 0;
+    readback[0] = readback[1] = 0;
+    readbackFrame = 0;
+    feedback.reset();
+    file.close();
+}
+
+
+bool
+VirtualTexture::create(const string & fileName, unsigned int slots, GLsizei feedbackWidth, GLsizei feedbackHeight,
+                       jobs::JobSystem * jobs)
+{
+    destroy();
+    if (!file.open(fileName))
+        return false;
+    const Layout & layout = file.getLayout();
+    GLsizei padded = layout.paddedSize();
+
+    // As square as it goes; the indirection texture has a byte for each
+    // of the slot's column and row
+    GLint maxSize = 4096;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    unsigned int most = std::min((unsigned int)(maxSize / padded), 256u);
+    slotsPerRow = std::min((unsigned int)ceil(sqrt((double)std::max(slots, 2u))), most);
+    unsigned int rows = std::min((std::max(slots, 2u) + slotsPerRow - 1) / slotsPerRow, most);
+    slots = std::min(std::max(slots, 2u), slotsPerRow * rows);
+
+    glGenTextures(1, &physical);
+    glBindTexture(GL_TEXTURE_2D, physical);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, slotsPerRow * padded, rows * padded);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // A layer per level, each using its tilesX x tilesY corner: halving
+    // rounds tile counts up, so they don't make a mip chain
+    glGenTextures(1, &indirection);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, indirection);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA8, layout.tilesX(0), layout.tilesY(0), layout.levels);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    STATS_COUNT(TEXTURE_BINDS, 4);
+    STATS_COUNT(TEXTURE_BYTES, (slotsPerRow * padded) * (rows * padded) * 4 +
+                               layout.tilesX(0) * layout.tilesY(0) * layout.levels * 4);
+
+    this->feedbackWidth = feedbackWidth;
+    this->feedbackHeight = feedbackHeight;
+    if (!feedback.create(feedbackWidth, feedbackHeight, 1)) {
+        printf("VirtualTexture: can't make a %dx%d feedback buffer\n", feedbackWidth, feedbackHeight);
+        destroy();
+        return false;
+    }
+    glGenBuffers(2, readback);
+    for (int i = 0; i < 2; i++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, feedbackWidth * feedbackHeight * 4, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    STATS_COUNT(BUFFER_BINDS, 3);
+
+    streamer = new Streamer(file, slots, jobs);
+    return true;
+}
+
+
+void
+VirtualTexture::beginFeedback()
+{
+    GLfloat clear[4];
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, clear);
+    feedback.enable();
+
+    // Level 255: no tile
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glClearColor(clear[0], clear[1], clear[2], clear[3]);
+}
+
+
+void
+VirtualTexture::endFeedback()
+{
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback[readbackFrame % 2]);
+    glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    feedback.disable();
+
+    streamer->beginFrame();
+    if (readbackFrame > 0) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback[(readbackFrame + 1) % 2]);
+        const GLubyte * pixels = (const GLubyte *)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+        if (pixels) {
+            streamer->request(pixels, feedbackWidth * feedbackHeight);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        STATS_COUNT(BUFFER_BINDS, 1);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    STATS_COUNT(BUFFER_BINDS, 2);
+    readbackFrame++;
+}
+
+
+void
+VirtualTexture::update(unsigned int maxUploads)
+{
+    const Layout & layout = file.getLayout();
+    GLsizei padded = layout.paddedSize();
+
+    streamer->update(maxUploads, uploads);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (!uploads.empty()) {
+        glBindTexture(GL_TEXTURE_2D, physical);
+        for (unsigned int i = 0; i < uploads.size(); i++) {
+            int slot = uploads[i].slot;
+            glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % slotsPerRow) * padded, (slot / slotsPerRow) * padded,
+                            padded, padded, GL_RGBA, GL_UNSIGNED_BYTE, &uploads[i].pixels[0]);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        STATS_COUNT(TEXTURE_BINDS, 2);
+        STATS_COUNT(TEXTURE_UPLOADS, uploads.size());
+        STATS_COUNT(TEXTURE_BYTES, uploads.size() * padded * padded * 4);
+    }
+
+    // Column, row and level of the slot to sample; alpha 0 for none
+    PageTable & table = streamer->getPageTable();
+    bool bound = false;
+    for (unsigned int level = 0; level < layout.levels; level++) {
+        unsigned int x0, y0, x1, y1;
+        if (!table.getDirty(level, &x0, &y0, &x1, &y1))
+            continue;
+        entries.resize((x1 - x0) * (y1 - y0) * 4);
+        GLubyte * out = &entries[0];
+        for (unsigned int y = y0; y < y1; y++)
+            for (unsigned int x = x0; x < x1; x++, out += 4) {
+                TileId tile = { level, x, y };
+                const PageTable::Mapping & mapping = table.lookup(tile);
+                bool valid = mapping.slot >= 0;
+                out[0] = valid ? mapping.slot % slotsPerRow : 0;
+                out[1] = valid ? mapping.slot / slotsPerRow : 0;
+                out[2] = mapping.level;
+                out[3] = valid ? 255 : 0;
+            }
+
+        if (!bound)
+            glBindTexture(GL_TEXTURE_2D_ARRAY, indirection);
+        bound = true;
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, x0, y0, level, x1 - x0, y1 - y0, 1, GL_RGBA, GL_UNSIGNED_BYTE,
+                        &entries[0]);
+        STATS_COUNT(TEXTURE_UPLOADS, 1);
+        STATS_COUNT(TEXTURE_BYTES, entries.size());
+    }
+    if (bound) {
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        STATS_COUNT(TEXTURE_BINDS, 2);
+    }
+    table.clearDirty();
+}
+
+
+void
+VirtualTexture::setUniforms(shader::GLSLProgram & program, GLuint physicalUnit, GLuint indirectionUnit,
+                            GLsizei screenWidth)
+{
+    const Layout & layout = file.getLayout();
+
+    glActiveTexture(GL_TEXTURE0 + physicalUnit);
+    glBindTexture(GL_TEXTURE_2D, physical);
+    glActiveTexture(GL_TEXTURE0 + indirectionUnit);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, indirection);
+    glActiveTexture(GL_TEXTURE0);
+    STATS_COUNT(TEXTURE_BINDS, 2);
+
+    program.setUniform("VtPhysical", (int)physicalUnit);
+    program.setUniform("VtIndirection", (int)indirectionUnit);
+    program.setUniform("VtSize", (float)layout.width, (float)layout.height, (float)layout.levels);
+    program.setUniform("VtTile", (float)layout.tileSize, (float)layout.border, (float)layout.paddedSize());
+
+    // Derivatives in the smaller feedback buffer are bigger by this
+    program.setUniform("VtFeedbackBias", log2f((float)screenWidth / std::max(feedbackWidth, 1)));
+}
+
+}
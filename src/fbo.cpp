@@ -11,10 +11,17 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#include "Profiler.hpp"
+#include "Stats.hpp"
+
+GLuint Fbo::default_handle = 0;
+
 /*
  * FBO Helper constructor
  */
-Fbo::Fbo()
+Fbo::Fbo():
+	name(NULL),
+	timed(false)
 {
 	reset();
 }
@@ -58,11 +65,13 @@ bool Fbo::create( GLuint width, GLuint height, GLuint count )
 
 	glDrawBuffers( texture_count, bufs);
 
+	// Check for errors while our FBO is still the one bound
+	GLenum status = glCheckFramebufferStatus( GL_FRAMEBUFFER );
+
 	// Unbind current FBO
-	glBindFramebufferEXT( GL_FRAMEBUFFER, 0 );
+	glBindFramebuffer( GL_FRAMEBUFFER, default_handle );
+	STATS_COUNT(FRAMEBUFFER_BINDS, 2);
 
-	// Check for errors
-	GLenum status = glCheckFramebufferStatusEXT( GL_FRAMEBUFFER );
 	if( status != GL_FRAMEBUFFER_COMPLETE )
 	{
 		reset();
@@ -110,7 +119,8 @@ bool Fbo::initializeFBO(bool useDepthBuffer )
 	}*/
 
 	// reset current bound buffer
-	glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+	glBindFramebuffer( GL_FRAMEBUFFER, default_handle );
+	STATS_COUNT(FRAMEBUFFER_BINDS, 2);
 	return true;
 }
 
@@ -129,6 +139,11 @@ bool Fbo::generateTexture( GLuint width, GLuint height, GLuint *handle)
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
 				 GL_UNSIGNED_BYTE, NULL);
 
+	// Nothing is copied, but the driver still allocates the storage
+	STATS_COUNT(TEXTURE_BINDS, 1);
+	STATS_COUNT(TEXTURE_UPLOADS, 1);
+	STATS_COUNT(TEXTURE_BYTES, width * height * 4);
+
 	// Set some basic parameters for texture filtering
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -152,10 +167,19 @@ bool Fbo::enable()
 	{
 		// Bind our current framebuffer
 		glBindFramebuffer( GL_FRAMEBUFFER, fbo_handle );
+		STATS_COUNT(FRAMEBUFFER_BINDS, 1);
 
 		// Assign the viewport to the correct size
 		glViewport( 0, 0, width, height );
 
+		// Everything until disable() is timed as one pass, if it has a name
+		timed = name != NULL;
+		if( timed )
+		{
+			profile::beginCpu(name);
+			profile::beginGpu(name);
+		}
+
 		// Finally mark as enabled
 		enabled = true;
 	}
@@ -175,8 +199,16 @@ bool Fbo::disable()
 
 	    //glGenerateMipmap(GL_TEXTURE_2D);
 		// Reset to the original state (no frame buffer)
-		glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+		glBindFramebuffer( GL_FRAMEBUFFER, default_handle );
+		STATS_COUNT(FRAMEBUFFER_BINDS, 1);
 		enabled = false;
+
+		if( timed )
+		{
+			profile::endGpu();
+			profile::endCpu();
+			timed = false;
+		}
 	}
 
 	// Return current (expectedly false) status
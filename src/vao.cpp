@@ -8,8 +8,15 @@
 
 #include <stdio.h>
 #include "vao.hpp"
-
-Vao::Vao()
+#include "Profiler.hpp"
+#include "Stats.hpp"
+
+Vao::Vao():
+	target(0),
+	shader_prog(0),
+	vbo_handle(0),
+	ibo_handle(0),
+	vao_handle(0)
 {
 
 }
@@ -17,7 +24,13 @@ Vao::Vao()
 
 Vao::~Vao()
 {
-
+	// Release our buffers (only if create() was ever called)
+	if (vbo_handle)
+		glDeleteBuffers(1, &vbo_handle);
+	if (ibo_handle)
+		glDeleteBuffers(1, &ibo_handle);
+	if (vao_handle)
+		glDeleteVertexArrays(1, &vao_handle);
 }
 
 
@@ -49,11 +62,35 @@ Vao::create(GLuint target,
 	// Reset
 	glBindBuffer(target, 0);
 
+	STATS_COUNT(BUFFER_BINDS, 2);
+	STATS_COUNT(BUFFER_UPLOADS, 1);
+	STATS_COUNT(BUFFER_BYTES, size);
+
 	// Now we're done.  The user needs to run bindAttribute to add
 	// attributes to our buffer.
 }
 
 
+void
+Vao::createIndices(GLuint count, const GLuint *indices, GLuint usageType)
+{
+	if (!ibo_handle)
+		glGenBuffers(1, &ibo_handle);
+
+	// The element buffer binding is part of the vertex array's state, so
+	// leave it bound there rather than resetting it
+	glBindVertexArray(vao_handle);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_handle);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, count * sizeof(GLuint), indices, usageType);
+	glBindVertexArray(0);
+
+	STATS_COUNT(VERTEX_ARRAY_BINDS, 2);
+	STATS_COUNT(BUFFER_BINDS, 1);
+	STATS_COUNT(BUFFER_UPLOADS, 1);
+	STATS_COUNT(BUFFER_BYTES, count * sizeof(GLuint));
+}
+
+
 void
 Vao::bindAttribute(const char * name,
 				   GLuint size,
@@ -80,12 +117,17 @@ Vao::bindAttribute(const char * name,
 	glBindBuffer(target, 0);
 	glBindVertexArray(0);
 
+	STATS_COUNT(PROGRAM_BINDS, 1);
+	STATS_COUNT(VERTEX_ARRAY_BINDS, 2);
+	STATS_COUNT(BUFFER_BINDS, 2);
 }
 
 
 void
 Vao::draw(GLuint mode, GLuint first, GLuint count)
 {
+	PROFILE_DRAW_SCOPE("Vao::draw");
+
 	// Begin using the given shader
 	glUseProgram(shader_prog);
 
@@ -98,4 +140,51 @@ Vao::draw(GLuint mode, GLuint first, GLuint count)
 	// Reset
 	glBindVertexArray(0);
 	glUseProgram(0);
+
+	STATS_COUNT(PROGRAM_BINDS, 2);
+	STATS_COUNT(VERTEX_ARRAY_BINDS, 2);
+	STATS_COUNT(DRAW_CALLS, 1);
+	STATS_COUNT(VERTICES, count);
+}
+
+
+void
+Vao::drawInstanced(GLuint mode, GLuint first, GLuint count, GLuint instances)
+{
+	PROFILE_DRAW_SCOPE("Vao::drawInstanced");
+
+	glUseProgram(shader_prog);
+	glBindVertexArray(vao_handle);
+
+	// Same as draw(), but the shader gets gl_InstanceID 0..instances-1
+	glDrawArraysInstanced(mode, first, count, instances);
+
+	glBindVertexArray(0);
+	glUseProgram(0);
+
+	STATS_COUNT(PROGRAM_BINDS, 2);
+	STATS_COUNT(VERTEX_ARRAY_BINDS, 2);
+	STATS_COUNT(DRAW_CALLS, 1);
+	STATS_COUNT(VERTICES, (unsigned long)count * instances);
+}
+
+
+void
+Vao::drawElements(GLuint mode, GLuint first, GLuint count)
+{
+	PROFILE_DRAW_SCOPE("Vao::drawElements");
+
+	glUseProgram(shader_prog);
+	glBindVertexArray(vao_handle);
+
+	// first is in indices; GL wants a byte offset into the element buffer
+	glDrawElements(mode, count, GL_UNSIGNED_INT, (GLvoid *)(first * sizeof(GLuint)));
+
+	glBindVertexArray(0);
+	glUseProgram(0);
+
+	STATS_COUNT(PROGRAM_BINDS, 2);
+	STATS_COUNT(VERTEX_ARRAY_BINDS, 2);
+	STATS_COUNT(DRAW_CALLS, 1);
+	STATS_COUNT(VERTICES, count);
 }
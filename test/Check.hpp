@@ -0,0 +1,37 @@
+/*
+ * Check.hpp
+ *
+ * Failure counting for the test programs. Each one is a single source
+ * file, so the count is a static here; a test reports through expect()
+ * or CHECK() and ends with
+ *
+ *     exit( failures ? EXIT_FAILURE : EXIT_SUCCESS );
+ */
+
+#ifndef CHECK_HPP_
+#define CHECK_HPP_
+
+#include <stdio.h>
+
+static int failures = 0;
+
+// Prints what went wrong if ok is false
+static inline void
+expect(bool ok, const char * what)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+// Same, with the condition and line as the message
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("FAILED: %s (line %d)\n", #cond, __LINE__); \
+            failures++; \
+        } \
+    } while (0)
+
+#endif /* CHECK_HPP_ */
@@ -0,0 +1,157 @@
+//========================================================================
+// Batch loading with and without an arena. Loads the bundled models and
+// a generated --size x --size grid, --rounds times over, first with
+// plain loadObj() and then with one mem::Arena reset between loads.
+// Prints the time and minor page faults for each and, separately, the
+// time spent in the loader's allocations alone, replayed without any
+// parsing. Exits non-zero if the two ways load different meshes. Needs
+// no window or GPU.
+//
+//   arenabench [--size N] [--rounds N]
+//========================================================================
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "Arena.hpp"
+#include "Loader.hpp"
+#include "Profiler.hpp"
+
+using glm::vec2;
+using glm::vec3;
+using std::string;
+using std::vector;
+
+static const char * GRID_PATH = "arenabench.obj";
+
+static long
+minorFaults()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt;
+}
+
+static bool
+sameMesh(const mesh::TriMesh & a, const mesh::TriMesh & b)
+{
+    return a.vertices == b.vertices && a.normals == b.normals && a.uvs == b.uvs &&
+           a.submeshes.size() == b.submeshes.size();
+}
+
+// The allocations a load of this many positions and corners makes,
+// without the parsing: growing vectors, or arena blocks
+static double
+replayAllocations(const mesh::TriMesh & m, mem::Arena * arena, int rounds)
+{
+    unsigned int corners = m.vertices.size(), positions = corners / 6 + 1;
+    double start = profile::now();
+    for (int r = 0; r < rounds; r++) {
+        if (arena) {
+            arena->reset();
+            mem::ArenaArray<vec3> vertices(*arena), cornerVertices(*arena), cornerNormals(*arena);
+            mem::ArenaArray<vec2> cornerUvs(*arena);
+            for (unsigned int i = 0; i < positions; i++)
+                vertices.push_back(vec3(i));
+            for (unsigned int i = 0; i < corners; i++) {
+                cornerVertices.push_back(vec3(i));
+                cornerUvs.push_back(vec2(i));
+                cornerNormals.push_back(vec3(i));
+            }
+        } else {
+            vector<vec3> vertices, cornerVertices, cornerNormals;
+            vector<vec2> cornerUvs;
+            for (unsigned int i = 0; i < positions; i++)
+                vertices.push_back(vec3(i));
+            for (unsigned int i = 0; i < corners; i++) {
+                cornerVertices.push_back(vec3(i));
+                cornerUvs.push_back(vec2(i));
+                cornerNormals.push_back(vec3(i));
+            }
+        }
+    }
+    return profile::now() - start;
+}
+
+int main( int argc, char* argv[] )
+{
+    int size = 300;
+    int rounds = 5;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--size") && i + 1 < argc)
+            size = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--rounds") && i + 1 < argc)
+            rounds = atoi(argv[++i]);
+    }
+
+    FILE * f = fopen(GRID_PATH, "w");
+    for (int y = 0; y <= size; y++)
+        for (int x = 0; x <= size; x++)
+            fprintf(f, "v %f %f %f\nvt %f %f\nvn 0 1 0\n", x / (float)size,
+                    0.05f * sinf(x * 0.1f) * cosf(y * 0.07f), y / (float)size, x / (float)size, y / (float)size);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            int a = y * (size + 1) + x + 1, b = a + 1, c = a + size + 2, d = a + size + 1;
+            fprintf(f, "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, b, b, b, c, c, c, d, d, d);
+        }
+    }
+    fclose(f);
+
+    const char * files[] = { "models/bunny2.obj", "models/armadillo_lowres.obj", "models/sphere.obj", GRID_PATH };
+    const int fileCount = 4;
+
+    vector<mesh::TriMesh> reference(fileCount);
+    for (int i = 0; i < fileCount; i++)
+        reference[i] = mesh::loadObj(files[i]);
+
+    int failures = 0;
+
+    // Plain
+    long faults = minorFaults();
+    double start = profile::now();
+    for (int r = 0; r < rounds; r++)
+        for (int i = 0; i < fileCount; i++)
+            mesh::loadObj(files[i]);
+    double plainTime = profile::now() - start;
+    long plainFaults = minorFaults() - faults;
+
+    // One arena, reset between loads
+    mem::Arena arena;
+    faults = minorFaults();
+    start = profile::now();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < fileCount; i++) {
+            arena.reset();
+            mesh::TriMesh m = mesh::loadObj(files[i], &arena);
+            if (r == 0 && !sameMesh(m, reference[i])) {
+                printf("MISMATCH: %s loads differently with an arena\n", files[i]);
+                failures++;
+            }
+        }
+    }
+    double arenaTime = profile::now() - start;
+    long arenaFaults = minorFaults() - faults;
+
+    int loads = rounds * fileCount;
+    printf("%d loads, grid of %u triangles\n", loads, (unsigned int)reference[3].vertices.size() / 3);
+    printf("vectors  %8.1f ms  %8ld minor faults\n", plainTime * 1e3, plainFaults);
+    printf("arena    %8.1f ms  %8ld minor faults  (%.1f MB in %u chunks)\n", arenaTime * 1e3, arenaFaults,
+           arena.reserved() / 1048576.0, arena.chunks());
+
+    // The allocations alone, for the grid
+    double vectorAllocs = replayAllocations(reference[3], NULL, rounds);
+    double arenaAllocs = replayAllocations(reference[3], &arena, rounds);
+    printf("grid temporaries alone, %d rounds: vectors %.1f ms, arena %.1f ms\n", rounds,
+           vectorAllocs * 1e3, arenaAllocs * 1e3);
+
+    remove(GRID_PATH);
+    exit( failures ? EXIT_FAILURE : EXIT_SUCCESS );
+}
@@ -0,0 +1,285 @@
+//========================================================================
+// Packs thousands of small images into atlas pages, once on one thread
+// and once on --threads, and reports the pages, how full they are and
+// how long each took. With image files as arguments it packs those
+// instead (through DevIL), and --out saves the atlas for AtlasFile: the
+// offline half of the tool.
+//
+// Exits non-zero if two cells overlap or leave their page, a cell isn't
+// aligned, a gutter texel differs from the image edge next to it, a
+// texel is copied wrong, the thread count changes the layout, a file
+// doesn't read back the same, or remapMesh() puts a uv in the wrong
+// place.
+//
+//   atlasbench [--images N] [--threads N] [--padding N] [--alignment N]
+//              [--page N] [--out FILE] [image files...]
+//========================================================================
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "Atlas.hpp"
+#include "Jobs.hpp"
+#include "Profiler.hpp"
+#include "imageUtil.hpp"
+
+#include "Check.hpp"
+
+using std::string;
+using std::vector;
+
+// A texel no other image or texel has, within reason
+static void
+texel(unsigned int image, int x, int y, GLubyte * out)
+{
+    out[0] = image & 0xff;
+    out[1] = (image >> 8) & 0xff;
+    out[2] = x * 4 + (y & 3);
+    out[3] = y * 4 + (x & 3);
+}
+
+static bool
+sameLayout(const atlas::Atlas & a, const atlas::Atlas & b)
+{
+    if (a.getPageCount() != b.getPageCount() || a.getRegionCount() != b.getRegionCount())
+        return false;
+    for (unsigned int i = 0; i < a.getRegionCount(); i++)
+        if (memcmp(&a.getRegion(i), &b.getRegion(i), sizeof(atlas::Region)))
+            return false;
+    size_t bytes = (size_t)a.getPageWidth() * a.getPageHeight() * 4;
+    for (unsigned int p = 0; p < a.getPageCount(); p++)
+        if (memcmp(a.getPage(p), b.getPage(p), bytes))
+            return false;
+    return true;
+}
+
+// Every cell (region plus padding) inside its page, aligned, and clear
+// of the others; every texel of the cell the nearest image texel
+static void
+checkAtlas(const atlas::Atlas & result, const vector<atlas::Image> & images, const atlas::Options & options)
+{
+    GLsizei pw = result.getPageWidth(), ph = result.getPageHeight(), pad = options.padding;
+    bool inside = true, aligned = true, disjoint = true, copied = true, gutters = true;
+
+    vector<vector<int> > owner(result.getPageCount(), vector<int>((size_t)pw * ph, -1));
+    for (unsigned int i = 0; i < result.getRegionCount(); i++) {
+        const atlas::Region & r = result.getRegion(i);
+        const atlas::Image & image = images[i];
+        int cx = r.x - pad, cy = r.y - pad;
+        int cw = image.width + 2 * pad, ch = image.height + 2 * pad;
+        if (r.page >= result.getPageCount() || cx < 0 || cy < 0 || cx + cw > pw || cy + ch > ph ||
+            (GLsizei)r.width != image.width || (GLsizei)r.height != image.height) {
+            inside = false;
+            continue;
+        }
+        aligned = aligned && cx % options.alignment == 0 && cy % options.alignment == 0;
+
+        const GLubyte * page = result.getPage(r.page);
+        for (int y = 0; y < ch; y++)
+            for (int x = 0; x < cw; x++) {
+                int & o = owner[r.page][(size_t)(cy + y) * pw + cx + x];
+                if (o >= 0)
+                    disjoint = false;
+                o = i;
+
+                int sx = std::min(std::max(x - pad, 0), image.width - 1);
+                int sy = std::min(std::max(y - pad, 0), image.height - 1);
+                const GLubyte * want = image.pixels + ((size_t)sy * image.width + sx) * 4;
+                const GLubyte * got = page + ((size_t)(cy + y) * pw + cx + x) * 4;
+                if (memcmp(want, got, 4)) {
+                    bool edge = x < pad || y < pad || x >= pad + image.width || y >= pad + image.height;
+                    (edge ? gutters : copied) = false;
+                }
+            }
+
+        float eps = 1e-6f;
+        inside = inside && fabsf(r.u0 * pw - r.x) < eps * pw && fabsf(r.v1 * ph - (r.y + r.height)) < eps * ph;
+    }
+
+    expect(inside, "a cell is off its page or its uvs are wrong");
+    expect(aligned, "a cell isn't aligned");
+    expect(disjoint, "cells overlap");
+    expect(copied, "a texel is copied wrong");
+    expect(gutters, "a gutter texel isn't the edge next to it");
+}
+
+static void
+checkFile(const atlas::Atlas & result, const char * fileName)
+{
+    expect(result.write(fileName), "writing the atlas failed");
+
+    atlas::AtlasFile file;
+    if (!file.open(fileName)) {
+        expect(false, "opening the atlas failed");
+        return;
+    }
+    bool same = file.getPageCount() == result.getPageCount() && file.getRegionCount() == result.getRegionCount() &&
+                file.getPageWidth() == result.getPageWidth() && file.getPageHeight() == result.getPageHeight();
+    for (unsigned int i = 0; same && i < result.getRegionCount(); i++)
+        same = !memcmp(&file.getRegion(i), &result.getRegion(i), sizeof(atlas::Region)) &&
+               file.getName(i) == result.getName(i) && file.find(result.getName(i)) == (int)i &&
+               result.find(result.getName(i)) == (int)i;
+    size_t bytes = (size_t)result.getPageWidth() * result.getPageHeight() * 4;
+    for (unsigned int p = 0; same && p < result.getPageCount(); p++)
+        same = !memcmp(file.getPage(p), result.getPage(p), bytes) && ((size_t)file.getPage(p) & 4095) == 0;
+    expect(same, "the file doesn't read back the same");
+    expect(file.find("no such image") == -1 && result.find("no such image") == -1, "found an image that isn't there");
+}
+
+// Two triangles per material, uvs at the corners and the middle
+static void
+checkRemap()
+{
+    mesh::TriMesh mesh;
+    const vec2 corners[6] = { vec2(0, 0), vec2(1, 0), vec2(1, 1), vec2(0.5f, 0.5f), vec2(2, -1), vec2(0, 1) };
+    for (int m = 0; m < 3; m++) {
+        mesh::SubMesh s;
+        s.material = m;
+        s.first = mesh.uvs.size();
+        s.count = 6;
+        mesh.submeshes.push_back(s);
+        for (int c = 0; c < 6; c++) {
+            mesh.vertices.push_back(vec3(0.0f));
+            mesh.uvs.push_back(corners[c]);
+        }
+    }
+
+    atlas::Region a = { 0, 0, 0, 0, 0, 0.25f, 0.5f, 0.5f, 1.0f };
+    atlas::Region b = { 0, 0, 0, 0, 0, 0.0f, 0.0f, 0.125f, 0.25f };
+    vector<const atlas::Region *> materials;
+    materials.push_back(&a);
+    materials.push_back(NULL);
+    materials.push_back(&b);
+    atlas::remapMesh(mesh, materials);
+
+    bool right = true;
+    const atlas::Region * expected[3] = { &a, NULL, &b };
+    for (int m = 0; m < 3; m++)
+        for (int c = 0; c < 6; c++) {
+            vec2 uv = glm::clamp(corners[c], vec2(0.0f), vec2(1.0f));
+            if (expected[m])
+                uv = vec2(expected[m]->u0, expected[m]->v0) +
+                     uv * vec2(expected[m]->u1 - expected[m]->u0, expected[m]->v1 - expected[m]->v0);
+            else
+                uv = corners[c];
+            right = right && glm::length(mesh.uvs[m * 6 + c] - uv) < 1e-6f;
+        }
+    expect(right, "remapMesh put a uv in the wrong place");
+}
+
+int main( int argc, char* argv[] )
+{
+    unsigned int count = 4000;
+    unsigned int threads = 0;
+    const char * out = NULL;
+    vector<const char *> files;
+    atlas::Options options;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--images") && i + 1 < argc)
+            count = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--padding") && i + 1 < argc)
+            options.padding = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--alignment") && i + 1 < argc)
+            options.alignment = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--page") && i + 1 < argc)
+            options.pageWidth = options.pageHeight = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--out") && i + 1 < argc)
+            out = argv[++i];
+        else
+            files.push_back(argv[i]);
+    }
+    options.padding = std::max(options.padding, 0);
+    GLsizei align = 1;
+    while (align < options.alignment)
+        align *= 2;
+    options.alignment = align;
+
+    // The images: files, or sizes from 8 to 64 with a texel pattern that
+    // tells them apart
+    vector<vector<GLubyte> > pixels;
+    vector<atlas::Image> images;
+    if (!files.empty()) {
+        pixels.resize(files.size());
+        for (unsigned int i = 0; i < files.size(); i++) {
+            atlas::Image image;
+            if (!util::image::loadPixels(files[i], &image.width, &image.height, pixels[i])) {
+                printf("Can't read %s\n", files[i]);
+                exit(EXIT_FAILURE);
+            }
+            image.name = files[i];
+            images.push_back(image);
+        }
+    } else {
+        srand(1);
+        pixels.resize(count);
+        for (unsigned int i = 0; i < count; i++) {
+            atlas::Image image;
+            char name[32];
+            snprintf(name, sizeof(name), "image%05u", (i * 7919) % count);
+            image.name = name;
+            image.width = 8 << (rand() % 4);
+            image.height = rand() % 3 ? image.width : 8 + rand() % 57;
+            pixels[i].resize((size_t)image.width * image.height * 4);
+            for (int y = 0; y < image.height; y++)
+                for (int x = 0; x < image.width; x++)
+                    texel(i, x, y, &pixels[i][((size_t)y * image.width + x) * 4]);
+            images.push_back(image);
+        }
+    }
+    for (unsigned int i = 0; i < images.size(); i++)
+        images[i].pixels = &pixels[i][0];
+
+    // One thread, then many
+    atlas::Atlas single, many;
+    jobs::JobSystem js(threads);
+    options.jobs = NULL;
+    double start = profile::now();
+    bool built = single.build(images, options);
+    double singleTime = profile::now() - start;
+
+    options.jobs = &js;
+    start = profile::now();
+    built = many.build(images, options) && built;
+    double manyTime = profile::now() - start;
+    if (!built) {
+        printf("An image is too big for a %dx%d page\n", options.pageWidth, options.pageHeight);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%u images, padding %d, alignment %d: %u pages of %dx%d, %.1f%% used\n", (unsigned int)images.size(),
+           options.padding, options.alignment, many.getPageCount(), many.getPageWidth(), many.getPageHeight(),
+           many.getOccupancy() * 100.0f);
+    char label[16];
+    snprintf(label, sizeof(label), "%u", js.getThreadCount());
+    printf("%-10s %10s\n", "threads", "ms");
+    printf("%-10s %10.2f\n", "1", singleTime * 1000.0);
+    printf("%-10s %10.2f\n", label, manyTime * 1000.0);
+
+    checkAtlas(many, images, options);
+    expect(sameLayout(single, many), "the thread count changed the layout");
+
+    // Too big for a page
+    {
+        atlas::Atlas small;
+        atlas::Options tiny = options;
+        tiny.pageWidth = tiny.pageHeight = 16;
+        vector<atlas::Image> one(1, images[0]);
+        one[0].width = 64;
+        expect(!small.build(one, tiny) && !small.getPageCount(), "an image bigger than a page was packed");
+    }
+
+    checkFile(many, out ? out : "/tmp/atlasbench.atlas");
+    if (!out)
+        remove("/tmp/atlasbench.atlas");
+    checkRemap();
+
+    exit( failures ? EXIT_FAILURE : EXIT_SUCCESS );
+}
@@ -0,0 +1,541 @@
+//========================================================================
+// Benchmark driver. Runs a handful of representative scenes for a
+// fixed number of frames at a fixed resolution (headless by default),
+// with vsync off and a warm-up period, and writes frame time
+// percentiles, draw calls, bytes uploaded and peak RSS as JSON. Each
+// scene runs in a child process with a context of its own, so its peak
+// RSS is its own; the overall figure is the largest of them.
+// Built with GL_STATS the counts come from the wrappers and include
+// state changes and uniform updates too.
+//
+//   bench [--out FILE] [--frames N] [--warmup N] [--size WxH]
+//         [--scene NAME] [--window]
+//
+// `scons bench` builds this and writes build/bench.json.
+//========================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <GL/glew.h>
+#include "GL/glfw.h"
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "GLSLProgram.hpp"
+#include "Context.hpp"
+#include "Profiler.hpp"
+#include "Stats.hpp"
+#include "imageUtil.hpp"
+#include "Loader.hpp"
+#include "TriMesh.hpp"
+#include "vao.hpp"
+#include "fbo.hpp"
+
+#define BUFFER_OFFSET(i) ((GLfloat*)NULL + (i))
+
+using glm::mat4;
+using glm::mat3;
+using glm::vec3;
+using std::string;
+using std::vector;
+
+typedef struct CVertex
+{
+    vec3 pos;
+    vec3 normal;
+} CVertex;
+
+// RUSAGE_SELF, or RUSAGE_CHILDREN for the largest child that has
+// been waited for
+static long
+peakRssKb(int who)
+{
+    struct rusage usage;
+    getrusage(who, &usage);
+    return usage.ru_maxrss;
+}
+
+static bool
+loadProgram(shader::GLSLProgram & prog, const char * vert, const char * frag)
+{
+    if( !prog.compileShaderFromFile(vert, shader::VERTEX) ||
+        !prog.compileShaderFromFile(frag, shader::FRAGMENT) ||
+        !prog.link() )
+    {
+        printf("Shader program %s/%s failed!\n%s", vert, frag, prog.log().c_str());
+        return false;
+    }
+    return true;
+}
+
+//========================================================================
+// Scenes. Each one counts the draws it issues and the bytes it hands
+// to glBufferData/glTexImage2D, for builds without GL_STATS.
+//========================================================================
+
+class Scene
+{
+public:
+    Scene(const char * name):name(name), drawCalls(0), bytesUploaded(0){}
+    virtual ~Scene() {}
+
+    virtual bool setup(int width, int height) = 0;
+    virtual void frame(int index, int width, int height) = 0;
+
+    const char *    name;
+    long            drawCalls;
+    long            bytesUploaded;
+
+protected:
+    // Pack a mesh into a position/normal VAO for the given program
+    void uploadMesh(Vao & vao, mesh::TriMesh & m, GLuint prog)
+    {
+        vector<CVertex> packed;
+        packed.reserve(m.vertices.size());
+        for (unsigned int i = 0; i < m.vertices.size(); i++)
+            packed.push_back((CVertex){ m.vertices[i], m.normals[i] });
+
+        vao.create(GL_ARRAY_BUFFER, packed.size() * sizeof(CVertex), &packed.front(), GL_STATIC_DRAW);
+        vao.setShaderProgram(prog);
+        vao.bindAttribute("VertexPosition", 3, GL_FLOAT, GL_FALSE, sizeof(CVertex), BUFFER_OFFSET(0));
+        vao.bindAttribute("VertexNormal", 3, GL_FLOAT, GL_FALSE, sizeof(CVertex), BUFFER_OFFSET(3));
+
+        bytesUploaded += packed.size() * sizeof(CVertex);
+    }
+};
+
+// Parse, normalize and upload the armadillo every frame
+class MeshLoadScene : public Scene
+{
+public:
+    MeshLoadScene():Scene("mesh_load"){}
+
+    virtual bool setup(int width, int height)
+    {
+        return loadProgram(prog, "shaders/basicshade.vert", "shaders/basicshade.frag");
+    }
+
+    virtual void frame(int index, int width, int height)
+    {
+        mesh::TriMesh m = mesh::loadObj("models/armadillo_lowres.obj");
+        m.normalize(2);
+
+        Vao vao;
+        uploadMesh(vao, m, prog.getHandle());
+        vao.draw(GL_TRIANGLES, 0, m.vertices.size());
+        drawCalls++;
+    }
+
+    shader::GLSLProgram prog;
+};
+
+// envmap.cpp: the bunny reflecting the cube map
+class EnvmapScene : public Scene
+{
+public:
+    EnvmapScene():Scene("envmap"){}
+
+    virtual bool setup(int width, int height)
+    {
+        if (!loadProgram(prog, "shaders/env.vert", "shaders/env.frag"))
+            return false;
+
+        mesh::TriMesh m = mesh::loadObj("models/bunny2.obj");
+        m.normalize(2);
+        count = m.vertices.size();
+        uploadMesh(vao, m, prog.getHandle());
+
+        ilInit();
+        iluInit();
+        ilutRenderer(ILUT_OPENGL);
+
+        texID = util::image::loadCubemap("img/cube");
+        GLint size;
+        glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_TEXTURE_WIDTH, &size);
+        bytesUploaded += 6 * size * size * 3;
+
+        glEnable(GL_DEPTH_TEST);
+        return true;
+    }
+
+    virtual void frame(int index, int width, int height)
+    {
+        float r = index / 60.0f * 50.0f;
+        vec3 eye(0,0.75,-4);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, texID);
+
+        mat4 proj = glm::perspective(45.0f, (float)width / (float)height, 0.1f, 100.0f);
+        mat4 view = glm::lookAt(eye, vec3(0), vec3(0,1,0));
+        mat4 modelview = glm::rotate(glm::mat4(1.0f), r, vec3(0,1,0));
+        mat3 normal = glm::transpose(glm::mat3(glm::inverse(view * modelview)));
+
+        prog.use();
+        prog.setUniform("Tex1", 0);
+        prog.setUniform("MVP", proj * view * modelview);
+        prog.setUniform("NormalMatrix", normal);
+        prog.setUniform("ModelMatrix", modelview);
+        prog.setUniform("WorldCameraPosition", eye);
+
+        vao.draw(GL_TRIANGLES, 0, count);
+        drawCalls++;
+    }
+
+    shader::GLSLProgram prog;
+    Vao vao;
+    GLuint texID;
+    int count;
+};
+
+// fbotest.cpp: render into an FBO, then composite it onto the screen
+class FboCompositeScene : public Scene
+{
+public:
+    FboCompositeScene():Scene("fbo_composite"){}
+
+    virtual bool setup(int width, int height)
+    {
+        if (!loadProgram(prog, "shaders/basicview.vert", "shaders/basicview.frag") ||
+            !loadProgram(fboprog, "shaders/fbo.vert", "shaders/fbo.frag"))
+            return false;
+
+        CVertex quad[] = {
+            { vec3( 1.0f, -1.0f, 0.0f), vec3( 1.0f, 0.0f, 0.0f) },
+            { vec3(-1.0f, -1.0f, 0.0f), vec3( 0.0f, 0.0f, 0.0f) },
+            { vec3( 1.0f,  1.0f, 0.0f), vec3( 1.0f, 1.0f, 0.0f) },
+            { vec3(-1.0f,  1.0f, 0.0f), vec3( 0.0f, 1.0f, 0.0f) },
+        };
+
+        vao.create(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+        vao.setShaderProgram(prog.getHandle());
+        vao.bindAttribute("VertexPosition", 3, GL_FLOAT, GL_FALSE, sizeof(CVertex), BUFFER_OFFSET(0));
+        vao.bindAttribute("VertexColor", 3, GL_FLOAT, GL_FALSE, sizeof(CVertex), BUFFER_OFFSET(3));
+
+        fboVao.create(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+        fboVao.setShaderProgram(fboprog.getHandle());
+        fboVao.bindAttribute("VertexPosition", 3, GL_FLOAT, GL_FALSE, sizeof(CVertex), BUFFER_OFFSET(0));
+        fboVao.bindAttribute("VertexUV", 3, GL_FLOAT, GL_FALSE, sizeof(CVertex), BUFFER_OFFSET(3));
+
+        bytesUploaded += 2 * sizeof(quad);
+        fbo.setName("offscreen pass");
+        return fbo.create(width, height, 1);
+    }
+
+    virtual void frame(int index, int width, int height)
+    {
+        float r = index / 60.0f * 100.0f;
+        vec3 eye(0,0,-3);
+        mat4 proj = glm::perspective(45.0f, (float)width / (float)height, 0.1f, 100.0f);
+        mat4 view = glm::lookAt(eye, vec3(0), vec3(0,1,0));
+
+        fbo.enable();
+        glClearColor(0.5f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        prog.use();
+        prog.setUniform("MVP", proj * view * glm::rotate(glm::mat4(1.0f), r, vec3(0.5,1.2,0.3)));
+        vao.draw(GL_TRIANGLE_STRIP, 0, 4);
+        fbo.disable();
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, fbo.getTextureHandles()[0]);
+        fboprog.use();
+        fboprog.setUniform("FboTexture", 0);
+        fboprog.setUniform("MVP", proj * view * glm::rotate(glm::mat4(1.0f), r * 0.4f, vec3(0,1,0)));
+        fboVao.draw(GL_TRIANGLE_STRIP, 0, 4);
+
+        drawCalls += 2;
+    }
+
+    shader::GLSLProgram prog, fboprog;
+    Vao vao, fboVao;
+    Fbo fbo;
+};
+
+// A lattice of spheres in a single instanced draw
+class InstancedSpheresScene : public Scene
+{
+public:
+    InstancedSpheresScene():Scene("instanced_spheres"){}
+
+    static const int GRID = 10;
+
+    virtual bool setup(int width, int height)
+    {
+        if (!loadProgram(prog, "shaders/instanced.vert", "shaders/basicshade.frag"))
+            return false;
+
+        mesh::TriMesh m = mesh::loadObj("models/sphere.obj");
+        m.normalize(0.8f);
+        count = m.vertices.size();
+        uploadMesh(vao, m, prog.getHandle());
+
+        glEnable(GL_DEPTH_TEST);
+        return true;
+    }
+
+    virtual void frame(int index, int width, int height)
+    {
+        float r = index / 60.0f * 20.0f;
+        mat4 proj = glm::perspective(45.0f, (float)width / (float)height, 0.1f, 100.0f);
+        mat4 view = glm::lookAt(vec3(0,8,-24), vec3(0), vec3(0,1,0));
+        mat4 model = glm::rotate(glm::mat4(1.0f), r, vec3(0,1,0));
+
+        prog.use();
+        prog.setUniform("ViewProj", proj * view * model);
+        prog.setUniform("NormalMatrix", glm::transpose(glm::mat3(glm::inverse(view * model))));
+        prog.setUniform("GridSize", GRID);
+        prog.setUniform("Spacing", 1.0f);
+
+        vao.drawInstanced(GL_TRIANGLES, 0, count, GRID * GRID * GRID);
+        drawCalls++;
+    }
+
+    shader::GLSLProgram prog;
+    Vao vao;
+    int count;
+};
+
+// Scenes are made once there is a context, as their programs need one
+template <class SceneType>
+static Scene *
+makeScene()
+{
+    return new SceneType();
+}
+
+static const struct
+{
+    const char *    name;
+    Scene *         (*make)();
+} SCENES[] = {
+    { "mesh_load", makeScene<MeshLoadScene> },
+    { "envmap", makeScene<EnvmapScene> },
+    { "fbo_composite", makeScene<FboCompositeScene> },
+    { "instanced_spheres", makeScene<InstancedSpheresScene> },
+};
+
+//========================================================================
+// Driver
+//========================================================================
+
+static double
+percentile(vector<double> & sorted, double p)
+{
+    unsigned int rank = (unsigned int)(p * sorted.size() + 0.5);
+    rank = rank > 0 ? rank - 1 : 0;
+    return sorted[std::min(rank, (unsigned int)sorted.size() - 1)];
+}
+
+// One scene on a context of its own, run in a child process so its
+// peak RSS is its own. Writes the renderer and the size it got, one to
+// a line, then the scene's JSON object to out.
+static bool
+runScene(int index, bool window, int width, int height, int frames, int warmup, FILE * out)
+{
+    // The benchmark paces itself, so no --frames cap on the context
+    context::Options options;
+    options.headless = !window;
+
+    context::Context * ctx;
+#ifdef HAVE_EGL
+    if (options.headless)
+        ctx = new context::EglContext(options);
+    else
+#endif
+        ctx = new context::GlfwContext(options);
+
+    if( !ctx->open( width, height, "Benchmark" ) )
+    {
+        fprintf( stderr, "Failed to open an OpenGL context\n" );
+        return false;
+    }
+
+    // Never wait for vsync
+    ctx->setSwapInterval( 0 );
+    ctx->getSize( &width, &height );
+
+    Scene * scene = SCENES[index].make();
+    stats::reset();
+    if (!scene->setup(width, height)) {
+        fprintf( stderr, "Scene %s failed to set up\n", scene->name );
+        return false;
+    }
+
+    // Setup gets a stats frame of its own
+    stats::endFrame();
+    const stats::Frame setup = stats::getLastFrame();
+
+    long setupBytes = scene->bytesUploaded;
+    vector<double> times;
+
+    for (int i = 0; i < warmup + frames; i++) {
+        // Measured frames start counting from a clean slate
+        if (i == warmup) {
+            scene->drawCalls = 0;
+            scene->bytesUploaded = 0;
+            stats::reset();
+        }
+
+        double start = profile::now();
+
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        scene->frame(i, width, height);
+        ctx->swapBuffers();
+        glFinish();
+
+        if (i >= warmup)
+            times.push_back(profile::now() - start);
+    }
+
+    vector<double> sorted = times;
+    std::sort(sorted.begin(), sorted.end());
+    double sum = 0.0;
+    for (unsigned int i = 0; i < sorted.size(); i++)
+        sum += sorted[i];
+
+    fprintf(out, "%s\n%d %d\n", glGetString(GL_RENDERER), width, height);
+    fprintf(out, "    {\n      \"name\": \"%s\",\n", scene->name);
+    fprintf(out, "      \"frame_ms\": { \"min\": %.4f, \"p50\": %.4f, \"p90\": %.4f, "
+                 "\"p99\": %.4f, \"max\": %.4f, \"mean\": %.4f },\n",
+            sorted.front() * 1e3, percentile(sorted, 0.5) * 1e3, percentile(sorted, 0.9) * 1e3,
+            percentile(sorted, 0.99) * 1e3, sorted.back() * 1e3, sum / sorted.size() * 1e3);
+    long drawCalls = scene->drawCalls;
+    long bytesUploaded = scene->bytesUploaded;
+    if (stats::ENABLED) {
+        const stats::Frame & totals = stats::getTotals();
+        drawCalls = totals[stats::DRAW_CALLS];
+        bytesUploaded = totals[stats::BUFFER_BYTES] + totals[stats::TEXTURE_BYTES];
+        setupBytes = setup[stats::BUFFER_BYTES] + setup[stats::TEXTURE_BYTES];
+    }
+
+    fprintf(out, "      \"draw_calls_per_frame\": %.2f,\n", (double)drawCalls / frames);
+    if (stats::ENABLED) {
+        const stats::Frame & totals = stats::getTotals();
+        fprintf(out, "      \"vertices_per_frame\": %.1f,\n", (double)totals[stats::VERTICES] / frames);
+        fprintf(out, "      \"state_changes_per_frame\": %.2f,\n", (double)totals.stateChanges() / frames);
+        fprintf(out, "      \"uniform_updates_per_frame\": %.2f,\n", (double)totals[stats::UNIFORM_UPDATES] / frames);
+    }
+    fprintf(out, "      \"setup_bytes_uploaded\": %ld,\n", setupBytes);
+    fprintf(out, "      \"bytes_uploaded_per_frame\": %.1f,\n", (double)bytesUploaded / frames);
+    fprintf(out, "      \"peak_rss_kb\": %ld\n    }", peakRssKb(RUSAGE_SELF));
+
+    delete scene;
+    ctx->close();
+    delete ctx;
+    return true;
+}
+
+
+// runScene() in a child; false if it failed. The parent never opens a
+// context, so the child starts from a small footprint.
+static bool
+inChild(int index, bool window, int width, int height, int frames, int warmup, string & output)
+{
+    int fds[2];
+    if (pipe(fds))
+        return false;
+
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        FILE * out = fdopen(fds[1], "w");
+        bool ok = out && runScene(index, window, width, height, frames, warmup, out);
+        if (out)
+            fclose(out);
+        fflush(stdout);
+        _exit(ok ? 0 : 1);
+    }
+
+    close(fds[1]);
+    char buffer[4096];
+    ssize_t got;
+    while (pid > 0 && (got = read(fds[0], buffer, sizeof(buffer))) > 0)
+        output.append(buffer, got);
+    close(fds[0]);
+
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid)
+        return false;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main( int argc, char* argv[] )
+{
+    int frames = 200, warmup = 20;
+    int width = 1280, height = 720;
+    const char * outPath = "bench.json";
+    const char * only = NULL;
+    bool window = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--out") && i + 1 < argc)
+            outPath = argv[++i];
+        else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+            frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--warmup") && i + 1 < argc)
+            warmup = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--size") && i + 1 < argc)
+            sscanf(argv[++i], "%dx%d", &width, &height);
+        else if (!strcmp(argv[i], "--scene") && i + 1 < argc)
+            only = argv[++i];
+        else if (!strcmp(argv[i], "--window"))
+            window = true;
+    }
+    if (frames < 1 || warmup < 0) {
+        fprintf( stderr, "usage: bench [--out FILE] [--frames N] [--warmup N] [--size WxH]\n"
+                         "             [--scene NAME] [--window]\n"
+                         "--frames needs at least 1, --warmup at least 0\n" );
+        exit( EXIT_FAILURE );
+    }
+
+    // Each child gives back the renderer, the size it got and the
+    // scene's JSON, which goes out once they have all run
+    string renderer, sceneJson;
+    int gotWidth = width, gotHeight = height;
+    for (int s = 0; s < (int)(sizeof(SCENES) / sizeof(SCENES[0])); s++) {
+        if (only && strcmp(only, SCENES[s].name))
+            continue;
+
+        string output;
+        size_t first, second;
+        if (!inChild(s, window, width, height, frames, warmup, output) ||
+            (first = output.find('\n')) == string::npos ||
+            (second = output.find('\n', first + 1)) == string::npos) {
+            fprintf( stderr, "Scene %s failed\n", SCENES[s].name );
+            exit( EXIT_FAILURE );
+        }
+
+        renderer = output.substr(0, first);
+        sscanf(output.c_str() + first + 1, "%d %d", &gotWidth, &gotHeight);
+        sceneJson += (sceneJson.empty() ? "\n" : ",\n") + output.substr(second + 1);
+    }
+
+    FILE * out = fopen(outPath, "w");
+    if (!out) {
+        fprintf( stderr, "Unable to write %s\n", outPath );
+        exit( EXIT_FAILURE );
+    }
+
+    // RUSAGE_CHILDREN is the largest child's peak, the worst scene
+    fprintf(out, "{\n  \"renderer\": \"%s\",\n", renderer.c_str());
+    fprintf(out, "  \"resolution\": [%d, %d],\n", gotWidth, gotHeight);
+    fprintf(out, "  \"frames\": %d,\n  \"warmup\": %d,\n", frames, warmup);
+    fprintf(out, "  \"scenes\": [%s", sceneJson.c_str());
+    fprintf(out, "\n  ],\n  \"peak_rss_kb\": %ld\n}\n", peakRssKb(RUSAGE_CHILDREN));
+    fclose(out);
+
+    printf("Wrote %s\n", outPath);
+
+    exit( EXIT_SUCCESS );
+}
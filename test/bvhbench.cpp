@@ -0,0 +1,177 @@
+//========================================================================
+// BVH benchmark. Builds a tree over the low-res armadillo with one and
+// with all hardware threads, casts random rays at it, then wobbles the
+// vertices and compares a refit against a rebuild. Needs no window or
+// GPU. A sample of the rays is checked against brute force; exits
+// non-zero if any of them disagree.
+//
+//   bvhbench [--model FILE] [--rays N] [--threads N]
+//========================================================================
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "Bvh.hpp"
+#include "Loader.hpp"
+#include "Profiler.hpp"
+
+using glm::vec3;
+using std::vector;
+
+static const unsigned int CHECKED_RAYS = 2000;
+
+static float
+randf(float lo, float hi)
+{
+    return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+// Every triangle, no tree
+static float
+bruteForce(const mesh::TriMesh & m, const bvh::Ray & ray)
+{
+    float best = ray.tmax;
+    for (unsigned int i = 0; i + 2 < m.vertices.size(); i += 3) {
+        vec3 e1 = m.vertices[i + 1] - m.vertices[i];
+        vec3 e2 = m.vertices[i + 2] - m.vertices[i];
+        vec3 p = glm::cross(ray.dir, e2);
+        float det = glm::dot(e1, p);
+        if (fabsf(det) < 1e-12f)
+            continue;
+
+        vec3 s = ray.origin - m.vertices[i];
+        float u = glm::dot(s, p) / det;
+        vec3 q = glm::cross(s, e1);
+        float v = glm::dot(ray.dir, q) / det;
+        float t = glm::dot(e2, q) / det;
+        if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t > 0.0f && t < best)
+            best = t;
+    }
+    return best;
+}
+
+// Rays from a sphere around the mesh towards points inside its bounds
+static vector<bvh::Ray>
+makeRays(const mesh::TriMesh & m, unsigned int count)
+{
+    vector<bvh::Ray> rays(count);
+    vec3 center = m.bounds.center(), extent = m.bounds.extent();
+    float radius = glm::length(extent) * 2.0f;
+
+    for (unsigned int i = 0; i < count; i++) {
+        vec3 from = glm::normalize(vec3(randf(-1, 1), randf(-1, 1), randf(-1, 1))) * radius + center;
+        vec3 to = center + extent * vec3(randf(-1, 1), randf(-1, 1), randf(-1, 1));
+        rays[i] = bvh::Ray(from, glm::normalize(to - from));
+    }
+    return rays;
+}
+
+static double
+castRays(const bvh::Bvh & tree, const vector<bvh::Ray> & rays, unsigned int * hits)
+{
+    double start = profile::now();
+    bvh::Hit hit;
+    *hits = 0;
+    for (unsigned int i = 0; i < rays.size(); i++)
+        *hits += tree.intersect(rays[i], hit);
+    return profile::now() - start;
+}
+
+static int
+check(const bvh::Bvh & tree, const mesh::TriMesh & m, const vector<bvh::Ray> & rays)
+{
+    int failures = 0;
+    for (unsigned int i = 0; i < CHECKED_RAYS && i < rays.size(); i++) {
+        bvh::Hit hit;
+        float expected = bruteForce(m, rays[i]);
+        float got = tree.intersect(rays[i], hit) ? hit.t : rays[i].tmax;
+        if (fabsf(got - expected) > 1e-4f * std::max(1.0f, expected)) {
+            if (failures++ < 10)
+                printf("MISMATCH: ray %u hit %f, brute force %f\n", i, got, expected);
+        }
+    }
+    return failures;
+}
+
+int main( int argc, char* argv[] )
+{
+    const char * modelPath = "models/armadillo_lowres.obj";
+    unsigned int rayCount = 1000000;
+    unsigned int threads = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--model") && i + 1 < argc)
+            modelPath = argv[++i];
+        else if (!strcmp(argv[i], "--rays") && i + 1 < argc)
+            rayCount = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+    }
+
+    mesh::TriMesh m = mesh::loadObj(modelPath);
+    if (m.vertices.empty()) {
+        fprintf( stderr, "Unable to load %s\n", modelPath );
+        exit( EXIT_FAILURE );
+    }
+    m.normalize(2);
+
+    srand(1);
+    vector<bvh::Ray> rays = makeRays(m, rayCount);
+    bvh::Bvh tree;
+    int failures = 0;
+
+    printf("%s: %u triangles\n", modelPath, (unsigned int)m.vertices.size() / 3);
+
+    // Build times, best of a few runs
+    unsigned int threadCounts[2] = { 1, threads };
+    for (int t = 0; t < 2; t++) {
+        double best = 1e30;
+        for (int run = 0; run < 5; run++) {
+            double start = profile::now();
+            tree.build(m, threadCounts[t]);
+            best = std::min(best, profile::now() - start);
+        }
+        printf("  build (%s)   %8.3f ms, %u nodes\n", t ? "all threads" : "1 thread   ",
+               best * 1e3, tree.getNodeCount());
+    }
+
+    unsigned int hits;
+    double elapsed = castRays(tree, rays, &hits);
+    printf("  trace              %8.3f Mrays/s (%u of %u hit)\n",
+           rays.size() / elapsed * 1e-6, hits, (unsigned int)rays.size());
+    failures += check(tree, m, rays);
+
+    // Wobble the mesh, then compare refitting with rebuilding
+    for (unsigned int i = 0; i < m.vertices.size(); i++) {
+        vec3 & v = m.vertices[i];
+        v += vec3(0.1f * sinf(v.y * 4.0f), 0.0f, 0.1f * cosf(v.y * 4.0f));
+    }
+
+    double start = profile::now();
+    tree.refit(m);
+    double refitTime = profile::now() - start;
+    elapsed = castRays(tree, rays, &hits);
+    printf("  refit              %8.3f ms, then %8.3f Mrays/s\n", refitTime * 1e3,
+           rays.size() / elapsed * 1e-6);
+    failures += check(tree, m, rays);
+
+    start = profile::now();
+    tree.build(m, threads);
+    double buildTime = profile::now() - start;
+    elapsed = castRays(tree, rays, &hits);
+    printf("  rebuild            %8.3f ms, then %8.3f Mrays/s\n", buildTime * 1e3,
+           rays.size() / elapsed * 1e-6);
+    failures += check(tree, m, rays);
+
+    if (failures) {
+        printf("%d mismatches\n", failures);
+        exit( EXIT_FAILURE );
+    }
+
+    exit( EXIT_SUCCESS );
+}
@@ -1,7 +1,8 @@
 //========================================================================
 // This is a small test application for which implements a
 // simple camera in OpenGL. The camera look direction is
-// controlled by the mouse, and keys move the camera location
+// controlled by the mouse, and keys move the camera location.
+// Right clicking picks the quad's triangles through a Bvh.
 //========================================================================
 
 #include <stdio.h>
@@ -13,6 +14,8 @@
 #include "glm/gtc/type_ptr.hpp"
 #include <math.h>
 #include "GLSLProgram.hpp"
+#include "Context.hpp"
+#include "Bvh.hpp"
 #include "glUtil.hpp"
 #include <vector>
 
@@ -31,45 +34,16 @@ typedef struct CVertex
     vec3 col;
 } CVertex;
 
-int main( void )
+int main( int argc, char* argv[] )
 {
     int width, height;
 
-    // Initialise GLFW
-    if( !glfwInit() )
+    // Open a window (or an offscreen target with --headless) and
+    // create its OpenGL context
+    context::Context * ctx = context::createContext( argc, argv );
+    if( !ctx->open( 640, 480, "Spinning Triangle" ) )
     {
-        fprintf( stderr, "Failed to initialize GLFW\n" );
-        exit( EXIT_FAILURE );
-    }
-    
-    glewExperimental = GL_TRUE;
-
-    // We need this to get the code to compile+run on MacOSX. I have yet
-    // to confirm if this works on Linux...
-
-#ifdef __APPLE__
-    glfwOpenWindowHint(GLFW_OPENGL_VERSION_MAJOR, 3);
-    glfwOpenWindowHint(GLFW_OPENGL_VERSION_MINOR, 2);
-    glfwOpenWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwOpenWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-#endif
-
-
-    // Open a window and create its OpenGL context
-    if( !glfwOpenWindow( 640, 480, 8,8,8,8,24,8, GLFW_WINDOW ) )
-    {
-        fprintf( stderr, "Failed to open GLFW window\n" );
-
-        glfwTerminate();
-        exit( EXIT_FAILURE );
-    }
-
-    // Initialize GLEW
-    GLenum err = glewInit();
-    if( err != GLEW_OK )
-    {
-        fprintf( stderr, "Failed to initialize GLEW: %s\n",
-                         glewGetErrorString(err));
+        fprintf( stderr, "Failed to open an OpenGL context\n" );
         exit( EXIT_FAILURE );
     }
 
@@ -82,13 +56,8 @@ int main( void )
         exit( EXIT_FAILURE );
     }
 
-    glfwSetWindowTitle( "Spinning Triangle" );
-
-    // Ensure we can capture the escape key being pressed below
-    glfwEnable( GLFW_STICKY_KEYS );
-
     // Enable vertical sync (on cards that support it)
-    glfwSwapInterval( 1 );
+    ctx->setSwapInterval( 1 );
 
     shader::GLSLProgram prog;
 
@@ -152,6 +121,16 @@ int main( void )
     glVertexAttribPointer( pLoc, 3, GL_FLOAT, GL_FALSE, sizeof(CVertex), BUFFER_OFFSET(0) );
     glVertexAttribPointer( cLoc, 3, GL_FLOAT, GL_FALSE, sizeof(CVertex), BUFFER_OFFSET(3) );
 
+    // The strip's two triangles, for picking
+    mesh::TriMesh pickMesh;
+    for (unsigned int i = 0; i + 2 < packedData.size(); i++)
+        for (unsigned int k = 0; k < 3; k++)
+            pickMesh.vertices.push_back(packedData[i + k].pos);
+
+    bvh::Bvh pickTree;
+    pickTree.build(pickMesh);
+    bool rightDown = false;
+
 
     // A bunch of variable declarations, including several for camera location, up vector and look dir
     vec3 eye(0,0,-3);
@@ -168,42 +147,42 @@ int main( void )
 
     float yaw = 0.0, tilt = 0.0, move_speed = 3.0, rot_speed = 2.0;
 
-    float t = glfwGetTime(), t_i, td;
+    float t = ctx->getTime(), t_i, td;
     glEnable(GL_DEPTH_TEST);
     do
     {
         // Get window size (may be different than the requested size)
-        glfwGetWindowSize( &width, &height );
+        ctx->getSize( &width, &height );
 
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         t_i = t;
-        t = glfwGetTime();
+        t = ctx->getTime();
         td = t-t_i;
 
         // Key logic
         bool changedPos = false;
         vec3 move(0);
-        if( glfwGetKey('W') == GLFW_PRESS ){
+        if( ctx->getKey('W') == GLFW_PRESS ){
         	move += lookDir;
         	changedPos = true;
         }
-        if( glfwGetKey('A') == GLFW_PRESS ){
+        if( ctx->getKey('A') == GLFW_PRESS ){
         	move -= lookDirRight;
         	changedPos = true;
         }
-        if( glfwGetKey('S') == GLFW_PRESS ){
+        if( ctx->getKey('S') == GLFW_PRESS ){
         	move -= lookDir;
         	changedPos = true;
         }
-        if( glfwGetKey('D') == GLFW_PRESS ){
+        if( ctx->getKey('D') == GLFW_PRESS ){
         	move += lookDirRight;
         	changedPos = true;
         }
-        if( glfwGetKey('R') == GLFW_PRESS ){
+        if( ctx->getKey('R') == GLFW_PRESS ){
         	move += lookDirUp;
         	changedPos = true;
         }
-        if( glfwGetKey('F') == GLFW_PRESS ){
+        if( ctx->getKey('F') == GLFW_PRESS ){
         	move -= lookDirUp;
         	changedPos = true;
         }
@@ -218,13 +197,13 @@ int main( void )
         }
 
         // Mouse logic
-        if( glfwGetMouseButton(GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS){
+        if( ctx->getMouseButton(GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS){
 
         	// Check to see if we already have the mouse down. If not, initialize the
         	// initial mouse location
         	if( !mouseDown ) {
             	int m_x, m_y;
-        		glfwGetMousePos(&m_x, &m_y);
+        		ctx->getMousePos(&m_x, &m_y);
         		mouse_i = vec2(m_x, m_y);
         	}
 
@@ -233,7 +212,7 @@ int main( void )
 
         	// Grab the current location of the mouse and find the delta between it and the last
         	int m_x, m_y;
-        	glfwGetMousePos(&m_x, &m_y);
+        	ctx->getMousePos(&m_x, &m_y);
         	mouse = vec2(m_x, m_y);
         	vec2 mouse_d = mouse - mouse_i;
         	mouse_i = mouse;
@@ -298,18 +277,33 @@ int main( void )
         // Pass on the MVP matrix onto the program
         prog.setUniform("MVP", modelviewProj);
 
+        // Report what's under the cursor on each right click
+        bool rightPressed = ctx->getMouseButton(GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS;
+        if( rightPressed && !rightDown ){
+        	int m_x, m_y;
+        	ctx->getMousePos(&m_x, &m_y);
+
+        	bvh::Hit hit;
+        	if( pickTree.intersect(bvh::screenRay(m_x, m_y, width, height, view * modelview, proj), hit) )
+        		printf("Picked triangle %u at distance %.3f\n", hit.triangle, hit.t);
+        	else
+        		printf("Picked nothing\n");
+        }
+        rightDown = rightPressed;
+
         glBindVertexArray(vaoHandle);
         glDrawArrays(GL_TRIANGLE_STRIP, 0, packedData.size());
 
         // Swap buffers
-        glfwSwapBuffers();
+        ctx->swapBuffers();
 
-    } // Check if the ESC key was pressed or the window was closed
-    while( glfwGetKey( GLFW_KEY_ESC ) != GLFW_PRESS &&
-           glfwGetWindowParam( GLFW_OPENED ) );
+    } // Check if the ESC key was pressed, the window was closed or we
+      // have rendered the requested number of frames
+    while( ctx->isRunning() );
 
-    // Close OpenGL window and terminate GLFW
-    glfwTerminate();
+    // Close the window (or offscreen target) and its context
+    ctx->close();
+    delete ctx;
 
     exit( EXIT_SUCCESS );
 }
@@ -0,0 +1,312 @@
+//========================================================================
+// Command buffer benchmark. A synthetic scene of --objects objects,
+// each spinning, with its matrices worked out and a uniform block, a
+// VAO bind and a draw issued every frame. Times --frames frames three
+// ways: making the calls as each object is done (what the demo loops
+// do), recording a frame and then replaying it on the same thread, and
+// recording while a second thread replays the frame before through a
+// render::CommandQueue. Recording is spread over --threads threads of
+// a job system, a list each.
+//
+// There's no GL here: the backend hashes every command and stands in
+// for the driver by spinning --draw-ns per draw, then for the swap by
+// sleeping --swap-ms a frame, so it needs no window or GPU.
+//
+// Exits non-zero if any frame replayed differs from the calls made
+// directly, or a frame goes missing.
+//
+//   cmdbench [--objects N] [--frames N] [--threads N] [--draw-ns N]
+//            [--swap-ms N]
+//========================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+#include "glm/gtc/matrix_inverse.hpp"
+
+#include "CommandBuffer.hpp"
+#include "Jobs.hpp"
+#include "Profiler.hpp"
+
+#include "Check.hpp"
+
+using glm::mat3;
+using glm::mat4;
+using glm::vec3;
+using std::vector;
+
+static float
+random(float lo, float hi)
+{
+    return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+// Hashes everything it's given, costs what a driver might, and keeps
+// one hash per frame
+class HashBackend : public render::CommandBackend
+{
+public:
+    HashBackend(double drawCost, double swapTime):drawCost(drawCost), swapTime(swapTime){}
+
+    virtual void beginFrame() { hash = 2166136261u; }
+    virtual void bindProgram(const render::BindProgram & cmd) { add(1, &cmd, sizeof(cmd)); }
+    virtual void uniformBlock(const render::UniformBlock & cmd, const void * data)
+    {
+        add(2, &cmd, sizeof(cmd));
+        add(0, data, cmd.size);
+    }
+    virtual void bindTexture(const render::BindTexture & cmd) { add(6, &cmd, sizeof(cmd)); }
+    virtual void bindVao(const render::BindVao & cmd) { add(3, &cmd, sizeof(cmd)); }
+    virtual void draw(const render::Draw & cmd)
+    {
+        add(4, &cmd, sizeof(cmd));
+        if (drawCost <= 0.0)
+            return;
+        double until = profile::now() + drawCost;
+        while (profile::now() < until)
+            ;
+    }
+    virtual void bindFramebuffer(const render::BindFramebuffer & cmd) { add(5, &cmd, sizeof(cmd)); }
+    virtual void endFrame()
+    {
+        hashes.push_back(hash);
+        if (swapTime > 0.0)
+            std::this_thread::sleep_for(std::chrono::microseconds((long)(swapTime * 1e6)));
+    }
+
+    vector<unsigned int> hashes;
+
+protected:
+    // FNV-1a a word at a time; everything recorded is whole words
+    void add(unsigned int type, const void * data, size_t size)
+    {
+        hash = (hash ^ type) * 16777619u;
+        const unsigned int * words = (const unsigned int *)data;
+        for (size_t i = 0; i < size / 4; i++)
+            hash = (hash ^ words[i]) * 16777619u;
+    }
+
+    double drawCost, swapTime;
+    unsigned int hash;
+};
+
+// What each object hands its shader
+struct ObjectBlock
+{
+    mat4 mvp;
+    mat4 model;
+    mat4 normal;    // mat3 padded to std140
+};
+
+struct Scene
+{
+    vector<vec3> positions, axes;
+    vector<float> speeds;
+    vector<GLuint> vaos;
+    vector<GLsizei> counts;
+    mat4 viewProjection;
+};
+
+static const GLuint PROGRAMS = 8;
+static const GLuint MESHES = 3;
+static const GLsizei MESH_VERTICES[MESHES] = { 36, 960, 2904 };
+
+// The per-object work of a frame, then its calls, for objects
+// [begin, end), into whatever takes them: a list or a backend. A piece
+// binds its own program, as a list can't know what came before it.
+template <class Target>
+static void
+drawObjects(const Scene & scene, int frame, unsigned int begin, unsigned int end, Target & out)
+{
+    unsigned int perProgram = (scene.positions.size() + PROGRAMS - 1) / PROGRAMS;
+    for (unsigned int i = begin; i < end; i++) {
+        if (i == begin || i % perProgram == 0)
+            out.bindProgram(1 + i / perProgram);
+
+        ObjectBlock block;
+        block.model = glm::rotate(glm::translate(mat4(1.0f), scene.positions[i]),
+                                  frame * scene.speeds[i], scene.axes[i]);
+        block.mvp = scene.viewProjection * block.model;
+        block.normal = mat4(glm::inverseTranspose(mat3(block.model)));
+
+        out.uniformBlock(0, &block, sizeof(block));
+        out.bindVao(scene.vaos[i]);
+        out.draw(GL_TRIANGLES, 0, scene.counts[i]);
+    }
+}
+
+// Lets drawObjects() call a backend the way it records into a list
+struct DirectCalls
+{
+    DirectCalls(render::CommandBackend & backend):backend(backend){}
+
+    void bindProgram(GLuint program) { render::BindProgram c = { program }; backend.bindProgram(c); }
+    void uniformBlock(GLuint binding, const void * data, GLuint size)
+    {
+        render::UniformBlock c = { binding, size };
+        backend.uniformBlock(c, data);
+    }
+    void bindVao(GLuint vao) { render::BindVao c = { vao }; backend.bindVao(c); }
+    void draw(GLenum mode, GLint first, GLsizei count)
+    {
+        render::Draw c = { mode, 0, first, count, 1, 0 };
+        backend.draw(c);
+    }
+
+    render::CommandBackend & backend;
+};
+
+static const GLfloat CLEAR_COLOR[4] = { 0.1f, 0.1f, 0.2f, 1.0f };
+
+// A frame into lists: the clear into the first, then the objects in
+// pieces, a list each
+static void
+recordFrame(const Scene & scene, int frame, jobs::JobSystem & js, render::CommandList ** lists, unsigned int piece)
+{
+    lists[0]->bindFramebuffer(0, 0, 0, 1280, 720, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, CLEAR_COLOR);
+    unsigned int count = scene.positions.size();
+    js.parallelFor(count, piece, [&](unsigned int begin, unsigned int end) {
+        drawObjects(scene, frame, begin, end, *lists[begin / piece]);
+    });
+}
+
+int main( int argc, char* argv[] )
+{
+    unsigned int objects = 20000;
+    int frames = 100;
+    unsigned int threads = 1;
+    double drawCost = 200e-9, swapTime = 2e-3;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--objects") && i + 1 < argc)
+            objects = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+            frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--draw-ns") && i + 1 < argc)
+            drawCost = atof(argv[++i]) * 1e-9;
+        else if (!strcmp(argv[i], "--swap-ms") && i + 1 < argc)
+            swapTime = atof(argv[++i]) * 1e-3;
+    }
+    objects = std::max(objects, 1u);
+
+    srand(1);
+    Scene scene;
+    for (unsigned int i = 0; i < objects; i++) {
+        scene.positions.push_back(vec3(random(-100, 100), random(-10, 10), random(-100, 100)));
+        scene.axes.push_back(glm::normalize(vec3(random(-1, 1), 1.0f, random(-1, 1))));
+        scene.speeds.push_back(random(0.5f, 3.0f));
+        scene.vaos.push_back(1 + i % MESHES);
+        scene.counts.push_back(MESH_VERTICES[i % MESHES]);
+    }
+    scene.viewProjection = glm::perspective(60.0f, 16.0f / 9.0f, 0.1f, 500.0f) *
+                           glm::lookAt(vec3(0.0f, 50.0f, 150.0f), vec3(0.0f), vec3(0.0f, 1.0f, 0.0f));
+
+    // Deleted before exit(), so the workers are stopped
+    jobs::JobSystem * pool = new jobs::JobSystem(threads);
+    jobs::JobSystem & js = *pool;
+    unsigned int listCount = js.getThreadCount() * 4;
+    unsigned int piece = (objects + listCount - 1) / listCount;
+    printf("%u objects, %d frames, %u recording threads, %.0f ns a draw, %.2f ms a swap (%u hardware threads)\n",
+           objects, frames, js.getThreadCount(), drawCost * 1e9, swapTime * 1e3, std::thread::hardware_concurrency());
+
+    // Calls made as each object is done
+    HashBackend direct(drawCost, swapTime);
+    double start = profile::now();
+    for (int f = 0; f < frames; f++) {
+        direct.beginFrame();
+        render::BindFramebuffer clear = { 0, 0, 0, 1280, 720, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT,
+                                          { CLEAR_COLOR[0], CLEAR_COLOR[1], CLEAR_COLOR[2], CLEAR_COLOR[3] } };
+        direct.bindFramebuffer(clear);
+        DirectCalls calls(direct);
+        for (unsigned int begin = 0; begin < objects; begin += piece)
+            drawObjects(scene, f, begin, std::min(begin + piece, objects), calls);
+        direct.endFrame();
+    }
+    double directTime = (profile::now() - start) / frames;
+
+    // Recorded, then replayed right away
+    HashBackend replayed(drawCost, swapTime);
+    render::CommandBuffer buffer(listCount);
+    vector<render::CommandList *> lists(listCount);
+    double recordTime = 0.0;
+    size_t bytes = 0;
+    unsigned int commands = 0;
+    start = profile::now();
+    for (int f = 0; f < frames; f++) {
+        double recordStart = profile::now();
+        for (unsigned int i = 0; i < listCount; i++)
+            lists[i] = &buffer.getList(i);
+        recordFrame(scene, f, js, &lists[0], piece);
+        recordTime += profile::now() - recordStart;
+
+        bytes = 0;
+        for (unsigned int i = 0; i < listCount; i++)
+            bytes += buffer.getList(i).bytes();
+        commands = buffer.size();
+        buffer.execute(replayed);
+        buffer.reset();
+    }
+    double inlineTime = (profile::now() - start) / frames;
+    recordTime /= frames;
+
+    // Recorded while the GL thread replays the frame before
+    HashBackend queued(drawCost, swapTime);
+    render::CommandQueue queue(listCount);
+    queue.start(queued);
+    start = profile::now();
+    for (int f = 0; f < frames; f++) {
+        for (unsigned int i = 0; i < listCount; i++)
+            lists[i] = &queue.getList(i);
+        recordFrame(scene, f, js, &lists[0], piece);
+        queue.submit();
+    }
+    queue.finish();
+    double queuedTime = (profile::now() - start) / frames;
+    render::QueueStats stats = queue.getStats();
+    queue.stop();
+
+    printf("%u commands, %.1f KB a frame, recorded in %.2f ms\n", commands, bytes / 1024.0, recordTime * 1e3);
+    printf("%-28s %8.2f ms a frame\n", "direct calls", directTime * 1e3);
+    printf("%-28s %8.2f ms a frame\n", "recorded, then replayed", inlineTime * 1e3);
+    printf("%-28s %8.2f ms a frame (%.2fx direct), replay %.2f ms, submit waited %.2f ms\n", "recorded, GL thread replays",
+           queuedTime * 1e3, directTime / queuedTime, stats.executeTime / std::max(1u, stats.frames) * 1e3,
+           stats.submitWait / frames * 1e3);
+
+    expect(stats.frames == (unsigned int)frames && queued.hashes.size() == (size_t)frames, "frames went missing");
+    expect(replayed.hashes == direct.hashes, "replayed commands differ from direct calls");
+    expect(queued.hashes == direct.hashes, "commands replayed on the GL thread differ from direct calls");
+
+    // A block bigger than a list's blocks, between two small commands
+    {
+        vector<unsigned char> big(render::CommandList::BLOCK_SIZE * 3 / 2);
+        for (size_t i = 0; i < big.size(); i++)
+            big[i] = (unsigned char)(i * 7 + i / 251);
+
+        HashBackend a(0.0, 0.0), b(0.0, 0.0);
+        render::CommandList list;
+        list.bindVao(1);
+        list.uniformBlock(2, &big[0], big.size());
+        list.bindVao(3);
+        a.beginFrame();
+        list.execute(a);
+        a.endFrame();
+
+        DirectCalls calls(b);
+        b.beginFrame();
+        calls.bindVao(1);
+        calls.uniformBlock(2, &big[0], big.size());
+        calls.bindVao(3);
+        b.endFrame();
+        expect(list.size() == 3 && a.hashes == b.hashes, "a large uniform block came back different");
+    }
+
+    delete pool;
+    exit( failures ? EXIT_FAILURE : EXIT_SUCCESS );
+}
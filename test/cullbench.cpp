@@ -0,0 +1,119 @@
+//========================================================================
+// Frustum culling benchmark. Scatters a million boxes through a large
+// volume, spins the camera in the middle of them, and times every
+// culling path per frame: scalar, SSE, AVX, spheres and the threaded
+// AVX variant. Needs no window or GPU. Exits non-zero if any SIMD path
+// disagrees with the scalar one.
+//
+//   cullbench [--objects N] [--frames N] [--threads N]
+//========================================================================
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "Culling.hpp"
+#include "Profiler.hpp"
+
+using glm::mat4;
+using glm::vec3;
+using std::vector;
+
+static float
+randf(float lo, float hi)
+{
+    return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+int main( int argc, char* argv[] )
+{
+    unsigned int objects = 1000000;
+    int frames = 100;
+    unsigned int threads = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--objects") && i + 1 < argc)
+            objects = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+            frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+    }
+
+    // Unit cubes, randomly scaled, rotated and placed
+    srand(1);
+    mesh::Aabb unit(vec3(-0.5f), vec3(0.5f));
+    cull::BoundsArray bounds;
+    bounds.reserve(objects);
+    for (unsigned int i = 0; i < objects; i++) {
+        mat4 model = glm::translate(mat4(1.0f), vec3(randf(-500, 500), randf(-50, 50), randf(-500, 500)));
+        model = glm::rotate(model, randf(0, 360), glm::normalize(vec3(randf(-1, 1), 1, randf(-1, 1))));
+        model = glm::scale(model, vec3(randf(0.5f, 4.0f)));
+        bounds.add(unit, model);
+    }
+
+    mat4 proj = glm::perspective(60.0f, 16.0f / 9.0f, 0.1f, 400.0f);
+    vector<unsigned char> reference(objects), visible(objects);
+
+    const int paths = 5;
+    const char * names[paths] = { "scalar", "sse", "avx", "avx spheres", "avx threaded" };
+    double times[paths] = { 0 };
+    unsigned long counts[paths] = { 0 };
+    int mismatches = 0;
+
+    for (int frame = 0; frame < frames; frame++) {
+        float angle = frame * 360.0f / frames;
+        vec3 dir(sinf(glm::radians(angle)), 0.0f, cosf(glm::radians(angle)));
+        cull::Frustum frustum(proj * glm::lookAt(vec3(0, 10, 0), vec3(0, 10, 0) + dir, vec3(0, 1, 0)));
+
+        for (int p = 0; p < paths; p++) {
+            if (p == 2 && cull::getBestIsa() != cull::AVX)
+                continue;
+
+            unsigned char * out = p ? &visible.front() : &reference.front();
+            cull::Isa isa = p == 1 ? cull::SSE : p == 0 ? cull::SCALAR : cull::BEST;
+
+            double start = profile::now();
+            unsigned int count;
+            if (p == 3)
+                count = cull::cullSpheres(frustum, bounds, out, isa);
+            else if (p == 4)
+                count = cull::cullAabbsParallel(frustum, bounds, out, threads, isa);
+            else
+                count = cull::cullAabbs(frustum, bounds, out, isa);
+            times[p] += profile::now() - start;
+            counts[p] += count;
+
+            // Spheres are looser, so they only have to keep everything
+            // the boxes kept
+            for (unsigned int i = 0; p && i < objects; i++) {
+                if (p == 3 ? reference[i] > out[i] : reference[i] != out[i]) {
+                    if (mismatches++ < 10)
+                        printf("MISMATCH: %s object %u frame %d\n", names[p], i, frame);
+                }
+            }
+        }
+    }
+
+    printf("%u objects, %d frames, best isa %s\n", objects, frames,
+           cull::getIsaName(cull::BEST));
+    for (int p = 0; p < paths; p++) {
+        if (!counts[p] && times[p] == 0.0)
+            continue;
+        printf("  %-14s %8.3f ms/frame  %7.2f Mobj/s  %8lu visible\n", names[p],
+               times[p] / frames * 1e3, objects * frames / times[p] * 1e-6,
+               counts[p] / frames);
+    }
+
+    if (mismatches) {
+        printf("%d mismatches\n", mismatches);
+        exit( EXIT_FAILURE );
+    }
+
+    exit( EXIT_SUCCESS );
+}
@@ -3,10 +3,15 @@
 // an environment map fragment shader. Using the camera
 // location, we can determine what point on the environment
 // cube to point to given a fragment on the 3D model.
+//
+// usage: envmap [--ibl] [model.obj]
+//   --ibl   shade with lighting precomputed from the cube map (cached
+//           in img/cube.ibl) instead of a plain reflection
 //========================================================================
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <GL/glew.h>
 #include "GL/glfw.h"
 #include "glm/glm.hpp"
@@ -14,10 +19,12 @@
 #include "glm/gtc/type_ptr.hpp"
 #include <math.h>
 #include "GLSLProgram.hpp"
+#include "Context.hpp"
 #include "imageUtil.hpp"
 #include "glUtil.hpp"
 #include <vector>
 
+#include "Ibl.hpp"
 #include "Loader.hpp"
 #include "TriMesh.hpp"
 
@@ -38,46 +45,23 @@ int main( int argc, char* argv[] )
     int width, height;
     double t;
 
-    string modelPath = "models/bunny2.obj";
-    if (argc == 2)
-        modelPath = string(argv[1]);
-
-    // Initialise GLFW
-    if( !glfwInit() )
+    // Open a window (or an offscreen target with --headless) and
+    // create its OpenGL context
+    context::Context * ctx = context::createContext( argc, argv );
+    if( !ctx->open( 1024, 768, "Mesh Viewer" ) )
     {
-        fprintf( stderr, "Failed to initialize GLFW\n" );
+        fprintf( stderr, "Failed to open an OpenGL context\n" );
         exit( EXIT_FAILURE );
     }
-    
-    glewExperimental = GL_TRUE;
-
-    // We need this to get the code to compile+run on MacOSX. I have yet
-    // to confirm if this works on Linux...
-
-#ifdef __APPLE__
-    glfwOpenWindowHint(GLFW_OPENGL_VERSION_MAJOR, 3);
-    glfwOpenWindowHint(GLFW_OPENGL_VERSION_MINOR, 2);
-    glfwOpenWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwOpenWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-#endif
-
 
-    // Open a window and create its OpenGL context
-    if( !glfwOpenWindow( 1024, 768, 8,8,8,8,24,8, GLFW_WINDOW ) )
-    {
-        fprintf( stderr, "Failed to open GLFW window\n" );
-
-        glfwTerminate();
-        exit( EXIT_FAILURE );
-    }
-
-    // Initialize GLEW
-    GLenum err = glewInit();
-    if( err != GLEW_OK )
-    {
-        fprintf( stderr, "Failed to initialize GLEW: %s\n",
-                         glewGetErrorString(err));
-        exit( EXIT_FAILURE );
+    // Any arguments the context didn't claim are ours
+    string modelPath = "models/bunny2.obj";
+    bool useIbl = false;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--ibl"))
+            useIbl = true;
+        else
+            modelPath = string(argv[i]);
     }
 
     printGLVersion();
@@ -89,13 +73,8 @@ int main( int argc, char* argv[] )
         exit( EXIT_FAILURE );
     }
 
-    glfwSetWindowTitle( "Mesh Viewer" );
-
-    // Ensure we can capture the escape key being pressed below
-    glfwEnable( GLFW_STICKY_KEYS );
-
     // Enable vertical sync (on cards that support it)
-    glfwSwapInterval( 1 );
+    ctx->setSwapInterval( 1 );
 
     shader::GLSLProgram prog;
 
@@ -107,7 +86,7 @@ int main( int argc, char* argv[] )
     }
 
     // Compile fragment shader
-    if( ! prog.compileShaderFromFile("shaders/env.frag", shader::FRAGMENT))
+    if( ! prog.compileShaderFromFile(useIbl ? "shaders/ibl.frag" : "shaders/env.frag", shader::FRAGMENT))
     {
         printf("Fragment shader failed to compile!\n%s", prog.log().c_str());
         exit(1);
@@ -170,6 +149,28 @@ int main( int argc, char* argv[] )
     GLuint texID = util::image::loadCubemap("img/cube");
     //texID = util::image::loadImage("/home/cgibson/Projects/OpenGL-Examples/img/random.png");
     printf("TEXTURE ID: %u\n", (uint)texID);
+
+    // The same faces on the CPU, prefiltered (or read back from the
+    // cache) and put in place of the plain cube map
+    ibl::Environment environment;
+    if (useIbl) {
+        GLsizei cubeSize;
+        vector<GLubyte> pixels;
+        if (!util::image::loadCubemapPixels("img/cube", &cubeSize, pixels))
+            exit(EXIT_FAILURE);
+        ibl::Cubemap source = ibl::Cubemap::fromPixels(cubeSize, &pixels[0]);
+        jobs::JobSystem js;
+        ibl::Options options;
+        options.jobs = &js;
+        ibl::Timing timing;
+        if (ibl::loadOrPrecompute("img/cube.ibl", source, options, &environment, &timing))
+            printf("Lighting: read from img/cube.ibl\n");
+        else
+            printf("Lighting: mips %.1f ms, irradiance %.1f ms, specular %.1f ms\n",
+                   timing.mips * 1000.0, timing.irradiance * 1000.0, timing.specular * 1000.0);
+        glDeleteTextures(1, &texID);
+        texID = environment.specular.createTexture();
+    }
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_CUBE_MAP, texID);
     glEnable(GL_TEXTURE_CUBE_MAP);
@@ -182,11 +183,11 @@ int main( int argc, char* argv[] )
     do
     {
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        t = glfwGetTime();
+        t = ctx->getTime();
         float r = (GLfloat)t*50.0f;
 
         // Get window size (may be different than the requested size)
-        glfwGetWindowSize( &width, &height );
+        ctx->getSize( &width, &height );
 
         // Special case: avoid division by zero below
         height = height > 0 ? height : 1;
@@ -196,6 +197,10 @@ int main( int argc, char* argv[] )
 
         //Set "Tex1" to point to GL_TEXTURE0.
         prog.setUniform("Tex1", 0);
+        if (useIbl) {
+            prog.setUniform("Specular", 0);
+            ibl::setUniforms(prog, environment.irradiance, environment.specular.getLevels());
+        }
 
         // We'll need all of these matrices
         mat4 proj, view, modelview, modelviewProj;
@@ -227,14 +232,15 @@ int main( int argc, char* argv[] )
         glDrawArrays(GL_TRIANGLES, 0, packedData.size());
 
         // Swap buffers
-        glfwSwapBuffers();
+        ctx->swapBuffers();
 
-    } // Check if the ESC key was pressed or the window was closed
-    while( glfwGetKey( GLFW_KEY_ESC ) != GLFW_PRESS &&
-           glfwGetWindowParam( GLFW_OPENED ) );
+    } // Check if the ESC key was pressed, the window was closed or we
+      // have rendered the requested number of frames
+    while( ctx->isRunning() );
 
-    // Close OpenGL window and terminate GLFW
-    glfwTerminate();
+    // Close the window (or offscreen target) and its context
+    ctx->close();
+    delete ctx;
 
     exit( EXIT_SUCCESS );
 }
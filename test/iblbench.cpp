@@ -0,0 +1,307 @@
+//========================================================================
+// Checks and times ibl::precompute() without a GL context.
+//
+// Environments with known answers first: a constant one, whose
+// irradiance is pi times it everywhere and whose specular levels are
+// all it, and one brighter towards +y (1 + y), whose irradiance is
+// pi + 2 pi / 3 n.y. Then a busier one, against itself: SSE against
+// scalar, no job system against --threads, roughness 0 against the
+// source, each level no sharper than the one before it, and a cache
+// file written and read back.
+//
+// Then the timing, on the --cube faces (img/cube_*.png, or a made up
+// environment if they don't load): the mips, the SH projection and the
+// specular levels, scalar and SSE, on one thread and --threads.
+//
+// Exits non-zero if any check fails.
+//
+//   iblbench [--cube BASE] [--size N] [--samples N] [--threads N]
+//========================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <vector>
+
+#include "Ibl.hpp"
+#include "imageUtil.hpp"
+#include "Profiler.hpp"
+
+#include "Check.hpp"
+
+using std::vector;
+
+static const float PI = 3.14159265358979f;
+
+// Level 0 made up from a function of the direction
+template <class Function>
+static ibl::Cubemap
+makeCube(GLsizei size, Function fn)
+{
+    ibl::Cubemap cube(size);
+    for (int face = 0; face < 6; face++)
+        for (int y = 0; y < size; y++)
+            for (int x = 0; x < size; x++) {
+                vec3 c = fn(ibl::texelDirection(face, size, x, y));
+                float * texel = cube.getTexel(0, face, x, y);
+                texel[0] = c.x;
+                texel[1] = c.y;
+                texel[2] = c.z;
+            }
+    return cube;
+}
+
+static float
+maxDifference(const ibl::Cubemap & a, const ibl::Cubemap & b)
+{
+    if (a.getSize() != b.getSize() || a.getLevels() != b.getLevels())
+        return INFINITY;
+    float most = 0.0f;
+    for (unsigned int l = 0; l < a.getLevels(); l++)
+        for (size_t i = 0; i < a.getLevel(l).size(); i++)
+            most = std::max(most, fabsf(a.getLevel(l)[i] - b.getLevel(l)[i]));
+    return most;
+}
+
+static float
+maxDifference(const ibl::Sh9 & a, const ibl::Sh9 & b)
+{
+    float most = 0.0f;
+    for (int k = 0; k < 9; k++)
+        for (int c = 0; c < 3; c++)
+            most = std::max(most, fabsf(a.c[k][c] - b.c[k][c]));
+    return most;
+}
+
+// The mean and variance of a level's red channel, texels weighted by
+// solid angle
+static void
+levelMoments(const ibl::Cubemap & cube, unsigned int level, double * mean, double * variance)
+{
+    GLsizei n = cube.getSize(level);
+    double sum = 0.0, squares = 0.0, total = 0.0;
+    for (int face = 0; face < 6; face++)
+        for (int y = 0; y < n; y++)
+            for (int x = 0; x < n; x++) {
+                double s = (2.0 * x + 1.0) / n - 1.0, t = (2.0 * y + 1.0) / n - 1.0;
+                double w = pow(1.0 + s * s + t * t, -1.5);
+                double r = cube.getTexel(level, face, x, y)[0];
+                sum += w * r;
+                squares += w * r * r;
+                total += w;
+            }
+    *mean = sum / total;
+    *variance = squares / total - *mean * *mean;
+}
+
+static void
+checkConstant()
+{
+    ibl::Cubemap source = makeCube(32, [](const vec3 &) { return vec3(0.25f, 0.5f, 1.0f); });
+    ibl::Options options;
+    options.size = 32;
+    options.samples = 32;
+    ibl::Environment environment;
+    ibl::precompute(source, options, &environment);
+
+    float worst = 0.0f;
+    for (int i = 0; i < 64; i++) {
+        vec3 n = glm::normalize(vec3(sinf(i * 1.3f), cosf(i * 0.7f), sinf(i * 2.9f + 1.0f)));
+        vec3 e = environment.irradiance.evaluate(n);
+        worst = std::max(worst, glm::length(e - PI * vec3(0.25f, 0.5f, 1.0f)));
+    }
+    expect(worst < 1e-3f, "a constant environment's irradiance isn't pi times it");
+
+    float off = 0.0f;
+    const ibl::Cubemap & specular = environment.specular;
+    for (unsigned int l = 0; l < specular.getLevels(); l++)
+        for (size_t i = 0; i < specular.getLevel(l).size(); i += 3) {
+            const float * c = &specular.getLevel(l)[i];
+            off = std::max(off, std::max(fabsf(c[0] - 0.25f), std::max(fabsf(c[1] - 0.5f), fabsf(c[2] - 1.0f))));
+        }
+    expect(off < 1e-4f, "a constant environment's specular levels aren't constant");
+    printf("constant: irradiance off by %g, specular by %g, %u levels of %d\n", worst, off,
+           specular.getLevels(), specular.getSize());
+}
+
+static void
+checkGradient()
+{
+    ibl::Cubemap source = makeCube(64, [](const vec3 & d) { return vec3(1.0f + d.y); });
+    ibl::Sh9 sh = ibl::computeIrradiance(source);
+
+    float worst = 0.0f;
+    for (int i = 0; i < 256; i++) {
+        vec3 n = glm::normalize(vec3(sinf(i * 1.3f), cosf(i * 0.7f), sinf(i * 2.9f + 1.0f)));
+        float expected = PI + 2.0f * PI / 3.0f * n.y;
+        worst = std::max(worst, fabsf(sh.evaluate(n).x - expected) / expected);
+    }
+    expect(worst < 0.005f, "the irradiance of 1 + y isn't pi + 2 pi / 3 n.y");
+    printf("1 + y: irradiance off by %.3f%% at worst\n", worst * 100.0f);
+}
+
+// Lights, a sky and a floor, to give the filtering something to do
+static ibl::Cubemap
+makeScene(GLsizei size)
+{
+    return makeCube(size, [](const vec3 & d) {
+        vec3 c = d.y > 0.0f ? vec3(0.3f, 0.5f, 0.9f) * (0.5f + d.y) : vec3(0.2f, 0.15f, 0.1f);
+        if (glm::dot(d, glm::normalize(vec3(0.3f, 0.8f, 0.5f))) > 0.97f)
+            c += vec3(8.0f, 7.0f, 5.0f);
+        if (fabsf(d.x) > 0.9f && fabsf(d.y) < 0.2f)
+            c += vec3(1.0f, 0.2f, 0.2f);
+        return c;
+    });
+}
+
+static void
+checkScene(jobs::JobSystem & jobs)
+{
+    ibl::Cubemap source = makeScene(64);
+    source.buildMips();
+    ibl::Options options;
+    options.size = 32;
+    options.samples = 32;
+
+    ibl::Cubemap one = ibl::prefilterSpecular(source, options);
+    ibl::Sh9 shOne = ibl::computeIrradiance(source);
+    options.jobs = &jobs;
+    ibl::Cubemap many = ibl::prefilterSpecular(source, options);
+    ibl::Sh9 shMany = ibl::computeIrradiance(source, &jobs);
+    expect(maxDifference(one, many) == 0.0f, "the specular levels change with the thread count");
+    expect(maxDifference(shOne, shMany) == 0.0f, "the irradiance changes with the thread count");
+
+    options.isa = cull::SCALAR;
+    ibl::Cubemap scalar = ibl::prefilterSpecular(source, options);
+    ibl::Sh9 shScalar = ibl::computeIrradiance(source, &jobs, cull::SCALAR);
+    options.isa = cull::SSE;
+    ibl::Cubemap sse = ibl::prefilterSpecular(source, options);
+    ibl::Sh9 shSse = ibl::computeIrradiance(source, &jobs, cull::SSE);
+    float specularOff = maxDifference(scalar, sse), shOff = maxDifference(shScalar, shSse);
+    expect(specularOff < 1e-4f, "SSE and scalar specular levels disagree");
+    expect(shOff < 1e-4f, "SSE and scalar irradiance disagree");
+    printf("scene: SSE against scalar off by %g (specular), %g (irradiance)\n", specularOff, shOff);
+
+    // Level 0 is the source's level 1 (64 to 32), sampled at texel
+    // centres, so exactly its texels
+    float mirror = 0.0f;
+    for (size_t i = 0; i < scalar.getLevel(0).size(); i++)
+        mirror = std::max(mirror, fabsf(scalar.getLevel(0)[i] - source.getLevel(1)[i]));
+    expect(mirror < 1e-5f, "roughness 0 isn't the source");
+
+    double previous = INFINITY, sourceMean, sourceVariance;
+    levelMoments(source, 0, &sourceMean, &sourceVariance);
+    for (unsigned int l = 0; l < scalar.getLevels(); l++) {
+        double mean, variance;
+        levelMoments(scalar, l, &mean, &variance);
+        printf("  level %u (%dx%d, roughness %.2f): mean %.4f, variance %.4f\n", l, scalar.getSize(l),
+               scalar.getSize(l), scalar.getLevels() > 1 ? (float)l / (scalar.getLevels() - 1) : 0.0f,
+               mean, variance);
+        expect(variance <= previous * 1.001, "a rougher level is sharper than the one before it");
+        expect(fabs(mean - sourceMean) < 0.1 * sourceMean, "a specular level gains or loses energy");
+        previous = variance;
+    }
+
+    // The cache
+    const char * fileName = "/tmp/iblbench.ibl";
+    ibl::Environment environment, loaded;
+    environment.irradiance = shScalar;
+    environment.specular = scalar;
+    unsigned long long key = ibl::cacheKey(source, options);
+    expect(ibl::writeCache(fileName, environment, key), "writing the cache failed");
+    expect(ibl::readCache(fileName, &loaded, key), "reading the cache back failed");
+    expect(maxDifference(loaded.specular, scalar) == 0.0f && maxDifference(loaded.irradiance, shScalar) == 0.0f,
+           "the cache doesn't give back what went in");
+
+    options.samples++;
+    expect(ibl::cacheKey(source, options) != key, "the cache key doesn't change with the options");
+    ibl::Environment stale;
+    expect(!ibl::readCache(fileName, &stale, ibl::cacheKey(source, options)), "a stale cache was read");
+    expect(stale.specular.getLevels() == 0, "a stale cache changed what it was read into");
+
+    // A face size far too big for the file, after the magic, the key and
+    // the 27 irradiance floats; read before allocating it would run out
+    // of memory
+    expect(ibl::writeCache(fileName, environment, key), "writing the cache failed");
+    FILE * damaged = fopen(fileName, "r+b");
+    unsigned int huge = 0x40000000;
+    expect(damaged && !fseek(damaged, 8 + 8 + 27 * 4, SEEK_SET) && fwrite(&huge, sizeof(huge), 1, damaged) == 1,
+           "damaging the cache failed");
+    if (damaged)
+        fclose(damaged);
+    expect(!ibl::readCache(fileName, &stale, key), "a cache with a damaged size was read");
+    unlink(fileName);
+}
+
+static void
+timeIsa(ibl::Cubemap & source, ibl::Options options, cull::Isa isa, jobs::JobSystem * jobs)
+{
+    options.isa = isa;
+    options.jobs = jobs;
+    unsigned int threads = jobs ? jobs->getThreadCount() : 1;
+    ibl::Environment environment;
+    ibl::Timing timing;
+
+    // buildMips() starts again from level 0, and precompute() then
+    // leaves the mips alone
+    double start = profile::now();
+    source.buildMips();
+    double mips = profile::now() - start;
+    ibl::precompute(source, options, &environment, &timing);
+    timing.mips = mips;
+
+    printf("  %-6s %2u thread%s  mips %7.1f ms  irradiance %7.1f ms  specular %8.1f ms\n", cull::getIsaName(isa),
+           threads, threads == 1 ? " " : "s", timing.mips * 1000.0, timing.irradiance * 1000.0,
+           timing.specular * 1000.0);
+}
+
+int main( int argc, char* argv[] )
+{
+    const char * cube = "img/cube";
+    ibl::Options options;
+    unsigned int threads = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--cube") && i + 1 < argc)
+            cube = argv[++i];
+        else if (!strcmp(argv[i], "--size") && i + 1 < argc)
+            options.size = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--samples") && i + 1 < argc)
+            options.samples = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+    }
+    options.size = std::max(options.size, 1);
+    jobs::JobSystem js(threads);
+
+    checkConstant();
+    checkGradient();
+    checkScene(js);
+
+    // The timing
+    ilInit();
+    iluInit();
+    GLsizei size;
+    vector<GLubyte> pixels;
+    ibl::Cubemap source;
+    if (util::image::loadCubemapPixels(cube, &size, pixels)) {
+        source = ibl::Cubemap::fromPixels(size, &pixels[0]);
+        printf("%s: %d square\n", cube, size);
+    } else {
+        source = makeScene(256);
+        printf("made up environment: 256 square\n");
+    }
+
+    GLsizei outSize = std::min(options.size, source.getSize());
+    printf("specular %d square, %u samples a texel:\n", outSize, options.samples);
+    timeIsa(source, options, cull::SCALAR, NULL);
+    timeIsa(source, options, cull::getBestIsa(), NULL);
+    if (js.getThreadCount() > 1) {
+        timeIsa(source, options, cull::SCALAR, &js);
+        timeIsa(source, options, cull::getBestIsa(), &js);
+    }
+
+    exit( failures ? EXIT_FAILURE : EXIT_SUCCESS );
+}
@@ -11,6 +11,7 @@
 #include "glm/glm.hpp"
 
 #include "GLSLProgram.hpp"
+#include "Context.hpp"
 #include "vao.hpp"
 #include "glUtil.hpp"
 
@@ -22,45 +23,16 @@ typedef struct CVertex
 	GLfloat col[3];
 } CVertex;
 
-int main( void )
+int main( int argc, char* argv[] )
 {
     int width, height, x;
 
-    // Initialise GLFW
-    if( !glfwInit() )
+    // Open a window (or an offscreen target with --headless) and
+    // create its OpenGL context
+    context::Context * ctx = context::createContext( argc, argv );
+    if( !ctx->open( 640, 480, "Spinning Triangle" ) )
     {
-        fprintf( stderr, "Failed to initialize GLFW\n" );
-        exit( EXIT_FAILURE );
-    }
-    
-    glewExperimental = GL_TRUE;
-
-    // We need this to get the code to compile+run on MacOSX. I have yet
-    // to confirm if this works on Linux...
-
-#ifdef __APPLE__
-    glfwOpenWindowHint(GLFW_OPENGL_VERSION_MAJOR, 3);
-    glfwOpenWindowHint(GLFW_OPENGL_VERSION_MINOR, 2);
-    glfwOpenWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwOpenWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-#endif
-
-
-    // Open a window and create its OpenGL context
-    if( !glfwOpenWindow( 640, 480, 8,8,8,8,24,8, GLFW_WINDOW ) )
-    {
-        fprintf( stderr, "Failed to open GLFW window\n" );
-
-        glfwTerminate();
-        exit( EXIT_FAILURE );
-    }
-
-    // Initialize GLEW
-    GLenum err = glewInit();
-    if( err != GLEW_OK )
-    {
-        fprintf( stderr, "Failed to initialize GLEW: %s\n",
-        				 glewGetErrorString(err));
+        fprintf( stderr, "Failed to open an OpenGL context\n" );
         exit( EXIT_FAILURE );
     }
 
@@ -73,13 +45,8 @@ int main( void )
 		exit( EXIT_FAILURE );
 	}
 
-    glfwSetWindowTitle( "Spinning Triangle" );
-
-    // Ensure we can capture the escape key being pressed below
-    glfwEnable( GLFW_STICKY_KEYS );
-
     // Enable vertical sync (on cards that support it)
-    glfwSwapInterval( 1 );
+    ctx->setSwapInterval( 1 );
 
     shader::GLSLProgram prog;
 
@@ -133,10 +100,10 @@ int main( void )
 
     do
     {
-        glfwGetMousePos( &x, NULL );
+        ctx->getMousePos( &x, NULL );
 
         // Get window size (may be different than the requested size)
-        glfwGetWindowSize( &width, &height );
+        ctx->getSize( &width, &height );
 
         // Special case: avoid division by zero below
         height = height > 0 ? height : 1;
@@ -145,14 +112,15 @@ int main( void )
         vao.draw(GL_TRIANGLE_STRIP, 0, 4);
 
         // Swap buffers
-        glfwSwapBuffers();
+        ctx->swapBuffers();
 
-    } // Check if the ESC key was pressed or the window was closed
-    while( glfwGetKey( GLFW_KEY_ESC ) != GLFW_PRESS &&
-           glfwGetWindowParam( GLFW_OPENED ) );
+    } // Check if the ESC key was pressed, the window was closed or we
+      // have rendered the requested number of frames
+    while( ctx->isRunning() );
 
-    // Close OpenGL window and terminate GLFW
-    glfwTerminate();
+    // Close the window (or offscreen target) and its context
+    ctx->close();
+    delete ctx;
 
     exit( EXIT_SUCCESS );
 }
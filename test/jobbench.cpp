@@ -0,0 +1,264 @@
+//========================================================================
+// Job system benchmark. Measures scheduling overhead with --jobs empty
+// jobs, queued from the main thread in batches and spawned as a binary
+// tree from inside jobs, and prints jobs per second and how often jobs
+// were stolen. Then times parallelFor() against starting threads per
+// call, and runs the engine's own work through the pool: loading the
+// bundled models with a main thread "upload" after each, culling, and
+// a transform hierarchy update. Needs no window or GPU.
+//
+// Exits non-zero if any job runs twice or not at all, a dependent job
+// starts early, a main thread job runs elsewhere, or any of the engine
+// work comes out different from doing it serially.
+//
+//   jobbench [--threads N] [--jobs N]
+//========================================================================
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "Culling.hpp"
+#include "Hierarchy.hpp"
+#include "Jobs.hpp"
+#include "Loader.hpp"
+#include "ParallelFor.hpp"
+#include "Profiler.hpp"
+
+#include "Check.hpp"
+
+using glm::mat4;
+using glm::vec3;
+using std::vector;
+
+static float
+random(float lo, float hi)
+{
+    return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+static void
+printStats(const char * name, unsigned int count, double seconds, const jobs::Stats & s)
+{
+    printf("%-22s %8.2f ms  %6.2f M jobs/s  %5.1f%% stolen  (%llu of %llu steal attempts won)\n",
+           name, seconds * 1e3, count / seconds * 1e-6, 100.0 * s.stolen / std::max(1ull, s.executed),
+           s.stolen, s.stealAttempts);
+}
+
+static std::atomic<unsigned int> treeJobs(0);
+
+static void
+spawnTree(jobs::JobSystem & js, jobs::Counter * counter, unsigned int depth)
+{
+    treeJobs++;
+    if (depth == 0)
+        return;
+    js.run([&js, counter, depth]() { spawnTree(js, counter, depth - 1); }, counter);
+    js.run([&js, counter, depth]() { spawnTree(js, counter, depth - 1); }, counter);
+}
+
+int main( int argc, char* argv[] )
+{
+    unsigned int threads = 4;
+    unsigned int count = 1000000;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--jobs") && i + 1 < argc)
+            count = atoi(argv[++i]);
+    }
+
+    // Deleted before exit(), so the workers are stopped
+    jobs::JobSystem * pool = new jobs::JobSystem(threads);
+    jobs::JobSystem & js = *pool;
+    printf("%u threads (%u hardware)\n", js.getThreadCount(), std::thread::hardware_concurrency());
+
+    // Empty jobs from the main thread, 1000 at a time
+    {
+        vector<unsigned char> ran(count, 0);
+        js.resetStats();
+        double start = profile::now();
+        for (unsigned int begin = 0; begin < count; begin += 1000) {
+            jobs::Counter counter;
+            for (unsigned int i = begin; i < std::min(begin + 1000, count); i++)
+                js.run([&ran, i]() { ran[i]++; }, &counter);
+            js.wait(counter);
+        }
+        double time = profile::now() - start;
+        printStats("batches of 1000", count, time, js.getStats());
+
+        bool once = true;
+        for (unsigned int i = 0; i < count; i++)
+            once = once && ran[i] == 1;
+        expect(once, "jobs didn't each run once");
+    }
+
+    // A binary tree of jobs spawning jobs
+    {
+        unsigned int depth = 0;
+        while ((2u << (depth + 1)) - 1 <= count)
+            depth++;
+        unsigned int expected = (2u << depth) - 1;
+        treeJobs = 0;
+        js.resetStats();
+        double start = profile::now();
+        jobs::Counter counter;
+        js.run([&js, &counter, depth]() { spawnTree(js, &counter, depth); }, &counter);
+        js.wait(counter);
+        double time = profile::now() - start;
+        printStats("spawned as a tree", expected, time, js.getStats());
+        expect(treeJobs == expected, "tree jobs went missing");
+    }
+
+    // parallelFor against a thread per piece, over short loops
+    {
+        const unsigned int length = 1 << 16, calls = 200;
+        vector<float> data(length, 1.0f);
+        std::atomic<unsigned int> sum(0);
+        auto body = [&](unsigned int begin, unsigned int end) {
+            float s = 0.0f;
+            for (unsigned int i = begin; i < end; i++)
+                s += sqrtf(data[i]);
+            sum += (unsigned int)s;
+        };
+
+        double start = profile::now();
+        for (unsigned int c = 0; c < calls; c++)
+            util::parallelFor(length, js.getThreadCount(), body);
+        double spawned = profile::now() - start;
+        unsigned int spawnedSum = sum.exchange(0);
+
+        start = profile::now();
+        for (unsigned int c = 0; c < calls; c++)
+            js.parallelFor(length, 0, body);
+        double pooled = profile::now() - start;
+
+        printf("parallelFor x%u: threads %.1f us, jobs %.1f us per call\n", calls,
+               spawned / calls * 1e6, pooled / calls * 1e6);
+        expect(sum == spawnedSum && sum == length * calls, "parallelFor missed elements");
+    }
+
+    // Dependencies and the main thread queue: B after A, then a main
+    // thread job after B
+    {
+        const unsigned int n = 200;
+        std::atomic<unsigned int> aDone(0), early(0), offMain(0), mainRan(0);
+        jobs::Counter a, b, c;
+        for (unsigned int i = 0; i < n; i++)
+            js.run([&]() { std::this_thread::yield(); aDone++; }, &a);
+        for (unsigned int i = 0; i < n; i++)
+            js.run([&]() { if (aDone != n) early++; }, &b, &a);
+        js.run([&]() {
+            js.runOnMain([&]() {
+                if (!js.isMainThread())
+                    offMain++;
+                mainRan++;
+            }, &c);
+        }, &c, &b);
+        js.wait(c);
+        expect(early == 0, "a job started before the ones it was waiting for");
+        expect(mainRan == 1 && offMain == 0, "main thread job ran elsewhere");
+    }
+
+    // Loading: every model at once, each handing its mesh to the main
+    // thread, as a GL upload would
+    {
+        const char * files[] = { "models/bunny2.obj", "models/armadillo_lowres.obj", "models/sphere.obj" };
+        const unsigned int fileCount = 3;
+
+        double start = profile::now();
+        vector<mesh::TriMesh> serial(fileCount);
+        for (unsigned int i = 0; i < fileCount; i++)
+            serial[i] = mesh::loadObj(files[i]);
+        double serialTime = profile::now() - start;
+
+        vector<mesh::TriMesh> loaded(fileCount);
+        vector<unsigned int> uploaded(fileCount, 0);
+        std::atomic<unsigned int> offMain(0);
+        start = profile::now();
+        jobs::Counter counter;
+        for (unsigned int i = 0; i < fileCount; i++) {
+            js.run([&, i]() {
+                loaded[i] = mesh::loadObj(files[i]);
+                js.runOnMain([&, i]() {
+                    if (!js.isMainThread())
+                        offMain++;
+                    uploaded[i] = loaded[i].vertices.size();
+                }, &counter);
+            }, &counter);
+        }
+        js.wait(counter);
+        double jobTime = profile::now() - start;
+
+        printf("loading %u models: serial %.1f ms, jobs %.1f ms\n", fileCount, serialTime * 1e3, jobTime * 1e3);
+        bool same = offMain == 0;
+        for (unsigned int i = 0; i < fileCount; i++)
+            same = same && loaded[i].vertices == serial[i].vertices && loaded[i].normals == serial[i].normals &&
+                   uploaded[i] == serial[i].vertices.size();
+        expect(same, "models loaded through jobs differ");
+    }
+
+    // Culling
+    {
+        srand(1);
+        mesh::Aabb unit(vec3(-0.5f), vec3(0.5f));
+        cull::BoundsArray bounds;
+        for (unsigned int i = 0; i < 1000000; i++)
+            bounds.add(unit, glm::translate(mat4(1.0f), vec3(random(-500, 500), random(-50, 50), random(-500, 500))));
+        cull::Frustum frustum(glm::perspective(60.0f, 16.0f / 9.0f, 0.1f, 400.0f) *
+                              glm::lookAt(vec3(0.0f), vec3(1.0f, 0.0f, 0.3f), vec3(0.0f, 1.0f, 0.0f)));
+
+        vector<unsigned char> reference(bounds.size()), visible(bounds.size());
+        double start = profile::now();
+        unsigned int expectedCount = cull::cullAabbs(frustum, bounds, &reference[0]);
+        double serialTime = profile::now() - start;
+        start = profile::now();
+        unsigned int visibleCount = cull::cullAabbsParallel(frustum, bounds, &visible[0], js);
+        double jobTime = profile::now() - start;
+
+        printf("culling %u boxes: serial %.2f ms, jobs %.2f ms\n", bounds.size(), serialTime * 1e3, jobTime * 1e3);
+        expect(visibleCount == expectedCount && visible == reference, "culling through jobs differs");
+    }
+
+    // Transform hierarchy
+    {
+        srand(1);
+        scene::Hierarchy a, b;
+        for (unsigned int i = 0; i < 100000; i++) {
+            unsigned int parent = i < 16 ? scene::Hierarchy::NONE : rand() % i;
+            vec3 t(random(-2.0f, 2.0f), random(0.0f, 1.0f), random(-2.0f, 2.0f));
+            a.add(parent, t);
+            b.add(parent, t);
+        }
+        a.update(1u);
+        b.update(js);
+
+        // A frame with everything moving, after the first update sorted
+        // the nodes into levels
+        for (unsigned int i = 0; i < 16; i++) {
+            a.setTranslation(i, vec3(1.0f));
+            b.setTranslation(i, vec3(1.0f));
+        }
+        double start = profile::now();
+        a.update(1u);
+        double serialTime = profile::now() - start;
+        start = profile::now();
+        b.update(js);
+        double jobTime = profile::now() - start;
+
+        printf("hierarchy of %u nodes: serial %.2f ms, jobs %.2f ms\n", a.size(), serialTime * 1e3, jobTime * 1e3);
+        expect(!memcmp(&a.getWorlds()[0], &b.getWorlds()[0], a.size() * sizeof(mat4)),
+               "hierarchy through jobs differs");
+    }
+
+    delete pool;
+    exit( failures ? EXIT_FAILURE : EXIT_SUCCESS );
+}
@@ -13,6 +13,7 @@
 #include "glm/gtc/type_ptr.hpp"
 #include <math.h>
 #include "GLSLProgram.hpp"
+#include "Context.hpp"
 #include "glUtil.hpp"
 #include <vector>
 
@@ -36,47 +37,19 @@ int main( int argc, char* argv[] )
     int width, height;
     double t;
 
-    string modelPath = "models/bunny2.obj";
-    if (argc == 2)
-        modelPath = string(argv[1]);
-
-    // Initialise GLFW
-    if( !glfwInit() )
-    {
-        fprintf( stderr, "Failed to initialize GLFW\n" );
-        exit( EXIT_FAILURE );
-    }
-    
-    glewExperimental = GL_TRUE;
-
-    // We need this to get the code to compile+run on MacOSX. I have yet
-    // to confirm if this works on Linux...
-
-#ifdef __APPLE__
-    glfwOpenWindowHint(GLFW_OPENGL_VERSION_MAJOR, 3);
-    glfwOpenWindowHint(GLFW_OPENGL_VERSION_MINOR, 2);
-    glfwOpenWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwOpenWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-#endif
-
-
-    // Open a window and create its OpenGL context
-    if( !glfwOpenWindow( 640, 480, 8,8,8,8,24,8, GLFW_WINDOW ) )
+    // Open a window (or an offscreen target with --headless) and
+    // create its OpenGL context
+    context::Context * ctx = context::createContext( argc, argv );
+    if( !ctx->open( 640, 480, "Mesh Viewer" ) )
     {
-        fprintf( stderr, "Failed to open GLFW window\n" );
-
-        glfwTerminate();
+        fprintf( stderr, "Failed to open an OpenGL context\n" );
         exit( EXIT_FAILURE );
     }
 
-    // Initialize GLEW
-    GLenum err = glewInit();
-    if( err != GLEW_OK )
-    {
-        fprintf( stderr, "Failed to initialize GLEW: %s\n",
-                         glewGetErrorString(err));
-        exit( EXIT_FAILURE );
-    }
+    // Any arguments the context didn't claim are ours
+    string modelPath = "models/bunny2.obj";
+    if (argc == 2)
+        modelPath = string(argv[1]);
 
     printGLVersion();
 
@@ -87,13 +60,8 @@ int main( int argc, char* argv[] )
         exit( EXIT_FAILURE );
     }
 
-    glfwSetWindowTitle( "Mesh Viewer" );
-
-    // Ensure we can capture the escape key being pressed below
-    glfwEnable( GLFW_STICKY_KEYS );
-
     // Enable vertical sync (on cards that support it)
-    glfwSwapInterval( 1 );
+    ctx->setSwapInterval( 1 );
 
     shader::GLSLProgram prog;
 
@@ -174,11 +142,11 @@ int main( int argc, char* argv[] )
     do
     {
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        t = glfwGetTime();
+        t = ctx->getTime();
         float r = (GLfloat)t*50.0f;
 
         // Get window size (may be different than the requested size)
-        glfwGetWindowSize( &width, &height );
+        ctx->getSize( &width, &height );
 
         // Special case: avoid division by zero below
         height = height > 0 ? height : 1;
@@ -214,14 +182,15 @@ int main( int argc, char* argv[] )
         glDrawArrays(GL_TRIANGLES, 0, packedData.size());
 
         // Swap buffers
-        glfwSwapBuffers();
+        ctx->swapBuffers();
 
-    } // Check if the ESC key was pressed or the window was closed
-    while( glfwGetKey( GLFW_KEY_ESC ) != GLFW_PRESS &&
-           glfwGetWindowParam( GLFW_OPENED ) );
+    } // Check if the ESC key was pressed, the window was closed or we
+      // have rendered the requested number of frames
+    while( ctx->isRunning() );
 
-    // Close OpenGL window and terminate GLFW
-    glfwTerminate();
+    // Close the window (or offscreen target) and its context
+    ctx->close();
+    delete ctx;
 
     exit( EXIT_SUCCESS );
 }
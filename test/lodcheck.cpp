@@ -0,0 +1,267 @@
+//========================================================================
+// Level of detail check. Builds the LOD chain of every bundled model and
+// prints, per level, the triangle count, the simplifier's own error
+// estimate and the measured Hausdorff distance to the full mesh (over
+// the vertices and triangle centers of both), relative to the bounding
+// box diagonal. Then builds them again as one batch on --threads, and
+// on a job system of that many, and compares. Needs no window or GPU.
+//
+// Exits non-zero if the chain doesn't reach --reduction of the original
+// triangle count, if a level with at least an eighth of the triangles is
+// further than --hausdorff off, if any indices are broken, or if the
+// batch builds differ from the serial one.
+//
+//   lodcheck [--threads N] [--reduction R] [--hausdorff H] [models...]
+//========================================================================
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "Jobs.hpp"
+
+#include "Loader.hpp"
+#include "Lod.hpp"
+#include "Profiler.hpp"
+
+using glm::vec3;
+using std::string;
+using std::vector;
+
+// Ericson, Real-Time Collision Detection 5.1.5
+static vec3
+closestOnTriangle(const vec3 & p, const vec3 & a, const vec3 & b, const vec3 & c)
+{
+    vec3 ab = b - a, ac = c - a, ap = p - a;
+    float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+    if (d1 <= 0.0f && d2 <= 0.0f)
+        return a;
+
+    vec3 bp = p - b;
+    float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+    if (d3 >= 0.0f && d4 <= d3)
+        return b;
+
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+        return a + ab * (d1 / (d1 - d3));
+
+    vec3 cp = p - c;
+    float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+    if (d6 >= 0.0f && d5 <= d6)
+        return c;
+
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+        return a + ac * (d2 / (d2 - d6));
+
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+        return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+    float denom = 1.0f / (va + vb + vc);
+    return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+// Triangles in a uniform grid, for distance queries
+class TriangleGrid
+{
+public:
+    TriangleGrid(const vector<vec3> & vertices, const unsigned int * indices, unsigned int count,
+                 const mesh::Aabb & box):
+        vertices(vertices), indices(indices), box(box)
+    {
+        vec3 size = box.max - box.min;
+        cell = std::max(std::max(size.x, size.y), size.z) / RES + 1e-6f;
+        cells.resize(RES * RES * RES);
+
+        for (unsigned int t = 0; t < count / 3; t++) {
+            mesh::Aabb b;
+            for (int k = 0; k < 3; k++)
+                b.add(vertices[indices[t * 3 + k]]);
+            glm::ivec3 lo = locate(b.min), hi = locate(b.max);
+            for (int z = lo.z; z <= hi.z; z++)
+                for (int y = lo.y; y <= hi.y; y++)
+                    for (int x = lo.x; x <= hi.x; x++)
+                        cells[(z * RES + y) * RES + x].push_back(t);
+        }
+    }
+
+    // Searches rings of cells outwards until the nearest hit so far is
+    // closer than anything further out can be
+    float distance(const vec3 & p) const
+    {
+        glm::ivec3 c = locate(p);
+        float best = 1e30f;
+        for (int r = 0; r < RES; r++) {
+            if (best < (r - 1) * cell)
+                break;
+            for (int z = c.z - r; z <= c.z + r; z++)
+                for (int y = c.y - r; y <= c.y + r; y++)
+                    for (int x = c.x - r; x <= c.x + r; x++) {
+                        if (std::max(std::max(abs(x - c.x), abs(y - c.y)), abs(z - c.z)) != r)
+                            continue;
+                        if (x < 0 || y < 0 || z < 0 || x >= RES || y >= RES || z >= RES)
+                            continue;
+
+                        const vector<unsigned int> & list = cells[(z * RES + y) * RES + x];
+                        for (unsigned int i = 0; i < list.size(); i++) {
+                            const unsigned int * v = indices + list[i] * 3;
+                            vec3 q = closestOnTriangle(p, vertices[v[0]], vertices[v[1]], vertices[v[2]]);
+                            best = std::min(best, glm::length(p - q));
+                        }
+                    }
+        }
+        return best;
+    }
+
+protected:
+    static const int RES = 32;
+
+    glm::ivec3 locate(const vec3 & p) const
+    {
+        glm::ivec3 c((p - box.min) / cell);
+        return glm::clamp(c, glm::ivec3(0), glm::ivec3(RES - 1));
+    }
+
+    const vector<vec3> &        vertices;
+    const unsigned int *        indices;
+    mesh::Aabb                  box;
+    float                       cell;
+    vector< vector<unsigned int> > cells;
+};
+
+// Farthest vertex or triangle center of a from the surface of b
+static float
+oneSided(const vector<vec3> & vertices, const unsigned int * a, unsigned int countA,
+         const TriangleGrid & b)
+{
+    float worst = 0.0f;
+    for (unsigned int i = 0; i < countA; i++)
+        worst = std::max(worst, b.distance(vertices[a[i]]));
+    for (unsigned int t = 0; t < countA / 3; t++) {
+        const unsigned int * v = a + t * 3;
+        worst = std::max(worst, b.distance((vertices[v[0]] + vertices[v[1]] + vertices[v[2]]) / 3.0f));
+    }
+    return worst;
+}
+
+int main( int argc, char* argv[] )
+{
+    unsigned int threads = 0;
+    float reduction = 0.05f;
+    float hausdorff = 0.03f;
+    vector<string> models;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--reduction") && i + 1 < argc)
+            reduction = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--hausdorff") && i + 1 < argc)
+            hausdorff = atof(argv[++i]);
+        else
+            models.push_back(argv[i]);
+    }
+    if (models.empty()) {
+        models.push_back("models/bunny2.obj");
+        models.push_back("models/armadillo_lowres.obj");
+        models.push_back("models/sphere.obj");
+    }
+
+    int failures = 0;
+    vector<mesh::TriMesh> meshes;
+    vector<lod::LodMesh> serial;
+    double serialTime = 0.0;
+
+    for (unsigned int m = 0; m < models.size(); m++) {
+        meshes.push_back(mesh::loadObj(models[m]));
+        const mesh::TriMesh & tri = meshes.back();
+        if (tri.vertices.empty()) {
+            printf("FAILED: %s did not load\n", models[m].c_str());
+            exit( EXIT_FAILURE );
+        }
+
+        double start = profile::now();
+        serial.push_back(lod::build(tri));
+        serialTime += profile::now() - start;
+        const lod::LodMesh & lods = serial.back();
+
+        const vector<vec3> & vertices = lods.mesh.vertices;
+        const unsigned int * indices = &lods.mesh.indices.front();
+        float diagonal = glm::length(lods.mesh.bounds.max - lods.mesh.bounds.min);
+        TriangleGrid full(vertices, indices, lods.levels[0].count, lods.mesh.bounds);
+
+        printf("%s: %u vertices, %u levels, built in %.1f ms\n", models[m].c_str(),
+               (unsigned int)vertices.size(), (unsigned int)lods.levels.size(),
+               (profile::now() - start) * 1e3);
+
+        unsigned int original = lods.levels[0].count / 3;
+        for (unsigned int l = 0; l < lods.levels.size(); l++) {
+            const lod::Level & level = lods.levels[l];
+            const unsigned int * levelIndices = indices + level.first;
+
+            for (unsigned int i = 0; i < level.count; i++) {
+                const unsigned int * v = levelIndices + i / 3 * 3;
+                if (levelIndices[i] >= vertices.size() || v[0] == v[1] || v[1] == v[2] || v[0] == v[2]) {
+                    printf("FAILED: level %u has a broken triangle\n", l);
+                    failures++;
+                    break;
+                }
+            }
+
+            TriangleGrid simplified(vertices, levelIndices, level.count, lods.mesh.bounds);
+            float distance = std::max(oneSided(vertices, levelIndices, level.count, full),
+                                      oneSided(vertices, indices, lods.levels[0].count, simplified));
+
+            printf("  level %u  %6u triangles  error %.5f  hausdorff %.5f\n", l, level.count / 3,
+                   level.error / diagonal, distance / diagonal);
+
+            if (level.count / 3 * 8 >= original && distance > hausdorff * diagonal) {
+                printf("FAILED: level %u is over the %.3f hausdorff limit\n", l, hausdorff);
+                failures++;
+            }
+        }
+
+        if (lods.levels.back().count / 3 > reduction * original) {
+            printf("FAILED: only got down to %u of %u triangles\n", lods.levels.back().count / 3, original);
+            failures++;
+        }
+    }
+
+    // The same again as one batch
+    vector<const mesh::TriMesh *> batch;
+    for (unsigned int m = 0; m < meshes.size(); m++)
+        batch.push_back(&meshes[m]);
+
+    double start = profile::now();
+    vector<lod::LodMesh> parallel = lod::buildBatch(batch, lod::Options(), threads);
+    double parallelTime = profile::now() - start;
+
+    jobs::JobSystem js(threads);
+    start = profile::now();
+    vector<lod::LodMesh> pooled = lod::buildBatch(batch, lod::Options(), js);
+    double pooledTime = profile::now() - start;
+
+    printf("%u meshes: %.1f ms one by one, %.1f ms as a batch, %.1f ms on %u jobs threads\n",
+           (unsigned int)meshes.size(), serialTime * 1e3, parallelTime * 1e3, pooledTime * 1e3,
+           js.getThreadCount());
+
+    for (unsigned int m = 0; m < serial.size(); m++) {
+        if (parallel[m].mesh.indices != serial[m].mesh.indices) {
+            printf("FAILED: batch build of %s differs\n", models[m].c_str());
+            failures++;
+        }
+        if (pooled[m].mesh.indices != serial[m].mesh.indices) {
+            printf("FAILED: job system build of %s differs\n", models[m].c_str());
+            failures++;
+        }
+    }
+
+    exit( failures ? EXIT_FAILURE : EXIT_SUCCESS );
+}
@@ -0,0 +1,172 @@
+//========================================================================
+// Level of detail demo. A field of bunnies runs off into the distance;
+// each one is drawn with the coarsest level of its LOD chain whose error
+// projects to less than --pixels on screen (default 1). The camera
+// drifts back and forth, and once a second the number of bunnies at each
+// level and the triangles actually drawn are printed next to what the
+// full meshes would have cost.
+//
+//   lodview [--pixels P] [model]
+//========================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <GL/glew.h>
+#include "GL/glfw.h"
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+#include <math.h>
+#include <string>
+#include <vector>
+
+#include "GLSLProgram.hpp"
+#include "Context.hpp"
+#include "glUtil.hpp"
+#include "Loader.hpp"
+#include "Lod.hpp"
+#include "Profiler.hpp"
+#include "vao.hpp"
+
+#define BUFFER_OFFSET(i) ((GLfloat*)NULL + (i))
+
+using glm::mat3;
+using glm::mat4;
+using glm::vec3;
+using std::string;
+using std::vector;
+
+typedef struct CVertex
+{
+    vec3 pos;
+    vec3 normal;
+} CVertex;
+
+static const int GRID = 9;
+static const float SPACING = 3.0f;
+
+int main( int argc, char* argv[] )
+{
+    int width, height;
+
+    context::Context * ctx = context::createContext( argc, argv );
+    if( !ctx->open( 640, 480, "LOD Viewer" ) )
+    {
+        fprintf( stderr, "Failed to open an OpenGL context\n" );
+        exit( EXIT_FAILURE );
+    }
+
+    string modelPath = "models/bunny2.obj";
+    float maxPixels = 1.0f;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--pixels") && i + 1 < argc)
+            maxPixels = atof(argv[++i]);
+        else
+            modelPath = argv[i];
+    }
+
+    printGLVersion();
+    ctx->setSwapInterval( 1 );
+
+    shader::GLSLProgram prog;
+    if( !prog.compileShaderFromFile("shaders/basicshade.vert", shader::VERTEX) ||
+        !prog.compileShaderFromFile("shaders/basicshade.frag", shader::FRAGMENT) ||
+        !prog.link() )
+    {
+        printf("Shader program failed!\n%s", prog.log().c_str());
+        exit( EXIT_FAILURE );
+    }
+
+    // Normalized first, so the levels' errors are in the units we draw in
+    mesh::TriMesh m = mesh::loadObj(modelPath);
+    if (m.vertices.empty()) {
+        fprintf( stderr, "Failed to load %s\n", modelPath.c_str() );
+        exit( EXIT_FAILURE );
+    }
+    m.normalize(2);
+
+    double start = profile::now();
+    lod::LodMesh lods = lod::build(m);
+    printf("%s: %u levels in %.1f ms\n", modelPath.c_str(), (unsigned int)lods.levels.size(),
+           (profile::now() - start) * 1e3);
+    for (unsigned int l = 0; l < lods.levels.size(); l++)
+        printf("  level %u  %6u triangles  error %.5f\n", l, lods.levels[l].count / 3,
+               lods.levels[l].error);
+
+    const mesh::IndexedMesh & im = lods.mesh;
+    vector<CVertex> packed;
+    for (unsigned int i = 0; i < im.vertices.size(); i++)
+        packed.push_back((CVertex){ im.vertices[i], im.normals[i] });
+
+    // Every level lives in the one element buffer
+    Vao vao;
+    vao.create(GL_ARRAY_BUFFER, packed.size() * sizeof(CVertex), &packed.front(), GL_STATIC_DRAW);
+    vao.setShaderProgram(prog.getHandle());
+    vao.bindAttribute("VertexPosition", 3, GL_FLOAT, GL_FALSE, sizeof(CVertex), BUFFER_OFFSET(0));
+    vao.bindAttribute("VertexNormal", 3, GL_FLOAT, GL_FALSE, sizeof(CVertex), BUFFER_OFFSET(3));
+    vao.createIndices(im.indices.size(), &im.indices.front(), GL_STATIC_DRAW);
+
+    vec3 center = (im.bounds.min + im.bounds.max) * 0.5f;
+    float radius = glm::length(im.bounds.max - im.bounds.min) * 0.5f;
+    float fovy = 45.0f;
+
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+
+    vector<unsigned int> perLevel(lods.levels.size());
+    double lastReport = ctx->getTime();
+    do
+    {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        double t = ctx->getTime();
+
+        ctx->getSize( &width, &height );
+        height = height > 0 ? height : 1;
+
+        // Back and forth over the field
+        vec3 eye(0.0f, 2.0f, -4.0f - 10.0f * (1.0f - cosf((float)t * 0.3f)));
+        mat4 proj = glm::perspective(fovy, (float)width / (float)height, 0.1f, 200.0f);
+        mat4 view = glm::lookAt(eye, vec3(0.0f, 0.0f, eye.z + 10.0f), vec3(0,1,0));
+        float pixelsPerUnit = lod::getPixelsPerUnit(fovy, height);
+
+        std::fill(perLevel.begin(), perLevel.end(), 0);
+        unsigned long drawn = 0;
+        for (int z = 0; z < GRID * 2; z++) {
+            for (int x = 0; x < GRID; x++) {
+                vec3 position((x - GRID / 2) * SPACING, 0.0f, z * SPACING);
+                mat4 model = glm::translate(mat4(1.0f), position);
+
+                // Nearest the bunny can get, never quite zero
+                float distance = glm::length(eye - (position + center)) - radius;
+                unsigned int level = lods.select(std::max(distance, 0.1f), pixelsPerUnit, maxPixels);
+                const lod::Level & chosen = lods.levels[level];
+                perLevel[level]++;
+                drawn += chosen.count / 3;
+
+                // Vao's draws leave no program bound
+                mat3 normal = glm::transpose(glm::mat3(glm::inverse(view * model)));
+                prog.use();
+                prog.setUniform("MVP", proj * view * model);
+                prog.setUniform("NormalMatrix", normal);
+                vao.drawElements(GL_TRIANGLES, chosen.first, chosen.count);
+            }
+        }
+
+        if (t - lastReport >= 1.0) {
+            lastReport = t;
+            printf("levels:");
+            for (unsigned int l = 0; l < perLevel.size(); l++)
+                printf(" %u", perLevel[l]);
+            printf("  %lu triangles of %lu\n", drawn,
+                   (unsigned long)lods.levels[0].count / 3 * GRID * GRID * 2);
+        }
+
+        ctx->swapBuffers();
+    }
+    while( ctx->isRunning() );
+
+    ctx->close();
+    delete ctx;
+
+    exit( EXIT_SUCCESS );
+}
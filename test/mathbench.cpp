@@ -0,0 +1,279 @@
+//========================================================================
+// Batch math benchmark. Times the batch:: functions with each instruction
+// set against the same work done one glm call at a time: --points points
+// through a projection and through an affine model matrix, and --objects
+// objects' matrices concatenated and turned into normal matrices, best
+// of --reps runs each. Needs no window or GPU.
+//
+// Exits non-zero if an instruction set disagrees with the scalar path on
+// a single bit (including short arrays and in place), if the products
+// differ at all from glm's operator*, or if a normal matrix is off from
+// glm::inverseTranspose by more than rounding.
+//
+//   mathbench [--points N] [--objects N] [--reps N]
+//========================================================================
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_inverse.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "BatchMath.hpp"
+#include "Profiler.hpp"
+
+#include "Check.hpp"
+
+using glm::mat3;
+using glm::mat4;
+using glm::vec3;
+using glm::vec4;
+using std::vector;
+
+static float
+random(float lo, float hi)
+{
+    return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+template <class T>
+static bool
+sameBits(const vector<T> & a, const vector<T> & b)
+{
+    return a.size() == b.size() && (a.empty() || !memcmp(&a[0], &b[0], a.size() * sizeof(T)));
+}
+
+static bool
+supported(cull::Isa isa)
+{
+    cull::Isa best = batch::getBestIsa();
+    return isa == cull::SCALAR || isa == best || (isa == cull::SSE && best == cull::AVX);
+}
+
+// Largest difference relative to the largest element, column by column
+static float
+difference(const mat3 & a, const mat3 & b)
+{
+    float worst = 0.0f;
+    for (int k = 0; k < 3; k++) {
+        float scale = std::max(glm::length(b[k]), 1e-30f);
+        worst = std::max(worst, glm::length(a[k] - b[k]) / scale);
+    }
+    return worst;
+}
+
+enum Op { POINTS, AFFINE, CONCATENATE, MULTIPLY, NORMALS, OPS };
+
+class Data
+{
+public:
+    mat4 projection, view, model;
+    vector<vec3> points;
+    vector<mat4> models, locals;
+};
+
+// One run of op, the glm way (isa < 0) or through batch::. Results go
+// into whichever of the outputs the op has.
+static void
+run(Op op, int isa, const Data & d, vector<vec4> & clip, vector<vec3> & moved,
+    vector<mat4> & products, vector<mat3> & normals)
+{
+    unsigned int n = d.points.size(), objects = d.models.size();
+    cull::Isa i = (cull::Isa)isa;
+    switch (op) {
+    case POINTS:
+        if (isa < 0) {
+            mat4 mvp = d.projection * d.view * d.model;
+            for (unsigned int k = 0; k < n; k++)
+                clip[k] = mvp * vec4(d.points[k], 1.0f);
+        } else {
+            batch::transformPoints(d.projection * d.view * d.model, &d.points[0], &clip[0], n, i);
+        }
+        break;
+    case AFFINE:
+        if (isa < 0) {
+            for (unsigned int k = 0; k < n; k++)
+                moved[k] = vec3(d.model * vec4(d.points[k], 1.0f));
+        } else {
+            batch::transformPoints(d.model, &d.points[0], &moved[0], n, i);
+        }
+        break;
+    case CONCATENATE:
+        if (isa < 0) {
+            mat4 viewProjection = d.projection * d.view;
+            for (unsigned int k = 0; k < objects; k++)
+                products[k] = viewProjection * d.models[k];
+        } else {
+            batch::concatenate(d.projection * d.view, &d.models[0], &products[0], objects, i);
+        }
+        break;
+    case MULTIPLY:
+        if (isa < 0) {
+            for (unsigned int k = 0; k < objects; k++)
+                products[k] = d.models[k] * d.locals[k];
+        } else {
+            batch::multiply(&d.models[0], &d.locals[0], &products[0], objects, i);
+        }
+        break;
+    case NORMALS:
+        if (isa < 0) {
+            for (unsigned int k = 0; k < objects; k++)
+                normals[k] = glm::inverseTranspose(mat3(d.models[k]));
+        } else {
+            batch::normalMatrices(&d.models[0], &normals[0], objects, i);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// Every length up to 19, for the remainders, and in place where allowed
+static void
+checkShort(const Data & d, cull::Isa isa)
+{
+    bool same = true;
+    for (unsigned int n = 0; n < 20; n++) {
+        vector<vec4> clip(n + 1), clipRef(n + 1);
+        vector<vec3> moved(n + 1), movedRef(n + 1), inPlace(d.points.begin(), d.points.begin() + n + 1);
+        vector<mat4> concat(n + 1), concatRef(n + 1), product(n + 1), productRef(n + 1);
+        vector<mat3> normals(n + 1), normalsRef(n + 1);
+
+        // Past the end stays as it was
+        clip[n] = clipRef[n] = vec4(-7.0f);
+        moved[n] = movedRef[n] = vec3(-7.0f);
+        concat[n] = concatRef[n] = product[n] = productRef[n] = mat4(-7.0f);
+        normals[n] = normalsRef[n] = mat3(-7.0f);
+
+        batch::transformPoints(d.model, &d.points[0], &clip[0], n, isa);
+        batch::transformPoints(d.model, &d.points[0], &clipRef[0], n, cull::SCALAR);
+        batch::transformPoints(d.model, &d.points[0], &moved[0], n, isa);
+        batch::transformPoints(d.model, &d.points[0], &movedRef[0], n, cull::SCALAR);
+        batch::transformPoints(d.model, &inPlace[0], &inPlace[0], n, isa);
+        inPlace[n] = vec3(-7.0f);
+
+        batch::concatenate(d.view, &d.models[0], &concat[0], n, isa);
+        batch::concatenate(d.view, &d.models[0], &concatRef[0], n, cull::SCALAR);
+        batch::multiply(&d.models[0], &d.locals[0], &product[0], n, isa);
+        batch::multiply(&d.models[0], &d.locals[0], &productRef[0], n, cull::SCALAR);
+        batch::normalMatrices(&d.models[0], &normals[0], n, isa);
+        batch::normalMatrices(&d.models[0], &normalsRef[0], n, cull::SCALAR);
+
+        same = same && sameBits(clip, clipRef) && sameBits(moved, movedRef) && sameBits(inPlace, movedRef) &&
+               sameBits(concat, concatRef) && sameBits(product, productRef) && sameBits(normals, normalsRef);
+
+        // concatenate() into b, multiply() into a
+        vector<mat4> b(d.models.begin(), d.models.begin() + n + 1), a = b;
+        b[n] = a[n] = mat4(-7.0f);
+        batch::concatenate(d.view, &b[0], &b[0], n, isa);
+        batch::multiply(&a[0], &d.locals[0], &a[0], n, isa);
+        same = same && sameBits(b, concatRef) && sameBits(a, productRef);
+    }
+    if (!same)
+        printf("MISMATCH: %s on short arrays or in place\n", cull::getIsaName(isa));
+    expect(same, "short arrays or in place differ from scalar");
+}
+
+int main( int argc, char* argv[] )
+{
+    unsigned int pointCount = 1000000;
+    unsigned int objectCount = 100000;
+    int reps = 5;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--points") && i + 1 < argc)
+            pointCount = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--objects") && i + 1 < argc)
+            objectCount = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--reps") && i + 1 < argc)
+            reps = atoi(argv[++i]);
+    }
+    pointCount = std::max(pointCount, 20u);
+    objectCount = std::max(objectCount, 20u);
+
+    srand(1);
+    Data d;
+    d.projection = glm::perspective(60.0f, 16.0f / 9.0f, 0.1f, 100.0f);
+    d.view = glm::lookAt(vec3(3.0f, 2.0f, 5.0f), vec3(0.0f), vec3(0.0f, 1.0f, 0.0f));
+    d.model = glm::rotate(glm::scale(glm::translate(mat4(1.0f), vec3(1.0f, -2.0f, 0.5f)),
+                                     vec3(2.0f, 1.0f, 0.5f)), 30.0f, vec3(1.0f, 2.0f, 3.0f));
+    for (unsigned int i = 0; i < pointCount; i++)
+        d.points.push_back(vec3(random(-10.0f, 10.0f), random(-10.0f, 10.0f), random(-10.0f, 10.0f)));
+    for (unsigned int i = 0; i < objectCount; i++) {
+        vec3 position(random(-50.0f, 50.0f), random(-5.0f, 5.0f), random(-50.0f, 50.0f));
+        vec3 scale(random(0.5f, 2.0f), random(0.5f, 2.0f), random(0.5f, 2.0f));
+        vec3 axis(random(-1.0f, 1.0f), random(0.1f, 1.0f), random(-1.0f, 1.0f));
+        d.models.push_back(glm::rotate(glm::scale(glm::translate(mat4(1.0f), position), scale),
+                                       random(0.0f, 360.0f), axis));
+        d.locals.push_back(glm::rotate(glm::translate(mat4(1.0f), vec3(0.0f, random(0.0f, 1.0f), 0.0f)),
+                                       random(0.0f, 360.0f), vec3(0.0f, 1.0f, 0.0f)));
+    }
+
+    const cull::Isa isas[4] = { cull::SCALAR, cull::SSE, cull::AVX, cull::NEON };
+    for (int k = 0; k < 4; k++)
+        if (supported(isas[k]))
+            checkShort(d, isas[k]);
+
+    printf("%u points, %u objects, best of %d\n", pointCount, objectCount, reps);
+    printf("%-12s %10s %10s %10s %10s %10s\n", "", "glm", "scalar", "sse", "avx", "neon");
+
+    vector<vec4> clip(pointCount), clipRef(pointCount);
+    vector<vec3> moved(pointCount), movedRef(pointCount);
+    vector<mat4> products(objectCount), productsRef(objectCount);
+    vector<mat3> normals(objectCount), normalsRef(objectCount);
+
+    for (int op = 0; op < OPS; op++) {
+        const char * names[OPS] = { "points", "affine", "concatenate", "multiply", "normals" };
+        double times[5];
+        for (int k = -1; k < 4; k++) {
+            times[k + 1] = 0.0;
+            if (k >= 0 && !supported(isas[k]))
+                continue;
+            times[k + 1] = 1e30;
+            bool reference = k < 0;
+            for (int r = 0; r < reps; r++) {
+                double start = profile::now();
+                if (reference)
+                    run((Op)op, -1, d, clipRef, movedRef, productsRef, normalsRef);
+                else
+                    run((Op)op, isas[k], d, clip, moved, products, normals);
+                times[k + 1] = std::min(times[k + 1], profile::now() - start);
+            }
+            if (reference)
+                continue;
+
+            bool same = true;
+            switch (op) {
+            case POINTS:        same = sameBits(clip, clipRef); break;
+            case AFFINE:        same = sameBits(moved, movedRef); break;
+            case CONCATENATE:
+            case MULTIPLY:      same = sameBits(products, productsRef); break;
+            case NORMALS: {
+                float worst = 0.0f;
+                for (unsigned int i = 0; i < objectCount; i++)
+                    worst = std::max(worst, difference(normals[i], normalsRef[i]));
+                same = worst < 1e-5f;
+                break;
+            }
+            }
+            if (!same)
+                printf("MISMATCH: %s %s\n", names[op], cull::getIsaName(isas[k]));
+            expect(same, "results differ from glm");
+        }
+
+        printf("%-12s", names[op]);
+        for (int k = 0; k < 5; k++) {
+            if (times[k] > 0.0)
+                printf(" %8.2fms", times[k] * 1e3);
+            else
+                printf(" %10s", "-");
+        }
+        printf("\n");
+    }
+
+    exit( failures ? EXIT_FAILURE : EXIT_SUCCESS );
+}
@@ -0,0 +1,343 @@
+//========================================================================
+// Meshlet check. Splits the bundled models into meshlets and looks at
+// them from --views directions, half from outside the whole model and
+// half close up with most of it off screen. Prints, per view, the share
+// of triangles rejected with their meshlets by the frustum and by the
+// normal cones, next to the share of triangles that face away (the most
+// backface culling could ever get). Needs no window or GPU.
+//
+// Exits non-zero if a meshlet is over its limits or the meshlets lose
+// or duplicate a triangle, if a bounding sphere misses a vertex, if a
+// rejected meshlet had a triangle that could have been seen, or if the
+// SSE path disagrees with the scalar one.
+//
+// With --gpu the same culling runs in shaders/meshletcull.comp on a
+// headless context too, and more than --tolerance percent of meshlets
+// coming out differently fails the run.
+//
+//   meshletcheck [--views N] [--gpu] [--tolerance P] [models...]
+//========================================================================
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <GL/glew.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "Context.hpp"
+#include "GLSLProgram.hpp"
+#include "Loader.hpp"
+#include "Meshlet.hpp"
+#include "Profiler.hpp"
+
+using glm::ivec3;
+using glm::mat4;
+using glm::vec3;
+using std::string;
+using std::vector;
+
+#ifdef HAVE_EGL
+
+// The bounds in one shader storage buffer and a visibility word per
+// meshlet plus a count in another
+class GpuCuller
+{
+public:
+    GpuCuller():bounds(0), results(0), count(0) {}
+    ~GpuCuller()
+    {
+        if (bounds)
+            glDeleteBuffers(1, &bounds);
+        if (results)
+            glDeleteBuffers(1, &results);
+    }
+
+    bool init()
+    {
+        if (!prog.compileShaderFromFile("shaders/meshletcull.comp", shader::COMPUTE) || !prog.link()) {
+            printf("Meshlet cull shader failed!\n%s", prog.log().c_str());
+            return false;
+        }
+        glGenBuffers(1, &bounds);
+        glGenBuffers(1, &results);
+        return true;
+    }
+
+    void upload(const meshlet::MeshletArray & m)
+    {
+        count = m.size();
+        const vector<float> * fields[8] = { &m.cx, &m.cy, &m.cz, &m.radius, &m.ax, &m.ay, &m.az, &m.cutoff };
+        vector<float> packed;
+        for (int f = 0; f < 8; f++)
+            packed.insert(packed.end(), fields[f]->begin(), fields[f]->end());
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, bounds);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, packed.size() * sizeof(float), &packed.front(), GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, results);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, (count + 1) * sizeof(GLuint), NULL, GL_DYNAMIC_READ);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    unsigned int cull(const cull::Frustum & frustum, const vec3 & camera, int tests,
+                      vector<unsigned char> & visible)
+    {
+        GLuint zero = 0;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, results);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &zero);
+
+        prog.use();
+        char name[16];
+        for (int p = 0; p < 6; p++) {
+            snprintf(name, sizeof(name), "Planes[%d]", p);
+            prog.setUniform(name, frustum.planes[p]);
+        }
+        prog.setUniform("Camera", camera);
+        prog.setUniform("Count", (int)count);
+        prog.setUniform("Tests", tests);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, bounds);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, results);
+        glDispatchCompute((count + 63) / 64, 1, 1);
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+        vector<GLuint> words(count + 1);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, words.size() * sizeof(GLuint), &words.front());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glUseProgram(0);
+
+        visible.resize(count);
+        for (unsigned int i = 0; i < count; i++)
+            visible[i] = words[i + 1];
+        return words[0];
+    }
+
+protected:
+    shader::GLSLProgram prog;
+    GLuint              bounds, results;
+    unsigned int        count;
+};
+
+#endif
+
+static bool
+isBackFacing(const vec3 & a, const vec3 & b, const vec3 & c, const vec3 & eye)
+{
+    // Degenerate ones aren't drawn either way
+    vec3 n = glm::cross(b - a, c - a);
+    return glm::dot(n, a - eye) >= -1e-5f * glm::length(n) * glm::length(a - eye);
+}
+
+static bool
+isOutside(const cull::Frustum & f, const vec3 & a, const vec3 & b, const vec3 & c)
+{
+    for (int p = 0; p < 6; p++) {
+        vec3 n(f.planes[p]);
+        float w = f.planes[p].w;
+        if (glm::dot(n, a) + w < 0.0f && glm::dot(n, b) + w < 0.0f && glm::dot(n, c) + w < 0.0f)
+            return true;
+    }
+    return false;
+}
+
+int main( int argc, char* argv[] )
+{
+    int views = 16;
+    bool gpu = false;
+    double tolerance = 1.0;
+    vector<string> models;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--views") && i + 1 < argc)
+            views = std::max(2, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--gpu"))
+            gpu = true;
+        else if (!strcmp(argv[i], "--tolerance") && i + 1 < argc)
+            tolerance = atof(argv[++i]);
+        else
+            models.push_back(argv[i]);
+    }
+    if (models.empty()) {
+        models.push_back("models/bunny2.obj");
+        models.push_back("models/armadillo_lowres.obj");
+    }
+
+#ifdef HAVE_EGL
+    // The culler's program needs the context to exist first
+    context::EglContext * ctx = NULL;
+    GpuCuller * gpuCuller = NULL;
+    if (gpu) {
+        ctx = new context::EglContext(context::Options());
+        if (ctx->open(64, 64, "Meshlet check"))
+            gpuCuller = new GpuCuller();
+        if (!gpuCuller || !gpuCuller->init()) {
+            fprintf( stderr, "Failed to set up the GPU path\n" );
+            exit( EXIT_FAILURE );
+        }
+    }
+#else
+    if (gpu)
+        printf("Built without EGL; skipping the GPU comparison\n");
+    gpu = false;
+#endif
+
+    int failures = 0;
+    for (unsigned int mi = 0; mi < models.size(); mi++) {
+        mesh::TriMesh tri = mesh::loadObj(models[mi]);
+        if (tri.vertices.empty()) {
+            printf("FAILED: %s did not load\n", models[mi].c_str());
+            exit( EXIT_FAILURE );
+        }
+        tri.normalize(1);
+        mesh::IndexedMesh m(tri);
+
+        double start = profile::now();
+        meshlet::MeshletArray meshlets = meshlet::build(m);
+        double buildTime = profile::now() - start;
+
+        unsigned int count = meshlets.size();
+        printf("%s: %u triangles in %u meshlets, %.1f vertices and %.1f triangles each, built in %.1f ms\n",
+               models[mi].c_str(), m.triangleCount(), count, (double)meshlets.vertices.size() / count,
+               (double)meshlets.triangles.size() / 3 / count, buildTime * 1e3);
+
+        // Limits, bounds, and every triangle exactly once
+        meshlet::Options limits;
+        for (unsigned int i = 0; i < count; i++) {
+            if (meshlets.vertexCount[i] > limits.maxVertices || meshlets.triangleCount[i] > limits.maxTriangles) {
+                printf("FAILED: meshlet %u has %u vertices and %u triangles\n", i,
+                       meshlets.vertexCount[i], meshlets.triangleCount[i]);
+                failures++;
+            }
+
+            vec3 center(meshlets.cx[i], meshlets.cy[i], meshlets.cz[i]);
+            for (unsigned int v = 0; v < meshlets.vertexCount[i]; v++) {
+                const vec3 & p = m.vertices[meshlets.vertices[meshlets.vertexOffset[i] + v]];
+                if (glm::length(p - center) > meshlets.radius[i] * 1.0001f) {
+                    printf("FAILED: meshlet %u's sphere misses a vertex\n", i);
+                    failures++;
+                    break;
+                }
+            }
+        }
+
+        vector<unsigned int> indices = meshlets.getIndices();
+        vector<ivec3> before, after;
+        for (unsigned int t = 0; t < m.triangleCount(); t++)
+            before.push_back(ivec3(m.indices[t * 3], m.indices[t * 3 + 1], m.indices[t * 3 + 2]));
+        for (unsigned int t = 0; t < indices.size() / 3; t++)
+            after.push_back(ivec3(indices[t * 3], indices[t * 3 + 1], indices[t * 3 + 2]));
+        struct Less {
+            bool operator()(const ivec3 & a, const ivec3 & b) const
+            {
+                return a.x != b.x ? a.x < b.x : a.y != b.y ? a.y < b.y : a.z < b.z;
+            }
+        };
+        std::sort(before.begin(), before.end(), Less());
+        std::sort(after.begin(), after.end(), Less());
+        if (before != after) {
+            printf("FAILED: the meshlets don't hold the mesh's triangles\n");
+            failures++;
+        }
+
+#ifdef HAVE_EGL
+        if (gpu)
+            gpuCuller->upload(meshlets);
+#endif
+
+        mat4 proj = glm::perspective(45.0f, 4.0f / 3.0f, 0.01f, 100.0f);
+        vector<unsigned char> reference(count), simd(count), frustumOnly(count), backOnly(count), onGpu;
+        double frustumSum = 0.0, backSum = 0.0, totalSum = 0.0, facingSum = 0.0, cullTime = 0.0;
+        unsigned int gpuMismatches = 0;
+
+        for (int view = 0; view < views; view++) {
+            // Alternately the whole model from 3 units out, and 0.6 units
+            // from a point on its surface
+            bool close = view % 2;
+            float angle = glm::radians(360.0f * view / views);
+            vec3 dir(sinf(angle), 0.3f * cosf(angle * 3.0f), cosf(angle));
+            vec3 target = close ? m.vertices[m.indices[(view * 997) % m.indices.size()]] : vec3(0.0f);
+            vec3 eye = target + glm::normalize(dir) * (close ? 0.6f : 3.0f);
+            cull::Frustum frustum(proj * glm::lookAt(eye, target, vec3(0, 1, 0)));
+
+            start = profile::now();
+            meshlet::cullMeshlets(frustum, eye, meshlets, &reference.front(), meshlet::ALL, cull::SCALAR);
+            cullTime += profile::now() - start;
+
+            meshlet::cullMeshlets(frustum, eye, meshlets, &simd.front(), meshlet::ALL, cull::SSE);
+            meshlet::cullMeshlets(frustum, eye, meshlets, &frustumOnly.front(), meshlet::FRUSTUM);
+            meshlet::cullMeshlets(frustum, eye, meshlets, &backOnly.front(), meshlet::BACKFACE);
+
+            if (simd != reference) {
+                printf("MISMATCH: sse and scalar differ in view %d\n", view);
+                failures++;
+            }
+
+            // Triangles thrown away, and whether any of them shouldn't have been
+            unsigned int byFrustum = 0, byBackface = 0, total = 0, facing = 0;
+            for (unsigned int i = 0; i < count; i++) {
+                unsigned int first = meshlets.triangleOffset[i] * 3, tris = meshlets.triangleCount[i];
+                byFrustum += frustumOnly[i] ? 0 : tris;
+                byBackface += backOnly[i] ? 0 : tris;
+                total += reference[i] ? 0 : tris;
+
+                for (unsigned int t = 0; t < tris; t++) {
+                    const vec3 & a = m.vertices[indices[first + t * 3]];
+                    const vec3 & b = m.vertices[indices[first + t * 3 + 1]];
+                    const vec3 & c = m.vertices[indices[first + t * 3 + 2]];
+                    bool back = isBackFacing(a, b, c, eye);
+                    facing += back;
+                    if ((!backOnly[i] && !back) || (!frustumOnly[i] && !isOutside(frustum, a, b, c))) {
+                        printf("FAILED: view %d rejected a visible triangle in meshlet %u\n", view, i);
+                        failures++;
+                        break;
+                    }
+                }
+            }
+
+            double all = m.triangleCount();
+            printf("  view %2d %-5s  frustum %5.1f%%  backface %5.1f%% (of %5.1f%% facing away)  total %5.1f%%\n",
+                   view, close ? "close" : "far", 100.0 * byFrustum / all, 100.0 * byBackface / all,
+                   100.0 * facing / all, 100.0 * total / all);
+            frustumSum += byFrustum / all;
+            backSum += byBackface / all;
+            totalSum += total / all;
+            facingSum += facing / all;
+
+#ifdef HAVE_EGL
+            if (gpu) {
+                gpuCuller->cull(frustum, eye, meshlet::ALL, onGpu);
+                for (unsigned int i = 0; i < count; i++)
+                    gpuMismatches += onGpu[i] != reference[i];
+            }
+#endif
+        }
+
+        printf("  average   frustum %5.1f%%  backface %5.1f%% (of %5.1f%% facing away)  total %5.1f%%,"
+               " %.2f us per cull\n", 100.0 * frustumSum / views, 100.0 * backSum / views,
+               100.0 * facingSum / views, 100.0 * totalSum / views, cullTime / views * 1e6);
+
+        if (gpu) {
+            double percent = 100.0 * gpuMismatches / (count * views);
+            printf("  gpu: %u of %u results differ (%.2f%%)\n", gpuMismatches, count * views, percent);
+            if (percent > tolerance) {
+                printf("FAILED: the compute shader disagrees too often\n");
+                failures++;
+            }
+        }
+    }
+
+#ifdef HAVE_EGL
+    if (ctx) {
+        delete gpuCuller;
+        ctx->close();
+        delete ctx;
+    }
+#endif
+
+    exit( failures ? EXIT_FAILURE : EXIT_SUCCESS );
+}
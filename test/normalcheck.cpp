@@ -0,0 +1,247 @@
+//========================================================================
+// Normal and tangent generation check. Compares generated normals with
+// the ones stored in the bundled models and with the exact normals of
+// sphere.obj, checks hard edges on a cube and tangents on planes and a
+// uv sphere, loads an .obj that has no normals at all, and times both
+// on a --size x --size grid (two triangles per cell) on one thread and
+// on --threads. Needs no window or GPU.
+//
+// Exits non-zero if any of those is off by more than a few degrees, or
+// if the thread count changes a single bit of the results.
+//
+//   normalcheck [--size N] [--threads N]
+//========================================================================
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "Loader.hpp"
+#include "Normals.hpp"
+#include "Profiler.hpp"
+
+#include "Check.hpp"
+
+using glm::vec2;
+using glm::vec3;
+using glm::vec4;
+using std::vector;
+
+static float
+degreesBetween(const vec3 & a, const vec3 & b)
+{
+    return glm::degrees(acosf(glm::clamp(glm::dot(glm::normalize(a), glm::normalize(b)), -1.0f, 1.0f)));
+}
+
+// Two triangles per cell of a grid over [0,1]^2, positions from place()
+template <typename Place>
+static mesh::TriMesh
+makeGrid(int size, Place place)
+{
+    mesh::TriMesh m;
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            vec2 c[4] = { vec2(x, y), vec2(x + 1, y), vec2(x + 1, y + 1), vec2(x, y + 1) };
+            const int corners[6] = { 0, 1, 2, 0, 2, 3 };
+            for (int k = 0; k < 6; k++) {
+                vec2 uv = c[corners[k]] / (float)size;
+                m.vertices.push_back(place(uv));
+                m.uvs.push_back(uv);
+            }
+        }
+    }
+    m.computeBounds();
+    return m;
+}
+
+static vec3
+onSphere(const vec2 & uv)
+{
+    float theta = uv.y * 3.14159265f, phi = uv.x * 2.0f * 3.14159265f;
+    return vec3(sinf(theta) * sinf(phi), -cosf(theta), sinf(theta) * cosf(phi));
+}
+
+int main( int argc, char* argv[] )
+{
+    int size = 700;
+    unsigned int threads = 4;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--size") && i + 1 < argc)
+            size = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+    }
+
+    mesh::NormalOptions smooth;
+    smooth.creaseAngle = 180.0f;
+
+    // Against the normals the models came with, and the exact ones
+    const char * models[] = { "models/bunny2.obj", "models/armadillo_lowres.obj", "models/sphere.obj" };
+    for (int i = 0; i < 3; i++) {
+        mesh::TriMesh m = mesh::loadObj(models[i]);
+        vector<vec3> stored = m.normals;
+
+        for (int w = 0; w < 2; w++) {
+            smooth.weighting = w ? mesh::ANGLE_WEIGHTED : mesh::AREA_WEIGHTED;
+            mesh::computeNormals(m, smooth);
+
+            double sum = 0.0, exact = 0.0;
+            for (unsigned int v = 0; v < m.vertices.size(); v++) {
+                sum += degreesBetween(m.normals[v], stored[v]);
+                exact += degreesBetween(m.normals[v], m.vertices[v] - m.bounds.center());
+            }
+            sum /= m.vertices.size();
+            exact /= m.vertices.size();
+
+            printf("%s, %s: %.2f degrees from the stored normals", models[i],
+                   w ? "angle weighted" : "area weighted", sum);
+            if (i == 2)
+                printf(", %.2f from the true ones", exact);
+            printf("\n");
+
+            // The models' normals were area weighted when they were made
+            expect(sum < (w ? 10.0 : 0.5), "generated normals are far from the stored ones");
+            if (i == 2)
+                expect(exact < 2.0, "generated sphere normals are off");
+        }
+    }
+
+    // A cube: hard at 60 degrees, corners pointing diagonally out when smooth
+    {
+        mesh::TriMesh cube;
+        for (int axis = 0; axis < 3; axis++) {
+            for (int side = -1; side <= 1; side += 2) {
+                vec3 n(0.0f), u(0.0f), v(0.0f);
+                n[axis] = side;
+                u[(axis + 1) % 3] = 1.0f;
+                v[(axis + 2) % 3] = side;
+                vec3 c[4] = { n - u - v, n + u - v, n + u + v, n - u + v };
+                const int corners[6] = { 0, 1, 2, 0, 2, 3 };
+                for (int k = 0; k < 6; k++)
+                    cube.vertices.push_back(c[corners[k]]);
+            }
+        }
+
+        mesh::computeNormals(cube);
+        bool hard = true;
+        for (unsigned int v = 0; v < cube.vertices.size(); v++) {
+            vec3 face = glm::cross(cube.vertices[v / 3 * 3 + 1] - cube.vertices[v / 3 * 3],
+                                   cube.vertices[v / 3 * 3 + 2] - cube.vertices[v / 3 * 3]);
+            hard = hard && degreesBetween(cube.normals[v], face) < 1e-3f;
+        }
+        expect(hard, "cube edges aren't hard at the default crease angle");
+
+        mesh::computeNormals(cube, smooth);
+        bool round = true;
+        for (unsigned int v = 0; v < cube.vertices.size(); v++)
+            round = round && degreesBetween(cube.normals[v], cube.vertices[v]) < 1e-3f;
+        expect(round, "smooth cube normals don't point out of the corners");
+        printf("cube: hard and smooth edges %s\n", hard && round ? "ok" : "wrong");
+    }
+
+    // Tangents: along +u on a plane, mirrored when the uvs are, and along
+    // the lines of latitude on a uv sphere
+    {
+        mesh::TriMesh plane = makeGrid(4, [](const vec2 & uv) { return vec3(uv, 0.0f); });
+        mesh::TriMesh mirror = makeGrid(4, [](const vec2 & uv) { return vec3(-uv.x, uv.y, 0.0f); });
+        // Wound the other way round, so the normals still face +z
+        for (unsigned int v = 0; v < mirror.vertices.size(); v += 3) {
+            std::swap(mirror.vertices[v + 1], mirror.vertices[v + 2]);
+            std::swap(mirror.uvs[v + 1], mirror.uvs[v + 2]);
+        }
+
+        mesh::computeNormals(plane);
+        mesh::computeNormals(mirror);
+        expect(mesh::computeTangents(plane) && mesh::computeTangents(mirror), "computeTangents refused a mesh");
+
+        bool planeOk = true, mirrorOk = true;
+        for (unsigned int v = 0; v < plane.vertices.size(); v++) {
+            planeOk = planeOk && plane.tangents[v] == vec4(1, 0, 0, 1) && plane.normals[v] == vec3(0, 0, 1);
+            mirrorOk = mirrorOk && mirror.tangents[v] == vec4(-1, 0, 0, -1) && mirror.normals[v] == vec3(0, 0, 1);
+        }
+        expect(planeOk, "plane tangents aren't +x with a positive sign");
+        expect(mirrorOk, "mirrored plane tangents aren't -x with a negative sign");
+
+        mesh::TriMesh sphere = makeGrid(64, onSphere);
+        mesh::computeNormals(sphere, smooth);
+        mesh::computeTangents(sphere);
+
+        double sum = 0.0, worst = 0.0;
+        unsigned int counted = 0;
+        bool frames = true;
+        for (unsigned int v = 0; v < sphere.vertices.size(); v++) {
+            vec3 t(sphere.tangents[v]);
+            frames = frames && fabsf(glm::length(t) - 1.0f) < 1e-4f &&
+                     fabsf(glm::dot(t, sphere.normals[v])) < 1e-4f && sphere.tangents[v].w == 1.0f;
+
+            // The poles have no direction to speak of
+            float theta = sphere.uvs[v].y * 3.14159265f;
+            if (sinf(theta) < 0.1f)
+                continue;
+            float phi = sphere.uvs[v].x * 2.0f * 3.14159265f;
+            float error = degreesBetween(t, vec3(cosf(phi), 0.0f, -sinf(phi)));
+            sum += error;
+            worst = std::max(worst, (double)error);
+            counted++;
+        }
+        printf("tangents: planes %s, uv sphere %.2f degrees off on average, %.2f at worst\n",
+               planeOk && mirrorOk ? "ok" : "wrong", sum / counted, worst);
+        expect(frames, "uv sphere tangent frames aren't orthonormal and right handed");
+        expect(sum / counted < 1.0 && worst < 5.0, "uv sphere tangents are off");
+    }
+
+    // An .obj with nothing but positions and faces
+    {
+        const char * path = "normalcheck.obj";
+        FILE * f = fopen(path, "w");
+        fprintf(f, "v 0 0 0\nv 1 0 0\nv 0 1 0\nv 0 0 1\nf 1 3 2\nf 1 2 4\nf 1 4 3\nf 2 3 4\n");
+        fclose(f);
+        mesh::TriMesh m = mesh::loadObj(path);
+        remove(path);
+
+        bool ok = m.vertices.size() == 12 && m.normals.size() == 12 &&
+                  degreesBetween(m.normals[0], vec3(0, 0, -1)) < 1e-3f &&
+                  degreesBetween(m.normals[9], vec3(1, 1, 1)) < 1e-3f;
+        printf("positions only .obj: %u corners, normals %s\n", (unsigned int)m.vertices.size(), ok ? "ok" : "wrong");
+        expect(ok, "normals for an .obj without any are wrong");
+    }
+
+    // Speed, and the same bits on any number of threads
+    {
+        mesh::TriMesh grid = makeGrid(size, [](const vec2 & uv) {
+            return vec3(uv.x, 0.05f * sinf(uv.x * 40.0f) * cosf(uv.y * 30.0f), uv.y);
+        });
+        mesh::TriMesh serial = grid;
+
+        mesh::NormalOptions one, many;
+        one.threads = 1;
+        many.threads = threads;
+
+        double start = profile::now();
+        mesh::computeNormals(serial, one);
+        double normalsOne = profile::now() - start;
+        start = profile::now();
+        mesh::computeTangents(serial, 1);
+        double tangentsOne = profile::now() - start;
+
+        start = profile::now();
+        mesh::computeNormals(grid, many);
+        double normalsMany = profile::now() - start;
+        start = profile::now();
+        mesh::computeTangents(grid, threads);
+        double tangentsMany = profile::now() - start;
+
+        printf("%u triangles: normals %.1f ms on 1 thread, %.1f ms on %u; tangents %.1f ms, %.1f ms\n",
+               (unsigned int)grid.vertices.size() / 3, normalsOne * 1e3, normalsMany * 1e3, threads,
+               tangentsOne * 1e3, tangentsMany * 1e3);
+        expect(serial.normals == grid.normals && serial.tangents == grid.tangents,
+               "results depend on the thread count");
+    }
+
+    exit( failures ? EXIT_FAILURE : EXIT_SUCCESS );
+}
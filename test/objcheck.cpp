@@ -0,0 +1,244 @@
+//========================================================================
+// OBJ loader check. Loads small files covering the grammar (n-gons,
+// relative indices, v, v/t, v//n and v/t/n corners, objects, groups,
+// materials, continuation lines, CRLF, bad faces) and checks every
+// corner, then checks the number parser bit for bit against strtof.
+//
+// Then times loading a --size x --size grid with uvs and normals against
+// reading the same file line by line with sscanf, the way the loader
+// used to, and exits non-zero if it is any slower than that, or if
+// anything else was wrong. Needs no window or GPU.
+//
+//   objcheck [--size N]
+//========================================================================
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "Loader.hpp"
+#include "Profiler.hpp"
+
+#include "Check.hpp"
+
+using glm::vec2;
+using glm::vec3;
+using std::string;
+using std::vector;
+
+static const char * PATH = "objcheck.obj";
+
+static mesh::TriMesh
+loadText(const char * text)
+{
+    FILE * f = fopen(PATH, "wb");
+    fputs(text, f);
+    fclose(f);
+    mesh::TriMesh m = mesh::loadObj(PATH);
+    remove(PATH);
+    return m;
+}
+
+static bool
+sameSubMesh(const mesh::SubMesh & s, const char * object, const char * group, int material,
+            unsigned int first, unsigned int count)
+{
+    return s.object == object && s.group == group && s.material == material &&
+           s.first == first && s.count == count;
+}
+
+// What the loader did before: a line at a time, trying sscanf patterns
+static unsigned int
+readWithSscanf(const char * path)
+{
+    std::ifstream fin(path);
+    vector<vec3> vertices, normals;
+    vector<vec2> uvs;
+    vector<unsigned int> indices;
+    float x, y, z;
+    unsigned int v[3], t[3], n[3];
+
+    string s;
+    while (getline(fin, s)) {
+        if (sscanf(s.c_str(), "v %f %f %f", &x, &y, &z) == 3)
+            vertices.push_back(vec3(x, y, z));
+        else if (sscanf(s.c_str(), "vt %f %f", &x, &y) == 2)
+            uvs.push_back(vec2(x, y));
+        else if (sscanf(s.c_str(), "vn %f %f %f", &x, &y, &z) == 3)
+            normals.push_back(vec3(x, y, z));
+        else if (sscanf(s.c_str(), "f %u/%u/%u %u/%u/%u %u/%u/%u",
+                        &v[0], &t[0], &n[0], &v[1], &t[1], &n[1], &v[2], &t[2], &n[2]) == 9) {
+            for (int k = 0; k < 3; k++) {
+                indices.push_back(v[k]);
+                indices.push_back(t[k]);
+                indices.push_back(n[k]);
+            }
+        }
+    }
+    return indices.size() / 9;
+}
+
+int main( int argc, char* argv[] )
+{
+    int size = 400;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--size") && i + 1 < argc)
+            size = atoi(argv[++i]);
+    }
+
+    // Quads, pentagons, relative indices, groups and materials
+    {
+        mesh::TriMesh m = loadText(
+            "# corners of a square, and a point above it\n"
+            "mtllib a.mtl b.mtl\n"
+            "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nv 0.5 1.5 0\n"
+            "vt 0 0\nvt 1 0\nvt 1 1\nvt 0 1\nvt 0.5 1.5\n"
+            "vn 0 0 1\n"
+            "o thing\n"
+            "g top\n"
+            "usemtl red\n"
+            "f 1/1/1 2/2/1 3/3/1 4/4/1\n"
+            "f -5/-5/-1 -4/-4/-1 \\\n"
+            "  -3/-3/-1\n"
+            "usemtl blue\n"
+            "s 1\n"
+            "f 1/1/1 2/2/1 3/3/1 5/5/1 4/4/1 # a pentagon\n"
+            "g bottom\n"
+            "usemtl red\n"
+            "f 1/1/1 2/2/1 3/3/1\n"
+            "f 1/1/1 2/2/1 9/1/1\n"
+            "f 1/1/1 2/2/1\n");
+
+        const unsigned int expected[] = { 0, 1, 2, 0, 2, 3,  0, 1, 2,  0, 1, 2, 0, 2, 4, 0, 4, 3,  0, 1, 2 };
+        const vec2 square[] = { vec2(0, 0), vec2(1, 0), vec2(1, 1), vec2(0, 1), vec2(0.5f, 1.5f) };
+        const unsigned int count = sizeof(expected) / sizeof(expected[0]);
+
+        bool corners = m.vertices.size() == count && m.uvs.size() == count && m.normals.size() == count;
+        for (unsigned int i = 0; corners && i < count; i++)
+            corners = vec2(m.vertices[i]) == square[expected[i]] && m.vertices[i].z == 0.0f &&
+                      m.uvs[i] == square[expected[i]] && m.normals[i] == vec3(0, 0, 1);
+        expect(corners, "n-gons or relative indices came out wrong");
+
+        bool groups = m.submeshes.size() == 3 &&
+                      sameSubMesh(m.submeshes[0], "thing", "top", 0, 0, 9) &&
+                      sameSubMesh(m.submeshes[1], "thing", "top", 1, 9, 9) &&
+                      sameSubMesh(m.submeshes[2], "thing", "bottom", 0, 18, 3);
+        bool materials = m.materials.size() == 2 && m.materials[0] == "red" && m.materials[1] == "blue" &&
+                         m.materialLibraries.size() == 2 && m.materialLibraries[0] == "a.mtl" &&
+                         m.materialLibraries[1] == "b.mtl";
+        expect(groups, "submeshes are wrong");
+        expect(materials, "materials or material libraries are wrong");
+        printf("grammar: %u corners, %u submeshes, %u materials: %s\n", (unsigned int)m.vertices.size(),
+               (unsigned int)m.submeshes.size(), (unsigned int)m.materials.size(),
+               corners && groups && materials ? "ok" : "wrong");
+    }
+
+    // f v and f v/t, CRLF, exponents; normals are generated
+    {
+        mesh::TriMesh m = loadText(
+            "v 0 0 0\r\nv 1e0 0 0\r\nv 0 -0.5E+1 0 1.0\r\n"
+            "vt 0.25\r\nvt 1 0 0\r\nvt 0 1\r\n"
+            "f 1/1 2/2 3/3\r\n"
+            "f -3 -2 -1\r\n");
+        bool ok = m.vertices.size() == 6 && m.normals.size() == 6 && m.uvs.empty() &&
+                  m.vertices[1] == vec3(1, 0, 0) && m.vertices[2] == vec3(0, -5, 0) &&
+                  glm::length(m.normals[0] - vec3(0, 0, -1)) < 1e-6f && m.submeshes.size() == 1 &&
+                  sameSubMesh(m.submeshes[0], "", "", -1, 0, 6);
+
+        mesh::TriMesh t = loadText("v 0 0 0\nv 1 0 0\nv 0 1 0\nvt 0.25\nvt 1 0 0\nvt 0 1\nf 1/1 2/2 3/3\n");
+        ok = ok && t.uvs.size() == 3 && t.uvs[0] == vec2(0.25f, 0.0f) && t.uvs[2] == vec2(0, 1);
+        printf("positions and uvs only: %s\n", ok ? "ok" : "wrong");
+        expect(ok, "faces without normals or uvs came out wrong");
+    }
+
+    // Numbers in every format exporters use, compared with strtof
+    {
+        const char * formats[] = { "%.6f", "%g", "%.9g", "%e", "%.17g", "%.3e" };
+        vector<string> numbers;
+        string text;
+        srand(1);
+        for (int i = 0; i < 30000; i++) {
+            double magnitude = pow(10.0, (rand() % 16) - 8);
+            double value = (rand() / (double)RAND_MAX - 0.5) * magnitude;
+            char number[64];
+            snprintf(number, sizeof(number), formats[i % 6], value);
+            numbers.push_back(number);
+        }
+        numbers.push_back("-0");
+        numbers.push_back("1e-40");
+        numbers.push_back("3.4028234e38");
+        numbers.push_back("123456789012345678901234");
+        numbers.push_back(".5");
+        numbers.push_back("+7.");
+        while (numbers.size() % 3)
+            numbers.push_back("0");
+
+        for (unsigned int i = 0; i < numbers.size(); i += 3)
+            text += "v " + numbers[i] + " " + numbers[i + 1] + " " + numbers[i + 2] + "\nf -1 -1 -1\n";
+
+        mesh::TriMesh m = loadText(text.c_str());
+        unsigned int wrong = m.vertices.size() == numbers.size() ? 0 : numbers.size();
+        for (unsigned int i = 0; !wrong && i < numbers.size(); i++) {
+            float expected = strtof(numbers[i].c_str(), NULL);
+            if (memcmp(&m.vertices[i / 3 * 3][i % 3], &expected, sizeof(float))) {
+                if (wrong++ < 5)
+                    printf("MISMATCH: %s read as %.9g, not %.9g\n", numbers[i].c_str(),
+                           m.vertices[i / 3 * 3][i % 3], expected);
+            }
+        }
+        printf("numbers: %u of %u differ from strtof\n", wrong, (unsigned int)numbers.size());
+        expect(!wrong, "numbers aren't read exactly");
+    }
+
+    // Throughput, against the old way of reading
+    {
+        FILE * f = fopen(PATH, "w");
+        for (int y = 0; y <= size; y++)
+            for (int x = 0; x <= size; x++)
+                fprintf(f, "v %f %f %f\n", x / (float)size, 0.05f * sinf(x * 0.1f) * cosf(y * 0.07f), y / (float)size);
+        for (int y = 0; y <= size; y++)
+            for (int x = 0; x <= size; x++)
+                fprintf(f, "vt %f %f\n", x / (float)size, y / (float)size);
+        for (int y = 0; y <= size; y++)
+            for (int x = 0; x <= size; x++)
+                fprintf(f, "vn %f %f %f\n", 0.0f, 1.0f, 0.0f);
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                int a = y * (size + 1) + x + 1, b = a + 1, c = a + size + 2, d = a + size + 1;
+                fprintf(f, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, b, b, b, c, c, c);
+                fprintf(f, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, c, c, c, d, d, d);
+            }
+        }
+        long bytes = ftell(f);
+        fclose(f);
+
+        double fast = 1e30, slow = 1e30;
+        unsigned int triangles = 0, reference = 0;
+        for (int run = 0; run < 3; run++) {
+            double start = profile::now();
+            mesh::TriMesh m = mesh::loadObj(PATH);
+            fast = std::min(fast, profile::now() - start);
+            triangles = m.vertices.size() / 3;
+
+            start = profile::now();
+            reference = readWithSscanf(PATH);
+            slow = std::min(slow, profile::now() - start);
+        }
+        remove(PATH);
+
+        printf("%u triangles, %.1f MB: %.1f ms (%.1f MB/s), sscanf %.1f ms (%.1f MB/s)\n", triangles,
+               bytes / 1e6, fast * 1e3, bytes / 1e6 / fast, slow * 1e3, bytes / 1e6 / slow);
+        expect(triangles == reference && triangles == (unsigned int)(2 * size * size), "grid lost triangles");
+        expect(fast <= slow, "loading is slower than reading with sscanf");
+    }
+
+    exit( failures ? EXIT_FAILURE : EXIT_SUCCESS );
+}
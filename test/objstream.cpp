@@ -0,0 +1,208 @@
+//========================================================================
+// Bounded memory OBJ loading. Writes a --size x --size grid with uvs and
+// normals, then loads it in a child process each way, so each gets its
+// own peak RSS:
+//
+//   load     loadObj()
+//   stream   scanObj() then readObj() into one malloc'ed block
+//   cache    writeObjCache(), then ObjCache::open() and a pass over it
+//
+// Prints each one's peak RSS above what the process started with, next
+// to the output size. Exits non-zero if the three disagree on a single
+// bit, or if streaming needs more than the output, the file's own
+// vertex arrays and a few MB. Needs no window or GPU.
+//
+//   objstream [--size N] [--keep]
+//========================================================================
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "glm/glm.hpp"
+
+#include "Loader.hpp"
+#include "Profiler.hpp"
+
+using glm::vec2;
+using glm::vec3;
+
+static const char * OBJ_PATH = "objstream.obj";
+static const char * CACHE_PATH = "objstream.cache";
+
+// What a child sends back
+struct Result
+{
+    unsigned long long hash;
+    unsigned int corners;
+    double peakMB, ms;
+};
+
+static double
+peakMB()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;    // kB on Linux
+}
+
+// FNV-1a over the corners' bytes
+static unsigned long long
+hashBytes(const void * data, size_t size, unsigned long long h = 14695981039346656037ULL)
+{
+    const unsigned char * p = (const unsigned char *)data;
+    for (size_t i = 0; i < size; i++)
+        h = (h ^ p[i]) * 1099511628211ULL;
+    return h;
+}
+
+static unsigned long long
+hashCorners(const vec3 * vertices, const vec3 * normals, const vec2 * uvs, unsigned int corners)
+{
+    unsigned long long h = hashBytes(vertices, corners * sizeof(vec3));
+    h = hashBytes(normals, corners * sizeof(vec3), h);
+    return hashBytes(uvs, corners * sizeof(vec2), h);
+}
+
+static Result
+load(const char * mode)
+{
+    Result r = { 0, 0, 0.0, 0.0 };
+    double before = peakMB(), start = profile::now();
+
+    if (!strcmp(mode, "load")) {
+        mesh::TriMesh m = mesh::loadObj(OBJ_PATH);
+        r.ms = (profile::now() - start) * 1e3;
+        r.peakMB = peakMB() - before;
+        r.corners = m.vertices.size();
+        if (r.corners && m.normals.size() == r.corners && m.uvs.size() == r.corners)
+            r.hash = hashCorners(&m.vertices[0], &m.normals[0], &m.uvs[0], r.corners);
+    }
+    else if (!strcmp(mode, "stream")) {
+        mesh::ObjInfo info;
+        if (!mesh::scanObj(OBJ_PATH, info) || !info.hasNormals || !info.hasUvs)
+            return r;
+        char * block = (char *)malloc(info.corners * (2 * sizeof(vec3) + sizeof(vec2)));
+        vec3 * vertices = (vec3 *)block;
+        vec3 * normals = vertices + info.corners;
+        vec2 * uvs = (vec2 *)(normals + info.corners);
+        bool ok = mesh::readObj(OBJ_PATH, info, vertices, normals, uvs);
+        r.ms = (profile::now() - start) * 1e3;
+        r.peakMB = peakMB() - before;
+        if (ok) {
+            r.corners = info.corners;
+            r.hash = hashCorners(vertices, normals, uvs, r.corners);
+        }
+        free(block);
+    }
+    else {
+        mesh::ObjCache cache;
+        if (mesh::writeObjCache(OBJ_PATH, CACHE_PATH) && cache.open(CACHE_PATH) && cache.normals() && cache.uvs()) {
+            r.corners = cache.corners();
+            r.hash = hashCorners(cache.vertices(), cache.normals(), cache.uvs(), r.corners);
+        }
+        r.ms = (profile::now() - start) * 1e3;
+        r.peakMB = peakMB() - before;
+    }
+    return r;
+}
+
+// Runs load(mode) in a child, so its peak is its own
+static Result
+inChild(const char * mode)
+{
+    Result r = { 0, 0, 0.0, 0.0 };
+    int fds[2];
+    if (pipe(fds))
+        return r;
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        Result mine = load(mode);
+        ssize_t written = write(fds[1], &mine, sizeof(mine));
+        _exit(written == sizeof(mine) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    if (pid < 0 || read(fds[0], &r, sizeof(r)) != sizeof(r))
+        memset(&r, 0, sizeof(r));
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    return r;
+}
+
+int main( int argc, char* argv[] )
+{
+    int size = 700;
+    bool keep = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--size") && i + 1 < argc)
+            size = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--keep"))
+            keep = true;
+    }
+
+    FILE * f = fopen(OBJ_PATH, "w");
+    if (!f) {
+        printf("Error: can't write %s\n", OBJ_PATH);
+        exit(EXIT_FAILURE);
+    }
+    for (int y = 0; y <= size; y++)
+        for (int x = 0; x <= size; x++)
+            fprintf(f, "v %f %f %f\n", x / (float)size, 0.05f * sinf(x * 0.1f) * cosf(y * 0.07f), y / (float)size);
+    for (int y = 0; y <= size; y++)
+        for (int x = 0; x <= size; x++)
+            fprintf(f, "vt %f %f\n", x / (float)size, y / (float)size);
+    for (int y = 0; y <= size; y++)
+        for (int x = 0; x <= size; x++)
+            fprintf(f, "vn %f %f %f\n", 0.0f, 1.0f, 0.0f);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            int a = y * (size + 1) + x + 1, b = a + 1, c = a + size + 2, d = a + size + 1;
+            fprintf(f, "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, b, b, b, c, c, c, d, d, d);
+        }
+    }
+    double fileMB = ftell(f) / 1048576.0;
+    fclose(f);
+
+    unsigned int vertexCount = (size + 1) * (size + 1);
+    unsigned int corners = 6 * size * size;
+    double outputMB = corners * (2 * sizeof(vec3) + sizeof(vec2)) / 1048576.0;
+    double arraysMB = vertexCount * (2 * sizeof(vec3) + sizeof(vec2)) / 1048576.0;
+    printf("%.1f MB file, %u corners: %.1f MB of output, %.1f MB of v/vt/vn\n", fileMB, corners, outputMB, arraysMB);
+
+    const char * modes[] = { "load", "stream", "cache" };
+    Result results[3];
+    for (int i = 0; i < 3; i++) {
+        results[i] = inChild(modes[i]);
+        printf("%-6s  %8.1f ms  peak %7.1f MB\n", modes[i], results[i].ms, results[i].peakMB);
+    }
+
+    int failures = 0;
+    for (int i = 0; i < 3; i++) {
+        if (results[i].corners != corners || results[i].hash != results[0].hash) {
+            printf("MISMATCH: %s read %u corners, hash %016llx; load read %u, %016llx\n", modes[i],
+                   results[i].corners, results[i].hash, results[0].corners, results[0].hash);
+            failures++;
+        }
+    }
+
+    double bound = outputMB + arraysMB + 8.0;
+    if (results[1].peakMB > bound) {
+        printf("FAILED: streaming peaked at %.1f MB, more than %.1f MB\n", results[1].peakMB, bound);
+        failures++;
+    }
+
+    remove(OBJ_PATH);
+    if (!keep)
+        remove(CACHE_PATH);
+
+    exit( failures ? EXIT_FAILURE : EXIT_SUCCESS );
+}
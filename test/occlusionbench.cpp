@@ -0,0 +1,257 @@
+//========================================================================
+// Occlusion culling benchmark. Builds a city of box buildings with small
+// objects scattered along the streets, walks a street-level camera down
+// the middle of it, and per frame runs the frustum cull followed by the
+// occlusion culler, started before a stand-in for submitting the
+// previous frame (--submit ms of busy work) and finished after it.
+// Reports the cull rate and the cost. Needs no window or GPU.
+//
+// Every culled object is checked by casting rays at points on its box
+// through a BVH of the buildings; exits non-zero if any of them can be
+// seen, if the SSE box test disagrees with the scalar one, or if a
+// fixed wall-in-front-of-a-box scene comes out wrong.
+//
+//   occlusionbench [--objects N] [--frames N] [--threads N]
+//                  [--size WxH] [--submit MS]
+//========================================================================
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "Bvh.hpp"
+#include "Culling.hpp"
+#include "Occlusion.hpp"
+#include "Profiler.hpp"
+
+using glm::mat4;
+using glm::vec3;
+using glm::vec4;
+using std::vector;
+
+static const int BLOCKS = 20;
+static const float BLOCK_SPACING = 20.0f;
+
+static float
+randf(float lo, float hi)
+{
+    return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+// 12 triangles around [-0.5, 0.5]^3
+static mesh::TriMesh
+makeBox()
+{
+    static const int faces[6][4] = {
+        { 0, 2, 3, 1 }, { 4, 5, 7, 6 }, { 0, 1, 5, 4 },
+        { 2, 6, 7, 3 }, { 0, 4, 6, 2 }, { 1, 3, 7, 5 },
+    };
+
+    mesh::TriMesh box;
+    for (int f = 0; f < 6; f++) {
+        vec3 corners[4];
+        for (int i = 0; i < 4; i++) {
+            int c = faces[f][i];
+            corners[i] = vec3((c & 1) ? 0.5f : -0.5f, (c & 2) ? 0.5f : -0.5f, (c & 4) ? 0.5f : -0.5f);
+        }
+        int order[6] = { 0, 1, 2, 0, 2, 3 };
+        for (int i = 0; i < 6; i++)
+            box.vertices.push_back(corners[order[i]]);
+    }
+    box.normals.resize(box.vertices.size(), vec3(0, 1, 0));
+    box.computeBounds();
+    return box;
+}
+
+// Visible if any point on the (slightly shrunk) box is in the frustum
+// and has nothing in front of it
+static bool
+canSee(const bvh::Bvh & tree, const cull::Frustum & frustum, const vec3 & eye,
+       const vec3 & center, const vec3 & extent)
+{
+    for (int i = 0; i < 9; i++) {
+        vec3 corner((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, (i & 4) ? 1.0f : -1.0f);
+        vec3 p = i == 8 ? center : center + corner * extent * 0.99f;
+        if (!frustum.testSphere(p, 0.0f))
+            continue;
+
+        vec3 dir = p - eye;
+        bvh::Hit hit;
+        if (!tree.intersect(bvh::Ray(eye, dir, 1.0f), hit))
+            return true;
+    }
+    return false;
+}
+
+// A wall between the eye and one box, and another box off to the side
+static bool
+checkWall(const mesh::TriMesh & box, unsigned int threads)
+{
+    cull::OcclusionCuller culler(128, 64, threads);
+    culler.addOccluder(box, glm::scale(glm::translate(mat4(1.0f), vec3(0, 0, 10)), vec3(8, 8, 1)));
+
+    cull::BoundsArray bounds;
+    bounds.add(vec3(0, 0, 20), vec3(1));       // behind the wall
+    bounds.add(vec3(0, 0, 5), vec3(1));        // in front of it
+    bounds.add(vec3(0, 0, 9.3f), vec3(0.3f));  // poking out of it
+    bounds.add(vec3(40, 0, 60), vec3(1));      // around it
+
+    mat4 viewProj = glm::perspective(60.0f, 2.0f, 0.1f, 400.0f) *
+                    glm::lookAt(vec3(0), vec3(0, 0, 1), vec3(0, 1, 0));
+    unsigned char visible[4] = { 1, 1, 1, 1 };
+    culler.cull(viewProj, bounds, visible);
+
+    if (visible[0] || !visible[1] || !visible[2] || !visible[3]) {
+        printf("FAILED: wall check gave %d %d %d %d, expected 0 1 1 1\n",
+               visible[0], visible[1], visible[2], visible[3]);
+        return false;
+    }
+    return true;
+}
+
+int main( int argc, char* argv[] )
+{
+    unsigned int objects = 200000;
+    int frames = 100;
+    unsigned int threads = 0;
+    int width = 256, height = 128;
+    double submit = 2.0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--objects") && i + 1 < argc)
+            objects = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+            frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--size") && i + 1 < argc)
+            sscanf(argv[++i], "%dx%d", &width, &height);
+        else if (!strcmp(argv[i], "--submit") && i + 1 < argc)
+            submit = atof(argv[++i]);
+    }
+
+    mesh::TriMesh box = makeBox();
+    int failures = checkWall(box, threads) ? 0 : 1;
+
+    // Buildings on a grid, centered on the multiples of BLOCK_SPACING.
+    // They are objects too, and the occluders draw them as plain boxes.
+    srand(1);
+    cull::OcclusionCuller culler(width, height, threads);
+    cull::BoundsArray bounds;
+    mesh::TriMesh city;
+    vector<vec3> footprints;
+    bounds.reserve(objects + BLOCKS * BLOCKS);
+
+    for (int i = -BLOCKS / 2; i < BLOCKS / 2; i++) {
+        for (int j = -BLOCKS / 2; j < BLOCKS / 2; j++) {
+            vec3 size(randf(8, 14), randf(10, 60), randf(8, 14));
+            vec3 center(i * BLOCK_SPACING, size.y * 0.5f, j * BLOCK_SPACING);
+            mat4 model = glm::scale(glm::translate(mat4(1.0f), center), size);
+
+            culler.addOccluder(box, model);
+            bounds.add(box.bounds, model);
+            footprints.push_back(size * 0.5f);
+
+            for (unsigned int v = 0; v < box.vertices.size(); v++)
+                city.vertices.push_back(vec3(model * vec4(box.vertices[v], 1.0f)));
+        }
+    }
+
+    // Small things in the streets
+    float half = BLOCKS / 2 * BLOCK_SPACING;
+    while (bounds.size() < objects + BLOCKS * BLOCKS) {
+        vec3 center(randf(-half, half), randf(0.5f, 3.0f), randf(-half, half));
+        int i = (int)floorf(center.x / BLOCK_SPACING + 0.5f) + BLOCKS / 2;
+        int j = (int)floorf(center.z / BLOCK_SPACING + 0.5f) + BLOCKS / 2;
+        if (i >= 0 && j >= 0 && i < BLOCKS && j < BLOCKS) {
+            const vec3 & f = footprints[i * BLOCKS + j];
+            vec3 d = glm::abs(center - vec3((i - BLOCKS / 2) * BLOCK_SPACING, 0, (j - BLOCKS / 2) * BLOCK_SPACING));
+            if (d.x < f.x + 1.0f && d.z < f.z + 1.0f)
+                continue;
+        }
+        bounds.add(center, vec3(randf(0.25f, 1.0f)));
+    }
+
+    bvh::Bvh tree;
+    tree.build(city);
+
+    unsigned int count = bounds.size();
+    vector<unsigned char> visible(count);
+    mat4 proj = glm::perspective(60.0f, 16.0f / 9.0f, 0.1f, 400.0f);
+
+    double frustumTime = 0.0, rasterTime = 0.0, testTime = 0.0, waitTime = 0.0;
+    unsigned long frustumCount = 0, occlusionCount = 0, checked = 0;
+    int errors = 0, mismatches = 0;
+
+    for (int frame = 0; frame < frames; frame++) {
+        // Down the street between two columns of blocks, turning round
+        float angle = frame * 720.0f / frames;
+        vec3 eye(BLOCK_SPACING * 0.5f, 2.0f, -half + 2.0f * half * frame / frames);
+        vec3 dir(sinf(glm::radians(angle)), 0.0f, cosf(glm::radians(angle)));
+        mat4 viewProj = proj * glm::lookAt(eye, eye + dir, vec3(0, 1, 0));
+        cull::Frustum frustum(viewProj);
+
+        double start = profile::now();
+        frustumCount += cull::cullAabbsParallel(frustum, bounds, &visible.front(), threads);
+        frustumTime += profile::now() - start;
+
+        // The previous frame's draws go out while the occluders render
+        culler.start(viewProj, bounds, &visible.front());
+        start = profile::now();
+        while (profile::now() - start < submit * 1e-3)
+            ;
+        start = profile::now();
+        occlusionCount += culler.finish();
+        waitTime += profile::now() - start;
+
+        rasterTime += culler.getRasterTime();
+        testTime += culler.getTestTime();
+
+        // Within the frustum, the batched test has to agree with the
+        // scalar isOccluded(), and no culled street object may be
+        // visible. The buildings are left out of the ray check: their
+        // sample points are inside them.
+        for (unsigned int i = 0; i < count; i++) {
+            vec3 center(bounds.cx[i], bounds.cy[i], bounds.cz[i]);
+            vec3 extent(bounds.ex[i], bounds.ey[i], bounds.ez[i]);
+            if (!frustum.testAabb(center, extent))
+                continue;
+
+            bool culled = !visible[i];
+            if (culled != culler.isOccluded(center, extent) && mismatches++ < 10)
+                printf("MISMATCH: object %u in frame %d\n", i, frame);
+
+            if (!culled || i < BLOCKS * BLOCKS)
+                continue;
+
+            checked++;
+            if (canSee(tree, frustum, eye, center, extent) && errors++ < 10)
+                printf("FAILED: object %u culled but visible in frame %d\n", i, frame);
+        }
+    }
+
+    printf("%u objects, %u occluder triangles, %dx%d buffer, %u threads\n", count,
+           (unsigned int)city.vertices.size() / 3, width, height, culler.getThreadCount());
+    printf("  frustum    %8.3f ms/frame  %8lu visible\n", frustumTime / frames * 1e3,
+           frustumCount / frames);
+    printf("  occlusion  %8.3f ms/frame  %8lu visible  (%.1f%% of the frustum set culled)\n",
+           (rasterTime + testTime) / frames * 1e3, occlusionCount / frames,
+           frustumCount ? 100.0 * (frustumCount - occlusionCount) / frustumCount : 0.0);
+    printf("    raster   %8.3f ms/frame\n", rasterTime / frames * 1e3);
+    printf("    test     %8.3f ms/frame  %7.2f Mobj/s\n", testTime / frames * 1e3,
+           frustumCount / testTime * 1e-6);
+    printf("  waited     %8.3f ms/frame  after %.1f ms of submit\n", waitTime / frames * 1e3, submit);
+    printf("  checked    %8lu culled objects with rays, %d visible\n", checked, errors);
+
+    if (mismatches)
+        printf("%d mismatches between the batched and scalar tests\n", mismatches);
+    if (errors || mismatches)
+        failures++;
+
+    exit( failures ? EXIT_FAILURE : EXIT_SUCCESS );
+}
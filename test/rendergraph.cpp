@@ -0,0 +1,262 @@
+//========================================================================
+// Headless check of the RenderGraph scheduler. A mock backend records
+// every call the graph would make to GL, so this runs without a window
+// or a GPU. Exits non-zero if any of the scheduling rules are broken.
+//========================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "RenderGraph.hpp"
+
+#include "Check.hpp"
+
+using std::string;
+using std::vector;
+using namespace render;
+
+// Records the GL traffic instead of issuing it
+class MockBackend : public GraphBackend
+{
+public:
+    virtual int createTarget(const TargetDesc & desc)
+    {
+        created.push_back(desc);
+        return (int)created.size() - 1;
+    }
+
+    virtual void bindTarget(int target)
+    {
+        char buf[64];
+        sprintf(buf, "bind %d", target);
+        calls.push_back(buf);
+    }
+
+    virtual void invalidateTarget(int target, bool color, bool depth)
+    {
+        char buf[64];
+        sprintf(buf, "invalidate %d%s%s", target, color ? " color" : "", depth ? " depth" : "");
+        calls.push_back(buf);
+    }
+
+    virtual void memoryBarrier(GLbitfield barriers)
+    {
+        char buf[64];
+        sprintf(buf, "barrier %x", barriers);
+        calls.push_back(buf);
+    }
+
+    virtual GLuint getTexture(int target, GLuint index)
+    {
+        return 100 + target * 10 + index;
+    }
+
+    vector<TargetDesc> created;
+    vector<string> calls;
+};
+
+static vector<string> executed;
+
+static PassCallback
+record(const string & name)
+{
+    return [name](PassContext &) { executed.push_back(name); };
+}
+
+static int
+stepOf(RenderGraph & graph, const string & name)
+{
+    const vector<ScheduledPass> & schedule = graph.getSchedule();
+    for (unsigned int i = 0; i < schedule.size(); i++) {
+        if (graph.getPassName(schedule[i].pass) == name)
+            return i;
+    }
+    return -1;
+}
+
+// A deferred-style frame: gbuffer, compute SSAO via image stores,
+// lighting, bloom and a composite, plus a debug view nobody consumes.
+static void
+buildFrame(RenderGraph & graph)
+{
+    graph.reset();
+
+    graph.createTarget("gbuffer", 640, 480, 3);
+    graph.createTarget("ssao", 320, 240);
+    graph.createTarget("lit", 640, 480);
+    graph.createTarget("bloom", 320, 240);
+    graph.createTarget("debug", 640, 480);
+    graph.importTarget("backbuffer", DEFAULT_TARGET);
+    graph.markOutput("backbuffer");
+
+    int p;
+    p = graph.addPass("geometry", record("geometry"));
+    graph.write(p, "gbuffer");
+
+    p = graph.addPass("ssao", record("ssao"));
+    graph.read(p, "gbuffer");
+    graph.write(p, "ssao", WRITE_IMAGE);
+
+    p = graph.addPass("debugview", record("debugview"));
+    graph.read(p, "gbuffer");
+    graph.write(p, "debug");
+
+    p = graph.addPass("lighting", record("lighting"));
+    graph.read(p, "gbuffer");
+    graph.read(p, "ssao");
+    graph.write(p, "lit");
+
+    p = graph.addPass("bloom", record("bloom"));
+    graph.read(p, "lit");
+    graph.write(p, "bloom");
+
+    p = graph.addPass("composite", record("composite"));
+    graph.read(p, "lit");
+    graph.read(p, "bloom");
+    graph.write(p, "backbuffer");
+}
+
+static void
+testDeferredFrame()
+{
+    MockBackend backend;
+    RenderGraph graph(backend);
+
+    buildFrame(graph);
+    CHECK(graph.compile());
+
+    // The debug view feeds nothing and must be culled
+    CHECK(graph.getSchedule().size() == 5);
+    CHECK(stepOf(graph, "debugview") < 0);
+
+    // Producers before consumers
+    CHECK(stepOf(graph, "geometry") < stepOf(graph, "ssao"));
+    CHECK(stepOf(graph, "ssao") < stepOf(graph, "lighting"));
+    CHECK(stepOf(graph, "lighting") < stepOf(graph, "bloom"));
+    CHECK(stepOf(graph, "bloom") < stepOf(graph, "composite"));
+
+    // Only the pass sampling the image-store result needs a barrier
+    const vector<ScheduledPass> & schedule = graph.getSchedule();
+    for (unsigned int i = 0; i < schedule.size(); i++) {
+        if (graph.getPassName(schedule[i].pass) == "lighting")
+            CHECK(schedule[i].barriers == GL_TEXTURE_FETCH_BARRIER_BIT);
+        else
+            CHECK(schedule[i].barriers == 0);
+    }
+
+    // gbuffer, ssao and lit are live at once; bloom reuses ssao's target
+    CHECK(graph.getPoolSize() == 3);
+    CHECK(backend.created.size() == 3);
+
+    graph.execute();
+
+    // Each transient's colour goes once its last reader is done:
+    // gbuffer (0) and ssao (1) after lighting, lit (2) and bloom (1,
+    // ssao's old target) after the composite
+    const char * expected[] = {
+        "bind 0", "invalidate 0 color depth", "invalidate 0 depth",
+        "barrier 8",    // GL_TEXTURE_FETCH_BARRIER_BIT
+        "bind 2", "invalidate 2 color depth",
+        "invalidate 0 color", "invalidate 1 color", "invalidate 2 depth",
+        "bind 1", "invalidate 1 color depth", "invalidate 1 depth",
+        "bind -1", "invalidate 2 color", "invalidate 1 color",
+        "bind -1",
+    };
+    unsigned int count = sizeof(expected) / sizeof(expected[0]);
+
+    CHECK(backend.calls.size() == count);
+    for (unsigned int i = 0; i < count && i < backend.calls.size(); i++) {
+        if (backend.calls[i] != expected[i]) {
+            printf("  call %u: got '%s', expected '%s'\n", i,
+                   backend.calls[i].c_str(), expected[i]);
+            failures++;
+        }
+    }
+
+    CHECK(executed.size() == 5);
+
+    // A second frame must not allocate anything new
+    buildFrame(graph);
+    CHECK(graph.compile());
+    CHECK(backend.created.size() == 3);
+}
+
+// Independent passes are grouped by render target to save switches
+static void
+testTargetGrouping()
+{
+    MockBackend backend;
+    RenderGraph graph(backend);
+
+    graph.createTarget("shadow", 1024, 1024);
+    graph.createTarget("scene", 640, 480);
+    graph.markOutput("shadow");
+    graph.markOutput("scene");
+
+    int p;
+    p = graph.addPass("shadow0", record("shadow0"));
+    graph.write(p, "shadow");
+    p = graph.addPass("opaque", record("opaque"));
+    graph.write(p, "scene");
+    p = graph.addPass("shadow1", record("shadow1"));
+    graph.write(p, "shadow");
+    p = graph.addPass("transparent", record("transparent"));
+    graph.write(p, "scene");
+
+    CHECK(graph.compile());
+    CHECK(stepOf(graph, "shadow0") == 0);
+    CHECK(stepOf(graph, "shadow1") == 1);
+    CHECK(stepOf(graph, "opaque") == 2);
+    CHECK(stepOf(graph, "transparent") == 3);
+
+    // Outputs keep their contents; only the first draw discards
+    const vector<ScheduledPass> & schedule = graph.getSchedule();
+    CHECK(schedule[0].discardColor && schedule[0].retired.empty());
+    CHECK(!schedule[1].discardColor && !schedule[1].invalidateDepth);
+}
+
+// Image writes read back as images need the image access barrier,
+// and a second image read of the same data doesn't repeat it
+static void
+testImageBarriers()
+{
+    MockBackend backend;
+    RenderGraph graph(backend);
+
+    graph.createTarget("particles", 256, 256);
+    graph.importTarget("backbuffer", DEFAULT_TARGET);
+    graph.markOutput("backbuffer");
+
+    int p;
+    p = graph.addPass("simulate", record("simulate"));
+    graph.write(p, "particles", WRITE_IMAGE);
+    p = graph.addPass("integrate", record("integrate"));
+    graph.read(p, "particles", READ_IMAGE);
+    graph.write(p, "backbuffer");
+    p = graph.addPass("draw", record("draw"));
+    graph.read(p, "particles", READ_IMAGE);
+    graph.write(p, "backbuffer");
+
+    CHECK(graph.compile());
+    const vector<ScheduledPass> & schedule = graph.getSchedule();
+    CHECK(schedule.size() == 3);
+    CHECK(schedule[1].barriers == GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    CHECK(schedule[2].barriers == 0);
+}
+
+int main( void )
+{
+    testDeferredFrame();
+    testTargetGrouping();
+    testImageBarriers();
+
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+        exit( EXIT_FAILURE );
+    }
+
+    printf("All render graph checks passed\n");
+    exit( EXIT_SUCCESS );
+}
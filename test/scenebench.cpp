@@ -0,0 +1,212 @@
+//========================================================================
+// Transform hierarchy benchmark. Builds a random tree of --nodes nodes
+// and times --frames updates of it two ways: with every root turning
+// each frame, so every node moves, and with 1% of the nodes changed at
+// random. Each is run on a scene::Hierarchy with one thread and with
+// --threads (0 = one per hardware thread), and the first also on a tree
+// of separately allocated nodes walked depth first, the usual way.
+// Needs no window or GPU.
+//
+// Exits non-zero if any world matrix differs by a bit from the same
+// products done node by node, or if threading changes anything.
+//
+//   scenebench [--nodes N] [--frames N] [--threads N]
+//========================================================================
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/quaternion.hpp"
+
+#include "Hierarchy.hpp"
+#include "Profiler.hpp"
+
+#include "Check.hpp"
+
+using glm::mat4;
+using glm::quat;
+using glm::vec3;
+using std::vector;
+
+static float
+random(float lo, float hi)
+{
+    return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+static mat4
+localMatrix(const vec3 & t, const quat & r, const vec3 & s)
+{
+    mat4 local(glm::mat3_cast(r));
+    local[0] *= s.x;
+    local[1] *= s.y;
+    local[2] *= s.z;
+    local[3] = glm::vec4(t, 1.0f);
+    return local;
+}
+
+// The usual scene graph, for comparison
+struct Node
+{
+    vec3 translation, scale;
+    quat rotation;
+    mat4 world;
+    vector<Node *> children;
+};
+
+static void
+updateTree(Node * node, const mat4 & parent)
+{
+    node->world = parent * localMatrix(node->translation, node->rotation, node->scale);
+    for (unsigned int i = 0; i < node->children.size(); i++)
+        updateTree(node->children[i], node->world);
+}
+
+// Every world matrix from scratch, in id order (parents come first)
+static bool
+matchesReference(const scene::Hierarchy & h)
+{
+    vector<mat4> worlds(h.size());
+    for (unsigned int id = 0; id < h.size(); id++) {
+        mat4 local = localMatrix(h.getTranslation(id), h.getRotation(id), h.getScale(id));
+        unsigned int parent = h.getParent(id);
+        worlds[id] = parent == scene::Hierarchy::NONE ? local : worlds[parent] * local;
+        if (memcmp(&worlds[id], &h.getWorld(id), sizeof(mat4)))
+            return false;
+    }
+    return true;
+}
+
+static bool
+sameWorlds(const scene::Hierarchy & a, const scene::Hierarchy & b)
+{
+    return a.size() == b.size() && !memcmp(&a.getWorlds()[0], &b.getWorlds()[0], a.size() * sizeof(mat4));
+}
+
+int main( int argc, char* argv[] )
+{
+    unsigned int nodes = 100000;
+    int frames = 50;
+    unsigned int threads = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--nodes") && i + 1 < argc)
+            nodes = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+            frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+    }
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    const unsigned int roots = 16;
+    nodes = std::max(nodes, roots * 2);
+
+    // A random tree: each node hangs off any earlier one
+    srand(1);
+    scene::Hierarchy hierarchy;
+    hierarchy.reserve(nodes);
+    vector<Node *> tree(nodes);
+    for (unsigned int i = 0; i < nodes; i++) {
+        unsigned int parent = i < roots ? scene::Hierarchy::NONE : rand() % i;
+        vec3 t(random(-2.0f, 2.0f), random(0.0f, 1.0f), random(-2.0f, 2.0f));
+        quat r = glm::rotate(quat(), random(0.0f, 360.0f), vec3(random(-1.0f, 1.0f), 1.0f, random(-1.0f, 1.0f)));
+        vec3 s(random(0.8f, 1.2f));
+        hierarchy.add(parent, t, r, s);
+
+        tree[i] = new Node;
+        tree[i]->translation = t;
+        tree[i]->rotation = r;
+        tree[i]->scale = s;
+        if (parent != scene::Hierarchy::NONE)
+            tree[parent]->children.push_back(tree[i]);
+    }
+
+    unsigned int updated = hierarchy.update(1);
+    printf("%u nodes in %u levels, %d frames, %u threads\n", hierarchy.size(), hierarchy.getLevelCount(),
+           frames, threads);
+    expect(updated == nodes, "first update missed nodes");
+    expect(matchesReference(hierarchy), "world matrices are wrong");
+
+    // Nodes added after an update, under old ones
+    {
+        scene::Hierarchy grown = hierarchy;
+        for (unsigned int i = 0; i < 1000; i++)
+            grown.add(rand() % grown.size(), vec3(random(-1.0f, 1.0f)));
+        grown.update(threads);
+        expect(matchesReference(grown), "world matrices are wrong after adding nodes");
+    }
+
+    printf("%-12s %10s %10s %10s %10s\n", "", "tree", "1 thread", "threads", "updated");
+    for (int mode = 0; mode < 2; mode++) {
+        // The same changes for every run
+        vector<vector<unsigned int> > changed(frames);
+        for (int f = 0; f < frames; f++) {
+            if (mode == 0) {
+                for (unsigned int i = 0; i < roots; i++)
+                    changed[f].push_back(i);
+            } else {
+                for (unsigned int i = 0; i < nodes / 100; i++)
+                    changed[f].push_back(rand() % nodes);
+            }
+        }
+
+        double treeTime = 0.0;
+        if (mode == 0) {
+            double start = profile::now();
+            for (int f = 0; f < frames; f++) {
+                for (unsigned int i = 0; i < changed[f].size(); i++) {
+                    Node * node = tree[changed[f][i]];
+                    node->rotation = glm::rotate(node->rotation, 1.0f, vec3(0.0f, 1.0f, 0.0f));
+                }
+                for (unsigned int i = 0; i < roots; i++)
+                    updateTree(tree[i], mat4(1.0f));
+            }
+            treeTime = (profile::now() - start) / frames;
+        }
+
+        scene::Hierarchy results[2];
+        double times[2];
+        unsigned int total = 0;
+        for (int k = 0; k < 2; k++) {
+            scene::Hierarchy h = hierarchy;
+            total = 0;
+            double start = profile::now();
+            for (int f = 0; f < frames; f++) {
+                for (unsigned int i = 0; i < changed[f].size(); i++) {
+                    unsigned int id = changed[f][i];
+                    h.setRotation(id, glm::rotate(h.getRotation(id), 1.0f, vec3(0.0f, 1.0f, 0.0f)));
+                }
+                total += h.update(k == 0 ? 1 : threads);
+            }
+            times[k] = (profile::now() - start) / frames;
+            results[k] = h;
+        }
+
+        const char * names[2] = { "all moving", "1% changed" };
+        printf("%-12s", names[mode]);
+        if (treeTime > 0.0)
+            printf(" %8.2fms", treeTime * 1e3);
+        else
+            printf(" %10s", "-");
+        printf(" %8.2fms %8.2fms %10u\n", times[0] * 1e3, times[1] * 1e3, total / frames);
+
+        expect(sameWorlds(results[0], results[1]), "threads change the results");
+        expect(matchesReference(results[0]), "world matrices are wrong after updates");
+        if (mode == 0) {
+            bool same = true;
+            for (unsigned int i = 0; i < nodes && same; i++)
+                same = !memcmp(&tree[i]->world, &results[0].getWorld(i), sizeof(mat4));
+            expect(same, "differs from the node tree");
+        }
+    }
+
+    for (unsigned int i = 0; i < nodes; i++)
+        delete tree[i];
+    exit( failures ? EXIT_FAILURE : EXIT_SUCCESS );
+}
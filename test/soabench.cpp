@@ -0,0 +1,193 @@
+//========================================================================
+// Structure of arrays benchmark. Runs bounds, normalize, transform and
+// normal generation over a --size x --size grid (two triangles per
+// cell) on the TriMesh (array of structures) originals and on a SoaMesh
+// with each instruction set, best of --reps runs each. Needs no window
+// or GPU.
+//
+// Exits non-zero if the SoaMesh instruction sets disagree on a single
+// bit, if bounds, normalize or normals differ at all from the TriMesh
+// versions, if transform is off by more than rounding, or if the
+// conversions lose anything.
+//
+//   soabench [--size N] [--reps N]
+//========================================================================
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_inverse.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "Normals.hpp"
+#include "Profiler.hpp"
+#include "SoaMesh.hpp"
+
+#include "Check.hpp"
+
+using glm::mat4;
+using glm::vec2;
+using glm::vec3;
+using glm::vec4;
+using std::vector;
+
+static bool
+sameBits(const mesh::SoaMesh & a, const mesh::SoaMesh & b)
+{
+    if (a.size() != b.size() || a.hasNormals() != b.hasNormals())
+        return false;
+    size_t bytes = a.paddedSize() * sizeof(float);
+    bool same = !memcmp(a.x, b.x, bytes) && !memcmp(a.y, b.y, bytes) && !memcmp(a.z, b.z, bytes);
+    if (a.hasNormals())
+        same = same && !memcmp(a.nx, b.nx, bytes) && !memcmp(a.ny, b.ny, bytes) && !memcmp(a.nz, b.nz, bytes);
+    return same && a.bounds.min == b.bounds.min && a.bounds.max == b.bounds.max;
+}
+
+// Largest difference between a SoaMesh and a TriMesh
+static float
+difference(const mesh::SoaMesh & s, const mesh::TriMesh & m)
+{
+    float worst = 0.0f;
+    for (unsigned int i = 0; i < s.size(); i++) {
+        worst = std::max(worst, glm::length(vec3(s.x[i], s.y[i], s.z[i]) - m.vertices[i]));
+        if (s.hasNormals())
+            worst = std::max(worst, glm::length(vec3(s.nx[i], s.ny[i], s.nz[i]) - m.normals[i]));
+    }
+    return worst;
+}
+
+// The original way of transforming a TriMesh
+static void
+transformAos(mesh::TriMesh & m, const mat4 & matrix)
+{
+    glm::mat3 normalMatrix = glm::inverseTranspose(glm::mat3(matrix));
+    for (unsigned int i = 0; i < m.vertices.size(); i++)
+        m.vertices[i] = vec3(matrix * vec4(m.vertices[i], 1.0f));
+    for (unsigned int i = 0; i < m.normals.size(); i++) {
+        vec3 n = normalMatrix * m.normals[i];
+        float length = glm::length(n);
+        m.normals[i] = length > 0.0f ? n / length : n;
+    }
+    m.computeBounds();
+}
+
+int main( int argc, char* argv[] )
+{
+    int size = 700;
+    int reps = 5;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--size") && i + 1 < argc)
+            size = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--reps") && i + 1 < argc)
+            reps = atoi(argv[++i]);
+    }
+
+    mesh::TriMesh grid;
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            vec2 c[4] = { vec2(x, y), vec2(x + 1, y), vec2(x + 1, y + 1), vec2(x, y + 1) };
+            const int corners[6] = { 0, 1, 2, 0, 2, 3 };
+            for (int k = 0; k < 6; k++) {
+                vec2 uv = c[corners[k]] / (float)size;
+                grid.vertices.push_back(vec3(uv.x * 3.0f, 0.1f * sinf(uv.x * 40.0f) * cosf(uv.y * 30.0f), uv.y * 2.0f));
+                grid.uvs.push_back(uv);
+            }
+        }
+    }
+    mesh::NormalOptions options;
+    options.threads = 1;
+    mesh::computeNormals(grid, options);
+    grid.computeBounds();
+
+    // Round trips
+    mesh::SoaMesh soa(grid);
+    {
+        mesh::TriMesh back = soa.toTriMesh();
+        vector<float> packed(soa.size() * 8);
+        soa.interleave(&packed[0]);
+        bool interleaved = true;
+        for (unsigned int i = 0; i < soa.size() && interleaved; i += 997)
+            interleaved = vec3(packed[i * 8], packed[i * 8 + 1], packed[i * 8 + 2]) == grid.vertices[i] &&
+                          vec3(packed[i * 8 + 3], packed[i * 8 + 4], packed[i * 8 + 5]) == grid.normals[i] &&
+                          vec2(packed[i * 8 + 6], packed[i * 8 + 7]) == grid.uvs[i];
+        bool aligned = !((size_t)soa.x % mesh::SoaMesh::ALIGNMENT) && !((size_t)soa.nz % mesh::SoaMesh::ALIGNMENT) &&
+                       soa.paddedSize() % mesh::SoaMesh::PADDING == 0 && soa.x[soa.paddedSize() - 1] == soa.x[soa.size() - 1];
+        expect(back.vertices == grid.vertices && back.normals == grid.normals && back.uvs == grid.uvs,
+               "TriMesh -> SoaMesh -> TriMesh changed something");
+        expect(interleaved, "interleaved vertices are wrong");
+        expect(aligned, "arrays aren't aligned and padded");
+    }
+
+    printf("%u corners, best of %d\n", soa.size(), reps);
+    printf("%-10s %10s %10s %10s %10s\n", "", "aos", "scalar", "sse", "avx");
+
+    const cull::Isa isas[3] = { cull::SCALAR, cull::SSE, cull::AVX };
+    bool haveAvx = cull::getBestIsa() == cull::AVX;
+    mat4 matrix = glm::rotate(glm::scale(glm::translate(mat4(1.0f), vec3(1.0f, -2.0f, 0.5f)),
+                                         vec3(2.0f, 1.0f, 0.5f)), 30.0f, vec3(1.0f, 2.0f, 3.0f));
+
+    for (int op = 0; op < 4; op++) {
+        const char * names[4] = { "bounds", "normalize", "transform", "normals" };
+        double aos = 1e30;
+        mesh::TriMesh aosResult;
+        for (int r = 0; r < reps; r++) {
+            mesh::TriMesh m = grid;
+            double start = profile::now();
+            switch (op) {
+            case 0: m.computeBounds(); break;
+            case 1: m.normalize(); break;
+            case 2: transformAos(m, matrix); break;
+            case 3: mesh::computeNormals(m, options); break;
+            }
+            aos = std::min(aos, profile::now() - start);
+            aosResult = m;
+        }
+
+        double times[3] = { 0.0, 0.0, 0.0 };
+        mesh::SoaMesh results[3];
+        for (int k = 0; k < 3; k++) {
+            // Normal generation has no SIMD paths to compare
+            if ((isas[k] == cull::AVX && !haveAvx) || (op == 3 && k > 0))
+                continue;
+            times[k] = 1e30;
+            for (int r = 0; r < reps; r++) {
+                mesh::SoaMesh s = soa;
+                double start = profile::now();
+                switch (op) {
+                case 0: s.computeBounds(isas[k]); break;
+                case 1: s.normalize(1.0f, isas[k]); break;
+                case 2: s.transform(matrix, isas[k]); break;
+                case 3: mesh::computeNormals(s, options); break;
+                }
+                times[k] = std::min(times[k], profile::now() - start);
+                results[k] = s;
+            }
+        }
+
+        printf("%-10s %8.2fms %8.2fms", names[op], aos * 1e3, times[0] * 1e3);
+        for (int k = 1; k < 3; k++) {
+            if (times[k] > 0.0)
+                printf(" %8.2fms", times[k] * 1e3);
+            else
+                printf(" %10s", "-");
+        }
+        printf("\n");
+
+        for (int k = 1; k < 3; k++)
+            expect(times[k] == 0.0 || sameBits(results[0], results[k]), "instruction sets disagree");
+        float worst = difference(results[0], aosResult);
+        bool boundsMatch = results[0].bounds.min == aosResult.bounds.min && results[0].bounds.max == aosResult.bounds.max;
+        if (op == 2) {
+            expect(worst < 1e-5f, "transform is off from the TriMesh one");
+        } else {
+            expect(worst == 0.0f && boundsMatch, "results differ from the TriMesh ones");
+        }
+    }
+
+    exit( failures ? EXIT_FAILURE : EXIT_SUCCESS );
+}
@@ -0,0 +1,265 @@
+//========================================================================
+// Software rasterizer check. Renders the first frame of loadmesh
+// (basicshade) and envmap (env) on the CPU, once on one thread and once
+// on several (--threads, default 4), and saves the results. Exits
+// non-zero if the thread count changes a single pixel.
+//
+// With --compare the same scenes are drawn through GL on a headless
+// context as well, and the run fails if more than --tolerance percent
+// of the pixels differ by more than a couple of levels.
+//
+//   softraster [--out PREFIX] [--size WxH] [--threads N] [--compare]
+//              [--tolerance P]
+//========================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <GL/glew.h>
+#include "GL/glfw.h"
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+#include <string>
+#include <vector>
+
+#include "GLSLProgram.hpp"
+#include "Context.hpp"
+#include "Profiler.hpp"
+#include "Loader.hpp"
+#include "SoftRenderer.hpp"
+#include "SoftShaders.hpp"
+#include "imageUtil.hpp"
+#include "vao.hpp"
+
+#define BUFFER_OFFSET(i) ((GLfloat*)NULL + (i))
+
+using glm::mat3;
+using glm::mat4;
+using glm::vec3;
+using std::string;
+using std::vector;
+
+typedef struct CVertex
+{
+    vec3 pos;
+    vec3 normal;
+} CVertex;
+
+struct Scene
+{
+    const char *    name;
+    const char *    model;
+    const char *    vert;
+    const char *    frag;
+    vec3            eye;
+    bool            cullFace;
+};
+
+static const Scene scenes[] = {
+    { "basicshade", "models/bunny2.obj", "shaders/basicshade.vert", "shaders/basicshade.frag", vec3(0, 2, -3), true },
+    { "env", "models/bunny2.obj", "shaders/env.vert", "shaders/env.frag", vec3(0, 0.75f, -4), false },
+};
+
+// Percentage of pixels where any channel differs by more than 2
+static double
+compareImages(const uint8_t * a, const uint8_t * b, int pixels)
+{
+    int differing = 0;
+    for (int i = 0; i < pixels; i++) {
+        for (int c = 0; c < 4; c++) {
+            if (abs((int)a[i * 4 + c] - (int)b[i * 4 + c]) > 2) {
+                differing++;
+                break;
+            }
+        }
+    }
+    return 100.0 * differing / pixels;
+}
+
+#ifdef HAVE_EGL
+
+// The same frame through GL, read back in the Framebuffer's layout
+static bool
+renderGL(const Scene & scene, const mesh::TriMesh & m, const mat4 & proj, const mat4 & view,
+         int width, int height, vector<uint8_t> & pixels)
+{
+    shader::GLSLProgram prog;
+    if( !prog.compileShaderFromFile(scene.vert, shader::VERTEX) ||
+        !prog.compileShaderFromFile(scene.frag, shader::FRAGMENT) ||
+        !prog.link() )
+    {
+        printf("Shader program %s failed!\n%s", scene.name, prog.log().c_str());
+        return false;
+    }
+
+    vector<CVertex> packed;
+    for (unsigned int i = 0; i < m.vertices.size(); i++)
+        packed.push_back((CVertex){ m.vertices[i], m.normals[i] });
+
+    Vao vao;
+    vao.create(GL_ARRAY_BUFFER, packed.size() * sizeof(CVertex), &packed.front(), GL_STATIC_DRAW);
+    vao.setShaderProgram(prog.getHandle());
+    vao.bindAttribute("VertexPosition", 3, GL_FLOAT, GL_FALSE, sizeof(CVertex), BUFFER_OFFSET(0));
+    vao.bindAttribute("VertexNormal", 3, GL_FLOAT, GL_FALSE, sizeof(CVertex), BUFFER_OFFSET(3));
+
+    GLuint texID = 0;
+    if (!strcmp(scene.name, "env")) {
+        texID = util::image::loadCubemap("img/cube");
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, texID);
+    }
+
+    glViewport(0, 0, width, height);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glEnable(GL_DEPTH_TEST);
+    if (scene.cullFace)
+        glEnable(GL_CULL_FACE);
+    else
+        glDisable(GL_CULL_FACE);
+
+    mat3 normal = glm::transpose(glm::mat3(glm::inverse(view)));
+
+    prog.use();
+    prog.setUniform("MVP", proj * view);
+    prog.setUniform("NormalMatrix", normal);
+    prog.setUniform("ModelMatrix", mat4(1.0f));
+    prog.setUniform("WorldCameraPosition", scene.eye);
+    prog.setUniform("Tex1", 0);
+    vao.draw(GL_TRIANGLES, 0, packed.size());
+
+    pixels.resize(width * height * 4);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, Fbo::getDefaultFramebuffer());
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, &pixels.front());
+
+    if (texID)
+        glDeleteTextures(1, &texID);
+    return true;
+}
+
+#endif
+
+int main( int argc, char* argv[] )
+{
+    string prefix = "soft_";
+    int width = 640, height = 480;
+    bool compare = false;
+    double tolerance = 1.0;
+    unsigned int threads = 4;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--out") && i + 1 < argc)
+            prefix = argv[++i];
+        else if (!strcmp(argv[i], "--size") && i + 1 < argc)
+            sscanf(argv[++i], "%dx%d", &width, &height);
+        else if (!strcmp(argv[i], "--compare"))
+            compare = true;
+        else if (!strcmp(argv[i], "--tolerance") && i + 1 < argc)
+            tolerance = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+    }
+
+#ifdef HAVE_EGL
+    context::EglContext * ctx = NULL;
+    if (compare) {
+        ctx = new context::EglContext(context::Options());
+        if (!ctx->open(width, height, "Software rasterizer check")) {
+            fprintf( stderr, "Failed to open an OpenGL context\n" );
+            exit( EXIT_FAILURE );
+        }
+    }
+#else
+    if (compare)
+        printf("Built without EGL; skipping the GL comparison\n");
+    compare = false;
+#endif
+
+    ilInit();
+    iluInit();
+
+    int failures = 0;
+    for (unsigned int s = 0; s < sizeof(scenes) / sizeof(scenes[0]); s++) {
+        const Scene & scene = scenes[s];
+
+        mesh::TriMesh m = mesh::loadObj(scene.model);
+        m.normalize(2);
+
+        // Frame 0 of the demo: no rotation yet
+        mat4 proj = glm::perspective(45.0f, (float)width / (float)height, 0.1f, 100.0f);
+        mat4 view = glm::lookAt(scene.eye, vec3(0), vec3(0,1,0));
+        mat3 normal = glm::transpose(glm::mat3(glm::inverse(view)));
+
+        soft::BasicShadeShader basic;
+        basic.MVP = proj * view;
+        basic.NormalMatrix = normal;
+
+        soft::Cubemap cube;
+        soft::EnvShader env;
+        env.MVP = proj * view;
+        env.ModelMatrix = mat4(1.0f);
+        env.NormalMatrix = normal;
+        env.WorldCameraPosition = scene.eye;
+        env.Tex1 = &cube;
+
+        const soft::Shader * shader = &basic;
+        if (!strcmp(scene.name, "env")) {
+            if (!cube.load("img/cube")) {
+                printf("%s: no cube map, skipped\n", scene.name);
+                continue;
+            }
+            shader = &env;
+        }
+
+        soft::Framebuffer single, threaded;
+        single.create(width, height);
+        threaded.create(width, height);
+
+        soft::Renderer serial(1), parallel(threads);
+        serial.setCullFace(scene.cullFace);
+        parallel.setCullFace(scene.cullFace);
+
+        double start = profile::now();
+        serial.draw(single, m, *shader);
+        double serialTime = profile::now() - start;
+
+        start = profile::now();
+        parallel.draw(threaded, m, *shader);
+        double parallelTime = profile::now() - start;
+
+        printf("%s: %u triangles, %.2f ms on 1 thread, %.2f ms on %u\n", scene.name,
+               (unsigned int)m.vertices.size() / 3, serialTime * 1e3, parallelTime * 1e3,
+               parallel.getThreadCount());
+
+        if (memcmp(single.getColor(), threaded.getColor(), width * height * 4)) {
+            printf("FAILED: %s differs between 1 and %u threads\n", scene.name,
+                   parallel.getThreadCount());
+            failures++;
+        }
+
+        threaded.save((prefix + scene.name + ".png").c_str());
+
+#ifdef HAVE_EGL
+        vector<uint8_t> gl;
+        if (compare && renderGL(scene, m, proj, view, width, height, gl)) {
+            double differing = compareImages(threaded.getColor(), &gl.front(), width * height);
+            printf("%s: %.3f%% of pixels differ from GL\n", scene.name, differing);
+            if (differing > tolerance) {
+                printf("FAILED: %s is over the %.3f%% tolerance\n", scene.name, tolerance);
+                failures++;
+            }
+        }
+#endif
+    }
+
+#ifdef HAVE_EGL
+    if (ctx) {
+        ctx->close();
+        delete ctx;
+    }
+#endif
+
+    exit( failures ? EXIT_FAILURE : EXIT_SUCCESS );
+}
@@ -0,0 +1,277 @@
+//========================================================================
+// Draw sorting benchmark. Scatters --objects copies of the bundled
+// models over a plane, each with one of a few programs and one of
+// --textures textures, and draws them into a shadow map and then the
+// screen, for --frames frames with the camera going round. Prints the
+// state changes a frame three ways: every draw binding everything, the
+// draws as added with redundant binds dropped, and sorted by
+// render::DrawList's keys with redundant binds dropped. Then times the
+// radix sort, on one thread and on --threads, against std::stable_sort.
+// Needs no window or GPU.
+//
+// Exits non-zero if sorting changes which draws are made with what
+// bound, if the sort isn't stable, or if threads change its result.
+//
+//   sortbench [--objects N] [--textures N] [--frames N] [--threads N]
+//========================================================================
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "CommandBuffer.hpp"
+#include "DrawList.hpp"
+#include "Jobs.hpp"
+#include "Loader.hpp"
+#include "Profiler.hpp"
+
+#include "Check.hpp"
+
+using glm::mat4;
+using glm::vec3;
+using glm::vec4;
+using std::vector;
+
+static float
+random(float lo, float hi)
+{
+    return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+// A draw and everything bound when it was made
+struct DrawRecord
+{
+    GLuint framebuffer, program, texture, vao;
+    GLsizei count;
+    unsigned int uniforms;      // hash of the block
+
+    bool operator<(const DrawRecord & o) const { return memcmp(this, &o, sizeof(*this)) < 0; }
+    bool operator==(const DrawRecord & o) const { return !memcmp(this, &o, sizeof(*this)); }
+};
+
+// Follows the state the commands set, and notes it at every draw
+class StateBackend : public render::CommandBackend
+{
+public:
+    StateBackend() { memset(&current, 0, sizeof(current)); }
+
+    virtual void bindProgram(const render::BindProgram & cmd) { current.program = cmd.program; }
+    virtual void uniformBlock(const render::UniformBlock & cmd, const void * data)
+    {
+        unsigned int hash = 2166136261u;
+        for (GLuint i = 0; i < cmd.size; i++)
+            hash = (hash ^ ((const unsigned char *)data)[i]) * 16777619u;
+        current.uniforms = hash;
+    }
+    virtual void bindTexture(const render::BindTexture & cmd) { current.texture = cmd.texture; }
+    virtual void bindVao(const render::BindVao & cmd) { current.vao = cmd.vao; }
+    virtual void draw(const render::Draw & cmd)
+    {
+        current.count = cmd.count;
+        draws.push_back(current);
+    }
+    virtual void bindFramebuffer(const render::BindFramebuffer & cmd)
+    {
+        current.framebuffer = cmd.framebuffer;
+        if (cmd.clear)
+            clears.push_back(cmd.framebuffer);
+    }
+
+    vector<DrawRecord> draws;
+    vector<GLuint> clears;
+
+protected:
+    DrawRecord current;
+};
+
+struct Object
+{
+    mat4 model;
+    vec3 center;
+    unsigned int mesh, program, texture;
+};
+
+static const unsigned int PROGRAMS = 4;     // lit, textured, envmap, toon
+static const GLuint SHADOW_PROGRAM = 100;
+
+static void
+printStats(const char * name, const render::DrawListStats & s, int frames)
+{
+    printf("%-30s %8u %8u %8u %8u %8u\n", name, s.stateChanges() / frames, s.targetBinds / frames,
+           s.programBinds / frames, s.textureBinds / frames, s.vaoBinds / frames);
+}
+
+static void
+addStats(render::DrawListStats & total, const render::DrawListStats & s)
+{
+    total.draws += s.draws;
+    total.targetBinds += s.targetBinds;
+    total.programBinds += s.programBinds;
+    total.textureBinds += s.textureBinds;
+    total.vaoBinds += s.vaoBinds;
+}
+
+int main( int argc, char* argv[] )
+{
+    unsigned int objects = 5000;
+    unsigned int textures = 16;
+    int frames = 10;
+    unsigned int threads = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--objects") && i + 1 < argc)
+            objects = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--textures") && i + 1 < argc)
+            textures = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+            frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+    }
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    jobs::JobSystem js(threads);
+    textures = std::max(textures, 1u);
+    frames = std::max(frames, 1);
+
+    const char * files[] = { "models/bunny2.obj", "models/armadillo_lowres.obj", "models/sphere.obj" };
+    const unsigned int meshCount = 3;
+    GLsizei vertices[meshCount];
+    for (unsigned int i = 0; i < meshCount; i++) {
+        mesh::TriMesh m = mesh::loadObj(files[i]);
+        vertices[i] = m.vertices.size();
+        expect(vertices[i] > 0, "a model didn't load");
+    }
+
+    srand(1);
+    vector<Object> scene(objects);
+    for (unsigned int i = 0; i < objects; i++) {
+        Object & o = scene[i];
+        o.center = vec3(random(-100, 100), 0.0f, random(-100, 100));
+        o.model = glm::rotate(glm::translate(mat4(1.0f), o.center), random(0, 360), vec3(0, 1, 0));
+        o.mesh = rand() % meshCount;
+        o.program = rand() % PROGRAMS;
+        o.texture = rand() % textures;
+    }
+
+    printf("%u objects, %u models, %u programs, %u textures, 2 passes, %d frames\n",
+           objects, meshCount, PROGRAMS, textures, frames);
+    printf("%-30s %8s %8s %8s %8s %8s\n", "state changes a frame", "total", "target", "program", "texture", "vao");
+
+    render::DrawListStats stats[3];
+    memset(stats, 0, sizeof(stats));
+    double sortTime = 0.0;
+    bool same = true, ordered = true, clears = true;
+    render::DrawList draws;
+    for (int f = 0; f < frames; f++) {
+        float angle = 2.0f * 3.14159265f * f / frames;
+        vec3 eye(150.0f * cosf(angle), 60.0f, 150.0f * sinf(angle));
+        mat4 view = glm::lookAt(eye, vec3(0.0f), vec3(0, 1, 0));
+        mat4 viewProjection = glm::perspective(60.0f, 16.0f / 9.0f, 1.0f, 400.0f) * view;
+        mat4 light = glm::ortho(-150.0f, 150.0f, -150.0f, 150.0f, 1.0f, 400.0f) *
+                     glm::lookAt(vec3(100, 200, 50), vec3(0.0f), vec3(0, 1, 0));
+
+        // The way a demo loop goes: the shadow pass, then the objects
+        // as they come
+        draws.clear();
+        render::BindFramebuffer shadowMap = { 1, 0, 0, 2048, 2048, GL_DEPTH_BUFFER_BIT, { 0, 0, 0, 0 } };
+        render::BindFramebuffer screen = { 0, 0, 0, 1280, 720, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT,
+                                           { 0.1f, 0.1f, 0.2f, 1.0f } };
+        unsigned int shadowTarget = draws.addTarget(shadowMap);
+        unsigned int screenTarget = draws.addTarget(screen);
+        for (int pass = 0; pass < 2; pass++) {
+            for (unsigned int i = 0; i < objects; i++) {
+                const Object & o = scene[i];
+                render::DrawState state;
+                mat4 mvp;
+                if (pass == 0) {
+                    render::DrawState shadow = { shadowTarget, SHADOW_PROGRAM, 0, 1 + o.mesh };
+                    state = shadow;
+                    mvp = light * o.model;
+                } else {
+                    render::DrawState lit = { screenTarget, 1 + o.program, 10 + o.texture, 1 + o.mesh };
+                    state = lit;
+                    mvp = viewProjection * o.model;
+                }
+                render::Draw draw = { GL_TRIANGLES, 0, 0, vertices[o.mesh], 1, 0 };
+                float depth = -(view * vec4(o.center, 1.0f)).z / 400.0f;
+                draws.add(state, draw, depth, &mvp, sizeof(mvp));
+            }
+        }
+
+        StateBackend naive, asAdded, sorted;
+        render::CommandList list;
+        addStats(stats[0], draws.record(list, 0, false));
+        list.execute(naive);
+        list.reset();
+        addStats(stats[1], draws.record(list));
+        list.execute(asAdded);
+        list.reset();
+
+        double start = profile::now();
+        draws.sort(&js);
+        sortTime += profile::now() - start;
+        addStats(stats[2], draws.record(list));
+        list.execute(sorted);
+
+        for (unsigned int i = 1; i < draws.size(); i++)
+            ordered = ordered && draws.getKey(i - 1) <= draws.getKey(i);
+
+        // The same draws with the same state, in any order
+        std::sort(naive.draws.begin(), naive.draws.end());
+        std::sort(asAdded.draws.begin(), asAdded.draws.end());
+        std::sort(sorted.draws.begin(), sorted.draws.end());
+        same = same && naive.draws == asAdded.draws && naive.draws == sorted.draws;
+        clears = clears && naive.clears.size() == 2 && sorted.clears.size() == 2 &&
+                 sorted.clears[0] == shadowMap.framebuffer && sorted.clears[1] == screen.framebuffer;
+    }
+
+    printStats("everything, every draw", stats[0], frames);
+    printStats("as added, redundant dropped", stats[1], frames);
+    printStats("sorted, redundant dropped", stats[2], frames);
+    printf("%u draws a frame, sorted in %.3f ms\n", stats[0].draws / frames, sortTime / frames * 1e3);
+
+    expect(same, "sorting changed the draws or their state");
+    expect(ordered, "draws aren't in key order");
+    expect(clears, "targets weren't cleared once each, in order");
+    expect(stats[2].stateChanges() < stats[1].stateChanges(), "sorting didn't save any state changes");
+
+    // The sort itself, on random keys with few distinct values in the
+    // top bits, as real keys have
+    {
+        const unsigned int count = 1 << 20;
+        vector<render::SortKey> keys(count);
+        for (unsigned int i = 0; i < count; i++)
+            keys[i] = (render::SortKey)(rand() % 64) << 50 | (render::SortKey)rand() << 18 | (rand() & 0x3ffff);
+
+        vector<unsigned int> reference(count);
+        for (unsigned int i = 0; i < count; i++)
+            reference[i] = i;
+        double start = profile::now();
+        std::stable_sort(reference.begin(), reference.end(),
+                         [&keys](unsigned int a, unsigned int b) { return keys[a] < keys[b]; });
+        double stdTime = profile::now() - start;
+
+        vector<unsigned int> one, many;
+        start = profile::now();
+        render::radixSort(keys, one);
+        double oneTime = profile::now() - start;
+        start = profile::now();
+        render::radixSort(keys, many, &js);
+        double manyTime = profile::now() - start;
+
+        printf("sorting %u keys: std::stable_sort %.2f ms, radix %.2f ms, radix x%u %.2f ms\n", count,
+               stdTime * 1e3, oneTime * 1e3, threads, manyTime * 1e3);
+        expect(one == reference, "radix sort differs from std::stable_sort");
+        expect(many == reference, "threads change the radix sort");
+    }
+
+    exit( failures ? EXIT_FAILURE : EXIT_SUCCESS );
+}
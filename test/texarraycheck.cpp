@@ -0,0 +1,228 @@
+//========================================================================
+// Checks render::LayerAllocator, the bookkeeping behind TextureArrays,
+// without a GL context: --textures images of a few sizes are packed
+// into arrays of --layers layers, half of them are freed, and as many
+// again are packed into the holes. Then a scene of the same materials
+// is put through render::DrawList three ways, to count the texture
+// binds left with a GL_TEXTURE_2D per material, with an array per size
+// (the fallback), and with bindless handles.
+//
+// Exits non-zero if two live images share a layer, an image lands in
+// an array of another size or past its capacity, an array is started
+// while one of its size has room, capacities don't follow the layers in
+// use, or a TextureRef doesn't survive packing.
+//
+//   texarraycheck [--textures N] [--layers N] [--objects N]
+//========================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "CommandBuffer.hpp"
+#include "DrawList.hpp"
+#include "TextureArrays.hpp"
+
+#include "Check.hpp"
+
+using std::vector;
+
+static const GLsizei SIZES[][2] = { { 256, 256 }, { 512, 512 }, { 1024, 1024 }, { 512, 256 } };
+static const unsigned int SIZE_COUNT = 4;
+
+struct Image
+{
+    unsigned int size;
+    render::TextureRef ref;
+    bool live;
+};
+
+// Every live image in its own layer of an array of its size, and the
+// arrays' counts agreeing
+static bool
+consistent(const render::LayerAllocator & allocator, const vector<Image> & images)
+{
+    std::set<std::pair<unsigned int, unsigned int> > taken;
+    vector<unsigned int> live(allocator.getArrayCount(), 0);
+    for (unsigned int i = 0; i < images.size(); i++) {
+        const Image & image = images[i];
+        if (!image.live)
+            continue;
+        const render::TextureRef & ref = image.ref;
+        if (ref.array >= allocator.getArrayCount() || ref.layer >= allocator.getCapacity(ref.array))
+            return false;
+        if (!taken.insert(std::make_pair(ref.array, ref.layer)).second)
+            return false;
+        if (allocator.getWidth(ref.array) != SIZES[image.size][0] ||
+            allocator.getHeight(ref.array) != SIZES[image.size][1])
+            return false;
+        live[ref.array]++;
+    }
+
+    for (unsigned int a = 0; a < allocator.getArrayCount(); a++)
+        if (live[a] != allocator.getUsedLayers(a))
+            return false;
+    return true;
+}
+
+static unsigned int
+totalCapacity(const render::LayerAllocator & allocator)
+{
+    unsigned int total = 0;
+    for (unsigned int a = 0; a < allocator.getArrayCount(); a++)
+        total += allocator.getCapacity(a);
+    return total;
+}
+
+static unsigned int
+arraysNeeded(const vector<Image> & images, unsigned int layers)
+{
+    vector<unsigned int> perSize(SIZE_COUNT, 0);
+    for (unsigned int i = 0; i < images.size(); i++)
+        perSize[images[i].size]++;
+    unsigned int total = 0;
+    for (unsigned int s = 0; s < SIZE_COUNT; s++)
+        total += (perSize[s] + layers - 1) / layers;
+    return total;
+}
+
+int main( int argc, char* argv[] )
+{
+    unsigned int textures = 300;
+    unsigned int layers = 64;
+    unsigned int objects = 5000;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--textures") && i + 1 < argc)
+            textures = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--layers") && i + 1 < argc)
+            layers = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--objects") && i + 1 < argc)
+            objects = atoi(argv[++i]);
+    }
+    textures = std::max(textures, 1u);
+    layers = std::max(layers, 1u);
+
+    // Packing
+    srand(1);
+    render::LayerAllocator allocator(layers);
+    vector<Image> images(textures);
+    unsigned int created = 0;
+    bool flagged = true;
+    for (unsigned int i = 0; i < textures; i++) {
+        unsigned int before = allocator.getArrayCount();
+        bool made;
+        images[i].size = rand() % SIZE_COUNT;
+        images[i].ref = allocator.allocate(SIZES[images[i].size][0], SIZES[images[i].size][1], &made);
+        images[i].live = true;
+        created += made;
+        flagged = flagged && made == (allocator.getArrayCount() != before) && (!made || images[i].ref.array == before);
+    }
+    printf("%u images of %u sizes in %u arrays of %u layers\n", textures, SIZE_COUNT,
+           allocator.getArrayCount(), layers);
+    expect(consistent(allocator, images), "packing is inconsistent");
+    expect(allocator.getArrayCount() == arraysNeeded(images, layers), "more arrays than the images need");
+    expect(flagged && created == allocator.getArrayCount(), "created doesn't match the arrays made");
+
+    // Packed from empty, each array has the power of two of layers
+    // covering its images, up to the most it can have
+    {
+        bool sized = true;
+        for (unsigned int a = 0; a < allocator.getArrayCount(); a++) {
+            unsigned int want = 1;
+            while (want < allocator.getUsedLayers(a))
+                want *= 2;
+            sized = sized && allocator.getCapacity(a) == std::min(want, layers);
+        }
+        printf("%u layers allocated for %u images\n", totalCapacity(allocator), textures);
+        expect(sized, "array capacities don't follow the layers in use");
+    }
+
+    // Free half, then fill the holes with images of the same sizes
+    {
+        unsigned int arrays = allocator.getArrayCount(), capacity = totalCapacity(allocator), freed = 0;
+        vector<unsigned int> sizes;
+        for (unsigned int i = 0; i < textures; i += 2) {
+            allocator.free(images[i].ref);
+            images[i].live = false;
+            sizes.push_back(images[i].size);
+            freed++;
+        }
+        allocator.free(images[0].ref);     // twice does nothing
+        expect(consistent(allocator, images), "freeing is inconsistent");
+
+        for (unsigned int i = 0; i < sizes.size(); i++) {
+            Image image;
+            image.size = sizes[i];
+            image.ref = allocator.allocate(SIZES[image.size][0], SIZES[image.size][1]);
+            image.live = true;
+            images.push_back(image);
+        }
+        printf("freed and refilled %u layers: %u arrays\n", freed, allocator.getArrayCount());
+        expect(consistent(allocator, images), "refilling is inconsistent");
+        expect(allocator.getArrayCount() == arrays, "refilling started new arrays");
+        expect(totalCapacity(allocator) == capacity, "refilling grew arrays");
+    }
+
+    // One layer per array
+    {
+        render::LayerAllocator single(1);
+        render::TextureRef a = single.allocate(64, 64), b = single.allocate(64, 64);
+        single.free(a);
+        render::TextureRef c = single.allocate(64, 64);
+        expect(a.array != b.array && c == a && single.getArrayCount() == 2, "single layer arrays go wrong");
+    }
+
+    // Packing refs for the shader
+    {
+        bool same = true;
+        unsigned int values[] = { 0, 1, 255, 256, 65535 };
+        for (unsigned int i = 0; i < 5; i++)
+            for (unsigned int j = 0; j < 5; j++) {
+                render::TextureRef ref = { values[i], values[j] };
+                same = same && render::TextureRef::unpack(ref.packed()) == ref;
+            }
+        expect(same, "TextureRef doesn't survive packing");
+    }
+
+    // Texture binds for a scene of these materials, draws sorted by state
+    {
+        vector<Image> live;
+        for (unsigned int i = 0; i < images.size(); i++)
+            if (images[i].live)
+                live.push_back(images[i]);
+
+        render::DrawList draws;
+        render::BindFramebuffer screen = { 0, 0, 0, 1280, 720, GL_COLOR_BUFFER_BIT, { 0, 0, 0, 1 } };
+        const char * names[3] = { "GL_TEXTURE_2D each", "an array at a time", "arrays, bindless" };
+        printf("%-22s %10s %10s\n", "", "draws", "texture binds");
+        unsigned int binds[3];
+        for (int mode = 0; mode < 3; mode++) {
+            srand(2);
+            draws.clear();
+            unsigned int target = draws.addTarget(screen);
+            for (unsigned int i = 0; i < objects; i++) {
+                unsigned int material = rand() % live.size();
+                const Image & image = live[material];
+                GLuint texture = mode == 0 ? 100 + material : mode == 1 ? 1 + image.ref.array : 0;
+                render::DrawState state = { target, 1, texture, 1 + (GLuint)(rand() % 3) };
+                render::Draw draw = { GL_TRIANGLES, 0, 0, 36, 1, 0 };
+                unsigned int packed = image.ref.packed();
+                draws.add(state, draw, (rand() % 1000) / 1000.0f, &packed, sizeof(packed));
+            }
+            draws.sort();
+            render::CommandList list;
+            render::DrawListStats stats = draws.record(list);
+            binds[mode] = stats.textureBinds;
+            printf("%-22s %10u %10u\n", names[mode], stats.draws, stats.textureBinds);
+        }
+        expect(binds[2] == 1 && binds[1] <= allocator.getArrayCount() && binds[1] < binds[0],
+               "arrays didn't cut the texture binds");
+    }
+
+    exit( failures ? EXIT_FAILURE : EXIT_SUCCESS );
+}
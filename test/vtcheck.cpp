@@ -0,0 +1,377 @@
+//========================================================================
+// Checks the parts of vt::VirtualTexture that don't need a GL context.
+// An image is made up texel by texel (--width x --height), written as a
+// tile file and read back against a mip chain built the obvious way,
+// borders included. The TileCache and PageTable are put through their
+// paces, the page table after every change against a walk up the
+// levels. Then a Streamer follows a view panning and zooming across
+// the image, fed feedback built like shaders/vtfeedback.frag builds it,
+// with the loads on --threads job threads, and reports what it loaded
+// and evicted.
+//
+// Exits non-zero if a texel is wrong, the cache evicts anything but the
+// least recently used slot it may, the page table points anywhere but
+// the nearest resident tile, an upload isn't the tile it says it is, or
+// the streamer doesn't end up with everything the view wants resident.
+//
+//   vtcheck [--width N] [--height N] [--tile N] [--slots N] [--threads N]
+//========================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "Jobs.hpp"
+#include "Profiler.hpp"
+#include "VirtualTexture.hpp"
+
+#include "Check.hpp"
+
+using std::vector;
+
+static void
+pattern(int x, int y, GLubyte * out)
+{
+    out[0] = (x * 7 + y * 3) & 0xff;
+    out[1] = (x ^ y) & 0xff;
+    out[2] = (x >> 2) & 0xff;
+    out[3] = (y >> 2) & 0xff;
+}
+
+// Level l from level l - 1, the way writeTileFile() does it
+static vector<vector<GLubyte> >
+buildLevels(const vt::Layout & layout)
+{
+    vector<vector<GLubyte> > levels(layout.levels);
+    levels[0].resize((size_t)layout.width * layout.height * 4);
+    for (int y = 0; y < layout.height; y++)
+        for (int x = 0; x < layout.width; x++)
+            pattern(x, y, &levels[0][((size_t)y * layout.width + x) * 4]);
+
+    for (unsigned int l = 1; l < layout.levels; l++) {
+        int w = layout.levelWidth(l), h = layout.levelHeight(l);
+        int bw = layout.levelWidth(l - 1), bh = layout.levelHeight(l - 1);
+        levels[l].resize((size_t)w * h * 4);
+        for (int y = 0; y < h; y++)
+            for (int x = 0; x < w; x++)
+                for (int k = 0; k < 4; k++) {
+                    int xa = std::min(2 * x, bw - 1), xb = std::min(2 * x + 1, bw - 1);
+                    int ya = std::min(2 * y, bh - 1), yb = std::min(2 * y + 1, bh - 1);
+                    const vector<GLubyte> & b = levels[l - 1];
+                    int sum = b[((size_t)ya * bw + xa) * 4 + k] + b[((size_t)ya * bw + xb) * 4 + k] +
+                              b[((size_t)yb * bw + xa) * 4 + k] + b[((size_t)yb * bw + xb) * 4 + k];
+                    levels[l][((size_t)y * w + x) * 4 + k] = (sum + 2) >> 2;
+                }
+    }
+    return levels;
+}
+
+static void
+checkFile(const vt::TileFile & file, const vector<vector<GLubyte> > & levels)
+{
+    const vt::Layout & layout = file.getLayout();
+    int padded = layout.paddedSize();
+    bool right = true;
+    for (unsigned int l = 0; l < layout.levels; l++) {
+        int w = layout.levelWidth(l), h = layout.levelHeight(l);
+        for (unsigned int ty = 0; ty < layout.tilesY(l); ty++)
+            for (unsigned int tx = 0; tx < layout.tilesX(l); tx++) {
+                vt::TileId tile = { l, tx, ty };
+                const GLubyte * texels = file.getTile(tile);
+                for (int y = 0; y < padded && right; y++)
+                    for (int x = 0; x < padded && right; x++) {
+                        int lx = std::min(std::max((int)tx * layout.tileSize - layout.border + x, 0), w - 1);
+                        int ly = std::min(std::max((int)ty * layout.tileSize - layout.border + y, 0), h - 1);
+                        right = !memcmp(texels + ((size_t)y * padded + x) * 4, &levels[l][((size_t)ly * w + lx) * 4], 4);
+                    }
+            }
+    }
+    expect(right, "a tile texel is wrong");
+}
+
+static void
+checkCache()
+{
+    vt::TileCache cache(4);
+    unsigned int evicted;
+    int a = cache.insert(10, 1, &evicted, true);
+    int b = cache.insert(11, 1, &evicted);
+    int c = cache.insert(12, 2, &evicted);
+    int d = cache.insert(13, 3, &evicted);
+    expect(a >= 0 && b >= 0 && c >= 0 && d >= 0 && evicted == vt::NO_TILE && cache.getUsedSlots() == 4,
+           "the cache didn't fill its free slots");
+
+    cache.touch(b, 4);
+    int e = cache.insert(14, 5, &evicted);
+    expect(e == c && evicted == 12 && cache.find(12) == -1 && cache.find(14) == e,
+           "the cache didn't evict the least recently used slot");
+
+    cache.touch(b, 6);
+    cache.touch(d, 6);
+    cache.touch(e, 6);
+    expect(cache.insert(15, 6, &evicted) == -1, "the cache evicted a slot used this frame");
+    int f = cache.insert(15, 7, &evicted);
+    expect(f >= 0 && f != a && cache.find(10) == a, "the cache evicted a pinned slot");
+
+    cache.remove(11);
+    cache.remove(15);
+    int g = cache.insert(16, 8, &evicted);
+    expect(evicted == vt::NO_TILE && g >= 0 && cache.getUsedSlots() == 4, "removing didn't free the slot");
+}
+
+// The nearest resident tile at or above each one, found the slow way
+static bool
+tableRight(const vt::PageTable & table, const vector<vector<int> > & slots)
+{
+    const vt::Layout & layout = table.getLayout();
+    for (unsigned int l = 0; l < layout.levels; l++)
+        for (unsigned int y = 0; y < layout.tilesY(l); y++)
+            for (unsigned int x = 0; x < layout.tilesX(l); x++) {
+                vt::TileId tile = { l, x, y };
+                vt::TileId at = tile;
+                int slot = slots[at.level][at.y * layout.tilesX(at.level) + at.x];
+                while (slot < 0 && at.level + 1 < layout.levels) {
+                    at = layout.parent(at);
+                    slot = slots[at.level][at.y * layout.tilesX(at.level) + at.x];
+                }
+                const vt::PageTable::Mapping & m = table.lookup(tile);
+                if (m.slot != slot || (slot >= 0 && m.level != at.level))
+                    return false;
+                if (table.isResident(tile) != (slots[l][y * layout.tilesX(l) + x] >= 0))
+                    return false;
+            }
+    return true;
+}
+
+static void
+checkPageTable(const vt::Layout & layout)
+{
+    vt::PageTable table(layout);
+    vector<vector<int> > slots(layout.levels);
+    for (unsigned int l = 0; l < layout.levels; l++)
+        slots[l].assign(layout.tilesX(l) * layout.tilesY(l), -1);
+    bool right = tableRight(table, slots), dirtyRight = true;
+
+    srand(3);
+    for (int step = 0; step < 400 && right; step++) {
+        // What every entry was, to see that the changes are all in the
+        // dirty rectangles
+        vector<vector<vt::PageTable::Mapping> > before(layout.levels);
+        for (unsigned int l = 0; l < layout.levels; l++)
+            for (unsigned int i = 0; i < slots[l].size(); i++) {
+                vt::TileId tile = { l, i % layout.tilesX(l), i / layout.tilesX(l) };
+                before[l].push_back(table.lookup(tile));
+            }
+        table.clearDirty();
+
+        // Finer levels have more tiles, so pick the level first
+        unsigned int l = rand() % layout.levels;
+        vt::TileId tile = { l, rand() % layout.tilesX(l), rand() % layout.tilesY(l) };
+        int & slot = slots[l][tile.y * layout.tilesX(l) + tile.x];
+        if (slot >= 0 && rand() % 2) {
+            table.unmap(tile);
+            slot = -1;
+        } else {
+            slot = step;
+            table.map(tile, slot);
+        }
+        right = tableRight(table, slots);
+
+        for (unsigned int l = 0; l < layout.levels; l++) {
+            unsigned int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+            table.getDirty(l, &x0, &y0, &x1, &y1);
+            for (unsigned int i = 0; i < slots[l].size(); i++) {
+                vt::TileId t = { l, i % layout.tilesX(l), i / layout.tilesX(l) };
+                const vt::PageTable::Mapping & m = table.lookup(t);
+                bool changed = m.slot != before[l][i].slot || m.level != before[l][i].level;
+                if (changed && !(t.x >= x0 && t.x < x1 && t.y >= y0 && t.y < y1))
+                    dirtyRight = false;
+            }
+        }
+    }
+    expect(right, "the page table doesn't point at the nearest resident tile");
+    expect(dirtyRight, "a page table change is outside the dirty rectangle");
+}
+
+// What the feedback pass would see of a view of the image: a window of
+// the level 0 texels, centred on (cx, cy), drawn width pixels across
+static void
+makeFeedback(const vt::Layout & layout, float cx, float cy, float texelsPerPixel, int width, int height,
+             vector<GLubyte> & out)
+{
+    out.resize(width * height * 4);
+    int level = 0;
+    while (level + 1 < (int)layout.levels && texelsPerPixel >= (float)(2 << level))
+        level++;
+    for (int py = 0; py < height; py++)
+        for (int px = 0; px < width; px++) {
+            GLubyte * o = &out[(py * width + px) * 4];
+            float u = (cx + (px - width / 2) * texelsPerPixel) / layout.width;
+            float v = (cy + (py - height / 2) * texelsPerPixel) / layout.height;
+            if (u < 0.0f || u >= 1.0f || v < 0.0f || v >= 1.0f) {
+                o[0] = o[1] = o[2] = 0;
+                o[3] = 255;
+                continue;
+            }
+            int size = layout.tileSize;
+            vt::TileId tile = { (unsigned int)level,
+                                std::min((unsigned int)(u * layout.levelWidth(level)) / size, layout.tilesX(level) - 1),
+                                std::min((unsigned int)(v * layout.levelHeight(level)) / size, layout.tilesY(level) - 1) };
+            vt::encodeFeedback(tile, o);
+        }
+}
+
+static void
+checkStreamer(const vt::TileFile & file, unsigned int slotCount, jobs::JobSystem & jobs)
+{
+    const vt::Layout & layout = file.getLayout();
+    vt::Streamer streamer(file, slotCount, &jobs, 8);
+
+    // What the physical texture would hold
+    vector<unsigned int> physical(streamer.getCache().getSlotCount(), vt::NO_TILE);
+    vector<vt::Upload> uploads;
+    vector<GLubyte> feedback;
+    bool uploadsRight = true, tableRight = true, encoded = true;
+    unsigned int frames = 0, settled = 0;
+
+    double start = profile::now();
+    const int FEEDBACK_WIDTH = 160, FEEDBACK_HEIGHT = 90;
+    for (int frame = 0; frame < 600; frame++) {
+        // Pan across close up, zoom out, then hold still
+        float t = std::min(frame, 300) / 150.0f;
+        float zoom = t < 1.0f ? 1.5f : 1.5f + (t - 1.0f) * 20.0f;
+        float cx = layout.width * (0.1f + 0.8f * std::min(t, 1.0f));
+        float cy = layout.height * 0.5f;
+        makeFeedback(layout, std::min(cx, layout.width - 1.0f), cy, zoom, FEEDBACK_WIDTH, FEEDBACK_HEIGHT, feedback);
+
+        streamer.beginFrame();
+        streamer.request(&feedback[0], FEEDBACK_WIDTH * FEEDBACK_HEIGHT);
+        streamer.update(8, uploads);
+        frames++;
+
+        for (unsigned int i = 0; i < uploads.size(); i++) {
+            const vt::Upload & upload = uploads[i];
+            physical[upload.slot] = upload.tile.packed();
+            uploadsRight = uploadsRight && upload.pixels.size() == file.getTileBytes() &&
+                           !memcmp(&upload.pixels[0], file.getTile(upload.tile), file.getTileBytes());
+        }
+
+        // Every mapping is to a slot that holds the tile it names
+        const vt::PageTable & table = streamer.getPageTable();
+        for (unsigned int p = 0; p < (unsigned int)FEEDBACK_WIDTH * FEEDBACK_HEIGHT; p++) {
+            vt::TileId tile;
+            if (!vt::decodeFeedback(&feedback[p * 4], layout.levels, &tile))
+                continue;
+            GLubyte check[4];
+            vt::encodeFeedback(tile, check);
+            encoded = encoded && !memcmp(check, &feedback[p * 4], 4);
+            const vt::PageTable::Mapping & m = table.lookup(tile);
+            if (m.slot < 0)
+                continue;
+            vt::TileId held = vt::TileId::unpack(physical[m.slot]);
+            tableRight = tableRight && physical[m.slot] != vt::NO_TILE && held.level == m.level &&
+                         streamer.getCache().find(physical[m.slot]) == m.slot;
+        }
+
+        // Once still, keep going until everything in view is resident
+        if (frame >= 300) {
+            bool all = true;
+            for (unsigned int p = 0; p < (unsigned int)FEEDBACK_WIDTH * FEEDBACK_HEIGHT && all; p++) {
+                vt::TileId tile;
+                all = !vt::decodeFeedback(&feedback[p * 4], layout.levels, &tile) || table.isResident(tile);
+            }
+            if (all && !streamer.getLoadsInFlight())
+                settled++;
+            if (settled > 2)
+                break;
+            std::this_thread::yield();
+        }
+    }
+    double elapsed = profile::now() - start;
+
+    const vt::StreamStats & stats = streamer.getStats();
+    printf("%u frames, %u slots, %u threads: %.2f ms a frame\n", frames, streamer.getCache().getSlotCount(),
+           jobs.getThreadCount(), elapsed * 1000.0 / frames);
+    printf("  %u tiles requested, %u resident (%.1f%%), %u loads, %u uploads, %u evictions, %u dropped\n",
+           stats.requested, stats.resident, stats.requested ? 100.0 * stats.resident / stats.requested : 0.0,
+           stats.loads, stats.uploads, stats.evictions, stats.dropped);
+
+    vt::TileId top = { layout.levels - 1, 0, 0 };
+    expect(encoded, "feedback doesn't survive encoding");
+    expect(uploadsRight, "an upload isn't the tile it says");
+    expect(tableRight, "the page table points at a slot holding something else");
+    expect(streamer.getPageTable().isResident(top), "the coarsest tile isn't resident");
+    expect(streamer.getCache().getUsedSlots() <= streamer.getCache().getSlotCount(), "the cache is over capacity");
+
+    // Only if the view fits the cache, with the coarsest tile besides
+    std::set<unsigned int> inView;
+    for (unsigned int p = 0; p < (unsigned int)FEEDBACK_WIDTH * FEEDBACK_HEIGHT; p++) {
+        vt::TileId tile;
+        if (vt::decodeFeedback(&feedback[p * 4], layout.levels, &tile) && tile.level != top.level)
+            inView.insert(tile.packed());
+    }
+    if (inView.size() < streamer.getCache().getSlotCount())
+        expect(settled > 2, "the streamer never caught up with the view");
+    else
+        printf("  the view wants %u tiles, more than the cache holds\n", (unsigned int)inView.size());
+}
+
+int main( int argc, char* argv[] )
+{
+    int width = 3000, height = 1700, tileSize = 64;
+    unsigned int slots = 64, threads = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--width") && i + 1 < argc)
+            width = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--height") && i + 1 < argc)
+            height = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--tile") && i + 1 < argc)
+            tileSize = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--slots") && i + 1 < argc)
+            slots = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+    }
+    width = std::max(width, 1);
+    height = std::max(height, 1);
+    tileSize = std::max(tileSize, 8);
+
+    jobs::JobSystem js(threads);
+
+    // Writing and reading the tiles
+    const char * fileName = "/tmp/vtcheck.tiles";
+    vt::Layout layout(width, height, tileSize, 4);
+    double start = profile::now();
+    bool written = vt::writeTileFile(fileName, width, height,
+                                     [](GLsizei x, GLsizei y, GLsizei w, GLsizei h, GLubyte * out) {
+        for (GLsizei j = 0; j < h; j++)
+            for (GLsizei i = 0; i < w; i++)
+                pattern(x + i, y + j, out + ((size_t)j * w + i) * 4);
+    }, tileSize, 4, &js);
+    double writeTime = profile::now() - start;
+    expect(written, "writing the tile file failed");
+
+    vt::TileFile file;
+    if (!written || !file.open(fileName)) {
+        expect(false, "opening the tile file failed");
+        exit(EXIT_FAILURE);
+    }
+    printf("%dx%d in tiles of %d: %u levels, %ux%u tiles at level 0, written in %.1f ms\n", width, height,
+           tileSize, layout.levels, layout.tilesX(0), layout.tilesY(0), writeTime * 1000.0);
+    expect(layout.tilesX(layout.levels - 1) == 1 && layout.tilesY(layout.levels - 1) == 1,
+           "the coarsest level is more than one tile");
+    checkFile(file, buildLevels(layout));
+
+    checkCache();
+    checkPageTable(layout);
+    checkStreamer(file, slots, js);
+
+    file.close();
+    remove(fileName);
+
+    exit( failures ? EXIT_FAILURE : EXIT_SUCCESS );
+}